@@ -0,0 +1,54 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#ifndef _INTERNAL_HASH_H_
+#define _INTERNAL_HASH_H_
+#include <stdint.h>
+#include <tools/hash.h>
+
+/* 32-bit FNV-1a, the default hash of htable and cuckoo */
+static inline unsigned fnv1a_hash(const char *key)
+{
+	unsigned h = 0x811c9dc5;
+	const unsigned char *c;
+	
+	for (c = (const unsigned char *)key; *c; c++)
+		h = (h ^ *c) *0x01000193;
+	
+	return h;
+}
+
+/* unseeded 64-bit FNV-1a, the default hash of struct hamt */
+static inline uint64_t fnv1a_hash64(const char *key)
+{
+	return hash_fnv1a64(key, 0);
+}
+
+/* MurmurHash3's 64-bit finalizer, spreads every input bit over the whole word */
+static inline uint64_t mix64(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+#endif
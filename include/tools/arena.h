@@ -0,0 +1,186 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#ifndef _TOOLS_ARENA_H_
+#define _TOOLS_ARENA_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+   Region allocator.
+
+   An arena hands out memory by bumping a pointer through a chain of large
+   chunks. Individual allocations are never freed; instead the whole arena is
+   released at once with arena_reset(), or rolled back to an earlier point with
+   arena_mark()/arena_rewind(). Released chunks are kept for reuse, so an arena
+   that is reset at the end of every request settles into doing no malloc()
+   calls at all.
+
+   Example:
+
+   struct arena a;
+   arena_init(&a, "chunk_size", (size_t)(64 << 10));
+   for (;;) {
+       struct req *r = arena_zalloc(&a, sizeof(*r));
+       r->path = arena_strdup(&a, path);
+       ...
+       arena_reset(&a);
+   }
+   arena_dest(&a);
+ */
+#define ARENA_ALIGN_DEFAULT _Alignof(max_align_t)
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	char *end;
+	char data[] __attribute__((aligned(ARENA_ALIGN_DEFAULT)));
+};
+
+struct arena {
+	char *cur;
+	char *end;
+	size_t chunk_size;
+	struct arena_chunk *chunk;	/* newest chunk, head of the chain */
+	struct arena_chunk *tail;	/* oldest chunk */
+	struct arena_chunk *spare;	/* released chunks kept for reuse */
+};
+
+struct arena_mark {
+	struct arena_chunk *chunk;
+	char *cur;
+};
+
+/**
+   @param arena an arena to initialize
+   @param options an option string, expects respective arguments
+
+   Initializes an empty arena, no memory is allocated until the first allocation.
+   Parameters specified in \p options are:
+
+   chunk_size: expects a size_t argument marking the size of the chunks requested from malloc()
+
+   Returns zero on success, and a negative number on failure.
+ */
+int arena_init(struct arena *arena, const char *options, ...);
+
+/**
+   @param arena an arena to destroy
+
+   Frees every chunk of \p arena, including the ones kept for reuse.
+ */
+void arena_dest(struct arena *arena);
+
+/* slow path of arena_memalign(), starts a new chunk */
+void *__arena_alloc_slow(struct arena *arena, size_t size, size_t align);
+
+/**
+   @param arena the arena to allocate from
+   @param align the alignment of the allocation, must be a power of two
+   @param size how much memory to allocate
+   @return pointer to allocated memory, returns NULL on failure
+
+   Allocates \p size bytes aligned to \p align from \p arena.
+ */
+static inline void *arena_memalign(struct arena *arena, size_t align, size_t size)
+{
+	uintptr_t p = ((uintptr_t)arena->cur + align - 1) & ~(uintptr_t)(align - 1);
+
+	/* a fresh or reset arena has no chunk, even a zero-sized request needs one */
+	if (!arena->cur || p > (uintptr_t)arena->end || size > (uintptr_t)arena->end - p)
+		return __arena_alloc_slow(arena, size, align);
+
+	arena->cur = (char *)p + size;
+	return (void *)p;
+}
+
+/**
+   @param arena the arena to allocate from
+   @param size how much memory to allocate
+   @return pointer to allocated memory, returns NULL on failure
+
+   Allocates memory from \p arena with the same alignment guarantee as malloc().
+ */
+static inline void *arena_malloc(struct arena *arena, size_t size)
+{
+	return arena_memalign(arena, ARENA_ALIGN_DEFAULT, size);
+}
+
+/**
+   @param arena the arena to allocate from
+   @param size how much memory to allocate
+   @return pointer to allocated memory, returns NULL on failure
+
+   Allocates zeroed memory from \p arena, the arena counterpart of zalloc().
+ */
+static inline void *arena_zalloc(struct arena *arena, size_t size)
+{
+	void *p = arena_malloc(arena, size);
+
+	if (p)
+		memset(p, 0, size);
+	return p;
+}
+
+/**
+   @param arena the arena to allocate from
+   @param str a string to duplicate
+   @return the duplicated string, returns NULL on failure
+
+   Duplicates a string into \p arena, the arena counterpart of strdup().
+ */
+static inline char *arena_strdup(struct arena *arena, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *p = arena_memalign(arena, 1, len);
+
+	if (p)
+		memcpy(p, str, len);
+	return p;
+}
+
+/**
+   @param arena the arena to mark
+
+   Returns the current allocation point of \p arena, to be passed to arena_rewind().
+ */
+static inline struct arena_mark arena_mark(const struct arena *arena)
+{
+	struct arena_mark mark = { arena->chunk, arena->cur };
+	return mark;
+}
+
+/**
+   @param arena the arena to rewind
+   @param mark a mark previously returned by arena_mark() for \p arena
+
+   Releases everything allocated from \p arena since \p mark was taken. Marks
+   taken after \p mark become invalid.
+ */
+void arena_rewind(struct arena *arena, struct arena_mark mark);
+
+/**
+   @param arena the arena to reset
+
+   Releases every allocation made from \p arena in constant time. The chunks are
+   kept for reuse by later allocations.
+ */
+void arena_reset(struct arena *arena);
+
+#endif
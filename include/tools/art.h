@@ -0,0 +1,139 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#ifndef _TOOLS_ART_H_
+#define _TOOLS_ART_H_
+#include <stddef.h>
+#include <stdint.h>
+#include "table.h"
+
+/**
+   Adaptive radix tree.
+
+   An ordered map from strings to tdata_t values. Inner nodes come in four
+   sizes (4, 16, 48 and 256 children) and grow or shrink with their fan-out,
+   and chains of single-child nodes are compressed into a prefix stored in the
+   node below them. Lookups cost O(key length) regardless of the number of
+   entries, and, unlike struct table, keys can be visited in order, by prefix
+   or by range.
+
+   Callbacks passed to the iteration functions return zero to continue and
+   anything else to stop; the tree must not be modified from a callback.
+ */
+#define ART_MAX_PREFIX 10
+
+struct art_node {
+	uint8_t type;
+	uint16_t n_children;
+	uint32_t prefix_len;
+	unsigned char prefix[ART_MAX_PREFIX];
+};
+
+struct art {
+	size_t n_entries;
+	struct art_node *root;
+};
+
+typedef int (*art_iter_func)(const char *key, tdata_t data, void *arg);
+
+/**
+   @param art a tree to initialize
+
+   Initializes an empty tree.
+ */
+void art_init(struct art *art);
+
+/**
+   @param art a tree to destroy
+
+   Frees every node and entry of \p art.
+ */
+void art_dest(struct art *art);
+
+/**
+   @param art the tree to update
+   @param key the key for which the data needs to be updated
+   @param data the value to set for \p key
+
+   Updates data value for \p key in \p art, if \p key is not in \p art then a new entry is created
+   from \p key with the value of \p data.
+
+   Returns zero on success and a negative value on failure.
+ */
+int art_update(struct art *art, const char *key, tdata_t data);
+
+/**
+   @param art the tree to update
+   @param key the key for which the data needs to be updated
+   @param data the value to set for \p key
+
+   Updates data value for \p key in \p art, if \p key is not in \p art then a negative value is returned.
+
+   Returns zero on success and a negative value on failure.
+ */
+int art_update_only(struct art *art, const char *key, tdata_t data);
+
+/**
+   @param art the tree to search
+   @param key the key for which to search
+   @param data the entry for \p key shall be passed back with this pointer
+
+   Searches \p art for \p key and returns its entry value using \p data.
+
+   Returns zero on success and a negative value if \p key is not found.
+ */
+int art_search(struct art *art, const char *key, tdata_t *data);
+
+/**
+   @param art the tree to remove from
+   @param key the key to remove
+
+   Removes \p key from \p art.
+
+   Returns zero on success and a negative value if \p key is not found.
+ */
+int art_remove(struct art *art, const char *key);
+
+/**
+   @param art the tree to iterate over
+   @param prefix the prefix of the keys to visit, "" visits every key
+   @param fn the function to call for each key
+   @param arg passed to \p fn
+
+   Calls \p fn, in key order, for every key of \p art starting with \p prefix.
+
+   Returns zero if every key was visited, or the non-zero value returned by \p fn.
+ */
+int art_prefix(struct art *art, const char *prefix, art_iter_func fn, void *arg);
+
+/**
+   @param art the tree to iterate over
+   @param lo the lowest key to visit, NULL for no lower bound
+   @param hi the key to stop before, NULL for no upper bound
+   @param fn the function to call for each key
+   @param arg passed to \p fn
+
+   Calls \p fn, in key order, for every key of \p art in the range [\p lo, \p hi).
+   Keys are ordered as by strcmp().
+
+   Returns zero if every key was visited, or the non-zero value returned by \p fn.
+ */
+int art_range(struct art *art, const char *lo, const char *hi, art_iter_func fn, void *arg);
+
+#endif
@@ -0,0 +1,228 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#ifndef _TOOLS_BTREE_H_
+#define _TOOLS_BTREE_H_
+#include <stddef.h>
+#include <stdint.h>
+#include "table.h"
+
+/**
+   B+tree ordered map.
+
+   Maps uint64_t keys, or strings when initialized with "string_keys", to
+   tdata_t values. Every node is one node_size block: the keys of a node sit in
+   one contiguous array searched without branches, followed by the child or
+   value pointers. String keys are represented in that array by their first 8
+   bytes, big endian, so most comparisons never touch the strings themselves.
+   Leaves are chained in key order, so a range scan is a sequential walk over
+   full leaves rather than a descent per key.
+
+   Nodes are split on the way down, so an insert that fails for lack of memory
+   leaves the tree intact. Removal does not merge underfull nodes; a tree that
+   shrank a lot can be rebuilt compactly with btree_load().
+
+   Functions taking a uint64_t key apply to numeric trees and their _str
+   counterparts to string trees.
+
+   Example:
+
+   struct btree_iter it;
+   uint64_t ts;
+   tdata_t sample;
+
+   btree_seek(&bt, &it, from);
+   while (!btree_next(&it, &ts, &sample) && ts < to)
+       ...
+ */
+struct btree_node {
+	uint32_t n_keys;
+	uint32_t leaf;
+	struct btree_node *next;	/* next leaf in key order, leaves only */
+	uint64_t keys[];		/* then string keys if any, then child or value slots */
+};
+
+struct btree {
+	size_t n_entries;
+	size_t node_size;
+	unsigned cap;		/* keys per node */
+	unsigned str_off;	/* offset of the string keys in node->keys, 0 for numeric trees */
+	unsigned slot_off;	/* offset of the slots in node->keys */
+	struct btree_node *root;
+	struct btree_node *first;	/* leftmost leaf */
+};
+
+struct btree_iter {
+	const struct btree *bt;
+	const struct btree_node *leaf;
+	unsigned pos;
+};
+
+/**
+   @param bt a tree to initialize
+   @param options an option string, expects respective arguments
+
+   Initializes an empty tree. Parameters specified in \p options are:
+
+   node_size: expects a size_t argument, the size in bytes of a node, rounded up to a cache line.
+              Defaults to 1024; a page suits larger trees with long scans.
+   string_keys: no argument, keys are strings ordered as by strcmp(), which the tree copies
+
+   Returns zero on success, and a negative number on failure.
+ */
+int btree_init(struct btree *bt, const char *options, ...);
+
+/**
+   @param bt a tree to destroy
+
+   Frees every node of \p bt.
+ */
+void btree_dest(struct btree *bt);
+
+/**
+   @param bt an empty tree to fill
+   @param keys the keys to load, strictly ascending
+   @param data the value of each key
+   @param n the number of keys
+
+   Builds \p bt bottom-up from sorted input, packing every node full. This is
+   much faster than \p n inserts and yields a tree with no slack.
+
+   Returns zero on success, -EINVAL if \p bt is not empty or \p keys are not
+   strictly ascending, and -ENOMEM on allocation failure, leaving \p bt empty.
+ */
+int btree_load(struct btree *bt, const uint64_t *keys, const tdata_t *data, size_t n);
+int btree_load_str(struct btree *bt, const char *const *keys, const tdata_t *data, size_t n);
+
+/**
+   @param bt the tree to update
+   @param key the key for which the data needs to be updated
+   @param data the value to set for \p key
+
+   Updates data value for \p key in \p bt, if \p key is not in \p bt then a new entry is created
+   from \p key with the value of \p data.
+
+   Returns zero on success and a negative value on failure.
+ */
+int btree_update(struct btree *bt, uint64_t key, tdata_t data);
+int btree_update_str(struct btree *bt, const char *key, tdata_t data);
+
+/**
+   @param bt the tree to update
+   @param key the key for which the data needs to be updated
+   @param data the value to set for \p key
+
+   Updates data value for \p key in \p bt, if \p key is not in \p bt then a negative value is returned.
+
+   Returns zero on success and a negative value on failure.
+ */
+int btree_update_only(struct btree *bt, uint64_t key, tdata_t data);
+int btree_update_only_str(struct btree *bt, const char *key, tdata_t data);
+
+/**
+   @param bt the tree to search
+   @param key the key for which to search
+   @param data the entry for \p key shall be passed back with this pointer
+
+   Searches \p bt for \p key and returns its entry value using \p data.
+
+   Returns zero on success and a negative value if \p key is not found.
+ */
+int btree_search(struct btree *bt, uint64_t key, tdata_t *data);
+int btree_search_str(struct btree *bt, const char *key, tdata_t *data);
+
+/**
+   @param bt the tree to remove from
+   @param key the key to remove
+
+   Removes \p key from \p bt.
+
+   Returns zero on success and a negative value if \p key is not found.
+ */
+int btree_remove(struct btree *bt, uint64_t key);
+int btree_remove_str(struct btree *bt, const char *key);
+
+/**
+   @param bt the tree to iterate over
+   @param it the iterator to position
+   @param key the key to start at
+
+   Positions \p it at the first key of \p bt not less than \p key.
+   btree_first() positions it at the first key of \p bt. The iterator is
+   invalidated by any modification of \p bt.
+ */
+void btree_seek(const struct btree *bt, struct btree_iter *it, uint64_t key);
+void btree_seek_str(const struct btree *bt, struct btree_iter *it, const char *key);
+void btree_first(const struct btree *bt, struct btree_iter *it);
+
+static inline void **__btree_slots(const struct btree *bt, const struct btree_node *node)
+{
+	return (void **)(node->keys + bt->slot_off);
+}
+
+static inline const char **__btree_strs(const struct btree *bt, const struct btree_node *node)
+{
+	return (const char **)(node->keys + bt->str_off);
+}
+
+static inline int __btree_iter_advance(struct btree_iter *it)
+{
+	while (it->leaf && it->pos >= it->leaf->n_keys) {
+		it->leaf = it->leaf->next;
+		it->pos = 0;
+		if (it->leaf && it->leaf->next)
+			__builtin_prefetch(it->leaf->next);
+	}
+	return it->leaf ? 0 : -1;
+}
+
+/**
+   @param it an iterator positioned by btree_seek() or btree_first()
+   @param key the key at \p it shall be passed back with this pointer, may be NULL
+   @param data the value at \p it shall be passed back with this pointer, may be NULL
+
+   Returns the entry at \p it and moves \p it to the next key.
+
+   Returns zero on success and a negative value once the iteration is done.
+ */
+static inline int btree_next(struct btree_iter *it, uint64_t *key, tdata_t *data)
+{
+	if (__btree_iter_advance(it))
+		return -1;
+	if (key)
+		*key = it->leaf->keys[it->pos];
+	if (data)
+		*data = (tdata_t)__btree_slots(it->bt, it->leaf)[it->pos];
+	it->pos++;
+	return 0;
+}
+
+static inline int btree_next_str(struct btree_iter *it, const char **key, tdata_t *data)
+{
+	if (__btree_iter_advance(it))
+		return -1;
+	if (key)
+		*key = __btree_strs(it->bt, it->leaf)[it->pos];
+	if (data)
+		*data = (tdata_t)__btree_slots(it->bt, it->leaf)[it->pos];
+	it->pos++;
+	return 0;
+}
+
+#endif
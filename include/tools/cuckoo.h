@@ -0,0 +1,143 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#ifndef _TOOLS_CUCKOO_H_
+#define _TOOLS_CUCKOO_H_
+#include <stddef.h>
+#include <stdint.h>
+#include "table.h"
+
+/**
+   Bucketized cuckoo hash table.
+
+   An alternative to struct table for callers that need a bounded worst case.
+   Every key has exactly two candidate buckets of CUCKOO_WAYS slots each, and
+   a bucket occupies a single cache line, so a lookup inspects at most two
+   bucket lines (plus a small stash that is only consulted when non-empty)
+   before touching the matching entry. Inserts displace residents along a
+   path of at most CUCKOO_MAX_KICKS steps; an entry that still has no home
+   parks in the stash, and a full stash grows the table.
+
+   The option string and the update/search functions mirror those of table.h.
+ */
+#define CUCKOO_WAYS       4
+#define CUCKOO_STASH      4
+#define CUCKOO_MAX_KICKS  128
+
+struct cuckoo_entry;
+
+struct cuckoo_bucket {
+	uint16_t tag[CUCKOO_WAYS];
+	struct cuckoo_entry *entry[CUCKOO_WAYS];
+} __attribute__((aligned(64)));
+
+struct cuckoo {
+	size_t e_max;
+	size_t n_entries;
+	unsigned b_bits;
+	unsigned n_stash;
+	unsigned rand;
+	table_hash_func hash;
+	struct cuckoo_bucket *buckets;
+	struct cuckoo_entry *stash[CUCKOO_STASH];
+};
+
+/**
+   @param cuckoo a table to initialize
+   @param options an option string, expects respective arguments
+
+   Initializes a cuckoo table. Parameters specified in \p options are:
+
+   max_size: expects a size_t argument marking the maximum number of entries in \p cuckoo
+   size: expects a size_t argument marking the initial capacity of \p cuckoo
+   with_hash: expects an argument of type unsigned (*)(const char *) which shall produce a reproducable value.
+
+   Returns zero on success, and a negative number on failure.
+ */
+int cuckoo_init(struct cuckoo *cuckoo, const char *options, ...);
+
+/**
+   @param cuckoo a table to destroy
+
+   Performs required cleanup on \p cuckoo. Calls to cuckoo_init() should be followed with a call to this function.
+ */
+void cuckoo_dest(struct cuckoo *cuckoo);
+
+/**
+   @param options an option string, expects respective arguments
+
+   Allocates and initializes a cuckoo table, see cuckoo_init() for \p options.
+
+   Returns NULL on failure.
+ */
+struct cuckoo *cuckoo_alloc(const char *options, ...);
+
+/**
+   @param cuckoo a table to destroy and free
+
+   Performs cleanup on \p cuckoo and then frees it. Calls to cuckoo_alloc() should be followed with a call to
+   this function.
+ */
+void cuckoo_free(struct cuckoo *cuckoo);
+
+/**
+   @param cuckoo the table to update
+   @param key the key for which the data needs to be updated
+   @param data the value to set for \p key
+
+   Updates data value for \p key in \p cuckoo, if \p key is not in \p cuckoo then a new entry is created
+   from \p key with the value of \p data.
+
+   Returns zero on success and a negative value on failure.
+ */
+int cuckoo_update(struct cuckoo *cuckoo, const char *key, tdata_t data);
+
+/**
+   @param cuckoo the table to update
+   @param key the key for which the data needs to be updated
+   @param data the value to set for \p key
+
+   Updates data value for \p key in \p cuckoo, if \p key is not in \p cuckoo then a negative value is returned.
+
+   Returns zero on success and a negative value on failure.
+ */
+int cuckoo_update_only(struct cuckoo *cuckoo, const char *key, tdata_t data);
+
+/**
+   @param cuckoo the table to search
+   @param key the key for which to search
+   @param data the entry for \p key shall be passed back with this pointer
+
+   Searches \p cuckoo for \p key and returns its entry value using \p data.
+
+   Returns zero on success and a negative value if \p key is not found.
+ */
+int cuckoo_search(struct cuckoo *cuckoo, const char *key, tdata_t *data);
+
+/**
+   @param cuckoo the table to remove from
+   @param key the key to remove
+
+   Removes \p key from \p cuckoo.
+
+   Returns zero on success and a negative value if \p key is not found.
+ */
+int cuckoo_remove(struct cuckoo *cuckoo, const char *key);
+
+#endif
@@ -0,0 +1,170 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#ifndef _TOOLS_DICT_H_
+#define _TOOLS_DICT_H_
+#include <stddef.h>
+#include <stdint.h>
+#include "table.h"
+
+/**
+   Insertion-ordered compact hash table.
+
+   Laid out like CPython's dict: the entries are records in one dense array,
+   in the order their keys were first inserted, and the hash table proper is
+   a separate open-addressed array of int32_t record numbers. A lookup probes
+   the small index and then reads a single record; a walk over all entries
+   reads the record array front to back, and always visits the entries in
+   the same order. A removed entry leaves a hole in the record array until
+   the next resize squeezes the holes out.
+
+   The option string and the update/search functions mirror those of table.h.
+
+   Example:
+
+   struct dict_record *rec;
+
+   dict_for_each_record(rec, &d)
+       printf("%s=%ld\n", rec->key, (long)rec->data);
+ */
+
+struct dict_record {
+	uint64_t hash;
+	const char *key;	/* NULL once removed */
+	tdata_t data;
+};
+
+struct dict {
+	size_t e_max;
+	size_t n_entries;
+	size_t n_records;	/* records in use, removed ones included */
+	size_t r_cap;
+	unsigned i_bits;	/* log2 of the slots in index */
+	table_hash64_func hash64;
+	uint64_t seed;
+	int32_t *index;		/* record numbers, or DICT_EMPTY or DICT_DUMMY */
+	struct dict_record *records;
+};
+
+/**
+   @param rec a struct dict_record * to use as a loop cursor
+   @param dict the dict to iterate over
+
+   Iterates over every entry of \p dict in insertion order.
+ */
+#define dict_for_each_record(rec, dict)						\
+	for ((rec) = (dict)->records; (rec) < (dict)->records + (dict)->n_records; (rec)++) \
+		if (!(rec)->key) {} else
+
+/**
+   @param dict a dict to initialize
+   @param options an option string, expects respective arguments
+
+   Initializes a dict. Parameters specified in \p options are:
+
+   max_size: expects a size_t argument marking the maximum number of entries in \p dict
+   size: expects a size_t argument marking the initial capacity of \p dict
+   with_hash64: expects an argument of type uint64_t (*)(const char *) which shall produce a reproducable value.
+   seed: expects a uint64_t argument, seeds the built-in hash. By default every dict draws a random seed.
+
+   Returns zero on success, and a negative number on failure.
+ */
+int dict_init(struct dict *dict, const char *options, ...);
+
+/**
+   @param dict a dict to destroy
+
+   Performs required cleanup on \p dict. Calls to dict_init() should be followed with a call to this function.
+ */
+void dict_dest(struct dict *dict);
+
+/**
+   @param options an option string, expects respective arguments
+
+   Allocates and initializes a dict, see dict_init() for \p options.
+
+   Returns NULL on failure.
+ */
+struct dict *dict_alloc(const char *options, ...);
+
+/**
+   @param dict a dict to destroy and free
+
+   Performs cleanup on \p dict and then frees it. Calls to dict_alloc() should be followed with a call to
+   this function.
+ */
+void dict_free(struct dict *dict);
+
+/**
+   @param dict the dict to update
+   @param key the key for which the data needs to be updated
+   @param data the value to set for \p key
+
+   Updates data value for \p key in \p dict, if \p key is not in \p dict then a new entry is appended
+   from \p key with the value of \p data. Updating a key keeps its place in the order.
+
+   Returns zero on success and a negative value on failure.
+ */
+int dict_update(struct dict *dict, const char *key, tdata_t data);
+
+/**
+   @param dict the dict to update
+   @param key the key for which the data needs to be updated
+   @param data the value to set for \p key
+
+   Updates data value for \p key in \p dict, if \p key is not in \p dict then a negative value is returned.
+
+   Returns zero on success and a negative value on failure.
+ */
+int dict_update_only(struct dict *dict, const char *key, tdata_t data);
+
+/**
+   @param dict the dict to search
+   @param key the key for which to search
+   @param data the entry for \p key shall be passed back with this pointer
+
+   Searches \p dict for \p key and returns its entry value using \p data.
+
+   Returns zero on success and a negative value if \p key is not found.
+ */
+int dict_search(struct dict *dict, const char *key, tdata_t *data);
+
+/**
+   @param dict the dict to remove from
+   @param key the key to remove
+
+   Removes \p key from \p dict. Inserting it again puts it last in the order.
+
+   Returns zero on success and a negative value if \p key is not found.
+ */
+int dict_remove(struct dict *dict, const char *key);
+
+/**
+   @param dict the dict to walk
+   @param fn called with every key in \p dict, its value and \p arg
+   @param arg passed to \p fn
+
+   Calls \p fn on every entry of \p dict in insertion order, stopping early if \p fn returns
+   non-zero. \p fn must not modify \p dict.
+
+   Returns zero, or the non-zero value \p fn stopped at.
+ */
+int dict_for_each(struct dict *dict, table_iter_func fn, void *arg);
+
+#endif
@@ -0,0 +1,135 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#ifndef _TOOLS_HAMT_H_
+#define _TOOLS_HAMT_H_
+#include <stddef.h>
+#include <stdint.h>
+#include "table.h"
+
+/**
+   Persistent hash array mapped trie.
+
+   A hamt is an immutable map from strings to tdata_t values. Updates never
+   modify existing nodes: they copy the path from the root to the changed leaf
+   and share every other node with the previous version. A snapshot is
+   therefore a pointer copy plus a reference count increment, regardless of the
+   number of entries, and a snapshot keeps seeing the contents it was taken
+   with while the original is updated.
+
+   Interior nodes are compact: a 32-bit bitmap records which of the 32 possible
+   children are present and only those are stored, indexed by the popcount of
+   the bitmap bits below the child's.
+
+   A hamt handle must not be updated concurrently with another update or
+   snapshot of the same handle, callers serialize those. Since a snapshot is
+   O(1), holding a writer lock while taking one is cheap. Each snapshot is an
+   independent handle that can be searched without any locking, and released
+   from any thread.
+
+   Example:
+
+   pthread_mutex_lock(&lock);
+   hamt_snapshot(&view, &live);
+   pthread_mutex_unlock(&lock);
+   ... hamt_search(&view, key, &data) ...
+   hamt_dest(&view);
+ */
+struct hamt_node;
+
+struct hamt {
+	size_t n_entries;
+	table_hash64_func hash;
+	struct hamt_node *root;
+};
+
+/**
+   @param hamt a hamt to initialize
+   @param options an option string, expects respective arguments
+
+   Initializes an empty hamt. Parameters specified in \p options are:
+
+   with_hash64: expects an argument of type uint64_t (*)(const char *) which shall produce a reproducable value.
+
+   Returns zero on success, and a negative number on failure.
+ */
+int hamt_init(struct hamt *hamt, const char *options, ...);
+
+/**
+   @param hamt a hamt to destroy
+
+   Drops the reference \p hamt holds on its root. Nodes still shared with other
+   snapshots stay alive until those are destroyed as well.
+ */
+void hamt_dest(struct hamt *hamt);
+
+/**
+   @param dst an uninitialized hamt to receive the snapshot
+   @param src the hamt to snapshot
+
+   Makes \p dst a snapshot of \p src in constant time. Both handles may be updated
+   independently afterwards, and both must be passed to hamt_dest().
+ */
+void hamt_snapshot(struct hamt *dst, const struct hamt *src);
+
+/**
+   @param hamt the hamt to update
+   @param key the key for which the data needs to be updated
+   @param data the value to set for \p key
+
+   Points \p hamt at a new version in which \p key maps to \p data, creating the
+   entry if needed. Snapshots of the previous version are not affected.
+
+   Returns zero on success and a negative value on failure.
+ */
+int hamt_update(struct hamt *hamt, const char *key, tdata_t data);
+
+/**
+   @param hamt the hamt to update
+   @param key the key for which the data needs to be updated
+   @param data the value to set for \p key
+
+   Same as hamt_update(), but if \p key is not in \p hamt then a negative value is returned.
+
+   Returns zero on success and a negative value on failure.
+ */
+int hamt_update_only(struct hamt *hamt, const char *key, tdata_t data);
+
+/**
+   @param hamt the hamt to remove from
+   @param key the key to remove
+
+   Points \p hamt at a new version without \p key.
+
+   Returns zero on success and a negative value if \p key is not found.
+ */
+int hamt_remove(struct hamt *hamt, const char *key);
+
+/**
+   @param hamt the hamt to search
+   @param key the key for which to search
+   @param data the entry for \p key shall be passed back with this pointer
+
+   Searches \p hamt for \p key and returns its entry value using \p data.
+
+   Returns zero on success and a negative value if \p key is not found.
+ */
+int hamt_search(const struct hamt *hamt, const char *key, tdata_t *data);
+
+#endif
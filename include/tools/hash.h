@@ -0,0 +1,59 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#ifndef _TOOLS_HASH_H_
+#define _TOOLS_HASH_H_
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+   String hashing.
+
+   hash_fnv1a64() is fast but offers no protection against keys chosen to
+   collide: whoever knows the seed, or can probe for it, can flood a bucket.
+   hash_siphash13() is a keyed pseudorandom function; as long as the key stays
+   secret, collisions cannot be produced faster than by guessing.
+ */
+
+/**
+   @param key a NUL-terminated string
+   @param seed perturbs the offset basis, zero gives plain FNV-1a
+
+   Returns the 64-bit FNV-1a hash of \p key.
+ */
+uint64_t hash_fnv1a64(const char *key, uint64_t seed);
+
+/**
+   @param data the bytes to hash
+   @param len the number of bytes at \p data
+   @param key the 128-bit secret key
+
+   Returns the SipHash-1-3 of \p data under \p key.
+ */
+uint64_t hash_siphash13(const void *data, size_t len, const uint64_t key[2]);
+
+/**
+   @param seed filled with 128 random bits
+
+   Draws a seed from the kernel's random number generator, falling back on
+   time and address entropy if it is unavailable.
+ */
+void hash_random_seed(uint64_t seed[2]);
+
+#endif
@@ -0,0 +1,332 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#ifndef _TOOLS_HEAP_H_
+#define _TOOLS_HEAP_H_
+#include <stddef.h>
+#include <stdint.h>
+#include "container_of.h"
+
+/**
+   Priority queues.
+
+   struct pheap is an intrusive pairing heap: the caller embeds a struct
+   pheap_node in their objects, orders them with a comparison function and
+   gets the object back from the node with pheap_entry(). Insertion, merging
+   and decreasing a key are O(1), removing the minimum or any other node is
+   O(log n) amortized. Nothing is allocated.
+
+   Example:
+
+   struct task {
+       uint64_t deadline;
+       struct pheap_node hnode;
+   };
+
+   static int task_less(const struct pheap_node *a, const struct pheap_node *b)
+   {
+       return pheap_entry(a, struct task, hnode)->deadline <
+              pheap_entry(b, struct task, hnode)->deadline;
+   }
+
+   struct pheap runq = PHEAP_INIT(task_less);
+
+   pheap_insert(&runq, &t->hnode);
+   t->deadline -= boost;
+   pheap_decrease(&runq, &t->hnode);
+   next = pheap_entry(pheap_pop(&runq), struct task, hnode);
+
+   struct dheap is an array-backed 4-ary min-heap of (key, data) pairs, for
+   when the elements are not objects of their own. The four children of a
+   node share a cache line, so a sift-down touches one line per level of a
+   tree half as deep as a binary heap's.
+ */
+
+struct pheap_node {
+	struct pheap_node *child;	/* leftmost child */
+	struct pheap_node *next;	/* next sibling */
+	struct pheap_node *prev;	/* previous sibling, or the parent of the leftmost child */
+};
+
+typedef int (*pheap_less_func)(const struct pheap_node *a, const struct pheap_node *b);
+
+struct pheap {
+	struct pheap_node *root;
+	pheap_less_func less;
+	size_t n;
+};
+
+#define PHEAP_INIT(less_fn) { NULL, (less_fn), 0 }
+
+/**
+   @param ptr a pointer to a struct pheap_node
+   @param type the type of the structure \p ptr is embedded in
+   @param member the name of the struct pheap_node within \p type
+
+   Returns a pointer to the structure containing \p ptr.
+ */
+#define pheap_entry(ptr, type, member) container_of(ptr, type, member)
+
+/**
+   @param heap a heap to initialize
+   @param less returns non-zero if its first argument goes before its second
+
+   Initializes \p heap empty.
+ */
+static inline void pheap_init(struct pheap *heap, pheap_less_func less)
+{
+	heap->root = NULL;
+	heap->less = less;
+	heap->n = 0;
+}
+
+/**
+   @param heap a heap
+
+   Returns non-zero if \p heap is empty.
+ */
+static inline int pheap_empty(const struct pheap *heap)
+{
+	return !heap->root;
+}
+
+/**
+   @param heap a heap
+
+   Returns the node that goes first in \p heap without removing it, or NULL if \p heap is empty.
+ */
+static inline struct pheap_node *pheap_min(const struct pheap *heap)
+{
+	return heap->root;
+}
+
+/* makes the later of two roots the leftmost child of the other, returns the root left */
+static inline struct pheap_node *__pheap_link(pheap_less_func less, struct pheap_node *a,
+					      struct pheap_node *b)
+{
+	struct pheap_node *tmp;
+
+	if (less(b, a)) {
+		tmp = a;
+		a = b;
+		b = tmp;
+	}
+	b->next = a->child;
+	if (a->child)
+		a->child->prev = b;
+	b->prev = a;
+	a->child = b;
+	return a;
+}
+
+/*
+ * Melds a list of siblings into one tree, the two-pass way: link them in
+ * pairs from left to right, then link the pairs into one from right to
+ * left. The first pass stacks the pairs on their next pointers, which puts
+ * the rightmost on top for the second.
+ */
+static inline struct pheap_node *__pheap_combine(pheap_less_func less, struct pheap_node *first)
+{
+	struct pheap_node *a, *b, *pairs = NULL, *root;
+
+	while (first) {
+		a = first;
+		b = a->next;
+		first = b ? b->next : NULL;
+		a->next = a->prev = NULL;
+		if (b) {
+			b->next = b->prev = NULL;
+			a = __pheap_link(less, a, b);
+		}
+		a->next = pairs;
+		pairs = a;
+	}
+	if (!pairs)
+		return NULL;
+
+	root = pairs;
+	pairs = pairs->next;
+	root->next = NULL;
+	while (pairs) {
+		a = pairs;
+		pairs = a->next;
+		a->next = NULL;
+		root = __pheap_link(less, root, a);
+	}
+	return root;
+}
+
+/* detaches the subtree rooted at node, which is not the root of the heap */
+static inline void __pheap_cut(struct pheap_node *node)
+{
+	if (node->prev->child == node)
+		node->prev->child = node->next;
+	else
+		node->prev->next = node->next;
+	if (node->next)
+		node->next->prev = node->prev;
+	node->next = node->prev = NULL;
+}
+
+/**
+   @param heap the heap to insert into
+   @param node the node to insert, not in any heap
+
+   Inserts \p node into \p heap in O(1).
+ */
+static inline void pheap_insert(struct pheap *heap, struct pheap_node *node)
+{
+	node->child = node->next = node->prev = NULL;
+	heap->root = heap->root ? __pheap_link(heap->less, heap->root, node) : node;
+	heap->n++;
+}
+
+/**
+   @param heap the heap to remove from
+
+   Removes the node that goes first in \p heap, in O(log n) amortized.
+
+   Returns the node removed, or NULL if \p heap is empty.
+ */
+static inline struct pheap_node *pheap_pop(struct pheap *heap)
+{
+	struct pheap_node *root = heap->root;
+
+	if (!root)
+		return NULL;
+	heap->root = __pheap_combine(heap->less, root->child);
+	heap->n--;
+	root->child = NULL;
+	return root;
+}
+
+/**
+   @param heap the heap \p node is in
+   @param node a node whose key has just been lowered
+
+   Restores the order of \p heap after \p node moved forward, in O(1).
+ */
+static inline void pheap_decrease(struct pheap *heap, struct pheap_node *node)
+{
+	if (node == heap->root)
+		return;
+	__pheap_cut(node);
+	heap->root = __pheap_link(heap->less, heap->root, node);
+}
+
+/**
+   @param heap the heap \p node is in
+   @param node the node to remove
+
+   Removes \p node from \p heap, in O(log n) amortized.
+ */
+static inline void pheap_remove(struct pheap *heap, struct pheap_node *node)
+{
+	struct pheap_node *sub;
+
+	if (node == heap->root) {
+		pheap_pop(heap);
+		return;
+	}
+	__pheap_cut(node);
+	sub = __pheap_combine(heap->less, node->child);
+	node->child = NULL;
+	if (sub)
+		heap->root = __pheap_link(heap->less, heap->root, sub);
+	heap->n--;
+}
+
+/**
+   @param dst the heap to merge into
+   @param src the heap to merge, ordered alike, left empty
+
+   Moves every node of \p src into \p dst in O(1).
+ */
+static inline void pheap_merge(struct pheap *dst, struct pheap *src)
+{
+	if (!src->root)
+		return;
+	dst->root = dst->root ? __pheap_link(dst->less, dst->root, src->root) : src->root;
+	dst->n += src->n;
+	src->root = NULL;
+	src->n = 0;
+}
+
+struct dheap_item {
+	uint64_t key;
+	intptr_t data;
+};
+
+struct dheap {
+	size_t n;
+	size_t cap;
+	struct dheap_item *items;	/* items[0] is the minimum */
+	void *mem;
+};
+
+/**
+   @param heap a heap to initialize
+   @param options an option string, expects respective arguments
+
+   Initializes an empty 4-ary heap. Parameters specified in \p options are:
+
+   size: expects a size_t argument, the number of items to allocate room for up front
+
+   Returns zero on success, and a negative number on failure.
+ */
+int dheap_init(struct dheap *heap, const char *options, ...);
+
+/**
+   @param heap a heap to destroy
+
+   Frees the items of \p heap.
+ */
+void dheap_dest(struct dheap *heap);
+
+/**
+   @param heap the heap to insert into
+   @param key the priority, lower keys come out first
+   @param data the value to store with \p key
+
+   Returns zero on success and -ENOMEM on failure.
+ */
+int dheap_push(struct dheap *heap, uint64_t key, intptr_t data);
+
+/**
+   @param heap the heap to remove from
+   @param key the key of the item removed shall be passed back with this pointer, may be NULL
+   @param data its data shall be passed back with this pointer, may be NULL
+
+   Removes an item of the lowest key from \p heap.
+
+   Returns zero on success and a negative value if \p heap is empty.
+ */
+int dheap_pop(struct dheap *heap, uint64_t *key, intptr_t *data);
+
+/**
+   @param heap a heap
+
+   Returns an item of the lowest key in \p heap without removing it, or NULL if \p heap is empty.
+ */
+static inline struct dheap_item *dheap_min(struct dheap *heap)
+{
+	return heap->n ? &heap->items[0] : NULL;
+}
+
+#endif
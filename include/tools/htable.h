@@ -0,0 +1,164 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#ifndef _TOOLS_HTABLE_H_
+#define _TOOLS_HTABLE_H_
+#include <stddef.h>
+#include "list.h"
+#include "table.h"
+
+/**
+   Intrusive hash table.
+
+   Unlike struct table, an htable does not own its entries. The user embeds a
+   struct htable_node in their own structure and the table links that node
+   into a flat array of hlist_head buckets. Inserting an object allocates nothing
+   (other than the occasional bucket array resize), and lookups hand back the
+   embedded node, from which the containing structure is recovered with
+   htable_entry().
+
+   Example:
+
+   struct conn {
+       char name[32];
+       struct htable_node hnode;
+   };
+
+   static const char *conn_key(const struct htable_node *node)
+   {
+       return htable_entry(node, struct conn, hnode)->name;
+   }
+
+   htable_init(&ht, conn_key, NULL);
+   htable_insert(&ht, &c->hnode);
+   c = htable_entry(htable_search(&ht, "foo"), struct conn, hnode);
+ */
+struct htable_node {
+	struct hlist_node node;
+	unsigned hash;
+};
+
+typedef const char *(*htable_key_func)(const struct htable_node *node);
+typedef int (*htable_cmp_func)(const char *a, const char *b);
+
+struct htable {
+	size_t e_max;
+	size_t n_entries;
+	unsigned b_bits;
+	table_hash_func hash;
+	htable_cmp_func cmp;
+	htable_key_func key;
+	struct hlist_head *buckets;
+};
+
+/**
+   @param ptr a pointer to a struct htable_node
+   @param type the type of the structure \p ptr is embedded in
+   @param member the name of the struct htable_node within \p type
+
+   Returns a pointer to the structure containing \p ptr, or NULL if \p ptr is NULL.
+ */
+#define htable_entry(ptr, type, member)				\
+	({ const struct htable_node *____hptr = (ptr);		\
+	   ____hptr ? container_of(____hptr, type, member) : NULL; })
+
+/**
+   @param ht an initialized htable
+
+   Returns the number of buckets in \p ht.
+ */
+#define htable_buckets(ht) ((size_t)1 << (ht)->b_bits)
+
+/**
+   @param pos a struct htable_node * to use as a loop cursor
+   @param bkt a size_t to use as the bucket cursor
+   @param ht the htable to iterate over
+
+   Iterates over every node in \p ht in bucket order. Note that a break from the
+   body only leaves the current bucket.
+ */
+#define htable_for_each(pos, bkt, ht)					\
+	for ((bkt) = 0; (bkt) < htable_buckets(ht); (bkt)++)		\
+		hlist_for_each_entry(pos, &(ht)->buckets[bkt], node)
+
+/**
+   @param pos a struct htable_node * to use as a loop cursor
+   @param tmp a struct hlist_node * to use as temporary storage
+   @param bkt a size_t to use as the bucket cursor
+   @param ht the htable to iterate over
+
+   Same as htable_for_each() but safe against removal of \p pos.
+ */
+#define htable_for_each_safe(pos, tmp, bkt, ht)				\
+	for ((bkt) = 0; (bkt) < htable_buckets(ht); (bkt)++)		\
+		hlist_for_each_entry_safe(pos, tmp, &(ht)->buckets[bkt], node)
+
+/**
+   @param ht an htable to initialize
+   @param key a function returning the key of a node linked into \p ht
+   @param options an option string, expects respective arguments
+
+   Initializes an intrusive table. Parameters specified in \p options are:
+
+   max_size: expects a size_t argument marking the maximum number of entries in \p ht, at most 2^30
+   size: expects a size_t argument marking the initial capacity of \p ht
+   with_hash: expects an argument of type unsigned (*)(const char *) which shall produce a reproducable value
+   with_cmp: expects an argument of type int (*)(const char *, const char *) which returns zero for equal keys
+
+   Returns zero on success, -EINVAL if \p size exceeds \p max_size or 2^30,
+   and a negative number on any other failure.
+ */
+int htable_init(struct htable *ht, htable_key_func key, const char *options, ...);
+
+/**
+   @param ht an htable to destroy
+
+   Releases the bucket array of \p ht. The nodes still linked into \p ht are
+   owned by the caller and are left untouched.
+ */
+void htable_dest(struct htable *ht);
+
+/**
+   @param ht the htable to insert into
+   @param node the node to link into \p ht
+
+   Links \p node into \p ht. The hash of the key of \p node is cached in \p node.
+
+   Returns zero on success, -EEXIST if an entry with the same key is already present
+   and a negative value on any other failure.
+ */
+int htable_insert(struct htable *ht, struct htable_node *node);
+
+/**
+   @param ht the htable to search
+   @param key the key for which to search
+
+   Returns the node with \p key, or NULL if \p key is not in \p ht.
+ */
+struct htable_node *htable_search(struct htable *ht, const char *key);
+
+/**
+   @param ht the htable \p node is linked into
+   @param node the node to unlink
+
+   Unlinks \p node from \p ht. The node may be reinserted afterwards.
+ */
+void htable_remove(struct htable *ht, struct htable_node *node);
+
+#endif
@@ -0,0 +1,165 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#ifndef _TOOLS_LFTABLE_H_
+#define _TOOLS_LFTABLE_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "table.h"
+
+/**
+   Lock-free hash table.
+
+   A split-ordered list (Shalev and Shavit): every entry sits in a single
+   lock-free sorted linked list (Harris and Michael), ordered by the bit
+   reversal of its hash. In that order the entries of bucket b of a table
+   with 2^k buckets are contiguous, and doubling the table splits every
+   bucket's run in two without moving a node. A bucket is a pointer to a
+   sentinel node in the list, created the first time the bucket is used, so
+   growing the table is a single compare-and-swap of the bucket count and
+   no thread ever waits for another.
+
+   Searches, updates and removals from any number of threads need no
+   locking. Removed nodes are freed by epoch-based reclamation once no
+   thread can still be reading them; each thread that uses a table is given
+   a small record in it, reused after the thread exits.
+
+   Every table finds the record of the calling thread through a
+   pthread_key_t of its own, held from lftable_init() to lftable_dest(), so
+   no more than PTHREAD_KEYS_MAX tables (at least 128, 1024 with glibc) can
+   be live in a process at once, fewer if other code uses keys too. Past
+   that lftable_init() fails with -EAGAIN.
+
+   The option string and the update/search functions mirror those of table.h.
+ */
+
+struct lft_node;
+struct lft_thread;
+
+#define LFT_SEGMENTS 48		/* segment s holds buckets 2^s to 2^(s+1) - 1, and segment 0 also bucket 0 */
+
+struct lftable {
+	size_t e_max;
+	unsigned b_bits;		/* log2 of the buckets in use, grows */
+	unsigned b_bits_max;
+	double load_factor;
+	table_hash64_func hash64;
+	uint64_t seed;
+	size_t n_approx;		/* entries at the last count, for max_size */
+	struct lft_node **segments[LFT_SEGMENTS];
+	uint64_t epoch;			/* global reclamation epoch */
+	struct lft_thread *threads;	/* one record per thread that used the table */
+	pthread_key_t thread_key;
+};
+
+/**
+   @param table a table to initialize
+   @param options an option string, expects respective arguments
+
+   Initializes a lock-free table. Parameters specified in \p options are:
+
+   max_size: expects a size_t argument marking the maximum number of entries in \p table. A thread
+             inserting alone never exceeds it; concurrent inserts may, by up to 127 entries per
+             other inserting thread.
+   size: expects a size_t argument marking the initial capacity of \p table
+   with_hash64: expects an argument of type uint64_t (*)(const char *) which shall produce a reproducable value.
+   seed: expects a uint64_t argument, seeds the built-in hash. By default every table draws a random seed.
+   load_factor: expects a double argument, the average number of entries per bucket the table grows at.
+                Defaults to 2.
+
+   Returns zero on success, and a negative number on failure.
+ */
+int lftable_init(struct lftable *table, const char *options, ...);
+
+/**
+   @param table a table to destroy
+
+   Frees every entry of \p table. No other thread may be using \p table.
+ */
+void lftable_dest(struct lftable *table);
+
+/**
+   @param options an option string, expects respective arguments
+
+   Allocates and initializes a lock-free table, see lftable_init() for \p options.
+
+   Returns NULL on failure.
+ */
+struct lftable *lftable_alloc(const char *options, ...);
+
+/**
+   @param table a table to destroy and free
+
+   Performs cleanup on \p table and then frees it.
+ */
+void lftable_free(struct lftable *table);
+
+/**
+   @param table the table to update
+   @param key the key for which the data needs to be updated
+   @param data the value to set for \p key
+
+   Updates data value for \p key in \p table, if \p key is not in \p table then a new entry is created
+   from \p key with the value of \p data. Fails if that would take \p table past its max_size.
+
+   Returns zero on success and a negative value on failure.
+ */
+int lftable_update(struct lftable *table, const char *key, tdata_t data);
+
+/**
+   @param table the table to update
+   @param key the key for which the data needs to be updated
+   @param data the value to set for \p key
+
+   Updates data value for \p key in \p table, if \p key is not in \p table then a negative value is returned.
+
+   Returns zero on success and a negative value on failure.
+ */
+int lftable_update_only(struct lftable *table, const char *key, tdata_t data);
+
+/**
+   @param table the table to search
+   @param key the key for which to search
+   @param data the entry for \p key shall be passed back with this pointer
+
+   Searches \p table for \p key and returns its entry value using \p data.
+
+   Returns zero on success and a negative value if \p key is not found.
+ */
+int lftable_search(struct lftable *table, const char *key, tdata_t *data);
+
+/**
+   @param table the table to remove from
+   @param key the key to remove
+
+   Removes \p key from \p table.
+
+   Returns zero on success and a negative value if \p key is not found.
+ */
+int lftable_remove(struct lftable *table, const char *key);
+
+/**
+   @param table a table
+
+   Returns the number of entries in \p table, exact only while no other thread modifies it.
+ */
+size_t lftable_entries(struct lftable *table);
+
+#endif
@@ -0,0 +1,182 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#ifndef _TOOLS_PLACEMENT_H_
+#define _TOOLS_PLACEMENT_H_
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+   Placement of keys on nodes.
+
+   Each scheme maps a 64-bit key hash to one of several nodes such that a
+   change in the set of nodes moves only about 1/n of the keys, where the
+   modulo of the hash moves nearly all of them:
+
+   jump_hash(): nodes are numbered 0..n-1 and can only be added or removed at
+                the end. No state, no memory, and the most even spread.
+   rendezvous_hash(): nodes have arbitrary ids and weights and any of them can
+                      go away. Costs one hash per node and lookup.
+   struct ring: consistent hashing on a ring of virtual nodes, optionally with
+                bounded loads, so that no node is assigned more than a given
+                factor above the average number of keys.
+
+   The hash is meant to be the one a struct table computes for the key,
+   table_hash(), so that a key is hashed once for both choosing its node and
+   looking it up there. All processes must then hash alike: give their tables
+   the same "seed" and leave out "max_chain", which changes the hash.
+
+   Example:
+
+   table_init(&t, "seed", (uint64_t)0x5eed);
+   hash = table_hash(&t, key);
+   node = jump_hash(hash, n_nodes);
+ */
+
+/**
+   @param hash a 64-bit hash of the key
+   @param n_buckets the number of nodes, at least one
+
+   Jump consistent hash (Lamping and Veach). Growing \p n_buckets by one moves
+   1/n_buckets of the keys, all of them onto the new node.
+
+   Returns the node of \p hash, between 0 and \p n_buckets - 1.
+ */
+uint32_t jump_hash(uint64_t hash, uint32_t n_buckets);
+
+struct rendezvous_node {
+	uint64_t id;
+	double weight;		/* share of the keys relative to the other nodes */
+};
+
+/**
+   @param hash a 64-bit hash of the key
+   @param nodes the nodes to choose from
+   @param n the number of elements of \p nodes
+
+   Weighted rendezvous (highest random weight) hashing: every node draws a
+   score from \p hash and its id, scaled so that it wins in proportion to its
+   weight. Only the keys of a node that is removed move, and a node that is
+   added only takes keys, each from whichever node held it.
+
+   Returns the index in \p nodes of the node of \p hash, or \p n if no node has
+   a positive weight.
+ */
+size_t rendezvous_hash(uint64_t hash, const struct rendezvous_node *nodes, size_t n);
+
+struct ring_node {
+	uint64_t id;
+	size_t load;		/* keys assigned with ring_assign() and not released */
+};
+
+struct ring_point {
+	uint64_t pos;
+	size_t node;		/* index in nodes */
+};
+
+struct ring {
+	unsigned vnodes;	/* points per node */
+	double load_bound;
+	size_t n_nodes;
+	size_t nodes_cap;
+	struct ring_node *nodes;
+	size_t n_points;
+	struct ring_point *points;	/* sorted by pos */
+	size_t total_load;
+};
+
+/**
+   @param ring a ring to initialize
+   @param options an option string, expects respective arguments
+
+   Initializes an empty consistent hashing ring. Parameters specified in \p options are:
+
+   vnodes: expects an unsigned argument, the points each node has on the ring; more even out
+           the share of the nodes. Defaults to 128.
+   load_bound: expects a double argument of at least 1, ring_assign() places at most this factor
+               above the average number of keys on any node. Defaults to 1.25.
+
+   Returns zero on success, and a negative number on failure.
+ */
+int ring_init(struct ring *ring, const char *options, ...);
+
+/**
+   @param ring a ring to destroy
+
+   Frees the nodes and points of \p ring.
+ */
+void ring_dest(struct ring *ring);
+
+/**
+   @param ring the ring to add to
+   @param id the id of the new node
+
+   Returns zero on success, -EEXIST if \p id is already on \p ring and -ENOMEM on failure.
+ */
+int ring_add(struct ring *ring, uint64_t id);
+
+/**
+   @param ring the ring to remove from
+   @param id the id of the node to remove
+
+   Removes a node, along with its load. The keys it was assigned must be
+   assigned again.
+
+   Returns zero on success and -ENOENT if \p id is not on \p ring.
+ */
+int ring_remove(struct ring *ring, uint64_t id);
+
+/**
+   @param ring the ring to search
+   @param hash a 64-bit hash of the key
+   @param id the id of the node of \p hash shall be passed back with this pointer
+
+   Plain consistent hashing: the node of the first point at or after \p hash
+   going round the ring. Ignores and does not change the load of the nodes.
+
+   Returns zero on success and -ENOENT if \p ring is empty.
+ */
+int ring_lookup(const struct ring *ring, uint64_t hash, uint64_t *id);
+
+/**
+   @param ring the ring to assign on
+   @param hash a 64-bit hash of the key
+   @param id the id of the node of \p hash shall be passed back with this pointer
+
+   Consistent hashing with bounded loads (Mirrokni, Thorup and Zadimoghaddam):
+   like ring_lookup(), but nodes already holding load_bound times the average
+   load are passed over, and the node chosen is charged with the key. Where a
+   key lands depends on the keys assigned before it, so the caller remembers
+   the node and releases it there with ring_release().
+
+   Returns zero on success and -ENOENT if \p ring is empty.
+ */
+int ring_assign(struct ring *ring, uint64_t hash, uint64_t *id);
+
+/**
+   @param ring the ring the key was assigned on
+   @param id the node the key was assigned to
+
+   Releases a key assigned with ring_assign().
+
+   Returns zero on success and -ENOENT if \p id is not on \p ring or has no load.
+ */
+int ring_release(struct ring *ring, uint64_t id);
+
+#endif
@@ -0,0 +1,130 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#ifndef _TOOLS_POOL_H_
+#define _TOOLS_POOL_H_
+#include <stddef.h>
+#include <pthread.h>
+#include "list.h"
+
+/**
+   Thread-caching fixed-size object pool.
+
+   Objects are carved out of page-backed slabs and recycled through
+   magazines, small stacks of free objects. Every thread using a pool owns two
+   magazines and serves allocations and frees from them without any locking.
+   Only when both are empty (or both full) does a thread visit the pool's
+   depot, under a lock, to exchange a whole magazine at a time. An object freed
+   by a thread other than the one that allocated it simply lands in the freeing
+   thread's magazines and flows back to other threads through the depot.
+
+   Memory is returned to the system when the pool is destroyed.
+ */
+#define POOL_MAG_ROUNDS 64
+
+struct pool_magazine {
+	struct pool_magazine *next;
+	unsigned rounds;
+	void *obj[POOL_MAG_ROUNDS];
+};
+
+struct pool_cache {
+	struct pool_magazine *loaded;
+	struct pool_magazine *previous;
+	size_t n_alloc;
+	size_t n_free;
+	struct pool *pool;
+	struct list_head node;
+};
+
+struct pool_stats {
+	size_t outstanding;	/* objects allocated and not yet freed */
+	size_t cached;		/* free objects held in magazines */
+	size_t slabs;		/* slabs mapped for the pool */
+	size_t slab_bytes;	/* bytes mapped for the pool */
+};
+
+struct pool {
+	size_t obj_size;
+	size_t slab_size;
+	int zero;
+	pthread_key_t key;
+	pthread_mutex_t lock;
+	/* everything below is protected by lock */
+	struct pool_magazine *full;	/* depot of non-empty magazines */
+	struct pool_magazine *empty;	/* depot of empty magazines */
+	size_t depot_rounds;
+	void *slabs;
+	char *slab_cur;
+	char *slab_end;
+	size_t n_slabs;
+	size_t n_alloc;			/* totals of exited threads */
+	size_t n_free;
+	struct list_head caches;
+};
+
+/**
+   @param pool a pool to initialize
+   @param obj_size the size of the objects served by \p pool
+   @param options an option string, expects respective arguments
+
+   Initializes an object pool. Parameters specified in \p options are:
+
+   zero: objects are zeroed on allocation, making pool_alloc() a drop-in replacement for zalloc()
+   slab_size: expects a size_t argument marking the size of the slabs mapped for \p pool
+
+   Returns zero on success, and a negative number on failure.
+ */
+int pool_init(struct pool *pool, size_t obj_size, const char *options, ...);
+
+/**
+   @param pool a pool to destroy
+
+   Unmaps every slab of \p pool. No thread may use \p pool, or any object allocated
+   from it, after this call.
+ */
+void pool_dest(struct pool *pool);
+
+/**
+   @param pool the pool to allocate from
+   @return pointer to an object, returns NULL on failure
+
+   Allocates an object of the size \p pool was initialized with.
+ */
+void *pool_alloc(struct pool *pool);
+
+/**
+   @param pool the pool \p obj was allocated from
+   @param obj the object to free
+
+   Returns \p obj to \p pool. Any thread may free any object of \p pool.
+ */
+void pool_free(struct pool *pool, void *obj);
+
+/**
+   @param pool the pool to report on
+   @param stats the statistics shall be passed back with this pointer
+
+   Collects usage statistics for \p pool. Counters of other running threads are
+   read without synchronization, so the result is a close approximation while
+   the pool is in use.
+ */
+void pool_stats(struct pool *pool, struct pool_stats *stats);
+
+#endif
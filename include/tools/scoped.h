@@ -0,0 +1,116 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#ifndef _TOOLS_SCOPED_H_
+#define _TOOLS_SCOPED_H_
+#include <alloca.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+   Scoped allocations: stack speed for small sizes, heap safety for large ones.
+
+   Requests of up to SCOPED_STACK_MAX bytes are served with alloca(), anything
+   larger falls back to malloc(). The pointer must be held in a variable
+   declared with __scoped, which releases a heap fallback when the variable
+   goes out of scope. Stack allocations are released when the caller returns,
+   as with alloca().
+
+   Example:
+
+   char *tmp __scoped = scoped_strdup(options);
+
+   The variable must still point to the start of the allocation when it goes out
+   of scope. Define SCOPED_STACK_MAX before including this header to change the
+   threshold.
+ */
+#ifndef SCOPED_STACK_MAX
+#define SCOPED_STACK_MAX 512
+#endif
+
+struct __scoped_hdr {
+	size_t on_heap;
+} __attribute__((aligned(16)));
+
+/**
+   @param ptr a pointer returned by one of the scoped allocators
+
+   Returns non-zero if \p ptr was allocated on the heap.
+ */
+#define scoped_on_heap(ptr) (((struct __scoped_hdr *)(ptr))[-1].on_heap)
+
+static inline void __scoped_release(void *ptr)
+{
+	void *p = *(void **)ptr;
+
+	if (p && scoped_on_heap(p))
+		free((struct __scoped_hdr *)p - 1);
+}
+
+#define __scoped __attribute__((cleanup(__scoped_release)))
+
+/**
+   @param len how much memory to allocate
+   @return pointer to allocated memory, returns NULL on failure
+
+   Allocates memory on the callers stack, or on the heap if \p len exceeds
+   SCOPED_STACK_MAX. The result must be assigned to a __scoped variable.
+ */
+#define scoped_alloc(len) ({						\
+	size_t __slen = (len);						\
+	struct __scoped_hdr *__shdr;					\
+	if (__slen <= SCOPED_STACK_MAX)					\
+		__shdr = alloca(sizeof(*__shdr) + __slen);		\
+	else if (__slen <= SIZE_MAX - sizeof(*__shdr))			\
+		__shdr = malloc(sizeof(*__shdr) + __slen);		\
+	else								\
+		__shdr = NULL;						\
+	if (__shdr)							\
+		__shdr->on_heap = __slen > SCOPED_STACK_MAX;		\
+	(void *)(__shdr ? __shdr + 1 : NULL);})
+
+/**
+   @param len how much memory to allocate
+   @return pointer to allocated memory, returns NULL on failure
+
+   Allocates zeroed memory, see scoped_alloc().
+ */
+#define scoped_zalloc(len) ({						\
+	size_t __szlen = (len);						\
+	void *__sztmp = scoped_alloc(__szlen);				\
+	if (__sztmp)							\
+		memset(__sztmp, 0, __szlen);				\
+	__sztmp;})
+
+/**
+   @param str a string to duplicate
+   @return the duplicated string, returns NULL on failure or if \p str is NULL
+
+   Duplicates a string, see scoped_alloc().
+ */
+#define scoped_strdup(str) ({						\
+	const char *__ssrc = (str);					\
+	size_t __sslen = __ssrc ? strlen(__ssrc) + 1 : 0;		\
+	char *__sstmp = __ssrc ? scoped_alloc(__sslen) : NULL;		\
+	if (__sstmp)							\
+		memcpy(__sstmp, __ssrc, __sslen);			\
+	__sstmp;})
+
+#endif
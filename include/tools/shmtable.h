@@ -0,0 +1,174 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#ifndef _TOOLS_SHMTABLE_H_
+#define _TOOLS_SHMTABLE_H_
+#include <stddef.h>
+#include <stdint.h>
+#include "table.h"
+
+/**
+   Hash table in shared memory.
+
+   A shmtable lives entirely inside one shared memory segment, created with
+   shm_open() when given a name or memfd_create() otherwise, and mapped by
+   every process that uses it. Chains and keys are linked by offsets from the
+   start of the segment instead of pointers, so the table is valid at whatever
+   address each process maps it. Processes forked after shmtable_create()
+   inherit the mapping; unrelated processes attach with shmtable_open(), or
+   with shmtable_open_fd() on a descriptor passed over a unix socket.
+
+   Writers serialize on a robust process-shared mutex, so a writer that dies
+   holding it does not wedge the others; every update is published with a
+   single store, so the table stays consistent even then, though the entry
+   count may be left one off and the block of an entry being removed may
+   leak. Readers take no
+   lock at all: a sequence counter bumped around each write tells them when a
+   lookup raced with a writer and must be retried.
+
+   The segment is sized once, from max_size and heap_size, and does not grow.
+
+   Example:
+
+   struct shmtable st;
+   shmtable_create(&st, NULL, "max_size", (size_t)100000);
+   if (fork() == 0) {
+       tdata_t v;
+       shmtable_search(&st, "config/epoch", &v);
+       ...
+   }
+   shmtable_update(&st, "config/epoch", 7);
+ */
+struct shmtable_hdr;
+
+struct shmtable {
+	struct shmtable_hdr *hdr;
+	size_t size;
+	int fd;
+};
+
+/**
+   @param st the table to create
+   @param name the name passed to shm_open(), or NULL for an anonymous memfd
+   @param options an option string, expects respective arguments
+
+   Creates a new segment holding an empty table and maps it. Fails if a
+   segment named \p name exists already. Parameters specified in \p options are:
+
+   max_size: expects a size_t argument marking the maximum number of entries
+   heap_size: expects a size_t argument, the bytes set aside for entries and their keys.
+              Defaults to 64 bytes per entry.
+   seed: expects a uint64_t argument, seeds the hash so that placement is reproducible
+
+   Returns zero on success, and a negative errno value on failure.
+ */
+int shmtable_create(struct shmtable *st, const char *name, const char *options, ...);
+
+/**
+   @param st the table to attach
+   @param name the name the table was created with
+
+   Maps an existing table created by another process.
+
+   Returns zero on success, and a negative errno value on failure.
+ */
+int shmtable_open(struct shmtable *st, const char *name);
+
+/**
+   @param st the table to attach
+   @param fd a descriptor of the segment, e.g. received over a unix socket
+
+   Maps an existing table from a descriptor of its segment. \p st takes over \p fd.
+
+   Returns zero on success, and a negative errno value on failure.
+ */
+int shmtable_open_fd(struct shmtable *st, int fd);
+
+/**
+   @param st a table to detach
+
+   Unmaps \p st and closes its descriptor. The table lives on as long as
+   another process maps it or, for a named table, until shmtable_unlink().
+ */
+void shmtable_close(struct shmtable *st);
+
+/**
+   @param name the name of the table
+
+   Removes the name of a table created with shmtable_create().
+
+   Returns zero on success, and a negative errno value on failure.
+ */
+int shmtable_unlink(const char *name);
+
+/**
+   @param st the table to update
+   @param key the key for which the data needs to be updated
+   @param data the value to set for \p key
+
+   Updates data value for \p key in \p st, if \p key is not in \p st then a new entry is created
+   from \p key with the value of \p data.
+
+   Returns zero on success and a negative value on failure, -ENOSPC once the segment is full.
+ */
+int shmtable_update(struct shmtable *st, const char *key, tdata_t data);
+
+/**
+   @param st the table to update
+   @param key the key for which the data needs to be updated
+   @param data the value to set for \p key
+
+   Updates data value for \p key in \p st, if \p key is not in \p st then a negative value is returned.
+
+   Returns zero on success and a negative value on failure.
+ */
+int shmtable_update_only(struct shmtable *st, const char *key, tdata_t data);
+
+/**
+   @param st the table to search
+   @param key the key for which to search
+   @param data the entry for \p key shall be passed back with this pointer
+
+   Searches \p st for \p key and returns its entry value using \p data. Never blocks
+   on writers.
+
+   Returns zero on success and a negative value if \p key is not found.
+ */
+int shmtable_search(struct shmtable *st, const char *key, tdata_t *data);
+
+/**
+   @param st the table to remove from
+   @param key the key to remove
+
+   Removes \p key from \p st, its space is reused by later inserts.
+
+   Returns zero on success and a negative value if \p key is not found.
+ */
+int shmtable_remove(struct shmtable *st, const char *key);
+
+/**
+   @param st a table
+
+   Returns the number of entries in \p st. A writer that died between linking or unlinking an
+   entry and counting it leaves the result off by one for good, short after an insert and over
+   after a removal; the entries themselves are intact.
+ */
+size_t shmtable_entries(const struct shmtable *st);
+
+#endif
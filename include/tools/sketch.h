@@ -0,0 +1,227 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#ifndef _TOOLS_SKETCH_H_
+#define _TOOLS_SKETCH_H_
+#include <stddef.h>
+#include <stdint.h>
+#include "list.h"
+#include "htable.h"
+
+/**
+   Streaming frequency estimation in constant memory.
+
+   A count-min sketch answers "how often has this key been seen" for any key,
+   overestimating by at most a small fraction of the total count with high
+   probability. struct topk (Space-Saving) tracks the k most frequent keys
+   of a stream, each with its count and a bound on how much that count may be
+   overstated. Neither grows with the number of distinct keys.
+
+   Both merge, so that every thread can count into its own sketch without
+   locking and the results be combined afterwards:
+
+   struct cms global, local[N];
+
+   cms_init(&global, "width depth", (size_t)4096, 4u);
+   for (i = 0; i < N; i++)
+       cms_init_from(&local[i], &global);
+   ... thread i calls cms_add(&local[i], key, 1) ...
+   for (i = 0; i < N; i++)
+       cms_merge(&global, &local[i]);
+ */
+
+struct cms {
+	unsigned depth;		/* rows, one hash function each */
+	unsigned w_bits;	/* log2 of the counters per row */
+	uint64_t seed;
+	uint64_t total;		/* sum of everything added */
+	uint32_t *rows;		/* depth rows of 1 << w_bits counters, back to back */
+};
+
+/**
+   @param cms a sketch to initialize
+   @param options an option string, expects respective arguments
+
+   Initializes a count-min sketch. An estimate exceeds the true count by at most
+   e/width of the total with probability 1 - e^-depth. Parameters specified in
+   \p options are:
+
+   width: expects a size_t argument, the counters per row, rounded up to a power of two. Defaults to 2048.
+   depth: expects an unsigned argument, the number of rows. Defaults to 4.
+   seed: expects a uint64_t argument, sketches only merge with sketches of the same seed.
+         By default every sketch draws a random seed.
+
+   Returns zero on success, and a negative number on failure.
+ */
+int cms_init(struct cms *cms, const char *options, ...);
+
+/**
+   @param cms a sketch to initialize
+   @param proto an initialized sketch
+
+   Initializes \p cms empty, with the dimensions and seed of \p proto, so that
+   the two can be merged.
+
+   Returns zero on success, and a negative number on failure.
+ */
+int cms_init_from(struct cms *cms, const struct cms *proto);
+
+/**
+   @param cms a sketch to destroy
+
+   Frees the counters of \p cms.
+ */
+void cms_dest(struct cms *cms);
+
+/**
+   @param cms the sketch to count into
+   @param key the key seen
+   @param n how many times it was seen
+
+   Adds \p n to the count of \p key. Only counters below the new estimate are
+   raised (conservative update), which keeps keys that share counters with
+   \p key from being overstated further. Counters saturate.
+
+   Returns the new estimate for \p key.
+ */
+uint32_t cms_add(struct cms *cms, const char *key, uint32_t n);
+
+/**
+   @param cms the sketch to query
+   @param key the key to estimate
+
+   Returns an estimate of how often \p key was added, never below the true count.
+ */
+uint32_t cms_estimate(const struct cms *cms, const char *key);
+
+/**
+   @param dst the sketch to merge into
+   @param src the sketch to merge
+
+   Adds the counts of \p src to \p dst.
+
+   Returns zero on success and -EINVAL if the sketches differ in dimensions or seed.
+ */
+int cms_merge(struct cms *dst, const struct cms *src);
+
+/**
+   @param cms the sketch to reset
+
+   Sets every count in \p cms back to zero.
+ */
+void cms_clear(struct cms *cms);
+
+struct topk_counter {
+	struct htable_node hnode;
+	struct list_head entry;		/* in the counters of bucket */
+	struct topk_bucket *bucket;
+	uint64_t error;
+	char *key;
+	size_t key_cap;
+};
+
+/* the counters sharing one count, kept in a list ordered by count */
+struct topk_bucket {
+	struct list_head entry;
+	struct list_head counters;
+	uint64_t count;
+};
+
+struct topk {
+	size_t k;
+	size_t n_used;
+	struct topk_counter *counters;	/* k of them */
+	struct topk_bucket *pool;	/* k + 1 buckets */
+	struct list_head buckets;	/* in use, lowest count first */
+	struct list_head free_buckets;
+	struct htable index;
+};
+
+struct topk_item {
+	const char *key;
+	uint64_t count;		/* never below the true count */
+	uint64_t error;		/* ... and at most this much above it */
+};
+
+/**
+   @param tk a tracker to initialize
+   @param k the number of keys to track
+
+   Initializes a Space-Saving tracker of \p k counters. Any key occurring more
+   than 1/k of the time is guaranteed to be tracked. All memory but that of the
+   keys is allocated here; key buffers are reused as keys are replaced.
+
+   Returns zero on success, and a negative number on failure.
+ */
+int topk_init(struct topk *tk, size_t k);
+
+/**
+   @param tk a tracker to destroy
+
+   Frees everything \p tk holds.
+ */
+void topk_dest(struct topk *tk);
+
+/**
+   @param tk the tracker to count into
+   @param key the key seen
+   @param n how many times it was seen
+
+   Adds \p n to the count of \p key. If \p key is not tracked and all counters
+   are taken, it replaces the key with the lowest count and inherits that count
+   as its error.
+
+   Returns zero on success and -ENOMEM on failure.
+ */
+int topk_add(struct topk *tk, const char *key, uint64_t n);
+
+/**
+   @param tk the tracker to query
+   @param key the key to look up
+   @param item the count of \p key shall be passed back with this pointer
+
+   Returns zero on success and a negative value if \p key is not tracked.
+ */
+int topk_search(struct topk *tk, const char *key, struct topk_item *item);
+
+/**
+   @param tk the tracker to query
+   @param items filled with the tracked keys, highest count first
+   @param n the number of elements of \p items
+
+   The keys passed back stay valid until \p tk is next modified.
+
+   Returns the number of items filled in.
+ */
+size_t topk_list(struct topk *tk, struct topk_item *items, size_t n);
+
+/**
+   @param dst the tracker to merge into
+   @param src the tracker to merge
+
+   Merges the counts of \p src into \p dst, keeping the k highest. A key missing
+   from a full tracker is counted with that tracker's lowest count, as the most
+   it can have occurred, and its error bound grows accordingly.
+
+   Returns zero on success and a negative value on failure, in which case \p dst
+   is unchanged.
+ */
+int topk_merge(struct topk *dst, struct topk *src);
+
+#endif
@@ -28,6 +28,8 @@
    
    Duplicates a string, the result is allocated on the callers stack.
    The memory is automatically released when the caller returns.
+   The size of the allocation is unbounded, see scoped_strdup() in scoped.h
+   for untrusted input.
  */
 #define strdupa(str) ({						\
 			char *tmp = alloca(strlen(str)+1);	\
@@ -22,15 +22,46 @@
 #include <stddef.h>
 #include <stdint.h>
 #include "list.h"
+#include "arena.h"
 
 typedef intptr_t tdata_t;
 typedef unsigned (*table_hash_func)(const char *key);
+typedef uint64_t (*table_hash64_func)(const char *key);
+typedef void (*table_upsert_func)(tdata_t *data, int created, void *arg);
+typedef int (*table_iter_func)(const char *key, tdata_t data, void *arg);
+typedef void (*table_combine_func)(tdata_t *data, tdata_t other, void *arg);
+struct wal;
+struct table_entry;
+
+/* counted with the "stats" option */
+struct table_stats {
+	uint64_t searches;	/* lookups of a key, including those made to update it */
+	uint64_t probes;	/* entries compared against the key looked up */
+	uint64_t hot_hits;	/* lookups answered by the hot cache */
+};
+
 struct table {
 	size_t e_max;
-	size_t e_size;
+	size_t e_size;		/* entries the buckets hold before the table grows */
 	size_t n_entries;
+	unsigned b_bits;	/* log2 of the number of buckets */
+	double load_factor;
+	double growth;
 	table_hash_func hash;
+	table_hash64_func hash64;
+	unsigned flags;
+	unsigned rehash_threads;
+	unsigned max_chain;
+	size_t reseed_at;
+	uint64_t seed[2];
 	struct list_head **buckets;		
+	struct arena arena[2];		/* compacted entries, see table_compact() */
+	unsigned compact_next;		/* index of the arena the current pass fills */
+	size_t compact_pos;		/* next bucket of the current pass */
+	struct wal *wal;		/* log of updates, see tools/wal.h */
+	struct table_entry **hot;	/* direct-mapped cache of recently found entries */
+	size_t hot_mask;
+	struct table_stats stats;
 };
 
 /**
@@ -44,6 +75,38 @@ struct table {
    max_size: expects a size_t argument marking the maximum number of entries in \p table
    size: expects a size_t argument marking the initial capacity of \p table
    with_hash: expects an argument of type unsigned (*)(const char *) which shall produce a reproducable value.
+   with_hash64: expects an argument of type uint64_t (*)(const char *) which shall produce a reproducable value.
+   no_hugepages: large bucket arrays are allocated from the heap instead of transparent huge pages.
+   rehash_threads: expects an unsigned argument, the number of threads that rehash a large table when it grows.
+                   At most 256 are used.
+   seed: expects a uint64_t argument, seeds the built-in hash so that placement is reproducible.
+         By default every table draws a random seed.
+   siphash: the built-in hash is SipHash-1-3 rather than seeded FNV-1a; slower, but keys cannot be
+            chosen to collide without knowing the seed.
+   max_chain: expects an unsigned argument, when an insert makes a chain longer than this the table
+              picks a new seed, switches to SipHash-1-3 and rehashes. Ignored with with_hash or with_hash64.
+   load_factor: expects a double argument, the average number of entries per bucket the table grows at.
+                Defaults to 0.75.
+   growth: expects a double argument greater than 1, the factor by which the capacity grows. Defaults to 2.
+           The number of buckets is always a power of two, so the actual growth may be larger.
+   with_wal: expects a struct wal * argument, every successful table_update(), table_update_only() and
+             table_upsert() is appended to that log before it takes effect; an update that cannot be
+             logged fails and leaves \p table as it was. Changes made through table_slot() are not
+             logged. When the log has a checkpoint_size, the update that outgrows it writes and
+             syncs a snapshot of the whole table before returning, a pause that grows with the
+             number of entries.
+   move_to_front: an entry found by a lookup is moved to the front of its bucket, so that frequently
+                  used keys are found after fewer comparisons when access is skewed.
+   transpose: an entry found by a lookup swaps places with the one before it in its bucket. Adapts
+              more slowly than move_to_front, but a single lookup of a cold key cannot displace a hot one.
+   hot_cache: expects a size_t argument, the number of slots, rounded up to a power of two, of a
+              direct-mapped cache of recently found entries that is checked before the bucket.
+   stats: counts searches and probes in table->stats.
+
+   With move_to_front, transpose or hot_cache, table_search() modifies \p table, so concurrent
+   lookups need the same exclusion as updates.
+
+   The seed, siphash and max_chain options only apply to the built-in hash.
    
    Rerturns zero on success, and a negative number on failure.
  */
@@ -66,6 +129,19 @@ void table_dest(struct table *table);
    max_size: expects a size_t argument marking the maximum number of entries in \p table
    size: expects a size_t argument marking the initial capacity of \p table
    with_hash: expects an argument of type unsigned (*)(const char *) which shall produce a reproducable value
+   with_hash64: expects an argument of type uint64_t (*)(const char *) which shall produce a reproducable value
+   no_hugepages: large bucket arrays are allocated from the heap instead of transparent huge pages
+   rehash_threads: expects an unsigned argument, the number of threads, at most 256, that rehash a large table
+   seed: expects a uint64_t argument, seeds the built-in hash so that placement is reproducible
+   siphash: the built-in hash is SipHash-1-3 rather than seeded FNV-1a
+   max_chain: expects an unsigned argument, the chain length past which the table reseeds and rehashes
+   load_factor: expects a double argument, the average number of entries per bucket the table grows at
+   growth: expects a double argument greater than 1, the factor by which the capacity grows
+   with_wal: expects a struct wal * argument, the log updates to \p table are appended to
+   move_to_front: an entry found by a lookup is moved to the front of its bucket
+   transpose: an entry found by a lookup swaps places with the one before it in its bucket
+   hot_cache: expects a size_t argument, the number of slots of a cache of recently found entries
+   stats: counts searches and probes in table->stats
  */
 struct table *table_alloc(const char *options, ...);
 
@@ -85,7 +161,7 @@ void table_free(struct table *table);
    @param data the value to set for \p key
 
    Updates data value for \p key in \p table, if \p key is not in \p table then a new entry is created
-   from \p key with the value of \p data.
+   from \p key with the value of \p data. Fails if that would take \p table past its max_size.
    
    Returns zero on success and a negative value on failure.
  */
@@ -112,5 +188,154 @@ int table_update_only(struct table *table, const char *key, tdata_t data);
  */
 int table_search(struct table *table, const char *key, tdata_t *data);
 
+/**
+   @param table the table to grow
+   @param n the number of entries to make room for
+
+   Grows \p table so that it holds \p n entries without rehashing, for when the number of
+   keys is known up front. Never shrinks \p table.
+
+   Returns zero on success, -EINVAL if \p n exceeds the table's max_size and -ENOMEM on
+   allocation failure.
+ */
+int table_reserve(struct table *table, size_t n);
+
+/**
+   @param table the table to update
+   @param key the key whose value slot is wanted
+   @param created set to 1 if \p key was inserted by this call and 0 if it was present, may be NULL
+
+   Looks up \p key in \p table, inserting it with a zero value if it is missing, and returns
+   a pointer to its value, through which the value may be read and written. This costs one
+   hash and one chain walk, where table_search() followed by table_update() costs two or three.
+
+   Example, counting words:
+
+   tdata_t *count = table_slot(&counts, word, NULL);
+   if (count)
+       (*count)++;
+
+   The pointer stays valid until the next call to table_compact(), table_compact_step() or
+   table_dest().
+
+   Changes made through the pointer bypass the table, so a log given with with_wal does not
+   see them.
+
+   Returns NULL on failure.
+ */
+tdata_t *table_slot(struct table *table, const char *key, int *created);
+
+/**
+   @param table the table to update
+   @param key the key whose value to update
+   @param fn called with a pointer to the value of \p key, whether \p key was just inserted, and \p arg
+   @param arg passed to \p fn
+
+   Looks up \p key in \p table, inserting it with a zero value if it is missing, and lets \p fn
+   update the value, with a single hash and chain walk. \p fn must not modify \p table.
+
+   Returns zero on success and a negative value on failure. \p fn is not called if \p key could
+   not be inserted; if the new value could not be logged, \p table is left as it was.
+ */
+int table_upsert(struct table *table, const char *key, table_upsert_func fn, void *arg);
+
+/**
+   @param table the table to compact
+
+   Copies every entry of \p table, together with its key, into contiguous
+   memory in bucket order, so that walking a chain reads adjacent memory
+   instead of a node scattered somewhere in the heap. Worth running after
+   heavy churn has fragmented a long-lived table.
+
+   Returns zero on success and a negative value on failure, in which case
+   \p table is intact but only partly compacted.
+ */
+int table_compact(struct table *table);
+
+/**
+   @param table the table to compact
+   @param n_buckets the number of buckets to process
+
+   Incremental form of table_compact(): compacts the next \p n_buckets
+   buckets of the pass in progress, starting a new pass if none is. Spreading
+   a pass over many calls bounds the pause each call causes. Growing the
+   table restarts the pass.
+
+   Returns 1 once the pass is complete, zero if buckets remain and a negative
+   value on failure.
+ */
+int table_compact_step(struct table *table, size_t n_buckets);
+
+/**
+   @param table the table to walk
+   @param fn called with every key in \p table, its value and \p arg
+   @param arg passed to \p fn
+
+   Calls \p fn on every entry of \p table in bucket order, stopping early if \p fn returns
+   non-zero. \p fn must not modify \p table.
+
+   Returns zero, or the non-zero value \p fn stopped at.
+ */
+int table_for_each(struct table *table, table_iter_func fn, void *arg);
+
+/**
+   @param table a table
+   @param key a key
+
+   Returns the hash \p table computes for \p key, the same for every table
+   of equal seed and hash options, for uses such as choosing the node of
+   \p key with tools/placement.h before looking it up there.
+ */
+uint64_t table_hash(struct table *table, const char *key);
+
+/**
+   @param dst the table to merge into
+   @param src the table to merge, left empty
+   @param combine called with a pointer to the value in \p dst, the value in \p src and \p arg
+                  for every key in both; if NULL the value in \p src wins
+   @param arg passed to \p combine
+
+   Moves every entry of \p src into \p dst. Entries are relinked rather than
+   copied, and when both tables hash alike (the same with_hash, with_hash64, or
+   seed and siphash options) their cached hashes are reused, so a key is not
+   hashed again. Meant for combining per-thread tables after a parallel
+   aggregation, e.g. summing counts:
+
+   static void add(tdata_t *data, tdata_t other, void *arg)
+   {
+       *data += other;
+   }
+
+   table_merge(&total, &counts[i], add, NULL);
+
+   \p src must not have a log; merged values are logged to that of \p dst.
+
+   Returns zero on success and a negative value on failure, in which case the
+   entries not yet moved are still in \p src.
+ */
+int table_merge(struct table *dst, struct table *src, table_combine_func combine, void *arg);
+
+/**
+   @param dst the table to merge into
+   @param srcs the tables to merge, left empty
+   @param n_srcs the number of elements of \p srcs
+   @param combine as for table_merge(), may be called from several threads at once
+   @param arg passed to \p combine
+   @param n_threads the number of threads to merge on, at most 256 are used
+
+   table_merge() of every table in \p srcs, on \p n_threads threads. The buckets of
+   \p dst are split into one partition per thread, and each thread merges the entries
+   of all sources that hash into its partition, so the merge scales with the threads
+   rather than ending in a serial step. Needs every source to hash like \p dst and
+   \p dst to have room for all entries; otherwise the tables are merged one after
+   the other on the calling thread.
+
+   Returns zero on success and a negative value on failure. Entries that could not be
+   allocated in \p dst are then dropped on the parallel path, and left in their source
+   on the serial one.
+ */
+int table_merge_parallel(struct table *dst, struct table **srcs, unsigned n_srcs,
+			 table_combine_func combine, void *arg, unsigned n_threads);
+
 
 #endif
@@ -0,0 +1,147 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#ifndef _TOOLS_TIMERWHEEL_H_
+#define _TOOLS_TIMERWHEEL_H_
+#include <stddef.h>
+#include <stdint.h>
+#include "list.h"
+
+/**
+   Hierarchical timing wheel.
+
+   Timers are embedded in the caller's objects and hashed by expiry into one
+   of TW_LEVELS wheels of TW_LVL_SIZE slots, each level covering TW_LVL_SIZE
+   times the span of the one below it. Adding, cancelling and re-arming a
+   timer is O(1). As the wheel advances, the slots of a higher level are
+   cascaded down a whole list at a time, and per-level occupancy bitmaps let
+   timerwheel_advance() skip straight over ticks with nothing to do, so its
+   cost follows the number of expired and cascaded timers rather than the
+   number of pending ones or the length of the interval.
+
+   Time is an abstract tick count chosen by the caller, e.g. milliseconds.
+
+   Example:
+
+   struct conn { struct timer idle; ... };
+
+   timer_init(&c->idle);
+   timerwheel_add(&tw, &c->idle, now + 30000);
+   ...
+   LIST_HEAD(expired);
+   timerwheel_advance(&tw, now, &expired);
+   list_for_each_entry_safe(t, tmp, &expired, entry) {
+       list_del_init(&t->entry);
+       conn_timeout(container_of(t, struct conn, idle));
+   }
+ */
+#define TW_LVL_BITS 6
+#define TW_LVL_SIZE (1 << TW_LVL_BITS)
+#define TW_LEVELS 8
+
+/* timer->slot of a timer that is not in a wheel */
+#define TIMER_IDLE 0xffff
+
+struct timer {
+	struct list_head entry;
+	uint64_t expires;
+	uint16_t slot;
+};
+
+struct timerwheel {
+	uint64_t clk;			/* next tick to be processed */
+	size_t n_pending;
+	uint64_t occupied[TW_LEVELS];	/* bit i set iff slots[level][i] is not empty */
+	struct list_head slots[TW_LEVELS][TW_LVL_SIZE];
+};
+
+/**
+   @param timer a timer to initialize
+
+   Initializes \p timer as not pending.
+ */
+static inline void timer_init(struct timer *timer)
+{
+	INIT_LIST_HEAD(&timer->entry);
+	timer->slot = TIMER_IDLE;
+}
+
+/**
+   @param timer a timer
+
+   Returns non-zero if \p timer is in a wheel waiting to expire.
+ */
+static inline int timer_pending(const struct timer *timer)
+{
+	return timer->slot != TIMER_IDLE;
+}
+
+/**
+   @param tw a wheel to initialize
+   @param now the current tick
+
+   Initializes an empty wheel whose clock starts at \p now.
+ */
+void timerwheel_init(struct timerwheel *tw, uint64_t now);
+
+/**
+   @param tw the wheel to add to
+   @param timer an initialized timer
+   @param expires the tick at which \p timer expires
+
+   Arms \p timer to expire at \p expires. If \p timer is already pending it is
+   re-armed with the new expiry. A timer whose expiry the wheel has already
+   advanced past expires on the next call to timerwheel_advance() that moves
+   the clock forward.
+ */
+void timerwheel_add(struct timerwheel *tw, struct timer *timer, uint64_t expires);
+
+/**
+   @param tw the wheel \p timer was added to
+   @param timer the timer to cancel
+
+   Removes \p timer from \p tw.
+
+   Returns zero on success and a negative value if \p timer was not pending.
+ */
+int timerwheel_cancel(struct timerwheel *tw, struct timer *timer);
+
+/**
+   @param tw the wheel to advance
+   @param now the current tick
+   @param expired a list to which expired timers are moved
+
+   Advances the clock of \p tw to \p now and moves every timer expiring at or
+   before \p now to the tail of \p expired, in order of expiry tick. The moved
+   timers are no longer pending and may be re-armed by the caller.
+
+   Returns the number of expired timers.
+ */
+size_t timerwheel_advance(struct timerwheel *tw, uint64_t now, struct list_head *expired);
+
+/**
+   @param tw the wheel to query
+
+   Returns the next tick at which timerwheel_advance() would expire or cascade
+   timers, which is never later than the earliest pending expiry, or
+   UINT64_MAX if no timer is pending. Useful as a bound on how long to sleep.
+ */
+uint64_t timerwheel_next_event(const struct timerwheel *tw);
+
+#endif
@@ -0,0 +1,169 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#ifndef _TOOLS_WAL_H_
+#define _TOOLS_WAL_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "table.h"
+
+/**
+   Write-ahead log for struct table.
+
+   A table initialized with "with_wal" appends a small checksummed record to
+   its log for every update. Appending only copies the record into memory;
+   making records durable is a separate step, wal_commit() or wal_sync(), so
+   that callers can release their table lock first. Callers that reach it at
+   the same time are served by a single write() and fdatasync(): the first to
+   arrive writes out everything appended so far while the others wait for it,
+   and whoever arrives during that write leads the next batch.
+
+   A checkpoint replaces the log with one record per live entry, which bounds
+   both the size of the log and the time wal_replay() takes at startup.
+
+   Example:
+
+   struct wal wal;
+   struct table t;
+
+   wal_open(&wal, "/var/lib/svc/meta.wal", "checkpoint_size", (size_t)(64 << 20));
+   table_init(&t, "with_wal", &wal);
+   wal_replay(&wal, &t);
+   ...
+   pthread_mutex_lock(&t_lock);
+   table_update(&t, key, value);
+   lsn = wal_lsn(&wal);
+   pthread_mutex_unlock(&t_lock);
+   wal_sync(&wal, lsn);
+ */
+enum wal_op {
+	WAL_OP_UPDATE = 1,
+	WAL_OP_REMOVE,
+};
+
+struct wal {
+	int fd;
+	char *path;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char *buf;		/* records appended since the last batch was taken */
+	size_t len;
+	size_t cap;
+	char *flush;		/* the batch being written by the leader */
+	size_t flush_cap;
+	uint64_t appended;	/* log sequence number of the last record appended */
+	uint64_t durable;	/* ... and of the last record known to be on disk */
+	int syncing;		/* a leader is writing a batch or a checkpoint is running */
+	int error;
+	size_t log_size;	/* bytes in the file */
+	size_t checkpoint_size;
+};
+
+/**
+   @param wal the log to open
+   @param path the log file, created if it does not exist
+   @param options an option string, expects respective arguments
+
+   Opens the log at \p path. A record torn by a crash at the end of the file
+   is cut off. Parameters specified in \p options are:
+
+   checkpoint_size: expects a size_t argument, a table logging to \p wal checkpoints
+                    itself in table_update() once the log grows beyond this many bytes.
+                    That one update then waits for the whole table to be written and
+                    synced, O(n) in its entries; leave it unset and call wal_checkpoint()
+                    from a quiet moment instead where that pause matters
+
+   Returns zero on success, and a negative errno value on failure.
+ */
+int wal_open(struct wal *wal, const char *path, const char *options, ...);
+
+/**
+   @param wal the log to close
+
+   Writes out pending records and closes \p wal.
+ */
+void wal_close(struct wal *wal);
+
+/**
+   @param wal the log to append to
+   @param op the operation to record
+   @param key the key the operation applies to
+   @param data the new value, for WAL_OP_UPDATE
+   @param lsn the log sequence number of the record shall be passed back with this pointer, may be NULL
+
+   Appends a record to \p wal in memory. Tables with a log call this themselves.
+
+   Returns zero on success and a negative value on failure.
+ */
+int wal_append(struct wal *wal, enum wal_op op, const char *key, tdata_t data, uint64_t *lsn);
+
+/**
+   @param wal a log
+
+   Returns the log sequence number of the last record appended to \p wal.
+ */
+uint64_t wal_lsn(struct wal *wal);
+
+/**
+   @param wal the log to sync
+   @param lsn a log sequence number
+
+   Returns once the record numbered \p lsn and every record before it are on
+   disk, writing them out as part of a batch if needed.
+
+   Returns zero on success and a negative errno value if the log could not be
+   written, in which case every later call fails too.
+ */
+int wal_sync(struct wal *wal, uint64_t lsn);
+
+/**
+   @param wal the log to sync
+
+   wal_sync() up to the last record appended to \p wal so far.
+ */
+int wal_commit(struct wal *wal);
+
+/* whether the log has outgrown checkpoint_size, for table_update() */
+int __wal_checkpoint_due(struct wal *wal);
+
+/**
+   @param wal the log of \p table
+   @param table the table to checkpoint
+
+   Replaces the log with a snapshot of \p table, written to a new file which
+   is synced and renamed over the old one. \p table must not be modified
+   during the checkpoint.
+
+   Returns zero on success and a negative errno value on failure, in which
+   case the old log is kept.
+ */
+int wal_checkpoint(struct wal *wal, struct table *table);
+
+/**
+   @param wal the log to replay
+   @param table the table to replay into
+
+   Applies every record of \p wal to \p table without logging them again.
+
+   Returns the number of records applied or a negative value on failure.
+ */
+long wal_replay(struct wal *wal, struct table *table);
+
+#endif
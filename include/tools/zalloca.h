@@ -26,7 +26,8 @@
    @return pointer to allocated memory, returns NULL on failure
    
    Allocates zeroed memory on the callers stack. Automatically freed
-   when the caller returns.
+   when the caller returns. The size of the allocation is unbounded, see
+   scoped_zalloc() in scoped.h for untrusted input.
  */
 #define zalloca(len)	({			\
 	void *__tmpzalloca = alloca(len);	\
@@ -0,0 +1,155 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <internal/printing.h>
+#include <tools/arena.h>
+#include <tools/scoped.h>
+
+#define CHUNK_SIZE_DEFAULT (1<<16)
+
+static void parse_opt(struct arena *arena, char *option, va_list ap)
+{
+	if (strcmp(option, "chunk_size")==0)
+		arena->chunk_size = va_arg(ap, size_t);
+}
+
+static int parse_opts(struct arena *arena, const char *options, va_list ap)
+{
+	char *opts __scoped = scoped_strdup(options);
+	char *tmp = opts, *opt, *delim = " ";
+
+	if (!options)
+		return 0;
+	if (!opts)
+		return -ENOMEM;
+
+	for (opt = strtok_r(tmp, delim, &tmp); opt; opt = strtok_r(tmp, delim, &tmp)) {
+		parse_opt(arena, opt, ap);
+	}
+	return 0;
+}
+
+int arena_init(struct arena *arena, const char *options, ...)
+{
+	va_list ap;
+	int ret;
+
+	memset(arena, 0, sizeof(*arena));
+	va_start(ap, options);
+	ret = parse_opts(arena, options, ap);
+	va_end(ap);
+	if (ret)
+		return ret;
+
+	if (!arena->chunk_size)
+		arena->chunk_size = CHUNK_SIZE_DEFAULT;
+	if (arena->chunk_size < sizeof(struct arena_chunk))
+		return -EINVAL;
+	return 0;
+}
+
+static void arena_free_chain(struct arena_chunk *chunk)
+{
+	struct arena_chunk *next;
+
+	for (; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+}
+
+void arena_dest(struct arena *arena)
+{
+	arena_free_chain(arena->chunk);
+	arena_free_chain(arena->spare);
+	arena->chunk = arena->tail = arena->spare = NULL;
+	arena->cur = arena->end = NULL;
+}
+
+void *__arena_alloc_slow(struct arena *arena, size_t size, size_t align)
+{
+	struct arena_chunk *chunk = arena->spare;
+	size_t need = size + align - 1, avail;
+
+	if (need < size)
+		return NULL;
+
+	/*
+	 * Reuse the first spare chunk if it fits. An oversized request gets a
+	 * chunk of its own and leaves the spare for the allocations after it.
+	 */
+	if (chunk && (size_t)(chunk->end - chunk->data) >= need)
+		arena->spare = chunk->next;
+	else
+		chunk = NULL;
+
+	if (!chunk) {
+		avail = arena->chunk_size - sizeof(*chunk);
+		if (avail < need)
+			avail = need;
+		pr_dbg("%s: new chunk of %zu bytes\n", __func__, avail);
+		chunk = malloc(sizeof(*chunk) + avail);
+		if (!chunk)
+			return NULL;
+		chunk->end = chunk->data + avail;
+	}
+
+	chunk->next = arena->chunk;
+	if (!arena->chunk)
+		arena->tail = chunk;
+	arena->chunk = chunk;
+	arena->cur = chunk->data;
+	arena->end = chunk->end;
+	return arena_memalign(arena, align, size);
+}
+
+void arena_rewind(struct arena *arena, struct arena_mark mark)
+{
+	struct arena_chunk *chunk;
+
+	while (arena->chunk != mark.chunk) {
+		chunk = arena->chunk;
+		arena->chunk = chunk->next;
+		chunk->next = arena->spare;
+		arena->spare = chunk;
+	}
+
+	if (!arena->chunk) {
+		arena->tail = NULL;
+		arena->cur = arena->end = NULL;
+	} else {
+		arena->cur = mark.cur;
+		arena->end = arena->chunk->end;
+	}
+}
+
+void arena_reset(struct arena *arena)
+{
+	if (!arena->chunk)
+		return;
+
+	arena->tail->next = arena->spare;
+	arena->spare = arena->chunk;
+	arena->chunk = arena->tail = NULL;
+	arena->cur = arena->end = NULL;
+}
@@ -0,0 +1,822 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <internal/printing.h>
+#include <tools/art.h>
+#include <tools/zalloc.h>
+
+enum art_type {
+	ART_NODE4 = 1,
+	ART_NODE16,
+	ART_NODE48,
+	ART_NODE256,
+};
+
+struct art_node4 {
+	struct art_node n;
+	unsigned char keys[4];
+	struct art_node *children[4];
+};
+
+struct art_node16 {
+	struct art_node n;
+	unsigned char keys[16];
+	struct art_node *children[16];
+};
+
+/* index maps a key byte to its slot in children, plus one; zero means absent */
+struct art_node48 {
+	struct art_node n;
+	unsigned char index[256];
+	struct art_node *children[48];
+};
+
+struct art_node256 {
+	struct art_node n;
+	struct art_node *children[256];
+};
+
+/* keys are stored with their terminating NUL, so no key is a prefix of another */
+struct art_leaf {
+	tdata_t data;
+	uint32_t len;
+	char key[];
+};
+
+/* leaves are told apart from inner nodes by the low bit of the child pointer */
+#define is_leaf(x)  ((uintptr_t)(x) & 1)
+#define to_leaf(x)  ((struct art_leaf *)((uintptr_t)(x) & ~(uintptr_t)1))
+#define tag_leaf(x) ((struct art_node *)((uintptr_t)(x) | 1))
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+static struct art_node *art_node_new(enum art_type type)
+{
+	static const size_t sizes[] = {
+		[ART_NODE4] = sizeof(struct art_node4),
+		[ART_NODE16] = sizeof(struct art_node16),
+		[ART_NODE48] = sizeof(struct art_node48),
+		[ART_NODE256] = sizeof(struct art_node256),
+	};
+	struct art_node *n = zalloc(sizes[type]);
+
+	if (n)
+		n->type = type;
+	return n;
+}
+
+static void art_copy_header(struct art_node *dst, const struct art_node *src)
+{
+	dst->n_children = src->n_children;
+	dst->prefix_len = src->prefix_len;
+	memcpy(dst->prefix, src->prefix, min(src->prefix_len, ART_MAX_PREFIX));
+}
+
+static struct art_node *art_leaf_new(const char *key, uint32_t len, tdata_t data)
+{
+	struct art_leaf *l = malloc(sizeof(*l) + len);
+
+	if (!l)
+		return NULL;
+	l->data = data;
+	l->len = len;
+	memcpy(l->key, key, len);
+	return tag_leaf(l);
+}
+
+static int art_leaf_matches(const struct art_leaf *l, const char *key, uint32_t len)
+{
+	return l->len == len && memcmp(l->key, key, len)==0;
+}
+
+static void art_free_node(struct art_node *n)
+{
+	union {
+		struct art_node4 *p4;
+		struct art_node16 *p16;
+		struct art_node48 *p48;
+		struct art_node256 *p256;
+	} p;
+	int i;
+
+	if (!n)
+		return;
+	if (is_leaf(n)) {
+		free(to_leaf(n));
+		return;
+	}
+
+	switch (n->type) {
+	case ART_NODE4:
+		p.p4 = (struct art_node4 *)n;
+		for (i = 0; i < n->n_children; i++)
+			art_free_node(p.p4->children[i]);
+		break;
+	case ART_NODE16:
+		p.p16 = (struct art_node16 *)n;
+		for (i = 0; i < n->n_children; i++)
+			art_free_node(p.p16->children[i]);
+		break;
+	case ART_NODE48:
+		p.p48 = (struct art_node48 *)n;
+		for (i = 0; i < 48; i++)
+			art_free_node(p.p48->children[i]);
+		break;
+	case ART_NODE256:
+		p.p256 = (struct art_node256 *)n;
+		for (i = 0; i < 256; i++)
+			art_free_node(p.p256->children[i]);
+		break;
+	}
+	free(n);
+}
+
+void art_init(struct art *art)
+{
+	art->root = NULL;
+	art->n_entries = 0;
+}
+
+void art_dest(struct art *art)
+{
+	art_free_node(art->root);
+	art_init(art);
+}
+
+static struct art_node **art_find_child(struct art_node *n, unsigned char c)
+{
+	struct art_node4 *p4;
+	struct art_node16 *p16;
+	struct art_node48 *p48;
+	int i;
+
+	switch (n->type) {
+	case ART_NODE4:
+		p4 = (struct art_node4 *)n;
+		for (i = 0; i < n->n_children; i++)
+			if (p4->keys[i] == c)
+				return &p4->children[i];
+		break;
+	case ART_NODE16: {
+		p16 = (struct art_node16 *)n;
+#ifdef __SSE2__
+		__m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8(c),
+					     _mm_loadu_si128((const __m128i *)p16->keys));
+		unsigned mask = _mm_movemask_epi8(cmp) & ((1u << n->n_children) - 1);
+
+		if (mask)
+			return &p16->children[__builtin_ctz(mask)];
+#else
+		for (i = 0; i < n->n_children; i++)
+			if (p16->keys[i] == c)
+				return &p16->children[i];
+#endif
+		break;
+	}
+	case ART_NODE48:
+		p48 = (struct art_node48 *)n;
+		if (p48->index[c])
+			return &p48->children[p48->index[c] - 1];
+		break;
+	case ART_NODE256:
+		if (((struct art_node256 *)n)->children[c])
+			return &((struct art_node256 *)n)->children[c];
+		break;
+	}
+	return NULL;
+}
+
+/* leftmost leaf under n */
+static struct art_leaf *art_minimum(struct art_node *n)
+{
+	int i;
+
+	while (n && !is_leaf(n)) {
+		switch (n->type) {
+		case ART_NODE4:
+			n = ((struct art_node4 *)n)->children[0];
+			break;
+		case ART_NODE16:
+			n = ((struct art_node16 *)n)->children[0];
+			break;
+		case ART_NODE48:
+			for (i = 0; !((struct art_node48 *)n)->index[i]; i++)
+				;
+			n = ((struct art_node48 *)n)->children[((struct art_node48 *)n)->index[i] - 1];
+			break;
+		case ART_NODE256:
+			for (i = 0; !((struct art_node256 *)n)->children[i]; i++)
+				;
+			n = ((struct art_node256 *)n)->children[i];
+			break;
+		}
+	}
+	return n ? to_leaf(n) : NULL;
+}
+
+/*
+ * Returns the number of bytes of the compressed path of n that match key at
+ * depth. Only the first ART_MAX_PREFIX bytes are stored in the node, the rest
+ * are read from a leaf below it.
+ */
+static uint32_t art_prefix_mismatch(struct art_node *n, const char *key, uint32_t len, uint32_t depth)
+{
+	uint32_t max_cmp = min(min(n->prefix_len, ART_MAX_PREFIX), len - depth);
+	struct art_leaf *l;
+	uint32_t i;
+
+	for (i = 0; i < max_cmp; i++)
+		if (n->prefix[i] != (unsigned char)key[depth + i])
+			return i;
+
+	if (n->prefix_len > ART_MAX_PREFIX) {
+		l = art_minimum(n);
+		max_cmp = min(min(l->len, len) - depth, n->prefix_len);
+		for (; i < max_cmp; i++)
+			if (l->key[depth + i] != key[depth + i])
+				return i;
+	}
+	return i;
+}
+
+static int art_add_child(struct art_node *n, struct art_node **ref, unsigned char c, struct art_node *child);
+
+static int art_add_child256(struct art_node256 *n, unsigned char c, struct art_node *child)
+{
+	n->children[c] = child;
+	n->n.n_children++;
+	return 0;
+}
+
+static int art_add_child48(struct art_node48 *n, struct art_node **ref, unsigned char c, struct art_node *child)
+{
+	struct art_node256 *grown;
+	int i;
+
+	if (n->n.n_children < 48) {
+		for (i = 0; n->children[i]; i++)
+			;
+		n->children[i] = child;
+		n->index[c] = i + 1;
+		n->n.n_children++;
+		return 0;
+	}
+
+	grown = (struct art_node256 *)art_node_new(ART_NODE256);
+	if (!grown)
+		return -ENOMEM;
+	art_copy_header(&grown->n, &n->n);
+	for (i = 0; i < 256; i++)
+		if (n->index[i])
+			grown->children[i] = n->children[n->index[i] - 1];
+	*ref = &grown->n;
+	free(n);
+	return art_add_child256(grown, c, child);
+}
+
+static int art_add_child16(struct art_node16 *n, struct art_node **ref, unsigned char c, struct art_node *child)
+{
+	struct art_node48 *grown;
+	int i;
+
+	if (n->n.n_children < 16) {
+		for (i = 0; i < n->n.n_children && n->keys[i] < c; i++)
+			;
+		memmove(&n->keys[i + 1], &n->keys[i], n->n.n_children - i);
+		memmove(&n->children[i + 1], &n->children[i], (n->n.n_children - i)*sizeof(child));
+		n->keys[i] = c;
+		n->children[i] = child;
+		n->n.n_children++;
+		return 0;
+	}
+
+	grown = (struct art_node48 *)art_node_new(ART_NODE48);
+	if (!grown)
+		return -ENOMEM;
+	art_copy_header(&grown->n, &n->n);
+	for (i = 0; i < 16; i++) {
+		grown->children[i] = n->children[i];
+		grown->index[n->keys[i]] = i + 1;
+	}
+	*ref = &grown->n;
+	free(n);
+	return art_add_child48(grown, ref, c, child);
+}
+
+static int art_add_child4(struct art_node4 *n, struct art_node **ref, unsigned char c, struct art_node *child)
+{
+	struct art_node16 *grown;
+	int i;
+
+	if (n->n.n_children < 4) {
+		for (i = 0; i < n->n.n_children && n->keys[i] < c; i++)
+			;
+		memmove(&n->keys[i + 1], &n->keys[i], n->n.n_children - i);
+		memmove(&n->children[i + 1], &n->children[i], (n->n.n_children - i)*sizeof(child));
+		n->keys[i] = c;
+		n->children[i] = child;
+		n->n.n_children++;
+		return 0;
+	}
+
+	grown = (struct art_node16 *)art_node_new(ART_NODE16);
+	if (!grown)
+		return -ENOMEM;
+	art_copy_header(&grown->n, &n->n);
+	memcpy(grown->keys, n->keys, 4);
+	memcpy(grown->children, n->children, 4*sizeof(child));
+	*ref = &grown->n;
+	free(n);
+	return art_add_child16(grown, ref, c, child);
+}
+
+static int art_add_child(struct art_node *n, struct art_node **ref, unsigned char c, struct art_node *child)
+{
+	switch (n->type) {
+	case ART_NODE4:
+		return art_add_child4((struct art_node4 *)n, ref, c, child);
+	case ART_NODE16:
+		return art_add_child16((struct art_node16 *)n, ref, c, child);
+	case ART_NODE48:
+		return art_add_child48((struct art_node48 *)n, ref, c, child);
+	default:
+		return art_add_child256((struct art_node256 *)n, c, child);
+	}
+}
+
+/* returns 1 if a new entry was created, 0 if an existing one was updated */
+static int art_insert(struct art_node **ref, const char *key, uint32_t len, tdata_t data, uint32_t depth)
+{
+	struct art_node *n = *ref, *leaf, **child;
+	struct art_node4 *split;
+	struct art_leaf *l;
+	uint32_t i, diff;
+	int ret;
+
+	if (!n) {
+		*ref = art_leaf_new(key, len, data);
+		return *ref ? 1 : -ENOMEM;
+	}
+
+	if (is_leaf(n)) {
+		l = to_leaf(n);
+		if (art_leaf_matches(l, key, len)) {
+			l->data = data;
+			return 0;
+		}
+
+		/* two leaves: split on the first byte where they differ */
+		split = (struct art_node4 *)art_node_new(ART_NODE4);
+		leaf = art_leaf_new(key, len, data);
+		if (!split || !leaf) {
+			free(split);
+			free(leaf ? to_leaf(leaf) : NULL);
+			return -ENOMEM;
+		}
+		for (i = depth; l->key[i] == key[i]; i++)
+			;
+		split->n.prefix_len = i - depth;
+		memcpy(split->n.prefix, key + depth, min(i - depth, ART_MAX_PREFIX));
+		art_add_child4(split, NULL, l->key[i], n);
+		art_add_child4(split, NULL, key[i], leaf);
+		*ref = &split->n;
+		return 1;
+	}
+
+	if (n->prefix_len) {
+		diff = art_prefix_mismatch(n, key, len, depth);
+		if (diff < n->prefix_len) {
+			/* the key leaves the compressed path: split it at diff */
+			split = (struct art_node4 *)art_node_new(ART_NODE4);
+			leaf = art_leaf_new(key, len, data);
+			if (!split || !leaf) {
+				free(split);
+				free(leaf ? to_leaf(leaf) : NULL);
+				return -ENOMEM;
+			}
+			split->n.prefix_len = diff;
+			memcpy(split->n.prefix, n->prefix, min(diff, ART_MAX_PREFIX));
+
+			if (n->prefix_len <= ART_MAX_PREFIX) {
+				art_add_child4(split, NULL, n->prefix[diff], n);
+				n->prefix_len -= diff + 1;
+				memmove(n->prefix, n->prefix + diff + 1, min(n->prefix_len, ART_MAX_PREFIX));
+			} else {
+				l = art_minimum(n);
+				art_add_child4(split, NULL, l->key[depth + diff], n);
+				n->prefix_len -= diff + 1;
+				memcpy(n->prefix, l->key + depth + diff + 1, min(n->prefix_len, ART_MAX_PREFIX));
+			}
+			art_add_child4(split, NULL, key[depth + diff], leaf);
+			*ref = &split->n;
+			return 1;
+		}
+		depth += n->prefix_len;
+	}
+
+	child = art_find_child(n, key[depth]);
+	if (child)
+		return art_insert(child, key, len, data, depth + 1);
+
+	leaf = art_leaf_new(key, len, data);
+	if (!leaf)
+		return -ENOMEM;
+	ret = art_add_child(n, ref, key[depth], leaf);
+	if (ret) {
+		free(to_leaf(leaf));
+		return ret;
+	}
+	return 1;
+}
+
+static void art_remove_child256(struct art_node256 *n, struct art_node **ref, unsigned char c)
+{
+	struct art_node48 *shrunk;
+	int i, pos = 0;
+
+	n->children[c] = NULL;
+	n->n.n_children--;
+
+	/* shrink with some hysteresis, so a node on the border does not flap */
+	if (n->n.n_children != 37)
+		return;
+	shrunk = (struct art_node48 *)art_node_new(ART_NODE48);
+	if (!shrunk)
+		return;
+	art_copy_header(&shrunk->n, &n->n);
+	for (i = 0; i < 256; i++)
+		if (n->children[i]) {
+			shrunk->children[pos] = n->children[i];
+			shrunk->index[i] = ++pos;
+		}
+	*ref = &shrunk->n;
+	free(n);
+}
+
+static void art_remove_child48(struct art_node48 *n, struct art_node **ref, unsigned char c)
+{
+	struct art_node16 *shrunk;
+	int i, pos = 0;
+
+	n->children[n->index[c] - 1] = NULL;
+	n->index[c] = 0;
+	n->n.n_children--;
+
+	if (n->n.n_children != 12)
+		return;
+	shrunk = (struct art_node16 *)art_node_new(ART_NODE16);
+	if (!shrunk)
+		return;
+	art_copy_header(&shrunk->n, &n->n);
+	for (i = 0; i < 256; i++)
+		if (n->index[i]) {
+			shrunk->keys[pos] = i;
+			shrunk->children[pos++] = n->children[n->index[i] - 1];
+		}
+	*ref = &shrunk->n;
+	free(n);
+}
+
+static void art_remove_child16(struct art_node16 *n, struct art_node **ref, struct art_node **child)
+{
+	struct art_node4 *shrunk;
+	int pos = child - n->children;
+
+	memmove(&n->keys[pos], &n->keys[pos + 1], n->n.n_children - 1 - pos);
+	memmove(&n->children[pos], &n->children[pos + 1], (n->n.n_children - 1 - pos)*sizeof(*child));
+	n->n.n_children--;
+
+	if (n->n.n_children != 3)
+		return;
+	shrunk = (struct art_node4 *)art_node_new(ART_NODE4);
+	if (!shrunk)
+		return;
+	art_copy_header(&shrunk->n, &n->n);
+	memcpy(shrunk->keys, n->keys, 3);
+	memcpy(shrunk->children, n->children, 3*sizeof(*child));
+	*ref = &shrunk->n;
+	free(n);
+}
+
+static void art_remove_child4(struct art_node4 *n, struct art_node **ref, struct art_node **child)
+{
+	struct art_node *only;
+	uint32_t prefix, sub;
+	int pos = child - n->children;
+
+	memmove(&n->keys[pos], &n->keys[pos + 1], n->n.n_children - 1 - pos);
+	memmove(&n->children[pos], &n->children[pos + 1], (n->n.n_children - 1 - pos)*sizeof(*child));
+	n->n.n_children--;
+
+	if (n->n.n_children != 1)
+		return;
+
+	/* a single child: fold this node's path and key byte into the child's prefix */
+	only = n->children[0];
+	if (!is_leaf(only)) {
+		prefix = n->n.prefix_len;
+		if (prefix < ART_MAX_PREFIX)
+			n->n.prefix[prefix++] = n->keys[0];
+		if (prefix < ART_MAX_PREFIX) {
+			sub = min(only->prefix_len, ART_MAX_PREFIX - prefix);
+			memcpy(n->n.prefix + prefix, only->prefix, sub);
+			prefix += sub;
+		}
+		memcpy(only->prefix, n->n.prefix, min(prefix, ART_MAX_PREFIX));
+		only->prefix_len += n->n.prefix_len + 1;
+	}
+	*ref = only;
+	free(n);
+}
+
+static void art_remove_child(struct art_node *n, struct art_node **ref, unsigned char c, struct art_node **child)
+{
+	switch (n->type) {
+	case ART_NODE4:
+		art_remove_child4((struct art_node4 *)n, ref, child);
+		break;
+	case ART_NODE16:
+		art_remove_child16((struct art_node16 *)n, ref, child);
+		break;
+	case ART_NODE48:
+		art_remove_child48((struct art_node48 *)n, ref, c);
+		break;
+	case ART_NODE256:
+		art_remove_child256((struct art_node256 *)n, ref, c);
+		break;
+	}
+}
+
+static struct art_leaf *art_delete(struct art_node **ref, const char *key, uint32_t len, uint32_t depth)
+{
+	struct art_node *n = *ref, **child;
+	struct art_leaf *l;
+
+	if (!n)
+		return NULL;
+
+	if (is_leaf(n)) {
+		l = to_leaf(n);
+		if (!art_leaf_matches(l, key, len))
+			return NULL;
+		*ref = NULL;
+		return l;
+	}
+
+	if (n->prefix_len) {
+		if (art_prefix_mismatch(n, key, len, depth) != n->prefix_len)
+			return NULL;
+		depth += n->prefix_len;
+	}
+	if (depth >= len)
+		return NULL;
+
+	child = art_find_child(n, key[depth]);
+	if (!child)
+		return NULL;
+
+	if (is_leaf(*child)) {
+		l = to_leaf(*child);
+		if (!art_leaf_matches(l, key, len))
+			return NULL;
+		art_remove_child(n, ref, key[depth], child);
+		return l;
+	}
+	return art_delete(child, key, len, depth + 1);
+}
+
+static struct art_leaf *art_search_leaf(struct art *art, const char *key, uint32_t len)
+{
+	struct art_node *n = art->root, **child;
+	uint32_t depth = 0;
+
+	while (n) {
+		if (is_leaf(n))
+			return art_leaf_matches(to_leaf(n), key, len) ? to_leaf(n) : NULL;
+
+		/* optimistic: bytes of the path beyond ART_MAX_PREFIX are checked at the leaf */
+		if (n->prefix_len) {
+			if (memcmp(n->prefix, key + depth, min(min(n->prefix_len, ART_MAX_PREFIX), len - depth)))
+				return NULL;
+			depth += n->prefix_len;
+		}
+		if (depth >= len)
+			return NULL;
+
+		child = art_find_child(n, key[depth]);
+		n = child ? *child : NULL;
+		depth++;
+	}
+	return NULL;
+}
+
+int art_update(struct art *art, const char *key, tdata_t data)
+{
+	int ret = art_insert(&art->root, key, strlen(key) + 1, data, 0);
+
+	if (ret < 0)
+		return ret;
+	art->n_entries += ret;
+	return 0;
+}
+
+int art_update_only(struct art *art, const char *key, tdata_t data)
+{
+	struct art_leaf *l = art_search_leaf(art, key, strlen(key) + 1);
+
+	if (!l)
+		return -1;
+
+	l->data = data;
+	return 0;
+}
+
+int art_search(struct art *art, const char *key, tdata_t *data)
+{
+	struct art_leaf *l = art_search_leaf(art, key, strlen(key) + 1);
+
+	if (!l)
+		return -1;
+
+	*data = l->data;
+	return 0;
+}
+
+int art_remove(struct art *art, const char *key)
+{
+	struct art_leaf *l = art_delete(&art->root, key, strlen(key) + 1, 0);
+
+	if (!l)
+		return -1;
+
+	free(l);
+	art->n_entries--;
+	return 0;
+}
+
+/*
+ * In-order walk of the subtree at n, which sits at depth. lo_eq and hi_eq tell
+ * whether the path to n so far equals the corresponding bytes of lo and hi;
+ * only then can a child fall outside the range, and children are pruned by
+ * comparing their key byte against the bound. Leaves are always checked
+ * against the full bounds.
+ */
+struct art_walk {
+	const char *lo;
+	const char *hi;
+	art_iter_func fn;
+	void *arg;
+};
+
+static int art_walk_child(struct art_walk *w, struct art_node *child, unsigned char c,
+			  uint32_t depth, int lo_eq, int hi_eq, int *stop);
+
+static int art_walk(struct art_walk *w, struct art_node *n, uint32_t depth, int lo_eq, int hi_eq)
+{
+	const unsigned char *path;
+	struct art_leaf *l;
+	uint32_t i;
+	int ret, c, stop = 0;
+
+	if (is_leaf(n)) {
+		l = to_leaf(n);
+		if (w->lo && strcmp(l->key, w->lo) < 0)
+			return 0;
+		if (w->hi && strcmp(l->key, w->hi) >= 0)
+			return 0;
+		return w->fn(l->key, l->data, w->arg);
+	}
+
+	if (n->prefix_len && (lo_eq || hi_eq)) {
+		path = n->prefix_len > ART_MAX_PREFIX ?
+			(const unsigned char *)art_minimum(n)->key + depth : n->prefix;
+		for (i = 0; i < n->prefix_len && (lo_eq || hi_eq); i++) {
+			if (lo_eq && path[i] != (unsigned char)w->lo[depth + i]) {
+				if (path[i] < (unsigned char)w->lo[depth + i])
+					return 0;
+				lo_eq = 0;
+			}
+			if (hi_eq && path[i] != (unsigned char)w->hi[depth + i]) {
+				if (path[i] > (unsigned char)w->hi[depth + i])
+					return 0;
+				hi_eq = 0;
+			}
+		}
+	}
+	depth += n->prefix_len;
+
+	switch (n->type) {
+	case ART_NODE4:
+		for (i = 0; i < n->n_children && !stop; i++)
+			if ((ret = art_walk_child(w, ((struct art_node4 *)n)->children[i],
+						  ((struct art_node4 *)n)->keys[i], depth, lo_eq, hi_eq, &stop)))
+				return ret;
+		break;
+	case ART_NODE16:
+		for (i = 0; i < n->n_children && !stop; i++)
+			if ((ret = art_walk_child(w, ((struct art_node16 *)n)->children[i],
+						  ((struct art_node16 *)n)->keys[i], depth, lo_eq, hi_eq, &stop)))
+				return ret;
+		break;
+	case ART_NODE48:
+		for (c = 0; c < 256 && !stop; c++)
+			if (((struct art_node48 *)n)->index[c] &&
+			    (ret = art_walk_child(w, ((struct art_node48 *)n)->children[((struct art_node48 *)n)->index[c] - 1],
+						  c, depth, lo_eq, hi_eq, &stop)))
+				return ret;
+		break;
+	case ART_NODE256:
+		for (c = 0; c < 256 && !stop; c++)
+			if (((struct art_node256 *)n)->children[c] &&
+			    (ret = art_walk_child(w, ((struct art_node256 *)n)->children[c],
+						  c, depth, lo_eq, hi_eq, &stop)))
+				return ret;
+		break;
+	}
+	return 0;
+}
+
+static int art_walk_child(struct art_walk *w, struct art_node *child, unsigned char c,
+			  uint32_t depth, int lo_eq, int hi_eq, int *stop)
+{
+	if (lo_eq) {
+		if (c < (unsigned char)w->lo[depth])
+			return 0;
+		lo_eq = c == (unsigned char)w->lo[depth];
+	}
+	if (hi_eq) {
+		if (c > (unsigned char)w->hi[depth]) {
+			/* children are visited in order, none of the rest can be in range */
+			*stop = 1;
+			return 0;
+		}
+		hi_eq = c == (unsigned char)w->hi[depth];
+	}
+	return art_walk(w, child, depth + 1, lo_eq, hi_eq);
+}
+
+int art_range(struct art *art, const char *lo, const char *hi, art_iter_func fn, void *arg)
+{
+	struct art_walk w = { lo, hi, fn, arg };
+
+	if (!art->root)
+		return 0;
+	return art_walk(&w, art->root, 0, lo != NULL, hi != NULL);
+}
+
+int art_prefix(struct art *art, const char *prefix, art_iter_func fn, void *arg)
+{
+	struct art_walk w = { NULL, NULL, fn, arg };
+	struct art_node *n = art->root, **child;
+	uint32_t len = strlen(prefix), depth = 0, diff;
+	struct art_leaf *l;
+
+	while (n) {
+		if (is_leaf(n)) {
+			l = to_leaf(n);
+			if (strncmp(l->key, prefix, len))
+				return 0;
+			return fn(l->key, l->data, arg);
+		}
+
+		if (depth == len)
+			return art_walk(&w, n, depth, 0, 0);
+
+		if (n->prefix_len) {
+			diff = art_prefix_mismatch(n, prefix, len, depth);
+			/* the prefix ends inside the compressed path: every key below matches */
+			if (depth + diff == len)
+				return art_walk(&w, n, depth, 0, 0);
+			if (diff < n->prefix_len)
+				return 0;
+			depth += n->prefix_len;
+		}
+
+		child = art_find_child(n, prefix[depth]);
+		n = child ? *child : NULL;
+		depth++;
+	}
+	return 0;
+}
@@ -0,0 +1,566 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <internal/printing.h>
+#include <tools/btree.h>
+#include <tools/scoped.h>
+
+#define NODE_SIZE_DEFAULT 1024
+#define NODE_ALIGN 64
+
+/* a key as compared in a node: the numeric key or string prefix, and the string if any */
+struct btree_key {
+	uint64_t k;
+	const char *s;
+};
+
+static void parse_opt(struct btree *bt, char *option, va_list ap)
+{
+	if (strcmp(option, "node_size")==0)
+		bt->node_size = va_arg(ap, size_t);
+	else if (strcmp(option, "string_keys")==0)
+		bt->str_off = 1;
+}
+
+static int parse_opts(struct btree *bt, const char *options, va_list ap)
+{
+	char *opts __scoped = scoped_strdup(options);
+	char *tmp = opts, *opt, *delim = " ";
+
+	if (!options)
+		return 0;
+	if (!opts)
+		return -ENOMEM;
+
+	for (opt = strtok_r(tmp, delim, &tmp); opt; opt = strtok_r(tmp, delim, &tmp)) {
+		parse_opt(bt, opt, ap);
+	}
+	return 0;
+}
+
+int btree_init(struct btree *bt, const char *options, ...)
+{
+	size_t per_key, cap;
+	va_list ap;
+	int ret;
+
+	memset(bt, 0, sizeof(*bt));
+	va_start(ap, options);
+	ret = parse_opts(bt, options, ap);
+	va_end(ap);
+	if (ret)
+		return ret;
+
+	if (!bt->node_size)
+		bt->node_size = NODE_SIZE_DEFAULT;
+	bt->node_size = (bt->node_size + NODE_ALIGN - 1) & ~(size_t)(NODE_ALIGN - 1);
+
+	/* a key, its slot and its string if any; inner nodes have one slot more than keys */
+	per_key = sizeof(uint64_t) + sizeof(void *) + (bt->str_off ? sizeof(char *) : 0);
+	if (bt->node_size < sizeof(struct btree_node) + sizeof(void *))
+		return -EINVAL;
+	cap = (bt->node_size - sizeof(struct btree_node) - sizeof(void *))/per_key;
+	if (cap < 3 || cap > UINT32_MAX)
+		return -EINVAL;
+
+	bt->cap = cap;
+	bt->str_off = bt->str_off ? cap : 0;
+	bt->slot_off = bt->str_off ? 2*cap : cap;
+	return 0;
+}
+
+/* big endian, so that comparing prefixes orders strings as strcmp() does */
+static uint64_t btree_str_prefix(const char *s)
+{
+	uint64_t p = 0;
+	int i;
+
+	for (i = 0; i < 8 && s[i]; i++)
+		p |= (uint64_t)(unsigned char)s[i] << (56 - 8*i);
+	return p;
+}
+
+static struct btree_key btree_key_str(const char *s)
+{
+	struct btree_key key = { btree_str_prefix(s), s };
+
+	return key;
+}
+
+static struct btree_node *btree_node_new(struct btree *bt, int leaf)
+{
+	struct btree_node *node;
+
+	if (posix_memalign((void **)&node, NODE_ALIGN, bt->node_size))
+		return NULL;
+	node->n_keys = 0;
+	node->leaf = leaf;
+	node->next = NULL;
+	return node;
+}
+
+static void btree_node_free(struct btree *bt, struct btree_node *node)
+{
+	const char **strs = __btree_strs(bt, node);
+	void **slots = __btree_slots(bt, node);
+	unsigned i;
+
+	if (!node->leaf)
+		for (i = 0; i <= node->n_keys; i++)
+			btree_node_free(bt, slots[i]);
+	if (bt->str_off)
+		for (i = 0; i < node->n_keys; i++)
+			free((char *)strs[i]);
+	free(node);
+}
+
+void btree_dest(struct btree *bt)
+{
+	if (bt->root)
+		btree_node_free(bt, bt->root);
+	bt->root = bt->first = NULL;
+	bt->n_entries = 0;
+}
+
+/* first index whose key is >= key, the halving loop compiles to conditional moves */
+static unsigned btree_lower_bound(const uint64_t *keys, unsigned n, uint64_t key)
+{
+	const uint64_t *base = keys;
+	unsigned half;
+
+	if (!n)
+		return 0;
+	while (n > 1) {
+		half = n/2;
+		base = base[half] < key ? base + half : base;
+		n -= half;
+	}
+	return (base - keys) + (*base < key);
+}
+
+/*
+ * Returns the first position in node whose key is > key (upper) or >= key
+ * (!upper). Among equal string prefixes the strings themselves decide.
+ */
+static unsigned btree_find(const struct btree *bt, const struct btree_node *node,
+			   struct btree_key key, int upper, int *found)
+{
+	const char **strs = __btree_strs(bt, node);
+	unsigned pos = btree_lower_bound(node->keys, node->n_keys, key.k);
+	int cmp;
+
+	*found = 0;
+	if (!bt->str_off) {
+		if (pos < node->n_keys && node->keys[pos] == key.k) {
+			*found = 1;
+			pos += upper;
+		}
+		return pos;
+	}
+
+	for (; pos < node->n_keys && node->keys[pos] == key.k; pos++) {
+		cmp = strcmp(strs[pos], key.s);
+		if (cmp > 0)
+			break;
+		if (cmp==0) {
+			*found = 1;
+			return pos + upper;
+		}
+	}
+	return pos;
+}
+
+static int btree_key_less(const struct btree *bt, struct btree_key a,
+			  const struct btree_node *node, unsigned pos)
+{
+	if (a.k != node->keys[pos])
+		return a.k < node->keys[pos];
+	return bt->str_off && strcmp(a.s, __btree_strs(bt, node)[pos]) < 0;
+}
+
+/*
+ * Splits the full child at slot i of parent, which has room for one more key.
+ * An insert beyond the end of the rightmost leaf, as in appending time
+ * series, leaves that leaf nearly full instead of half full.
+ */
+static int btree_split_child(struct btree *bt, struct btree_node *parent, unsigned i, int append)
+{
+	void **pslots = __btree_slots(bt, parent), **lslots, **rslots;
+	const char **pstrs = __btree_strs(bt, parent), **lstrs, **rstrs;
+	struct btree_node *left = pslots[i], *right;
+	unsigned at, n = left->n_keys;
+	uint64_t sep;
+	char *sep_str = NULL;
+
+	right = btree_node_new(bt, left->leaf);
+	if (!right)
+		return -ENOMEM;
+	lslots = __btree_slots(bt, left);
+	rslots = __btree_slots(bt, right);
+	lstrs = __btree_strs(bt, left);
+	rstrs = __btree_strs(bt, right);
+
+	if (left->leaf) {
+		at = append && !left->next ? n - 1 : n/2;
+		sep = left->keys[at];
+		if (bt->str_off && !(sep_str = strdup(lstrs[at]))) {
+			free(right);
+			return -ENOMEM;
+		}
+		right->n_keys = n - at;
+		memcpy(right->keys, left->keys + at, right->n_keys*sizeof(uint64_t));
+		memcpy(rslots, lslots + at, right->n_keys*sizeof(void *));
+		if (bt->str_off)
+			memcpy(rstrs, lstrs + at, right->n_keys*sizeof(char *));
+		right->next = left->next;
+		left->next = right;
+	} else {
+		/* the middle key moves up to the parent */
+		at = n/2;
+		sep = left->keys[at];
+		sep_str = bt->str_off ? (char *)lstrs[at] : NULL;
+		right->n_keys = n - at - 1;
+		memcpy(right->keys, left->keys + at + 1, right->n_keys*sizeof(uint64_t));
+		memcpy(rslots, lslots + at + 1, (right->n_keys + 1)*sizeof(void *));
+		if (bt->str_off)
+			memcpy(rstrs, lstrs + at + 1, right->n_keys*sizeof(char *));
+	}
+	left->n_keys = at;
+
+	memmove(parent->keys + i + 1, parent->keys + i, (parent->n_keys - i)*sizeof(uint64_t));
+	memmove(pslots + i + 2, pslots + i + 1, (parent->n_keys - i)*sizeof(void *));
+	if (bt->str_off) {
+		memmove(pstrs + i + 1, pstrs + i, (parent->n_keys - i)*sizeof(char *));
+		pstrs[i] = sep_str;
+	}
+	parent->keys[i] = sep;
+	pslots[i + 1] = right;
+	parent->n_keys++;
+	return 0;
+}
+
+static int btree_insert(struct btree *bt, struct btree_key key, tdata_t data, int only)
+{
+	struct btree_node *node, *root;
+	const char **strs;
+	void **slots;
+	unsigned i;
+	int found, append;
+	char *dup = NULL;
+
+	if (!bt->root) {
+		if (only)
+			return -1;
+		if (!(bt->root = bt->first = btree_node_new(bt, 1)))
+			return -ENOMEM;
+	}
+
+	if (!only && bt->root->n_keys == bt->cap) {
+		root = btree_node_new(bt, 0);
+		if (!root)
+			return -ENOMEM;
+		__btree_slots(bt, root)[0] = bt->root;
+		append = bt->root->leaf && !btree_key_less(bt, key, bt->root, bt->root->n_keys - 1);
+		if (btree_split_child(bt, root, 0, append)) {
+			free(root);
+			return -ENOMEM;
+		}
+		bt->root = root;
+	}
+
+	for (node = bt->root; !node->leaf; node = slots[i]) {
+		slots = __btree_slots(bt, node);
+		i = btree_find(bt, node, key, 1, &found);
+		if (only || ((struct btree_node *)slots[i])->n_keys < bt->cap)
+			continue;
+
+		append = i == node->n_keys;
+		if (btree_split_child(bt, node, i, append))
+			return -ENOMEM;
+		if (!btree_key_less(bt, key, node, i))
+			i++;
+	}
+
+	i = btree_find(bt, node, key, 0, &found);
+	slots = __btree_slots(bt, node);
+	if (found) {
+		slots[i] = (void *)data;
+		return 0;
+	}
+	if (only)
+		return -1;
+
+	if (bt->str_off && !(dup = strdup(key.s)))
+		return -ENOMEM;
+	memmove(node->keys + i + 1, node->keys + i, (node->n_keys - i)*sizeof(uint64_t));
+	memmove(slots + i + 1, slots + i, (node->n_keys - i)*sizeof(void *));
+	if (bt->str_off) {
+		strs = __btree_strs(bt, node);
+		memmove(strs + i + 1, strs + i, (node->n_keys - i)*sizeof(char *));
+		strs[i] = dup;
+	}
+	node->keys[i] = key.k;
+	slots[i] = (void *)data;
+	node->n_keys++;
+	bt->n_entries++;
+	return 0;
+}
+
+/* returns the leaf that would hold key, and in *pos where key is or would go */
+static const struct btree_node *btree_find_leaf(const struct btree *bt, struct btree_key key,
+						unsigned *pos, int *found)
+{
+	const struct btree_node *node = bt->root;
+
+	*found = 0;
+	*pos = 0;
+	if (!node)
+		return NULL;
+	while (!node->leaf)
+		node = __btree_slots(bt, node)[btree_find(bt, node, key, 1, found)];
+	*pos = btree_find(bt, node, key, 0, found);
+	return node;
+}
+
+static int btree_lookup(struct btree *bt, struct btree_key key, tdata_t *data)
+{
+	const struct btree_node *leaf;
+	unsigned pos;
+	int found;
+
+	leaf = btree_find_leaf(bt, key, &pos, &found);
+	if (!found)
+		return -1;
+
+	*data = (tdata_t)__btree_slots(bt, leaf)[pos];
+	return 0;
+}
+
+static int btree_delete(struct btree *bt, struct btree_key key)
+{
+	struct btree_node *leaf;
+	const char **strs;
+	void **slots;
+	unsigned pos;
+	int found;
+
+	leaf = (struct btree_node *)btree_find_leaf(bt, key, &pos, &found);
+	if (!found)
+		return -1;
+
+	slots = __btree_slots(bt, leaf);
+	strs = __btree_strs(bt, leaf);
+	leaf->n_keys--;
+	memmove(leaf->keys + pos, leaf->keys + pos + 1, (leaf->n_keys - pos)*sizeof(uint64_t));
+	memmove(slots + pos, slots + pos + 1, (leaf->n_keys - pos)*sizeof(void *));
+	if (bt->str_off) {
+		free((char *)strs[pos]);
+		memmove(strs + pos, strs + pos + 1, (leaf->n_keys - pos)*sizeof(char *));
+	}
+	bt->n_entries--;
+	return 0;
+}
+
+int btree_update(struct btree *bt, uint64_t key, tdata_t data)
+{
+	struct btree_key k = { key, NULL };
+
+	return btree_insert(bt, k, data, 0);
+}
+
+int btree_update_str(struct btree *bt, const char *key, tdata_t data)
+{
+	return btree_insert(bt, btree_key_str(key), data, 0);
+}
+
+int btree_update_only(struct btree *bt, uint64_t key, tdata_t data)
+{
+	struct btree_key k = { key, NULL };
+
+	return btree_insert(bt, k, data, 1);
+}
+
+int btree_update_only_str(struct btree *bt, const char *key, tdata_t data)
+{
+	return btree_insert(bt, btree_key_str(key), data, 1);
+}
+
+int btree_search(struct btree *bt, uint64_t key, tdata_t *data)
+{
+	struct btree_key k = { key, NULL };
+
+	return btree_lookup(bt, k, data);
+}
+
+int btree_search_str(struct btree *bt, const char *key, tdata_t *data)
+{
+	return btree_lookup(bt, btree_key_str(key), data);
+}
+
+int btree_remove(struct btree *bt, uint64_t key)
+{
+	struct btree_key k = { key, NULL };
+
+	return btree_delete(bt, k);
+}
+
+int btree_remove_str(struct btree *bt, const char *key)
+{
+	return btree_delete(bt, btree_key_str(key));
+}
+
+static void btree_seek_key(const struct btree *bt, struct btree_iter *it, struct btree_key key)
+{
+	int found;
+
+	it->bt = bt;
+	it->leaf = btree_find_leaf(bt, key, &it->pos, &found);
+}
+
+void btree_seek(const struct btree *bt, struct btree_iter *it, uint64_t key)
+{
+	struct btree_key k = { key, NULL };
+
+	btree_seek_key(bt, it, k);
+}
+
+void btree_seek_str(const struct btree *bt, struct btree_iter *it, const char *key)
+{
+	btree_seek_key(bt, it, btree_key_str(key));
+}
+
+void btree_first(const struct btree *bt, struct btree_iter *it)
+{
+	it->bt = bt;
+	it->leaf = bt->first;
+	it->pos = 0;
+}
+
+/*
+ * Bulk loading: leaves are filled to capacity from the sorted input, then
+ * each level of inner nodes is built over the one below, using the smallest
+ * key under each child as its separator. All nodes are allocated up front so
+ * that a failure can be undone by freeing them in one pass.
+ */
+static int btree_build(struct btree *bt, const uint64_t *keys, const char *const *strs,
+		       const tdata_t *data, size_t n)
+{
+	struct btree_node **nodes, **level, *node;
+	size_t n_nodes = 0, count, n_level, i, j, k;
+	uint64_t *mins;
+	const char **smins;
+	int ret = -ENOMEM;
+
+	if (bt->root)
+		return -EINVAL;
+	for (i = 1; i < n; i++)
+		if (strs ? strcmp(strs[i - 1], strs[i]) >= 0 : keys[i - 1] >= keys[i])
+			return -EINVAL;
+	if (!n)
+		return 0;
+
+	for (count = (n + bt->cap - 1)/bt->cap; ; count = (count + bt->cap)/(bt->cap + 1)) {
+		n_nodes += count;
+		if (count==1)
+			break;
+	}
+
+	nodes = calloc(n_nodes, sizeof(*nodes));
+	mins = malloc(n_nodes*sizeof(*mins));
+	smins = malloc(n_nodes*sizeof(*smins));
+	if (!nodes || !mins || !smins)
+		goto out;
+
+	count = (n + bt->cap - 1)/bt->cap;
+	for (i = 0; i < n_nodes; i++)
+		if (!(nodes[i] = btree_node_new(bt, i < count)))
+			goto out;
+
+	/* leaves */
+	for (i = 0, k = 0; i < count; i++) {
+		node = nodes[i];
+		node->next = i + 1 < count ? nodes[i + 1] : NULL;
+		for (j = 0; j < bt->cap && k < n; j++, k++) {
+			node->keys[j] = strs ? btree_str_prefix(strs[k]) : keys[k];
+			__btree_slots(bt, node)[j] = (void *)data[k];
+			if (strs && !(__btree_strs(bt, node)[j] = strdup(strs[k])))
+				goto out;
+			node->n_keys++;
+		}
+		mins[i] = node->keys[0];
+		smins[i] = strs ? __btree_strs(bt, node)[0] : NULL;
+	}
+
+	/* inner levels, mins and smins hold the smallest key of each node of the level below */
+	level = nodes;
+	for (; count > 1; count = n_level) {
+		n_level = (count + bt->cap)/(bt->cap + 1);
+		for (i = 0; i < n_level; i++) {
+			node = level[count + i];
+			for (j = 0; j <= bt->cap && i*(bt->cap + 1) + j < count; j++) {
+				k = i*(bt->cap + 1) + j;
+				__btree_slots(bt, node)[j] = level[k];
+				if (!j)
+					continue;
+				node->keys[j - 1] = mins[k];
+				if (strs && !(__btree_strs(bt, node)[j - 1] = strdup(smins[k])))
+					goto out;
+				node->n_keys++;
+			}
+			k = i*(bt->cap + 1);
+			mins[i] = mins[k];
+			smins[i] = smins[k];
+		}
+		level += count;
+	}
+
+	bt->root = level[0];
+	bt->first = nodes[0];
+	bt->n_entries = n;
+	ret = 0;
+out:
+	if (ret && nodes)
+		for (i = 0; i < n_nodes && nodes[i]; i++) {
+			/* free the nodes one by one, children are freed through nodes[] */
+			nodes[i]->leaf = 1;
+			btree_node_free(bt, nodes[i]);
+		}
+	free(nodes);
+	free(mins);
+	free(smins);
+	return ret;
+}
+
+int btree_load(struct btree *bt, const uint64_t *keys, const tdata_t *data, size_t n)
+{
+	if (bt->str_off)
+		return -EINVAL;
+	return btree_build(bt, keys, NULL, data, n);
+}
+
+int btree_load_str(struct btree *bt, const char *const *keys, const tdata_t *data, size_t n)
+{
+	if (!bt->str_off)
+		return -EINVAL;
+	return btree_build(bt, NULL, keys, data, n);
+}
@@ -0,0 +1,421 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <internal/printing.h>
+#include <internal/hash.h>
+#include <tools/cuckoo.h>
+#include <tools/zalloc.h>
+#include <tools/scoped.h>
+
+struct cuckoo_entry {
+	unsigned hash;
+	tdata_t data;
+	char key[];
+};
+
+#define ABSOLUTE_MAX   (1<<30) /* no more than a billion entries */
+#define E_MAX_DEFAULT  (1<<13)
+#define E_SIZE_DEFAULT (1<<10)
+
+#define cuckoo_nbuckets(c) ((size_t)1 << (c)->b_bits)
+
+/* first bucket from hash: the high bits of a multiplicative mix */
+static size_t bfh(const struct cuckoo *c, unsigned hash)
+{
+	return ((uint64_t)hash * 0x9E3779B97F4A7C15ull) >> (64 - c->b_bits);
+}
+
+/* tag from hash: a second, independent mix; zero marks an empty slot */
+static uint16_t tfh(unsigned hash)
+{
+	return (((uint64_t)hash * 0xC2B2AE3D27D4EB4Full) >> 48) | 1;
+}
+
+/* alternate bucket: an involution, computable without the key */
+static size_t alt(const struct cuckoo *c, size_t i, uint16_t tag)
+{
+	return (i ^ ((size_t)tag * 0x5bd1e995)) & (cuckoo_nbuckets(c) - 1);
+}
+
+static unsigned cuckoo_rand(struct cuckoo *c)
+{
+	c->rand ^= c->rand << 13;
+	c->rand ^= c->rand >> 17;
+	c->rand ^= c->rand << 5;
+	return c->rand;
+}
+
+static void parse_opt(struct cuckoo *c, size_t *size, char *option, va_list ap)
+{
+	if (strcmp(option, "max_size")==0) {
+		c->e_max = va_arg(ap, size_t);
+		if (c->e_max > ABSOLUTE_MAX)
+			c->e_max = ABSOLUTE_MAX;
+	} else if (strcmp(option, "size")==0) {
+		*size = va_arg(ap, size_t);
+	} else if (strcmp(option, "with_hash")==0) {
+		c->hash = va_arg(ap, table_hash_func);
+	}
+}
+
+static int parse_opts(struct cuckoo *c, size_t *size, const char *options, va_list ap)
+{
+	char *opts __scoped = scoped_strdup(options);
+	char *tmp = opts, *opt, *delim = " ";
+
+	if (!options)
+		return 0;
+	if (!opts)
+		return -ENOMEM;
+
+	for (opt = strtok_r(tmp, delim, &tmp); opt; opt = strtok_r(tmp, delim, &tmp)) {
+		parse_opt(c, size, opt, ap);
+	}
+	return 0;
+}
+
+static struct cuckoo_bucket *cuckoo_alloc_buckets(unsigned b_bits)
+{
+	struct cuckoo_bucket *buckets;
+	size_t sz = sizeof(*buckets) << b_bits;
+
+	if (posix_memalign((void **)&buckets, sizeof(*buckets), sz))
+		return NULL;
+	memset(buckets, 0, sz);
+	return buckets;
+}
+
+static int vcuckoo_init(struct cuckoo *c, const char *options, va_list ap)
+{
+	size_t size = 0;
+	int ret;
+
+	memset(c, 0, sizeof(*c));
+	c->hash = fnv1a_hash;
+	c->rand = 0x9e3779b9;
+	ret = parse_opts(c, &size, options, ap);
+	if (ret)
+		return ret;
+
+	if (!size) {
+		size = E_SIZE_DEFAULT;
+		if (c->e_max && c->e_max < size)
+			size = c->e_max;
+	}
+	if (!c->e_max)
+		c->e_max = size < E_MAX_DEFAULT ? E_MAX_DEFAULT : size;
+	if (c->e_max < size)
+		return -EINVAL;
+
+	/* aim for a load of at most 80% at the initial capacity */
+	c->b_bits = 1;
+	while ((cuckoo_nbuckets(c) * CUCKOO_WAYS * 4) / 5 < size)
+		c->b_bits++;
+
+	c->buckets = cuckoo_alloc_buckets(c->b_bits);
+	if (!c->buckets)
+		return -ENOMEM;
+	return 0;
+}
+
+int cuckoo_init(struct cuckoo *cuckoo, const char *options, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, options);
+	ret = vcuckoo_init(cuckoo, options, ap);
+	va_end(ap);
+	return ret;
+}
+
+void cuckoo_dest(struct cuckoo *cuckoo)
+{
+	size_t i;
+	unsigned w;
+
+	for (i = 0; i < cuckoo_nbuckets(cuckoo); i++)
+		for (w = 0; w < CUCKOO_WAYS; w++)
+			free(cuckoo->buckets[i].entry[w]);
+	for (w = 0; w < cuckoo->n_stash; w++)
+		free(cuckoo->stash[w]);
+
+	free(cuckoo->buckets);
+	cuckoo->buckets = NULL;
+	cuckoo->n_stash = 0;
+	cuckoo->n_entries = 0;
+}
+
+struct cuckoo *cuckoo_alloc(const char *options, ...)
+{
+	struct cuckoo *cuckoo = zalloc(sizeof(*cuckoo));
+	va_list ap;
+	int ret;
+
+	if (!cuckoo)
+		return NULL;
+
+	va_start(ap, options);
+	ret = vcuckoo_init(cuckoo, options, ap);
+	va_end(ap);
+
+	if (ret) {
+		free(cuckoo);
+		return NULL;
+	}
+	return cuckoo;
+}
+
+void cuckoo_free(struct cuckoo *cuckoo)
+{
+	cuckoo_dest(cuckoo);
+	free(cuckoo);
+}
+
+/* try to put entryp in a free slot of bucket i, no displacement */
+static int cuckoo_place_in(struct cuckoo *c, size_t i, uint16_t tag, struct cuckoo_entry *entryp)
+{
+	struct cuckoo_bucket *b = &c->buckets[i];
+	unsigned w;
+
+	for (w = 0; w < CUCKOO_WAYS; w++)
+		if (!b->tag[w]) {
+			b->tag[w] = tag;
+			b->entry[w] = entryp;
+			return 0;
+		}
+	return -1;
+}
+
+/*
+ * Place entryp, displacing residents along a random walk of bounded length.
+ * The walk is only started while the stash has room for whichever entry is
+ * left homeless at the end of it, so no entry is ever lost; -ENOSPC means
+ * the table has to grow before entryp can be placed.
+ */
+static int cuckoo_place(struct cuckoo *c, struct cuckoo_entry *entryp)
+{
+	struct cuckoo_bucket *b;
+	struct cuckoo_entry *tmpe;
+	uint16_t tag = tfh(entryp->hash), tmpt;
+	size_t i = bfh(c, entryp->hash);
+	unsigned kick, w;
+
+	if (!cuckoo_place_in(c, i, tag, entryp) ||
+	    !cuckoo_place_in(c, alt(c, i, tag), tag, entryp))
+		return 0;
+
+	if (c->n_stash == CUCKOO_STASH)
+		return -ENOSPC;
+
+	if (cuckoo_rand(c) & 1)
+		i = alt(c, i, tag);
+
+	for (kick = 0; kick < CUCKOO_MAX_KICKS; kick++) {
+		b = &c->buckets[i];
+		w = cuckoo_rand(c) % CUCKOO_WAYS;
+
+		tmpe = b->entry[w];
+		tmpt = b->tag[w];
+		b->entry[w] = entryp;
+		b->tag[w] = tag;
+		entryp = tmpe;
+		tag = tmpt;
+
+		i = alt(c, i, tag);
+		if (!cuckoo_place_in(c, i, tag, entryp))
+			return 0;
+	}
+
+	pr_dbg("%s: displacement path exhausted, stashing\n", __func__);
+	c->stash[c->n_stash++] = entryp;
+	return 0;
+}
+
+/* rebuild into a table twice the size, doubling again if even that overflows */
+static int cuckoo_grow(struct cuckoo *c)
+{
+	struct cuckoo_bucket *old = c->buckets;
+	struct cuckoo_entry *stash[CUCKOO_STASH];
+	unsigned old_bits = c->b_bits, n_stash = c->n_stash, w;
+	size_t i;
+
+	memcpy(stash, c->stash, sizeof(stash));
+	for (;;) {
+		if ((cuckoo_nbuckets(c) * CUCKOO_WAYS) / 2 >= c->e_max)
+			goto fail;
+
+		c->b_bits++;
+		pr_dbg("%s: resizing to %zu buckets\n", __func__, cuckoo_nbuckets(c));
+		c->buckets = cuckoo_alloc_buckets(c->b_bits);
+		if (!c->buckets)
+			goto fail;
+		c->n_stash = 0;
+
+		for (i = 0; i < ((size_t)1 << old_bits); i++)
+			for (w = 0; w < CUCKOO_WAYS; w++)
+				if (old[i].entry[w] && cuckoo_place(c, old[i].entry[w]))
+					goto retry;
+		for (w = 0; w < n_stash; w++)
+			if (cuckoo_place(c, stash[w]))
+				goto retry;
+
+		free(old);
+		return 0;
+	retry:
+		free(c->buckets);
+	}
+fail:
+	c->buckets = old;
+	c->b_bits = old_bits;
+	c->n_stash = n_stash;
+	memcpy(c->stash, stash, sizeof(stash));
+	return -ENOSPC;
+}
+
+static struct cuckoo_entry **cuckoo_search_slot(struct cuckoo *c, const char *key, unsigned hash)
+{
+	uint16_t tag = tfh(hash);
+	size_t i1 = bfh(c, hash), i2 = alt(c, i1, tag);
+	struct cuckoo_bucket *b1 = &c->buckets[i1], *b2 = &c->buckets[i2];
+	unsigned w;
+
+	__builtin_prefetch(b2);
+	for (w = 0; w < CUCKOO_WAYS; w++)
+		if (b1->tag[w] == tag && b1->entry[w]->hash == hash &&
+		    strcmp(b1->entry[w]->key, key)==0)
+			return &b1->entry[w];
+
+	for (w = 0; w < CUCKOO_WAYS; w++)
+		if (b2->tag[w] == tag && b2->entry[w]->hash == hash &&
+		    strcmp(b2->entry[w]->key, key)==0)
+			return &b2->entry[w];
+
+	for (w = 0; w < c->n_stash; w++)
+		if (c->stash[w]->hash == hash && strcmp(c->stash[w]->key, key)==0)
+			return &c->stash[w];
+
+	return NULL;
+}
+
+static int cuckoo_insert_entry(struct cuckoo *c, struct cuckoo_entry *entryp)
+{
+	int ret;
+
+	if (c->n_entries >= c->e_max)
+		return -ENOSPC;
+
+	while ((ret = cuckoo_place(c, entryp)) == -ENOSPC) {
+		ret = cuckoo_grow(c);
+		if (ret)
+			return ret;
+	}
+	c->n_entries++;
+	return 0;
+}
+
+int cuckoo_update_only(struct cuckoo *cuckoo, const char *key, tdata_t data)
+{
+	struct cuckoo_entry **slot = cuckoo_search_slot(cuckoo, key, cuckoo->hash(key));
+
+	if (!slot)
+		return -1;
+
+	(*slot)->data = data;
+	return 0;
+}
+
+int cuckoo_update(struct cuckoo *cuckoo, const char *key, tdata_t data)
+{
+	unsigned hash = cuckoo->hash(key);
+	struct cuckoo_entry **slot = cuckoo_search_slot(cuckoo, key, hash);
+	struct cuckoo_entry *entryp;
+	size_t len;
+
+	if (slot) {
+		(*slot)->data = data;
+		return 0;
+	}
+
+	len = strlen(key);
+	entryp = malloc(sizeof(*entryp) + len + 1);
+	if (!entryp)
+		return -1;
+	entryp->hash = hash;
+	entryp->data = data;
+	memcpy(entryp->key, key, len + 1);
+
+	if (cuckoo_insert_entry(cuckoo, entryp)) {
+		free(entryp);
+		return -1;
+	}
+	return 0;
+}
+
+int cuckoo_search(struct cuckoo *cuckoo, const char *key, tdata_t *data)
+{
+	struct cuckoo_entry **slot = cuckoo_search_slot(cuckoo, key, cuckoo->hash(key));
+
+	if (!slot)
+		return -1;
+
+	*data = (*slot)->data;
+	return 0;
+}
+
+int cuckoo_remove(struct cuckoo *cuckoo, const char *key)
+{
+	struct cuckoo_entry **slot = cuckoo_search_slot(cuckoo, key, cuckoo->hash(key));
+	struct cuckoo_entry *entryp;
+	struct cuckoo_bucket *b;
+	uint16_t tag;
+	unsigned s;
+	size_t i;
+
+	if (!slot)
+		return -1;
+
+	free(*slot);
+	cuckoo->n_entries--;
+	if (slot >= cuckoo->stash && slot < cuckoo->stash + CUCKOO_STASH) {
+		*slot = cuckoo->stash[--cuckoo->n_stash];
+		return 0;
+	}
+
+	i = ((char *)slot - (char *)cuckoo->buckets) / sizeof(*b);
+	b = &cuckoo->buckets[i];
+	b->tag[slot - b->entry] = 0;
+	*slot = NULL;
+
+	/* the freed slot may be a home for a stashed entry */
+	for (s = 0; s < cuckoo->n_stash; s++) {
+		entryp = cuckoo->stash[s];
+		tag = tfh(entryp->hash);
+		i = bfh(cuckoo, entryp->hash);
+		if (!cuckoo_place_in(cuckoo, i, tag, entryp) ||
+		    !cuckoo_place_in(cuckoo, alt(cuckoo, i, tag), tag, entryp)) {
+			cuckoo->stash[s] = cuckoo->stash[--cuckoo->n_stash];
+			break;
+		}
+	}
+	return 0;
+}
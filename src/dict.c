@@ -0,0 +1,354 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <internal/printing.h>
+#include <tools/dict.h>
+#include <tools/hash.h>
+#include <tools/zalloc.h>
+#include <tools/scoped.h>
+
+#define ABSOLUTE_MAX   (1<<30) /* record numbers are int32_t */
+#define E_MAX_DEFAULT  (1<<13)
+#define E_SIZE_DEFAULT (1<<10)
+#define I_BITS_MIN     3
+#define PERTURB_SHIFT  5
+
+#define DICT_EMPTY     (-1)
+#define DICT_DUMMY     (-2)	/* the record was removed, probing goes on past it */
+
+#define dict_n_slots(d) ((size_t)1 << (d)->i_bits)
+
+/* records the index of 1 << bits slots can number, keeping it at most 2/3 full */
+static size_t dict_capacity(unsigned bits)
+{
+	return ((size_t)2 << bits)/3;
+}
+
+static unsigned dict_index_bits(size_t n)
+{
+	unsigned bits = I_BITS_MIN;
+
+	while (dict_capacity(bits) < n)
+		bits++;
+	return bits;
+}
+
+static void parse_opt(struct dict *d, size_t *size, int *seeded, char *option, va_list ap)
+{
+	if (strcmp(option, "max_size")==0) {
+		d->e_max = va_arg(ap, size_t);
+		if (d->e_max > ABSOLUTE_MAX)
+			d->e_max = ABSOLUTE_MAX;
+	} else if (strcmp(option, "size")==0) {
+		*size = va_arg(ap, size_t);
+	} else if (strcmp(option, "with_hash64")==0) {
+		d->hash64 = va_arg(ap, table_hash64_func);
+	} else if (strcmp(option, "seed")==0) {
+		d->seed = va_arg(ap, uint64_t);
+		*seeded = 1;
+	}
+}
+
+static int parse_opts(struct dict *d, size_t *size, int *seeded, const char *options, va_list ap)
+{
+	char *opts __scoped = scoped_strdup(options);
+	char *tmp = opts, *opt, *delim = " ";
+
+	if (!options)
+		return 0;
+	if (!opts)
+		return -ENOMEM;
+
+	for (opt = strtok_r(tmp, delim, &tmp); opt; opt = strtok_r(tmp, delim, &tmp)) {
+		parse_opt(d, size, seeded, opt, ap);
+	}
+	return 0;
+}
+
+static uint64_t dict_hashkey(struct dict *d, const char *key)
+{
+	if (d->hash64)
+		return d->hash64(key);
+	return hash_fnv1a64(key, d->seed);
+}
+
+/*
+ * The probe sequence of CPython's dict: i = 5i + 1 + perturb, with the
+ * upper bits of the hash shifted into perturb so that keys whose low bits
+ * collide part ways after a few steps. It visits every slot eventually.
+ */
+#define dict_for_each_probe(i, perturb, hash, mask)			\
+	for ((perturb) = (hash), (i) = (hash) & (mask); ;		\
+	     (perturb) >>= PERTURB_SHIFT, (i) = ((i)*5 + (perturb) + 1) & (mask))
+
+/*
+ * Returns the record number of key, or -1 if it is absent. *slot is set to
+ * the index slot holding it, or else to the slot an insertion should use:
+ * the first removed one on the probe path, if any.
+ */
+static int32_t dict_lookup(struct dict *d, const char *key, uint64_t hash, size_t *slot)
+{
+	size_t mask = dict_n_slots(d) - 1, i, free = SIZE_MAX;
+	struct dict_record *rec;
+	uint64_t perturb;
+	int32_t ix;
+
+	dict_for_each_probe(i, perturb, hash, mask) {
+		ix = d->index[i];
+		if (ix == DICT_EMPTY) {
+			*slot = free != SIZE_MAX ? free : i;
+			return -1;
+		}
+		if (ix == DICT_DUMMY) {
+			if (free == SIZE_MAX)
+				free = i;
+			continue;
+		}
+		rec = &d->records[ix];
+		if (rec->hash == hash && strcmp(rec->key, key)==0) {
+			*slot = i;
+			return ix;
+		}
+	}
+}
+
+/* index slot for a record known not to be in an index without removed slots */
+static size_t dict_free_slot(struct dict *d, uint64_t hash)
+{
+	size_t mask = dict_n_slots(d) - 1, i;
+	uint64_t perturb;
+
+	dict_for_each_probe(i, perturb, hash, mask) {
+		if (d->index[i] == DICT_EMPTY)
+			return i;
+	}
+}
+
+/*
+ * Squeezes the removed records out of the record array and rebuilds an
+ * index of 1 << bits slots over it, growing the record array to match.
+ */
+static int dict_resize(struct dict *d, unsigned bits)
+{
+	size_t cap = dict_capacity(bits), i, n = 0;
+	struct dict_record *records = d->records;
+	int32_t *index;
+
+	pr_dbg("%s: %zu entries, %zu records, %zu slots\n", __func__,
+	       d->n_entries, d->n_records, (size_t)1 << bits);
+	index = malloc(sizeof(*index) << bits);
+	if (!index)
+		return -ENOMEM;
+	if (cap > d->r_cap) {
+		records = realloc(d->records, cap*sizeof(*records));
+		if (!records) {
+			free(index);
+			return -ENOMEM;
+		}
+	}
+	memset(index, 0xff, sizeof(*index) << bits);
+
+	free(d->index);
+	d->index = index;
+	d->records = records;
+	d->r_cap = cap;
+	d->i_bits = bits;
+	for (i = 0; i < d->n_records; i++) {
+		if (!records[i].key)
+			continue;
+		records[n] = records[i];
+		index[dict_free_slot(d, records[n].hash)] = n;
+		n++;
+	}
+	d->n_records = n;
+	return 0;
+}
+
+static int vdict_init(struct dict *d, const char *options, va_list ap)
+{
+	size_t size = 0;
+	uint64_t seed[2];
+	int seeded = 0, ret;
+
+	memset(d, 0, sizeof(*d));
+	ret = parse_opts(d, &size, &seeded, options, ap);
+	if (ret)
+		return ret;
+
+	if (!size) {
+		/* like table_init(), a max_size below the default size lowers it */
+		size = E_SIZE_DEFAULT;
+		if (d->e_max && d->e_max < size)
+			size = d->e_max;
+	}
+	if (!d->e_max)
+		d->e_max = size < E_MAX_DEFAULT ? E_MAX_DEFAULT : size;
+	if (d->e_max < size || size > ABSOLUTE_MAX)
+		return -EINVAL;
+	if (!seeded) {
+		hash_random_seed(seed);
+		d->seed = seed[0];
+	}
+	return dict_resize(d, dict_index_bits(size));
+}
+
+int dict_init(struct dict *dict, const char *options, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, options);
+	ret = vdict_init(dict, options, ap);
+	va_end(ap);
+	return ret;
+}
+
+void dict_dest(struct dict *dict)
+{
+	size_t i;
+
+	for (i = 0; i < dict->n_records; i++)
+		free((void *)dict->records[i].key);
+	free(dict->records);
+	free(dict->index);
+	dict->records = NULL;
+	dict->index = NULL;
+	dict->n_entries = dict->n_records = 0;
+}
+
+struct dict *dict_alloc(const char *options, ...)
+{
+	struct dict *dict = zalloc(sizeof(*dict));
+	va_list ap;
+	int ret;
+
+	if (!dict)
+		return NULL;
+
+	va_start(ap, options);
+	ret = vdict_init(dict, options, ap);
+	va_end(ap);
+	if (ret) {
+		free(dict);
+		return NULL;
+	}
+	return dict;
+}
+
+void dict_free(struct dict *dict)
+{
+	dict_dest(dict);
+	free(dict);
+}
+
+int dict_update(struct dict *dict, const char *key, tdata_t data)
+{
+	uint64_t hash = dict_hashkey(dict, key);
+	struct dict_record *rec;
+	unsigned bits;
+	size_t slot;
+	int32_t ix;
+	char *copy;
+
+	ix = dict_lookup(dict, key, hash, &slot);
+	if (ix >= 0) {
+		dict->records[ix].data = data;
+		return 0;
+	}
+	if (dict->n_entries >= dict->e_max)
+		return -1;
+
+	copy = strdup(key);
+	if (!copy)
+		return -1;
+	if (dict->n_records == dict->r_cap) {
+		/* grow, unless squeezing out removed records frees enough room */
+		bits = dict->i_bits;
+		if (dict_capacity(bits) < 2*dict->n_entries + 1)
+			bits = dict_index_bits(2*dict->n_entries + 1);
+		if (dict_resize(dict, bits)) {
+			free(copy);
+			return -1;
+		}
+		slot = dict_free_slot(dict, hash);
+	}
+
+	rec = &dict->records[dict->n_records];
+	rec->hash = hash;
+	rec->key = copy;
+	rec->data = data;
+	dict->index[slot] = dict->n_records++;
+	dict->n_entries++;
+	return 0;
+}
+
+int dict_update_only(struct dict *dict, const char *key, tdata_t data)
+{
+	size_t slot;
+	int32_t ix = dict_lookup(dict, key, dict_hashkey(dict, key), &slot);
+
+	if (ix < 0)
+		return -1;
+	dict->records[ix].data = data;
+	return 0;
+}
+
+int dict_search(struct dict *dict, const char *key, tdata_t *data)
+{
+	size_t slot;
+	int32_t ix = dict_lookup(dict, key, dict_hashkey(dict, key), &slot);
+
+	if (ix < 0)
+		return -1;
+	*data = dict->records[ix].data;
+	return 0;
+}
+
+int dict_remove(struct dict *dict, const char *key)
+{
+	struct dict_record *rec;
+	size_t slot;
+	int32_t ix = dict_lookup(dict, key, dict_hashkey(dict, key), &slot);
+
+	if (ix < 0)
+		return -1;
+	rec = &dict->records[ix];
+	free((void *)rec->key);
+	rec->key = NULL;
+	dict->index[slot] = DICT_DUMMY;
+	dict->n_entries--;
+	return 0;
+}
+
+int dict_for_each(struct dict *dict, table_iter_func fn, void *arg)
+{
+	struct dict_record *rec;
+	int ret;
+
+	dict_for_each_record(rec, dict) {
+		ret = fn(rec->key, rec->data, arg);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
@@ -0,0 +1,514 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <internal/printing.h>
+#include <internal/hash.h>
+#include <tools/hamt.h>
+#include <tools/scoped.h>
+
+#define HAMT_BITS 5
+#define HAMT_MASK ((1u << HAMT_BITS) - 1)
+
+enum hamt_kind {
+	HAMT_LEAF,
+	HAMT_BRANCH,
+	HAMT_COLLISION,
+};
+
+struct hamt_node {
+	unsigned refs;
+	unsigned kind;
+};
+
+struct hamt_leaf {
+	struct hamt_node node;
+	uint64_t hash;
+	tdata_t data;
+	char key[];
+};
+
+struct hamt_branch {
+	struct hamt_node node;
+	uint32_t bitmap;
+	struct hamt_node *child[];
+};
+
+/* leaves whose 64-bit hashes are equal */
+struct hamt_collision {
+	struct hamt_node node;
+	uint64_t hash;
+	unsigned n;
+	struct hamt_leaf *leaf[];
+};
+
+#define to_leaf(n)      container_of(n, struct hamt_leaf, node)
+#define to_branch(n)    container_of(n, struct hamt_branch, node)
+#define to_collision(n) container_of(n, struct hamt_collision, node)
+
+static void parse_opt(struct hamt *hamt, char *option, va_list ap)
+{
+	if (strcmp(option, "with_hash64")==0)
+		hamt->hash = va_arg(ap, table_hash64_func);
+}
+
+static int parse_opts(struct hamt *hamt, const char *options, va_list ap)
+{
+	char *opts __scoped = scoped_strdup(options);
+	char *tmp = opts, *opt, *delim = " ";
+
+	if (!options)
+		return 0;
+	if (!opts)
+		return -ENOMEM;
+
+	for (opt = strtok_r(tmp, delim, &tmp); opt; opt = strtok_r(tmp, delim, &tmp)) {
+		parse_opt(hamt, opt, ap);
+	}
+	return 0;
+}
+
+/* the trie consumes the hash 5 bits at a time from the bottom, make them all count */
+static uint64_t hamt_hashkey(const struct hamt *hamt, const char *key)
+{
+	uint64_t h = hamt->hash(key);
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+static struct hamt_node *hamt_get(struct hamt_node *node)
+{
+	if (node)
+		__atomic_add_fetch(&node->refs, 1, __ATOMIC_RELAXED);
+	return node;
+}
+
+static void hamt_put(struct hamt_node *node)
+{
+	unsigned i;
+
+	if (!node || __atomic_sub_fetch(&node->refs, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	switch (node->kind) {
+	case HAMT_BRANCH:
+		for (i = 0; i < __builtin_popcount(to_branch(node)->bitmap); i++)
+			hamt_put(to_branch(node)->child[i]);
+		break;
+	case HAMT_COLLISION:
+		for (i = 0; i < to_collision(node)->n; i++)
+			hamt_put(&to_collision(node)->leaf[i]->node);
+		break;
+	}
+	free(node);
+}
+
+static struct hamt_node *hamt_leaf_new(uint64_t hash, const char *key, tdata_t data)
+{
+	size_t len = strlen(key) + 1;
+	struct hamt_leaf *leaf = malloc(sizeof(*leaf) + len);
+
+	if (!leaf)
+		return NULL;
+	leaf->node.refs = 1;
+	leaf->node.kind = HAMT_LEAF;
+	leaf->hash = hash;
+	leaf->data = data;
+	memcpy(leaf->key, key, len);
+	return &leaf->node;
+}
+
+static struct hamt_branch *hamt_branch_new(uint32_t bitmap)
+{
+	struct hamt_branch *branch;
+
+	branch = malloc(sizeof(*branch) + __builtin_popcount(bitmap)*sizeof(branch->child[0]));
+	if (!branch)
+		return NULL;
+	branch->node.refs = 1;
+	branch->node.kind = HAMT_BRANCH;
+	branch->bitmap = bitmap;
+	return branch;
+}
+
+static struct hamt_collision *hamt_collision_new(uint64_t hash, unsigned n)
+{
+	struct hamt_collision *coll = malloc(sizeof(*coll) + n*sizeof(coll->leaf[0]));
+
+	if (!coll)
+		return NULL;
+	coll->node.refs = 1;
+	coll->node.kind = HAMT_COLLISION;
+	coll->hash = hash;
+	coll->n = n;
+	return coll;
+}
+
+static uint64_t hamt_node_hash(struct hamt_node *node)
+{
+	return node->kind == HAMT_LEAF ? to_leaf(node)->hash : to_collision(node)->hash;
+}
+
+/*
+ * Joins two leaf or collision nodes with different hashes under new branches,
+ * starting at shift. Consumes the references to a and b, even on failure.
+ */
+static struct hamt_node *hamt_merge(struct hamt_node *a, struct hamt_node *b, unsigned shift)
+{
+	uint64_t ha = hamt_node_hash(a), hb = hamt_node_hash(b);
+	unsigned ia = (ha >> shift) & HAMT_MASK, ib = (hb >> shift) & HAMT_MASK;
+	struct hamt_branch *branch;
+	struct hamt_node *child;
+
+	if (ia == ib) {
+		child = hamt_merge(a, b, shift + HAMT_BITS);
+		if (!child)
+			return NULL;
+		branch = hamt_branch_new(1u << ia);
+		if (!branch) {
+			hamt_put(child);
+			return NULL;
+		}
+		branch->child[0] = child;
+		return &branch->node;
+	}
+
+	branch = hamt_branch_new((1u << ia) | (1u << ib));
+	if (!branch) {
+		hamt_put(a);
+		hamt_put(b);
+		return NULL;
+	}
+	branch->child[ia < ib ? 0 : 1] = a;
+	branch->child[ia < ib ? 1 : 0] = b;
+	return &branch->node;
+}
+
+static struct hamt_node *hamt_insert_collision(struct hamt_collision *coll, uint64_t hash,
+					       const char *key, tdata_t data, int *added)
+{
+	struct hamt_collision *copy;
+	struct hamt_node *leaf;
+	unsigned i, pos;
+
+	for (pos = 0; pos < coll->n; pos++)
+		if (strcmp(coll->leaf[pos]->key, key)==0)
+			break;
+
+	leaf = hamt_leaf_new(hash, key, data);
+	if (!leaf)
+		return NULL;
+	*added = pos == coll->n;
+	copy = hamt_collision_new(hash, coll->n + *added);
+	if (!copy) {
+		hamt_put(leaf);
+		return NULL;
+	}
+	for (i = 0; i < coll->n; i++)
+		copy->leaf[i] = i == pos ? NULL : to_leaf(hamt_get(&coll->leaf[i]->node));
+	copy->leaf[pos] = to_leaf(leaf);
+	return &copy->node;
+}
+
+/*
+ * Returns a new version of the subtrie at node in which key maps to data. The
+ * old version is left untouched; unchanged children are shared with it.
+ */
+static struct hamt_node *hamt_insert(struct hamt_node *node, unsigned shift, uint64_t hash,
+				     const char *key, tdata_t data, int *added)
+{
+	struct hamt_branch *branch, *copy;
+	struct hamt_collision *coll;
+	struct hamt_node *leaf, *child;
+	uint32_t bit;
+	unsigned i, n, pos;
+
+	if (!node) {
+		*added = 1;
+		return hamt_leaf_new(hash, key, data);
+	}
+
+	switch (node->kind) {
+	case HAMT_LEAF:
+		if (to_leaf(node)->hash == hash && strcmp(to_leaf(node)->key, key)==0) {
+			*added = 0;
+			return hamt_leaf_new(hash, key, data);
+		}
+		*added = 1;
+		leaf = hamt_leaf_new(hash, key, data);
+		if (!leaf)
+			return NULL;
+		if (to_leaf(node)->hash != hash)
+			return hamt_merge(hamt_get(node), leaf, shift);
+
+		pr_dbg("%s: full hash collision on '%s'\n", __func__, key);
+		coll = hamt_collision_new(hash, 2);
+		if (!coll) {
+			hamt_put(leaf);
+			return NULL;
+		}
+		coll->leaf[0] = to_leaf(hamt_get(node));
+		coll->leaf[1] = to_leaf(leaf);
+		return &coll->node;
+
+	case HAMT_COLLISION:
+		coll = to_collision(node);
+		if (coll->hash == hash)
+			return hamt_insert_collision(coll, hash, key, data, added);
+		*added = 1;
+		leaf = hamt_leaf_new(hash, key, data);
+		if (!leaf)
+			return NULL;
+		return hamt_merge(hamt_get(node), leaf, shift);
+
+	default:
+		branch = to_branch(node);
+		bit = 1u << ((hash >> shift) & HAMT_MASK);
+		pos = __builtin_popcount(branch->bitmap & (bit - 1));
+		n = __builtin_popcount(branch->bitmap);
+
+		if (branch->bitmap & bit)
+			child = hamt_insert(branch->child[pos], shift + HAMT_BITS, hash, key, data, added);
+		else
+			child = hamt_insert(NULL, shift + HAMT_BITS, hash, key, data, added);
+		if (!child)
+			return NULL;
+
+		copy = hamt_branch_new(branch->bitmap | bit);
+		if (!copy) {
+			hamt_put(child);
+			return NULL;
+		}
+		if (branch->bitmap & bit) {
+			for (i = 0; i < n; i++)
+				copy->child[i] = i == pos ? child : hamt_get(branch->child[i]);
+		} else {
+			for (i = 0; i < pos; i++)
+				copy->child[i] = hamt_get(branch->child[i]);
+			copy->child[pos] = child;
+			for (i = pos; i < n; i++)
+				copy->child[i + 1] = hamt_get(branch->child[i]);
+		}
+		return &copy->node;
+	}
+}
+
+/*
+ * Returns, in *out, a new version of the subtrie at node without key, which
+ * must be present. Branches left with a single leaf or collision child are
+ * collapsed into that child.
+ */
+static int hamt_delete(struct hamt_node *node, unsigned shift, uint64_t hash,
+		       const char *key, struct hamt_node **out)
+{
+	struct hamt_branch *branch, *copy;
+	struct hamt_collision *coll, *ccopy;
+	struct hamt_node *child;
+	uint32_t bit;
+	unsigned i, j, n, pos;
+	int ret;
+
+	switch (node->kind) {
+	case HAMT_LEAF:
+		*out = NULL;
+		return 0;
+
+	case HAMT_COLLISION:
+		coll = to_collision(node);
+		for (pos = 0; pos < coll->n; pos++)
+			if (strcmp(coll->leaf[pos]->key, key)==0)
+				break;
+		if (coll->n == 2) {
+			*out = hamt_get(&coll->leaf[!pos]->node);
+			return 0;
+		}
+		ccopy = hamt_collision_new(hash, coll->n - 1);
+		if (!ccopy)
+			return -ENOMEM;
+		for (i = 0, j = 0; i < coll->n; i++)
+			if (i != pos)
+				ccopy->leaf[j++] = to_leaf(hamt_get(&coll->leaf[i]->node));
+		*out = &ccopy->node;
+		return 0;
+
+	default:
+		branch = to_branch(node);
+		bit = 1u << ((hash >> shift) & HAMT_MASK);
+		pos = __builtin_popcount(branch->bitmap & (bit - 1));
+		n = __builtin_popcount(branch->bitmap);
+
+		ret = hamt_delete(branch->child[pos], shift + HAMT_BITS, hash, key, &child);
+		if (ret)
+			return ret;
+
+		if (!child) {
+			if (n == 1) {
+				*out = NULL;
+				return 0;
+			}
+			if (n == 2 && branch->child[!pos]->kind != HAMT_BRANCH) {
+				*out = hamt_get(branch->child[!pos]);
+				return 0;
+			}
+			copy = hamt_branch_new(branch->bitmap & ~bit);
+			if (!copy)
+				return -ENOMEM;
+			for (i = 0, j = 0; i < n; i++)
+				if (i != pos)
+					copy->child[j++] = hamt_get(branch->child[i]);
+		} else {
+			if (n == 1 && child->kind != HAMT_BRANCH) {
+				*out = child;
+				return 0;
+			}
+			copy = hamt_branch_new(branch->bitmap);
+			if (!copy) {
+				hamt_put(child);
+				return -ENOMEM;
+			}
+			for (i = 0; i < n; i++)
+				copy->child[i] = i == pos ? child : hamt_get(branch->child[i]);
+		}
+		*out = &copy->node;
+		return 0;
+	}
+}
+
+static struct hamt_leaf *hamt_search_leaf(const struct hamt *hamt, const char *key, uint64_t hash)
+{
+	struct hamt_node *node = hamt->root;
+	struct hamt_branch *branch;
+	struct hamt_collision *coll;
+	unsigned shift = 0, i;
+	uint32_t bit;
+
+	while (node) {
+		switch (node->kind) {
+		case HAMT_LEAF:
+			if (to_leaf(node)->hash == hash && strcmp(to_leaf(node)->key, key)==0)
+				return to_leaf(node);
+			return NULL;
+		case HAMT_COLLISION:
+			coll = to_collision(node);
+			if (coll->hash != hash)
+				return NULL;
+			for (i = 0; i < coll->n; i++)
+				if (strcmp(coll->leaf[i]->key, key)==0)
+					return coll->leaf[i];
+			return NULL;
+		default:
+			branch = to_branch(node);
+			bit = 1u << ((hash >> shift) & HAMT_MASK);
+			if (!(branch->bitmap & bit))
+				return NULL;
+			node = branch->child[__builtin_popcount(branch->bitmap & (bit - 1))];
+			shift += HAMT_BITS;
+		}
+	}
+	return NULL;
+}
+
+int hamt_init(struct hamt *hamt, const char *options, ...)
+{
+	va_list ap;
+	int ret;
+
+	memset(hamt, 0, sizeof(*hamt));
+	va_start(ap, options);
+	ret = parse_opts(hamt, options, ap);
+	va_end(ap);
+	if (ret)
+		return ret;
+
+	if (!hamt->hash)
+		hamt->hash = fnv1a_hash64;
+	return 0;
+}
+
+void hamt_dest(struct hamt *hamt)
+{
+	hamt_put(hamt->root);
+	hamt->root = NULL;
+	hamt->n_entries = 0;
+}
+
+void hamt_snapshot(struct hamt *dst, const struct hamt *src)
+{
+	*dst = *src;
+	hamt_get(dst->root);
+}
+
+int hamt_update(struct hamt *hamt, const char *key, tdata_t data)
+{
+	struct hamt_node *root;
+	int added = 0;
+
+	root = hamt_insert(hamt->root, 0, hamt_hashkey(hamt, key), key, data, &added);
+	if (!root)
+		return -ENOMEM;
+
+	hamt_put(hamt->root);
+	hamt->root = root;
+	hamt->n_entries += added;
+	return 0;
+}
+
+int hamt_update_only(struct hamt *hamt, const char *key, tdata_t data)
+{
+	if (!hamt_search_leaf(hamt, key, hamt_hashkey(hamt, key)))
+		return -1;
+	return hamt_update(hamt, key, data);
+}
+
+int hamt_remove(struct hamt *hamt, const char *key)
+{
+	uint64_t hash = hamt_hashkey(hamt, key);
+	struct hamt_node *root;
+	int ret;
+
+	if (!hamt_search_leaf(hamt, key, hash))
+		return -1;
+
+	ret = hamt_delete(hamt->root, 0, hash, key, &root);
+	if (ret)
+		return ret;
+
+	hamt_put(hamt->root);
+	hamt->root = root;
+	hamt->n_entries--;
+	return 0;
+}
+
+int hamt_search(const struct hamt *hamt, const char *key, tdata_t *data)
+{
+	struct hamt_leaf *leaf = hamt_search_leaf(hamt, key, hamt_hashkey(hamt, key));
+
+	if (!leaf)
+		return -1;
+
+	*data = leaf->data;
+	return 0;
+}
@@ -0,0 +1,119 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <tools/hash.h>
+
+uint64_t hash_fnv1a64(const char *key, uint64_t seed)
+{
+	uint64_t h = 0xcbf29ce484222325ull ^ seed;
+	const unsigned char *c;
+
+	for (c = (const unsigned char *)key; *c; c++)
+		h = (h ^ *c) *0x100000001b3ull;
+
+	return h;
+}
+
+#define ROTL64(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND(v0, v1, v2, v3)				\
+	do {							\
+		v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0;	\
+		v0 = ROTL64(v0, 32);				\
+		v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2;	\
+		v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0;	\
+		v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2;	\
+		v2 = ROTL64(v2, 32);				\
+	} while (0)
+
+static uint64_t load_le64(const unsigned char *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+uint64_t hash_siphash13(const void *data, size_t len, const uint64_t key[2])
+{
+	const unsigned char *p = data, *end = p + (len & ~(size_t)7);
+	uint64_t v0 = 0x736f6d6570736575ull ^ key[0];
+	uint64_t v1 = 0x646f72616e646f6dull ^ key[1];
+	uint64_t v2 = 0x6c7967656e657261ull ^ key[0];
+	uint64_t v3 = 0x7465646279746573ull ^ key[1];
+	uint64_t m, b = (uint64_t)len << 56;
+
+	for (; p != end; p += 8) {
+		m = load_le64(p);
+		v3 ^= m;
+		SIPROUND(v0, v1, v2, v3);
+		v0 ^= m;
+	}
+
+	switch (len & 7) {
+	case 7: b |= (uint64_t)p[6] << 48;	/* fall through */
+	case 6: b |= (uint64_t)p[5] << 40;	/* fall through */
+	case 5: b |= (uint64_t)p[4] << 32;	/* fall through */
+	case 4: b |= (uint64_t)p[3] << 24;	/* fall through */
+	case 3: b |= (uint64_t)p[2] << 16;	/* fall through */
+	case 2: b |= (uint64_t)p[1] << 8;	/* fall through */
+	case 1: b |= (uint64_t)p[0];
+	}
+
+	v3 ^= b;
+	SIPROUND(v0, v1, v2, v3);
+	v0 ^= b;
+
+	v2 ^= 0xff;
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+void hash_random_seed(uint64_t seed[2])
+{
+	struct timespec ts;
+	FILE *f;
+
+	if (getrandom(seed, 2*sizeof(*seed), GRND_NONBLOCK) == 2*sizeof(*seed))
+		return;
+
+	f = fopen("/dev/urandom", "r");
+	if (f) {
+		if (fread(seed, sizeof(*seed), 2, f) == 2) {
+			fclose(f);
+			return;
+		}
+		fclose(f);
+	}
+
+	/* last resort, not secret but at least not the same in every process */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	seed[0] = ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)ts.tv_nsec ^ (uintptr_t)&ts;
+	seed[1] = hash_siphash13(&ts, sizeof(ts), seed) ^ (uint64_t)getpid();
+}
@@ -0,0 +1,156 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <tools/heap.h>
+#include <tools/scoped.h>
+
+#define DHEAP_ARITY     4
+#define DHEAP_LINE      64
+#define DHEAP_SIZE_MIN  16
+
+/*
+ * The children of item i are items 4i+1 to 4i+4. Starting the array one item
+ * short of a cache line boundary puts every such group of four 16 byte items
+ * on a line of its own.
+ */
+#define DHEAP_OFFSET    (DHEAP_LINE - sizeof(struct dheap_item))
+
+static void parse_opt(size_t *size, char *option, va_list ap)
+{
+	if (strcmp(option, "size")==0)
+		*size = va_arg(ap, size_t);
+}
+
+static int parse_opts(size_t *size, const char *options, va_list ap)
+{
+	char *opts __scoped = scoped_strdup(options);
+	char *tmp = opts, *opt, *delim = " ";
+
+	if (!options)
+		return 0;
+	if (!opts)
+		return -ENOMEM;
+
+	for (opt = strtok_r(tmp, delim, &tmp); opt; opt = strtok_r(tmp, delim, &tmp)) {
+		parse_opt(size, opt, ap);
+	}
+	return 0;
+}
+
+static int dheap_grow(struct dheap *heap, size_t cap)
+{
+	size_t bytes = DHEAP_OFFSET + cap*sizeof(struct dheap_item);
+	void *mem;
+
+	bytes = (bytes + DHEAP_LINE - 1) & ~(size_t)(DHEAP_LINE - 1);
+	mem = aligned_alloc(DHEAP_LINE, bytes);
+	if (!mem)
+		return -ENOMEM;
+	if (heap->n)
+		memcpy((char *)mem + DHEAP_OFFSET, heap->items, heap->n*sizeof(struct dheap_item));
+	free(heap->mem);
+	heap->mem = mem;
+	heap->items = (struct dheap_item *)((char *)mem + DHEAP_OFFSET);
+	heap->cap = cap;
+	return 0;
+}
+
+int dheap_init(struct dheap *heap, const char *options, ...)
+{
+	size_t size = DHEAP_SIZE_MIN;
+	va_list ap;
+	int ret;
+
+	memset(heap, 0, sizeof(*heap));
+	va_start(ap, options);
+	ret = parse_opts(&size, options, ap);
+	va_end(ap);
+	if (ret)
+		return ret;
+
+	if (size < DHEAP_SIZE_MIN)
+		size = DHEAP_SIZE_MIN;
+	if (size > (SIZE_MAX - DHEAP_LINE)/sizeof(struct dheap_item))
+		return -EINVAL;
+	return dheap_grow(heap, size);
+}
+
+void dheap_dest(struct dheap *heap)
+{
+	free(heap->mem);
+	heap->mem = NULL;
+	heap->items = NULL;
+	heap->n = heap->cap = 0;
+}
+
+int dheap_push(struct dheap *heap, uint64_t key, intptr_t data)
+{
+	struct dheap_item *items;
+	size_t i, parent;
+
+	if (heap->n == heap->cap) {
+		if (heap->cap > (SIZE_MAX - DHEAP_LINE)/sizeof(struct dheap_item)/2 ||
+		    dheap_grow(heap, 2*heap->cap))
+			return -ENOMEM;
+	}
+
+	/* move parents down into the hole until the key fits */
+	items = heap->items;
+	for (i = heap->n++; i; i = parent) {
+		parent = (i - 1)/DHEAP_ARITY;
+		if (items[parent].key <= key)
+			break;
+		items[i] = items[parent];
+	}
+	items[i].key = key;
+	items[i].data = data;
+	return 0;
+}
+
+int dheap_pop(struct dheap *heap, uint64_t *key, intptr_t *data)
+{
+	struct dheap_item *items = heap->items, last;
+	size_t i, c, min, end, n;
+
+	if (!heap->n)
+		return -1;
+	if (key)
+		*key = items[0].key;
+	if (data)
+		*data = items[0].data;
+
+	n = --heap->n;
+	last = items[n];
+	/* move the least child up into the hole until the last item fits there */
+	for (i = 0; (c = DHEAP_ARITY*i + 1) < n; i = min) {
+		end = c + DHEAP_ARITY < n ? c + DHEAP_ARITY : n;
+		for (min = c++; c < end; c++)
+			if (items[c].key < items[min].key)
+				min = c;
+		if (last.key <= items[min].key)
+			break;
+		items[i] = items[min];
+	}
+	items[i] = last;
+	return 0;
+}
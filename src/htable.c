@@ -0,0 +1,198 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <internal/printing.h>
+#include <internal/hash.h>
+#include <tools/htable.h>
+#include <tools/zalloc.h>
+#include <tools/scoped.h>
+
+#define ABSOLUTE_MAX    (1<<30)
+#define E_MAX_DEFAULT   (1<<13)
+#define E_SIZE_DEFAULT  (1<<10)
+#define GOLDEN_RATIO_32 0x61C88647
+
+/* bucket from hash: multiplicative hash, keeps the high bits */
+static size_t bfh(const struct htable *ht, unsigned hash)
+{
+	return (unsigned)(hash * GOLDEN_RATIO_32) >> (32 - ht->b_bits);
+}
+
+/* bits from size: smallest power of two holding size entries */
+static unsigned bits_from_size(size_t size)
+{
+	unsigned bits = 1;
+
+	while (((size_t)1 << bits) < size)
+		bits++;
+	return bits;
+}
+
+static void parse_opt(struct htable *ht, size_t *size, char *option, va_list ap)
+{
+	if (strcmp(option, "max_size")==0) {
+		ht->e_max = va_arg(ap, size_t);
+		if (ht->e_max > ABSOLUTE_MAX)
+			ht->e_max = ABSOLUTE_MAX;
+	} else if (strcmp(option, "size")==0) {
+		*size = va_arg(ap, size_t);
+	} else if (strcmp(option, "with_hash")==0) {
+		ht->hash = va_arg(ap, table_hash_func);
+	} else if (strcmp(option, "with_cmp")==0) {
+		ht->cmp = va_arg(ap, htable_cmp_func);
+	}
+}
+
+static int parse_opts(struct htable *ht, size_t *size, const char *options, va_list ap)
+{
+	char *opts __scoped = scoped_strdup(options);
+	char *tmp = opts, *opt, *delim = " ";
+
+	if (!options)
+		return 0;
+	if (!opts)
+		return -ENOMEM;
+
+	for (opt = strtok_r(tmp, delim, &tmp); opt; opt = strtok_r(tmp, delim, &tmp)) {
+		parse_opt(ht, size, opt, ap);
+	}
+	return 0;
+}
+
+int htable_init(struct htable *ht, htable_key_func key, const char *options, ...)
+{
+	size_t size = 0;
+	va_list ap;
+	int ret;
+
+	if (!key)
+		return -EINVAL;
+
+	memset(ht, 0, sizeof(*ht));
+	ht->key = key;
+	ht->hash = fnv1a_hash;
+	ht->cmp = strcmp;
+
+	va_start(ap, options);
+	ret = parse_opts(ht, &size, options, ap);
+	va_end(ap);
+	if (ret)
+		return ret;
+
+	if (!size) {
+		/* like table_init(), a max_size below the default size lowers it */
+		size = E_SIZE_DEFAULT;
+		if (ht->e_max && ht->e_max < size)
+			size = ht->e_max;
+	}
+	/* max_size is capped in parse_opt(), a size above the cap would lift it */
+	if (size > ABSOLUTE_MAX)
+		return -EINVAL;
+	if (!ht->e_max)
+		ht->e_max = size < E_MAX_DEFAULT ? E_MAX_DEFAULT : size;
+	if (ht->e_max < size)
+		return -EINVAL;
+
+	ht->b_bits = bits_from_size(size);
+	ht->buckets = calloc(htable_buckets(ht), sizeof(*ht->buckets));
+	if (!ht->buckets)
+		return -ENOMEM;
+	return 0;
+}
+
+void htable_dest(struct htable *ht)
+{
+	free(ht->buckets);
+	ht->buckets = NULL;
+	ht->n_entries = 0;
+}
+
+static int htable_resize(struct htable *ht)
+{
+	struct hlist_head *buckets, *old = ht->buckets;
+	struct htable_node *pos;
+	struct hlist_node *tmp;
+	size_t i, n_old = htable_buckets(ht);
+
+	if (ht->n_entries < n_old || n_old >= ht->e_max)
+		return 0;
+
+	pr_dbg("%s: resizing to %zu buckets\n", __func__, n_old*2);
+	buckets = calloc(n_old*2, sizeof(*buckets));
+	if (!buckets)
+		return -ENOMEM;
+
+	ht->buckets = buckets;
+	ht->b_bits++;
+	for (i = 0; i < n_old; i++)
+		hlist_for_each_entry_safe(pos, tmp, &old[i], node)
+			hlist_add_head(&pos->node, &buckets[bfh(ht, pos->hash)]);
+
+	free(old);
+	return 0;
+}
+
+static struct htable_node *htable_search_hashed(struct htable *ht, const char *key, unsigned hash)
+{
+	struct htable_node *pos;
+
+	hlist_for_each_entry(pos, &ht->buckets[bfh(ht, hash)], node)
+		if (pos->hash == hash && ht->cmp(ht->key(pos), key)==0)
+			return pos;
+
+	return NULL;
+}
+
+struct htable_node *htable_search(struct htable *ht, const char *key)
+{
+	return htable_search_hashed(ht, key, ht->hash(key));
+}
+
+int htable_insert(struct htable *ht, struct htable_node *node)
+{
+	const char *key = ht->key(node);
+	unsigned hash = ht->hash(key);
+	int ret;
+
+	if (htable_search_hashed(ht, key, hash))
+		return -EEXIST;
+	if (ht->n_entries >= ht->e_max)
+		return -ENOSPC;
+
+	ret = htable_resize(ht);
+	if (ret)
+		return ret;
+
+	node->hash = hash;
+	hlist_add_head(&node->node, &ht->buckets[bfh(ht, hash)]);
+	ht->n_entries++;
+	return 0;
+}
+
+void htable_remove(struct htable *ht, struct htable_node *node)
+{
+	if (hlist_unhashed(&node->node))
+		return;
+
+	hlist_del_init(&node->node);
+	ht->n_entries--;
+}
@@ -0,0 +1,645 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <internal/printing.h>
+#include <internal/hash.h>
+#include <tools/lftable.h>
+#include <tools/hash.h>
+#include <tools/zalloc.h>
+#include <tools/scoped.h>
+
+#define E_MAX_DEFAULT       (1<<13)
+#define E_SIZE_DEFAULT      (1<<10)
+#define LOAD_FACTOR_DEFAULT 2.0
+#define LFT_CACHE_LINE      64
+#define LFT_ADVANCE_EVERY   64	/* retirements between attempts to advance the epoch */
+#define LFT_COUNT_EVERY     128	/* inserts between checks of the load */
+
+struct lft_node {
+	struct lft_node *next;		/* bit 0 set once the node is removed */
+	struct lft_node *retired;	/* in a limbo list, once unlinked */
+	uint64_t so_key;		/* split-order key, odd for entries and even for sentinels */
+	tdata_t data;
+	char key[];
+};
+
+/* nodes retired while the global epoch was epoch */
+struct lft_limbo {
+	uint64_t epoch;
+	struct lft_node *head;
+};
+
+struct lft_thread {
+	struct lft_thread *next;
+	uint64_t epoch;			/* (epoch << 1) | 1 inside an operation, 0 outside */
+	int in_use;
+	unsigned n_retired;
+	unsigned n_inserts;
+	int64_t count;			/* entries this record inserted minus those it removed */
+	struct lft_limbo limbo[3];
+} __attribute__((aligned(LFT_CACHE_LINE)));
+
+#define lft_marked(p)  ((uintptr_t)(p) & 1)
+#define lft_mark(p)    ((struct lft_node *)((uintptr_t)(p) | 1))
+#define lft_unmark(p)  ((struct lft_node *)((uintptr_t)(p) & ~(uintptr_t)1))
+
+#define lft_load(p)        __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define lft_store(p, v)    __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define lft_cas(p, old, v) ({ __typeof__(*(p)) ____old = (old); \
+	__atomic_compare_exchange_n(p, &____old, v, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE); })
+
+static void parse_opt(struct lftable *t, size_t *size, int *seeded, char *option, va_list ap)
+{
+	if (strcmp(option, "max_size")==0) {
+		t->e_max = va_arg(ap, size_t);
+	} else if (strcmp(option, "size")==0) {
+		*size = va_arg(ap, size_t);
+	} else if (strcmp(option, "with_hash64")==0) {
+		t->hash64 = va_arg(ap, table_hash64_func);
+	} else if (strcmp(option, "seed")==0) {
+		t->seed = va_arg(ap, uint64_t);
+		*seeded = 1;
+	} else if (strcmp(option, "load_factor")==0) {
+		t->load_factor = va_arg(ap, double);
+	}
+}
+
+static int parse_opts(struct lftable *t, size_t *size, int *seeded, const char *options, va_list ap)
+{
+	char *opts __scoped = scoped_strdup(options);
+	char *tmp = opts, *opt, *delim = " ";
+
+	if (!options)
+		return 0;
+	if (!opts)
+		return -ENOMEM;
+
+	for (opt = strtok_r(tmp, delim, &tmp); opt; opt = strtok_r(tmp, delim, &tmp)) {
+		parse_opt(t, size, seeded, opt, ap);
+	}
+	return 0;
+}
+
+static uint64_t reverse64(uint64_t x)
+{
+	x = (x >> 1 & 0x5555555555555555ull) | (x & 0x5555555555555555ull) << 1;
+	x = (x >> 2 & 0x3333333333333333ull) | (x & 0x3333333333333333ull) << 2;
+	x = (x >> 4 & 0x0f0f0f0f0f0f0f0full) | (x & 0x0f0f0f0f0f0f0f0full) << 4;
+	return __builtin_bswap64(x);
+}
+
+/* the hash, mixed so that its low bits, which pick the bucket, are as good as any */
+static uint64_t lft_hashkey(struct lftable *t, const char *key)
+{
+	return mix64(t->hash64 ? t->hash64(key) : hash_fnv1a64(key, t->seed));
+}
+
+static uint64_t lft_so_key(uint64_t hash)
+{
+	return reverse64(hash) | 1;
+}
+
+static uint64_t lft_sentinel_key(uint64_t bucket)
+{
+	return reverse64(bucket);
+}
+
+static unsigned lft_bits(struct lftable *t, size_t n)
+{
+	unsigned bits = 1;
+
+	while (bits < LFT_SEGMENTS && (double)((size_t)1 << bits)*t->load_factor < n)
+		bits++;
+	return bits;
+}
+
+static struct lft_node *lft_new_node(uint64_t so_key, const char *key, tdata_t data)
+{
+	size_t len = key ? strlen(key) + 1 : 1;
+	struct lft_node *node = malloc(sizeof(*node) + len);
+
+	if (!node)
+		return NULL;
+	node->next = NULL;
+	node->retired = NULL;
+	node->so_key = so_key;
+	node->data = data;
+	if (key)
+		memcpy(node->key, key, len);
+	else
+		node->key[0] = '\0';
+	return node;
+}
+
+static void lft_free_list(struct lft_node *node)
+{
+	struct lft_node *next;
+
+	for (; node; node = next) {
+		next = node->retired;
+		free(node);
+	}
+}
+
+static void lft_thread_exit(void *arg)
+{
+	struct lft_thread *th = arg;
+
+	lft_store(&th->in_use, 0);
+}
+
+/* the calling thread's record, taken over from an exited thread if possible */
+static struct lft_thread *lft_thread(struct lftable *t)
+{
+	struct lft_thread *th = pthread_getspecific(t->thread_key), *head;
+
+	if (th)
+		return th;
+	for (th = lft_load(&t->threads); th; th = th->next)
+		if (!lft_load(&th->in_use) && lft_cas(&th->in_use, 0, 1))
+			goto found;
+
+	th = aligned_alloc(LFT_CACHE_LINE, sizeof(*th));
+	if (!th)
+		return NULL;
+	memset(th, 0, sizeof(*th));
+	th->in_use = 1;
+	do {
+		head = lft_load(&t->threads);
+		th->next = head;
+	} while (!lft_cas(&t->threads, head, th));
+found:
+	if (pthread_setspecific(t->thread_key, th)) {
+		lft_store(&th->in_use, 0);
+		return NULL;
+	}
+	return th;
+}
+
+/*
+ * Epoch-based reclamation. A node unlinked while the global epoch is e may
+ * still be read by operations that started before, which announced an epoch
+ * of at most e. The epoch only advances once every operation in progress has
+ * announced the current one, so when it reaches e + 2 all of those are over
+ * and the node can be freed.
+ */
+static void lft_enter(struct lftable *t, struct lft_thread *th)
+{
+	uint64_t e = __atomic_load_n(&t->epoch, __ATOMIC_RELAXED);
+	int i;
+
+	__atomic_store_n(&th->epoch, e << 1 | 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	for (i = 0; i < 3; i++) {
+		if (th->limbo[i].head && th->limbo[i].epoch + 2 <= e) {
+			lft_free_list(th->limbo[i].head);
+			th->limbo[i].head = NULL;
+		}
+	}
+}
+
+static void lft_exit(struct lft_thread *th)
+{
+	lft_store(&th->epoch, 0);
+}
+
+static void lft_try_advance(struct lftable *t)
+{
+	uint64_t e = __atomic_load_n(&t->epoch, __ATOMIC_RELAXED), ep;
+	struct lft_thread *th;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	for (th = lft_load(&t->threads); th; th = th->next) {
+		ep = __atomic_load_n(&th->epoch, __ATOMIC_RELAXED);
+		if ((ep & 1) && ep >> 1 != e)
+			return;
+	}
+	__atomic_compare_exchange_n(&t->epoch, &e, e + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+static void lft_retire(struct lftable *t, struct lft_thread *th, struct lft_node *node)
+{
+	uint64_t e = __atomic_load_n(&t->epoch, __ATOMIC_SEQ_CST);
+	struct lft_limbo *limbo = &th->limbo[e % 3];
+
+	/* a list left from three or more epochs ago is safe by now */
+	if (limbo->head && limbo->epoch != e) {
+		lft_free_list(limbo->head);
+		limbo->head = NULL;
+	}
+	limbo->epoch = e;
+	node->retired = limbo->head;
+	limbo->head = node;
+	if (++th->n_retired >= LFT_ADVANCE_EVERY) {
+		th->n_retired = 0;
+		lft_try_advance(t);
+	}
+}
+
+static int lft_cmp(const struct lft_node *node, uint64_t so_key, const char *key)
+{
+	if (node->so_key != so_key)
+		return node->so_key < so_key ? -1 : 1;
+	/* equal split-order keys of a sentinel are the same sentinel */
+	return key ? strcmp(node->key, key) : 0;
+}
+
+/*
+ * Searches the list from the sentinel head for (so_key, key), the way of
+ * Harris and Michael. Sets *prevp to the link pointing at *curp, the first
+ * node not ordered before the one searched for, and unlinks and retires the
+ * removed nodes passed on the way. Returns 1 if *curp is the one searched for.
+ */
+static int lft_find(struct lftable *t, struct lft_thread *th, struct lft_node *head,
+		    uint64_t so_key, const char *key, struct lft_node ***prevp, struct lft_node **curp)
+{
+	struct lft_node **prev, *cur, *next;
+	int cmp;
+
+retry:
+	prev = &head->next;
+	cur = lft_load(prev);
+	for (;;) {
+		if (!cur) {
+			cmp = 1;
+			break;
+		}
+		next = lft_load(&cur->next);
+		if (lft_marked(next)) {
+			if (!lft_cas(prev, cur, lft_unmark(next)))
+				goto retry;
+			lft_retire(t, th, cur);
+			cur = lft_unmark(next);
+			continue;
+		}
+		if (lft_load(prev) != cur)
+			goto retry;
+		cmp = lft_cmp(cur, so_key, key);
+		if (cmp >= 0)
+			break;
+		prev = &cur->next;
+		cur = next;
+	}
+	*prevp = prev;
+	*curp = cur;
+	return cmp == 0;
+}
+
+/* the slot of bucket b in its segment, allocating the segment if needed */
+static struct lft_node **lft_slot(struct lftable *t, uint64_t b)
+{
+	unsigned s = b < 2 ? 0 : 63 - __builtin_clzll(b);
+	size_t size = s ? (size_t)1 << s : 2, idx = s ? b - ((uint64_t)1 << s) : b;
+	struct lft_node **seg = lft_load(&t->segments[s]), **new;
+
+	if (!seg) {
+		new = calloc(size, sizeof(*new));
+		if (!new)
+			return NULL;
+		if (lft_cas(&t->segments[s], NULL, new)) {
+			seg = new;
+		} else {
+			free(new);
+			seg = lft_load(&t->segments[s]);
+		}
+	}
+	return &seg[idx];
+}
+
+/*
+ * Returns the sentinel of bucket b, first inserting it behind the sentinel of
+ * its parent, the bucket b was split from, if no thread has yet. On allocation
+ * failure the parent's sentinel is returned instead: the list is ordered, so
+ * starting a search further back only makes it longer.
+ */
+static struct lft_node *lft_bucket(struct lftable *t, struct lft_thread *th, uint64_t b)
+{
+	struct lft_node **slot = lft_slot(t, b), *sentinel, *parent, **prev, *cur;
+
+	if (slot && (sentinel = lft_load(slot)))
+		return sentinel;
+
+	parent = lft_bucket(t, th, b & ~((uint64_t)1 << (63 - __builtin_clzll(b))));
+	if (!slot)
+		return parent;
+	sentinel = lft_new_node(lft_sentinel_key(b), NULL, 0);
+	if (!sentinel)
+		return parent;
+
+	for (;;) {
+		if (lft_find(t, th, parent, sentinel->so_key, NULL, &prev, &cur)) {
+			/* another thread got there first, and the sentinel was never visible */
+			free(sentinel);
+			sentinel = cur;
+			break;
+		}
+		sentinel->next = cur;
+		if (lft_cas(prev, cur, sentinel))
+			break;
+	}
+	lft_cas(slot, NULL, sentinel);
+	return sentinel;
+}
+
+static struct lft_node *lft_head(struct lftable *t, struct lft_thread *th, uint64_t hash)
+{
+	unsigned bits = __atomic_load_n(&t->b_bits, __ATOMIC_RELAXED);
+
+	return lft_bucket(t, th, hash & (((uint64_t)1 << bits) - 1));
+}
+
+size_t lftable_entries(struct lftable *table)
+{
+	struct lft_thread *th;
+	int64_t n = 0;
+
+	for (th = lft_load(&table->threads); th; th = th->next)
+		n += __atomic_load_n(&th->count, __ATOMIC_RELAXED);
+	return n > 0 ? n : 0;
+}
+
+/* counts the entries now and then, and doubles the buckets once they are too loaded */
+static void lft_check_load(struct lftable *t, struct lft_thread *th)
+{
+	unsigned bits;
+	size_t n;
+
+	if (++th->n_inserts % LFT_COUNT_EVERY)
+		return;
+	n = lftable_entries(t);
+	__atomic_store_n(&t->n_approx, n, __ATOMIC_RELAXED);
+	bits = __atomic_load_n(&t->b_bits, __ATOMIC_RELAXED);
+	if (bits < t->b_bits_max && (double)n > t->load_factor*(double)((size_t)1 << bits)) {
+		pr_dbg("%s: %zu entries, growing to %zu buckets\n", __func__, n, (size_t)2 << bits);
+		lft_cas(&t->b_bits, bits, bits + 1);
+	}
+}
+
+/*
+ * Whether another entry would take the table past max_size. The count of the
+ * last check, plus what this thread inserted since its own, overestimates the
+ * entries when it is not exact, so only then are they counted again; this
+ * thread never overshoots, others by at most the inserts they made since
+ * their last check.
+ */
+static int lft_full(struct lftable *t, struct lft_thread *th)
+{
+	size_t n = __atomic_load_n(&t->n_approx, __ATOMIC_RELAXED) + th->n_inserts % LFT_COUNT_EVERY;
+
+	if (n < t->e_max)
+		return 0;
+	n = lftable_entries(t);
+	__atomic_store_n(&t->n_approx, n, __ATOMIC_RELAXED);
+	return n >= t->e_max;
+}
+
+static int vlftable_init(struct lftable *t, const char *options, va_list ap)
+{
+	size_t size = 0;
+	uint64_t seed[2];
+	int seeded = 0, ret;
+
+	memset(t, 0, sizeof(*t));
+	ret = parse_opts(t, &size, &seeded, options, ap);
+	if (ret)
+		return ret;
+
+	if (!size) {
+		/* like table_init(), a max_size below the default size lowers it */
+		size = E_SIZE_DEFAULT;
+		if (t->e_max && t->e_max < size)
+			size = t->e_max;
+	}
+	if (!t->e_max)
+		t->e_max = size < E_MAX_DEFAULT ? E_MAX_DEFAULT : size;
+	if (t->e_max < size)
+		return -EINVAL;
+	if (!t->load_factor)
+		t->load_factor = LOAD_FACTOR_DEFAULT;
+	if (!(t->load_factor > 0))
+		return -EINVAL;
+	if (!seeded) {
+		hash_random_seed(seed);
+		t->seed = seed[0];
+	}
+	t->b_bits = lft_bits(t, size);
+	t->b_bits_max = lft_bits(t, t->e_max);
+
+	t->segments[0] = calloc(2, sizeof(*t->segments[0]));
+	if (!t->segments[0])
+		return -ENOMEM;
+	/* bucket 0's sentinel heads the list */
+	t->segments[0][0] = lft_new_node(lft_sentinel_key(0), NULL, 0);
+	if (!t->segments[0][0]) {
+		free(t->segments[0]);
+		return -ENOMEM;
+	}
+	ret = pthread_key_create(&t->thread_key, lft_thread_exit);
+	if (ret) {
+		free(t->segments[0][0]);
+		free(t->segments[0]);
+		return -ret;
+	}
+	return 0;
+}
+
+int lftable_init(struct lftable *table, const char *options, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, options);
+	ret = vlftable_init(table, options, ap);
+	va_end(ap);
+	return ret;
+}
+
+void lftable_dest(struct lftable *table)
+{
+	struct lft_node *node, *next;
+	struct lft_thread *th, *tmp;
+	unsigned s;
+	int i;
+
+	pthread_key_delete(table->thread_key);
+	for (node = table->segments[0][0]; node; node = next) {
+		next = lft_unmark(node->next);
+		free(node);
+	}
+	for (th = table->threads; th; th = tmp) {
+		tmp = th->next;
+		for (i = 0; i < 3; i++)
+			lft_free_list(th->limbo[i].head);
+		free(th);
+	}
+	for (s = 0; s < LFT_SEGMENTS; s++)
+		free(table->segments[s]);
+	memset(table, 0, sizeof(*table));
+}
+
+struct lftable *lftable_alloc(const char *options, ...)
+{
+	struct lftable *table = zalloc(sizeof(*table));
+	va_list ap;
+	int ret;
+
+	if (!table)
+		return NULL;
+
+	va_start(ap, options);
+	ret = vlftable_init(table, options, ap);
+	va_end(ap);
+	if (ret) {
+		free(table);
+		return NULL;
+	}
+	return table;
+}
+
+void lftable_free(struct lftable *table)
+{
+	lftable_dest(table);
+	free(table);
+}
+
+int lftable_update(struct lftable *table, const char *key, tdata_t data)
+{
+	struct lft_thread *th = lft_thread(table);
+	struct lft_node *head, **prev, *cur, *node = NULL;
+	uint64_t so_key;
+	int ret = 0, inserted = 0;
+
+	if (!th)
+		return -ENOMEM;
+	so_key = lft_so_key(lft_hashkey(table, key));
+
+	lft_enter(table, th);
+	head = lft_head(table, th, reverse64(so_key));
+	for (;;) {
+		if (lft_find(table, th, head, so_key, key, &prev, &cur)) {
+			__atomic_store_n(&cur->data, data, __ATOMIC_RELEASE);
+			break;
+		}
+		if (!node) {
+			if (lft_full(table, th)) {
+				ret = -1;
+				break;
+			}
+			node = lft_new_node(so_key, key, data);
+			if (!node) {
+				ret = -ENOMEM;
+				break;
+			}
+		}
+		node->next = cur;
+		if (lft_cas(prev, cur, node)) {
+			node = NULL;
+			inserted = 1;
+			break;
+		}
+	}
+	lft_exit(th);
+
+	/* inserted by another thread meanwhile */
+	free(node);
+	if (inserted) {
+		__atomic_store_n(&th->count, th->count + 1, __ATOMIC_RELAXED);
+		lft_check_load(table, th);
+	}
+	return ret;
+}
+
+int lftable_update_only(struct lftable *table, const char *key, tdata_t data)
+{
+	struct lft_thread *th = lft_thread(table);
+	struct lft_node **prev, *cur;
+	uint64_t so_key;
+	int found;
+
+	if (!th)
+		return -ENOMEM;
+	so_key = lft_so_key(lft_hashkey(table, key));
+
+	lft_enter(table, th);
+	found = lft_find(table, th, lft_head(table, th, reverse64(so_key)), so_key, key, &prev, &cur);
+	if (found)
+		__atomic_store_n(&cur->data, data, __ATOMIC_RELEASE);
+	lft_exit(th);
+	return found ? 0 : -1;
+}
+
+int lftable_search(struct lftable *table, const char *key, tdata_t *data)
+{
+	struct lft_thread *th = lft_thread(table);
+	struct lft_node **prev, *cur;
+	uint64_t so_key;
+	int found;
+
+	if (!th)
+		return -ENOMEM;
+	so_key = lft_so_key(lft_hashkey(table, key));
+
+	lft_enter(table, th);
+	found = lft_find(table, th, lft_head(table, th, reverse64(so_key)), so_key, key, &prev, &cur);
+	if (found)
+		*data = __atomic_load_n(&cur->data, __ATOMIC_ACQUIRE);
+	lft_exit(th);
+	return found ? 0 : -1;
+}
+
+int lftable_remove(struct lftable *table, const char *key)
+{
+	struct lft_thread *th = lft_thread(table);
+	struct lft_node *head, **prev, *cur, *next;
+	uint64_t so_key;
+	int ret = -1;
+
+	if (!th)
+		return -ENOMEM;
+	so_key = lft_so_key(lft_hashkey(table, key));
+
+	lft_enter(table, th);
+	head = lft_head(table, th, reverse64(so_key));
+	while (lft_find(table, th, head, so_key, key, &prev, &cur)) {
+		next = lft_load(&cur->next);
+		/* marking the node removes it, unlinking it is tidying up */
+		if (lft_marked(next) || !lft_cas(&cur->next, next, lft_mark(next)))
+			continue;
+		if (lft_cas(prev, cur, next))
+			lft_retire(table, th, cur);
+		else
+			lft_find(table, th, head, so_key, key, &prev, &cur);
+		ret = 0;
+		break;
+	}
+	lft_exit(th);
+
+	if (!ret) {
+		__atomic_store_n(&th->count, th->count - 1, __ATOMIC_RELAXED);
+		/* a full table has room again, spare the next insert the recount */
+		if (__atomic_load_n(&table->n_approx, __ATOMIC_RELAXED) >= table->e_max)
+			__atomic_store_n(&table->n_approx, lftable_entries(table), __ATOMIC_RELAXED);
+	}
+	return ret;
+}
@@ -0,0 +1,248 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/types.h>
+#include <internal/hash.h>
+#include <tools/placement.h>
+#include <tools/scoped.h>
+
+#define RING_VNODES_DEFAULT     128
+#define RING_LOAD_BOUND_DEFAULT 1.25
+
+uint32_t jump_hash(uint64_t hash, uint32_t n_buckets)
+{
+	int64_t b = -1, j = 0;
+
+	while (j < n_buckets) {
+		b = j;
+		hash = hash*2862933555777941757ull + 1;
+		j = (b + 1)*((double)(1ll << 31)/(double)((hash >> 33) + 1));
+	}
+	return b;
+}
+
+size_t rendezvous_hash(uint64_t hash, const struct rendezvous_node *nodes, size_t n)
+{
+	double score, best = 0, u;
+	size_t i, winner = n;
+
+	for (i = 0; i < n; i++) {
+		if (!(nodes[i].weight > 0))
+			continue;
+		/* uniform in (0,1), then -w/ln(u) is the score that wins in proportion to w */
+		u = ((mix64(hash ^ mix64(nodes[i].id)) >> 11) + 0.5)*0x1.0p-53;
+		score = -nodes[i].weight/log(u);
+		if (score > best) {
+			best = score;
+			winner = i;
+		}
+	}
+	return winner;
+}
+
+static void parse_opt(struct ring *ring, char *option, va_list ap)
+{
+	if (strcmp(option, "vnodes")==0)
+		ring->vnodes = va_arg(ap, unsigned);
+	else if (strcmp(option, "load_bound")==0)
+		ring->load_bound = va_arg(ap, double);
+}
+
+static int parse_opts(struct ring *ring, const char *options, va_list ap)
+{
+	char *opts __scoped = scoped_strdup(options);
+	char *tmp = opts, *opt, *delim = " ";
+
+	if (!options)
+		return 0;
+	if (!opts)
+		return -ENOMEM;
+
+	for (opt = strtok_r(tmp, delim, &tmp); opt; opt = strtok_r(tmp, delim, &tmp)) {
+		parse_opt(ring, opt, ap);
+	}
+	return 0;
+}
+
+int ring_init(struct ring *ring, const char *options, ...)
+{
+	va_list ap;
+	int ret;
+
+	memset(ring, 0, sizeof(*ring));
+	va_start(ap, options);
+	ret = parse_opts(ring, options, ap);
+	va_end(ap);
+	if (ret)
+		return ret;
+
+	if (!ring->vnodes)
+		ring->vnodes = RING_VNODES_DEFAULT;
+	if (!ring->load_bound)
+		ring->load_bound = RING_LOAD_BOUND_DEFAULT;
+	if (!(ring->load_bound >= 1))
+		return -EINVAL;
+	return 0;
+}
+
+void ring_dest(struct ring *ring)
+{
+	free(ring->nodes);
+	free(ring->points);
+	ring->nodes = NULL;
+	ring->points = NULL;
+	ring->n_nodes = ring->n_points = 0;
+}
+
+static ssize_t ring_find_node(const struct ring *ring, uint64_t id)
+{
+	size_t i;
+
+	for (i = 0; i < ring->n_nodes; i++)
+		if (ring->nodes[i].id == id)
+			return i;
+	return -1;
+}
+
+static int ring_point_cmp(const void *a, const void *b)
+{
+	const struct ring_point *x = a, *y = b;
+
+	return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+int ring_add(struct ring *ring, uint64_t id)
+{
+	size_t n = ring->n_points + ring->vnodes, cap, i;
+	struct ring_point *points;
+	struct ring_node *nodes;
+
+	if (ring_find_node(ring, id) >= 0)
+		return -EEXIST;
+
+	if (ring->n_nodes == ring->nodes_cap) {
+		cap = ring->nodes_cap ? 2*ring->nodes_cap : 8;
+		nodes = realloc(ring->nodes, cap*sizeof(*nodes));
+		if (!nodes)
+			return -ENOMEM;
+		ring->nodes = nodes;
+		ring->nodes_cap = cap;
+	}
+	points = realloc(ring->points, n*sizeof(*points));
+	if (!points)
+		return -ENOMEM;
+	ring->points = points;
+
+	for (i = 0; i < ring->vnodes; i++) {
+		points[ring->n_points + i].pos = mix64(mix64(id) + i);
+		points[ring->n_points + i].node = ring->n_nodes;
+	}
+	ring->n_points = n;
+	qsort(points, n, sizeof(*points), ring_point_cmp);
+
+	ring->nodes[ring->n_nodes].id = id;
+	ring->nodes[ring->n_nodes].load = 0;
+	ring->n_nodes++;
+	return 0;
+}
+
+int ring_remove(struct ring *ring, uint64_t id)
+{
+	ssize_t node = ring_find_node(ring, id);
+	size_t i, n = 0, last = ring->n_nodes - 1;
+
+	if (node < 0)
+		return -ENOENT;
+
+	/* drop its points, and give the last node its index */
+	for (i = 0; i < ring->n_points; i++) {
+		if (ring->points[i].node == (size_t)node)
+			continue;
+		ring->points[n] = ring->points[i];
+		if (ring->points[n].node == last)
+			ring->points[n].node = node;
+		n++;
+	}
+	ring->n_points = n;
+	ring->total_load -= ring->nodes[node].load;
+	ring->nodes[node] = ring->nodes[last];
+	ring->n_nodes--;
+	return 0;
+}
+
+/* index of the first point at or after the position of hash, wrapping round */
+static size_t ring_first_point(const struct ring *ring, uint64_t hash)
+{
+	uint64_t pos = mix64(hash);
+	size_t lo = 0, hi = ring->n_points, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo)/2;
+		if (ring->points[mid].pos < pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo == ring->n_points ? 0 : lo;
+}
+
+int ring_lookup(const struct ring *ring, uint64_t hash, uint64_t *id)
+{
+	if (!ring->n_nodes)
+		return -ENOENT;
+	*id = ring->nodes[ring->points[ring_first_point(ring, hash)].node].id;
+	return 0;
+}
+
+int ring_assign(struct ring *ring, uint64_t hash, uint64_t *id)
+{
+	struct ring_node *node;
+	size_t i, cap;
+
+	if (!ring->n_nodes)
+		return -ENOENT;
+
+	/* the bound counts the key being placed, so that some node is always below it */
+	cap = (size_t)ceil(ring->load_bound*(ring->total_load + 1)/ring->n_nodes);
+	for (i = ring_first_point(ring, hash); ; i = i + 1 == ring->n_points ? 0 : i + 1) {
+		node = &ring->nodes[ring->points[i].node];
+		if (node->load < cap)
+			break;
+	}
+	node->load++;
+	ring->total_load++;
+	*id = node->id;
+	return 0;
+}
+
+int ring_release(struct ring *ring, uint64_t id)
+{
+	ssize_t node = ring_find_node(ring, id);
+
+	if (node < 0 || !ring->nodes[node].load)
+		return -ENOENT;
+	ring->nodes[node].load--;
+	ring->total_load--;
+	return 0;
+}
@@ -0,0 +1,335 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <internal/printing.h>
+#include <tools/pool.h>
+#include <tools/zalloc.h>
+#include <tools/scoped.h>
+
+#define SLAB_SIZE_DEFAULT (1<<16)
+#define OBJ_ALIGN         16
+
+/* counters that pool_stats() reads from other threads */
+#define pool_load(x)     __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define pool_store(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+static void parse_opt(struct pool *pool, char *option, va_list ap)
+{
+	if (strcmp(option, "zero")==0)
+		pool->zero = 1;
+	else if (strcmp(option, "slab_size")==0)
+		pool->slab_size = va_arg(ap, size_t);
+}
+
+static int parse_opts(struct pool *pool, const char *options, va_list ap)
+{
+	char *opts __scoped = scoped_strdup(options);
+	char *tmp = opts, *opt, *delim = " ";
+
+	if (!options)
+		return 0;
+	if (!opts)
+		return -ENOMEM;
+
+	for (opt = strtok_r(tmp, delim, &tmp); opt; opt = strtok_r(tmp, delim, &tmp)) {
+		parse_opt(pool, opt, ap);
+	}
+	return 0;
+}
+
+static void pool_cache_dest(void *arg)
+{
+	struct pool_cache *cache = arg;
+	struct pool *pool = cache->pool;
+	struct pool_magazine *mags[2] = { cache->loaded, cache->previous };
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	for (i = 0; i < 2; i++) {
+		if (mags[i]->rounds) {
+			mags[i]->next = pool->full;
+			pool->full = mags[i];
+			pool->depot_rounds += mags[i]->rounds;
+		} else {
+			mags[i]->next = pool->empty;
+			pool->empty = mags[i];
+		}
+	}
+	pool->n_alloc += cache->n_alloc;
+	pool->n_free += cache->n_free;
+	list_del(&cache->node);
+	pthread_mutex_unlock(&pool->lock);
+	free(cache);
+}
+
+int pool_init(struct pool *pool, size_t obj_size, const char *options, ...)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	va_list ap;
+	int ret;
+
+	memset(pool, 0, sizeof(*pool));
+	va_start(ap, options);
+	ret = parse_opts(pool, options, ap);
+	va_end(ap);
+	if (ret)
+		return ret;
+
+	if (!obj_size)
+		return -EINVAL;
+	if (obj_size < sizeof(void *))
+		obj_size = sizeof(void *);
+	pool->obj_size = obj_size < OBJ_ALIGN ?
+		(obj_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1) :
+		(obj_size + OBJ_ALIGN - 1) & ~(size_t)(OBJ_ALIGN - 1);
+
+	if (!pool->slab_size)
+		pool->slab_size = SLAB_SIZE_DEFAULT;
+	pool->slab_size = (pool->slab_size + page - 1) & ~(size_t)(page - 1);
+	if (pool->slab_size < OBJ_ALIGN + pool->obj_size)
+		return -EINVAL;
+
+	INIT_LIST_HEAD(&pool->caches);
+	if (pthread_key_create(&pool->key, pool_cache_dest))
+		return -EAGAIN;
+	pthread_mutex_init(&pool->lock, NULL);
+	return 0;
+}
+
+void pool_dest(struct pool *pool)
+{
+	struct pool_cache *cache, *tmpc;
+	struct pool_magazine *mag;
+	void *slab;
+
+	list_for_each_entry_safe(cache, tmpc, &pool->caches, node) {
+		free(cache->loaded);
+		free(cache->previous);
+		free(cache);
+	}
+	while ((mag = pool->full)) {
+		pool->full = mag->next;
+		free(mag);
+	}
+	while ((mag = pool->empty)) {
+		pool->empty = mag->next;
+		free(mag);
+	}
+	while ((slab = pool->slabs)) {
+		pool->slabs = *(void **)slab;
+		munmap(slab, pool->slab_size);
+	}
+
+	pthread_key_delete(pool->key);
+	pthread_mutex_destroy(&pool->lock);
+}
+
+static struct pool_cache *pool_cache_create(struct pool *pool)
+{
+	struct pool_cache *cache = zalloc(sizeof(*cache));
+
+	if (!cache)
+		return NULL;
+
+	cache->pool = pool;
+	cache->loaded = zalloc(sizeof(*cache->loaded));
+	cache->previous = zalloc(sizeof(*cache->previous));
+	if (!cache->loaded || !cache->previous)
+		goto fail;
+	if (pthread_setspecific(pool->key, cache))
+		goto fail;
+
+	pthread_mutex_lock(&pool->lock);
+	list_add(&cache->node, &pool->caches);
+	pthread_mutex_unlock(&pool->lock);
+	return cache;
+fail:
+	free(cache->loaded);
+	free(cache->previous);
+	free(cache);
+	return NULL;
+}
+
+static inline struct pool_cache *pool_cache(struct pool *pool)
+{
+	struct pool_cache *cache = pthread_getspecific(pool->key);
+
+	return cache ? cache : pool_cache_create(pool);
+}
+
+/* fill an empty magazine with fresh objects carved from the current slab, lock held */
+static int pool_carve(struct pool *pool, struct pool_magazine *mag)
+{
+	void *slab;
+
+	if (pool->slab_cur + pool->obj_size > pool->slab_end) {
+		slab = mmap(NULL, pool->slab_size, PROT_READ|PROT_WRITE,
+			    MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (slab == MAP_FAILED)
+			return -ENOMEM;
+
+		pr_dbg("%s: new slab at %p\n", __func__, slab);
+		*(void **)slab = pool->slabs;
+		pool->slabs = slab;
+		pool->n_slabs++;
+		pool->slab_cur = (char *)slab + OBJ_ALIGN;
+		pool->slab_end = (char *)slab + pool->slab_size;
+	}
+
+	while (mag->rounds < POOL_MAG_ROUNDS &&
+	       pool->slab_cur + pool->obj_size <= pool->slab_end) {
+		mag->obj[mag->rounds++] = pool->slab_cur;
+		pool->slab_cur += pool->obj_size;
+	}
+	return 0;
+}
+
+/* both magazines are empty: trade one for a full one from the depot */
+static int pool_reload(struct pool *pool, struct pool_cache *cache)
+{
+	struct pool_magazine *mag;
+	int ret = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->full) {
+		mag = pool->full;
+		pool->full = mag->next;
+		pool->depot_rounds -= mag->rounds;
+
+		cache->previous->next = pool->empty;
+		pool->empty = cache->previous;
+		pool_store(cache->previous, cache->loaded);
+		pool_store(cache->loaded, mag);
+	} else {
+		ret = pool_carve(pool, cache->loaded);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return ret;
+}
+
+void *pool_alloc(struct pool *pool)
+{
+	struct pool_cache *cache = pool_cache(pool);
+	struct pool_magazine *mag;
+	void *obj;
+
+	if (!cache)
+		return NULL;
+
+	mag = cache->loaded;
+	if (!mag->rounds) {
+		if (cache->previous->rounds) {
+			pool_store(cache->loaded, cache->previous);
+			pool_store(cache->previous, mag);
+		} else if (pool_reload(pool, cache)) {
+			return NULL;
+		}
+		mag = cache->loaded;
+	}
+
+	obj = mag->obj[mag->rounds - 1];
+	pool_store(mag->rounds, mag->rounds - 1);
+	pool_store(cache->n_alloc, cache->n_alloc + 1);
+	if (pool->zero)
+		memset(obj, 0, pool->obj_size);
+	return obj;
+}
+
+/* both magazines are full: hand one to the depot in exchange for an empty one */
+static int pool_unload(struct pool *pool, struct pool_cache *cache)
+{
+	struct pool_magazine *mag;
+
+	pthread_mutex_lock(&pool->lock);
+	mag = pool->empty;
+	if (mag)
+		pool->empty = mag->next;
+	pthread_mutex_unlock(&pool->lock);
+
+	if (!mag) {
+		mag = zalloc(sizeof(*mag));
+		if (!mag)
+			return -ENOMEM;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	cache->previous->next = pool->full;
+	pool->full = cache->previous;
+	pool->depot_rounds += cache->previous->rounds;
+	pool_store(cache->previous, cache->loaded);
+	pool_store(cache->loaded, mag);
+	pthread_mutex_unlock(&pool->lock);
+	return 0;
+}
+
+void pool_free(struct pool *pool, void *obj)
+{
+	struct pool_cache *cache = pool_cache(pool);
+	struct pool_magazine *mag;
+
+	if (!cache)
+		goto leak;
+
+	mag = cache->loaded;
+	if (mag->rounds == POOL_MAG_ROUNDS) {
+		if (cache->previous->rounds < POOL_MAG_ROUNDS) {
+			pool_store(cache->loaded, cache->previous);
+			pool_store(cache->previous, mag);
+		} else if (pool_unload(pool, cache)) {
+			goto leak;
+		}
+		mag = cache->loaded;
+	}
+
+	mag->obj[mag->rounds] = obj;
+	pool_store(mag->rounds, mag->rounds + 1);
+	pool_store(cache->n_free, cache->n_free + 1);
+	return;
+leak:
+	/* out of memory for bookkeeping, the object stays in its slab until pool_dest() */
+	pr_warning("%s: leaking object %p\n", __func__, obj);
+}
+
+void pool_stats(struct pool *pool, struct pool_stats *stats)
+{
+	struct pool_cache *cache;
+	size_t n_alloc, n_free, cached;
+
+	pthread_mutex_lock(&pool->lock);
+	n_alloc = pool->n_alloc;
+	n_free = pool->n_free;
+	cached = pool->depot_rounds;
+	list_for_each_entry(cache, &pool->caches, node) {
+		n_alloc += pool_load(cache->n_alloc);
+		n_free += pool_load(cache->n_free);
+		cached += pool_load(pool_load(cache->loaded)->rounds);
+		cached += pool_load(pool_load(cache->previous)->rounds);
+	}
+	stats->outstanding = n_alloc - n_free;
+	stats->cached = cached;
+	stats->slabs = pool->n_slabs;
+	stats->slab_bytes = pool->n_slabs * pool->slab_size;
+	pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,537 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <internal/printing.h>
+#include <tools/shmtable.h>
+#include <tools/hash.h>
+#include <tools/scoped.h>
+
+#define SHMTABLE_MAGIC   0x454c4241544d4853ull	/* "SHMTABLE" */
+#define SHMTABLE_VERSION 1
+
+#define E_MAX_DEFAULT  (1<<13)
+#define HEAP_PER_ENTRY 64
+#define ENTRY_ALIGN    16
+/* exact-size free lists for blocks up to N_CLASSES*ENTRY_ALIGN bytes, one first-fit list above */
+#define N_CLASSES      32
+/* spins on an odd sequence before a reader checks whether the writer died */
+#define RECOVER_SPINS  (1<<12)
+
+#define GOLDEN_RATIO_64 0x61c8864680b583ebull
+
+/* every offset is relative to the start of the segment, zero is the null offset */
+struct shmtable_hdr {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t b_bits;
+	uint64_t size;
+	uint64_t e_max;
+	uint64_t n_entries;
+	uint64_t seed;
+	uint64_t buckets;		/* offset of the bucket array */
+	uint64_t heap_start;
+	uint64_t heap_cur;		/* bump pointer, blocks below it are in use or on a free list */
+	uint64_t free[N_CLASSES + 1];
+	uint32_t seq;			/* odd while a writer is modifying the table */
+	pthread_mutex_t lock;
+};
+
+struct shmtable_entry {
+	uint64_t next;
+	uint64_t hash;
+	int64_t data;
+	uint32_t len;			/* of the key, without the NUL */
+	uint32_t cap;			/* size of the block */
+	char key[];
+};
+
+struct shmtable_params {
+	size_t e_max;
+	size_t heap_size;
+	uint64_t seed;
+	int seeded;
+};
+
+static void parse_opt(struct shmtable_params *p, char *option, va_list ap)
+{
+	if (strcmp(option, "max_size")==0) {
+		p->e_max = va_arg(ap, size_t);
+	} else if (strcmp(option, "heap_size")==0) {
+		p->heap_size = va_arg(ap, size_t);
+	} else if (strcmp(option, "seed")==0) {
+		p->seed = va_arg(ap, uint64_t);
+		p->seeded = 1;
+	}
+}
+
+static int parse_opts(struct shmtable_params *p, const char *options, va_list ap)
+{
+	char *opts __scoped = scoped_strdup(options);
+	char *tmp = opts, *opt, *delim = " ";
+
+	if (!options)
+		return 0;
+	if (!opts)
+		return -ENOMEM;
+
+	for (opt = strtok_r(tmp, delim, &tmp); opt; opt = strtok_r(tmp, delim, &tmp)) {
+		parse_opt(p, opt, ap);
+	}
+	return 0;
+}
+
+static size_t round_up(size_t n, size_t align)
+{
+	return (n + align - 1) & ~(align - 1);
+}
+
+static uint64_t *shmtable_bucket(const struct shmtable *st, uint64_t hash)
+{
+	uint64_t *buckets = (uint64_t *)((char *)st->hdr + st->hdr->buckets);
+
+	return &buckets[(hash*GOLDEN_RATIO_64) >> (64 - st->hdr->b_bits)];
+}
+
+/*
+ * Returns the entry at off, or NULL if off cannot be one. That only happens
+ * to a reader racing with a writer, which the sequence check then retries.
+ */
+static struct shmtable_entry *shmtable_entry(const struct shmtable *st, uint64_t off)
+{
+	if (off < st->hdr->heap_start || off > st->size - sizeof(struct shmtable_entry) ||
+	    off % ENTRY_ALIGN)
+		return NULL;
+	return (struct shmtable_entry *)((char *)st->hdr + off);
+}
+
+static uint64_t shmtable_hashkey(const struct shmtable *st, const char *key)
+{
+	return hash_fnv1a64(key, st->hdr->seed);
+}
+
+/*
+ * Walks the chain of hash and returns the link that points at the entry for
+ * key, or at the end of the chain if there is none, *found telling which. A
+ * reader may walk a chain while it is being rewritten, so every offset is
+ * checked and the walk is bounded; NULL means the walk went astray.
+ */
+static uint64_t *shmtable_find(const struct shmtable *st, const char *key, size_t len,
+			       uint64_t hash, struct shmtable_entry **found)
+{
+	uint64_t *link = shmtable_bucket(st, hash);
+	uint64_t off, steps = 0;
+	struct shmtable_entry *e;
+
+	*found = NULL;
+	while ((off = __atomic_load_n(link, __ATOMIC_ACQUIRE))) {
+		e = shmtable_entry(st, off);
+		if (!e || steps++ > st->hdr->e_max)
+			return NULL;
+		if (__atomic_load_n(&e->hash, __ATOMIC_RELAXED) == hash &&
+		    __atomic_load_n(&e->len, __ATOMIC_RELAXED) == len &&
+		    off + sizeof(*e) + len < st->size && memcmp(e->key, key, len)==0) {
+			*found = e;
+			return link;
+		}
+		link = &e->next;
+	}
+	return link;
+}
+
+static unsigned shmtable_class(uint32_t cap)
+{
+	return cap <= N_CLASSES*ENTRY_ALIGN ? cap/ENTRY_ALIGN - 1 : N_CLASSES;
+}
+
+/* called with the lock held, returns the offset of a block of at least need bytes or zero */
+static uint64_t shmtable_alloc(struct shmtable *st, uint32_t need)
+{
+	struct shmtable_hdr *hdr = st->hdr;
+	unsigned cls = shmtable_class(need);
+	struct shmtable_entry *e;
+	uint64_t *link, off;
+
+	if (cls < N_CLASSES) {
+		off = hdr->free[cls];
+		if (off) {
+			hdr->free[cls] = shmtable_entry(st, off)->next;
+			return off;
+		}
+	} else {
+		for (link = &hdr->free[N_CLASSES]; (off = *link); link = &e->next) {
+			e = shmtable_entry(st, off);
+			if (e->cap >= need) {
+				*link = e->next;
+				return off;
+			}
+		}
+	}
+
+	if (need > hdr->size - hdr->heap_cur)
+		return 0;
+	off = hdr->heap_cur;
+	hdr->heap_cur += need;
+	shmtable_entry(st, off)->cap = need;
+	return off;
+}
+
+static void shmtable_free(struct shmtable *st, uint64_t off)
+{
+	struct shmtable_entry *e = shmtable_entry(st, off);
+	unsigned cls = shmtable_class(e->cap);
+
+	e->next = st->hdr->free[cls];
+	st->hdr->free[cls] = off;
+}
+
+static void shmtable_write_begin(struct shmtable_hdr *hdr)
+{
+	__atomic_store_n(&hdr->seq, hdr->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void shmtable_write_end(struct shmtable_hdr *hdr)
+{
+	__atomic_store_n(&hdr->seq, hdr->seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Every change to a chain is published with a single store, so a writer that
+ * died holding the lock left the chains intact, at worst leaking a block or
+ * miscounting by one. All that needs repair is the sequence it left odd.
+ */
+static void shmtable_recover(struct shmtable_hdr *hdr)
+{
+	pr_err("%s: a writer died holding the lock, recovering\n", __func__);
+	if (hdr->seq & 1)
+		shmtable_write_end(hdr);
+	pthread_mutex_consistent(&hdr->lock);
+}
+
+static int shmtable_lock(struct shmtable_hdr *hdr)
+{
+	int ret = pthread_mutex_lock(&hdr->lock);
+
+	if (ret == EOWNERDEAD) {
+		shmtable_recover(hdr);
+		ret = 0;
+	}
+	return -ret;
+}
+
+static void shmtable_unlock(struct shmtable_hdr *hdr)
+{
+	pthread_mutex_unlock(&hdr->lock);
+}
+
+/* a reader seeing an odd sequence for long checks whether its writer is still alive */
+static void shmtable_reader_wait(struct shmtable_hdr *hdr, unsigned *spins)
+{
+	int ret;
+
+	if (++*spins % RECOVER_SPINS) {
+		sched_yield();
+		return;
+	}
+	ret = pthread_mutex_trylock(&hdr->lock);
+	if (ret == EOWNERDEAD)
+		shmtable_recover(hdr);
+	else if (ret==0 && (hdr->seq & 1))
+		shmtable_write_end(hdr);
+	if (ret==0 || ret == EOWNERDEAD)
+		shmtable_unlock(hdr);
+}
+
+static int shmtable_map(struct shmtable *st, int fd, size_t size)
+{
+	void *p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+
+	if (p == MAP_FAILED)
+		return -errno;
+	st->hdr = p;
+	st->size = size;
+	st->fd = fd;
+	return 0;
+}
+
+static int shmtable_init_hdr(struct shmtable *st, const struct shmtable_params *p,
+			     unsigned b_bits, size_t buckets, size_t heap_start)
+{
+	struct shmtable_hdr *hdr = st->hdr;
+	pthread_mutexattr_t attr;
+	uint64_t seed[2];
+	int ret;
+
+	/* ftruncate() zeroed the segment: empty buckets and free lists */
+	hdr->magic = SHMTABLE_MAGIC;
+	hdr->version = SHMTABLE_VERSION;
+	hdr->b_bits = b_bits;
+	hdr->size = st->size;
+	hdr->e_max = p->e_max;
+	hdr->buckets = buckets;
+	hdr->heap_start = heap_start;
+	hdr->heap_cur = heap_start;
+	if (p->seeded) {
+		hdr->seed = p->seed;
+	} else {
+		hash_random_seed(seed);
+		hdr->seed = seed[0];
+	}
+
+	ret = pthread_mutexattr_init(&attr);
+	if (ret)
+		return -ret;
+	ret = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	if (!ret)
+		ret = pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	if (!ret)
+		ret = pthread_mutex_init(&hdr->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	return -ret;
+}
+
+int shmtable_create(struct shmtable *st, const char *name, const char *options, ...)
+{
+	struct shmtable_params p = { 0 };
+	size_t n_buckets, buckets, heap_start, size;
+	unsigned b_bits = 1;
+	va_list ap;
+	int fd, ret;
+
+	va_start(ap, options);
+	ret = parse_opts(&p, options, ap);
+	va_end(ap);
+	if (ret)
+		return ret;
+
+	if (!p.e_max)
+		p.e_max = E_MAX_DEFAULT;
+	if (!p.heap_size)
+		p.heap_size = p.e_max*HEAP_PER_ENTRY;
+	while (((size_t)1 << b_bits) < p.e_max && b_bits < 8*sizeof(size_t) - 4)
+		b_bits++;
+	n_buckets = (size_t)1 << b_bits;
+
+	buckets = round_up(sizeof(struct shmtable_hdr), 64);
+	heap_start = round_up(buckets + n_buckets*sizeof(uint64_t), ENTRY_ALIGN);
+	size = heap_start + round_up(p.heap_size, ENTRY_ALIGN);
+	if (size < heap_start)
+		return -EINVAL;
+
+	fd = name ? shm_open(name, O_CREAT|O_EXCL|O_RDWR, 0600) : memfd_create("shmtable", 0);
+	if (fd < 0)
+		return -errno;
+
+	if (ftruncate(fd, size)) {
+		ret = -errno;
+		goto fail;
+	}
+	ret = shmtable_map(st, fd, size);
+	if (ret)
+		goto fail;
+	ret = shmtable_init_hdr(st, &p, b_bits, buckets, heap_start);
+	if (ret) {
+		munmap(st->hdr, size);
+		goto fail;
+	}
+	return 0;
+fail:
+	close(fd);
+	if (name)
+		shm_unlink(name);
+	return ret;
+}
+
+int shmtable_open_fd(struct shmtable *st, int fd)
+{
+	struct stat sb;
+	int ret;
+
+	if (fstat(fd, &sb))
+		return -errno;
+	if ((size_t)sb.st_size < sizeof(struct shmtable_hdr))
+		return -EINVAL;
+
+	ret = shmtable_map(st, fd, sb.st_size);
+	if (ret)
+		return ret;
+	if (st->hdr->magic != SHMTABLE_MAGIC || st->hdr->version != SHMTABLE_VERSION ||
+	    st->hdr->size != st->size) {
+		munmap(st->hdr, st->size);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+int shmtable_open(struct shmtable *st, const char *name)
+{
+	int fd = shm_open(name, O_RDWR, 0);
+	int ret;
+
+	if (fd < 0)
+		return -errno;
+	ret = shmtable_open_fd(st, fd);
+	if (ret)
+		close(fd);
+	return ret;
+}
+
+void shmtable_close(struct shmtable *st)
+{
+	munmap(st->hdr, st->size);
+	close(st->fd);
+	st->hdr = NULL;
+	st->fd = -1;
+}
+
+int shmtable_unlink(const char *name)
+{
+	return shm_unlink(name) ? -errno : 0;
+}
+
+static int shmtable_write(struct shmtable *st, const char *key, tdata_t data, int only)
+{
+	struct shmtable_hdr *hdr = st->hdr;
+	uint64_t hash = shmtable_hashkey(st, key), *link, off;
+	size_t len = strlen(key);
+	struct shmtable_entry *e;
+	uint32_t need;
+	int ret;
+
+	if (len > UINT32_MAX - sizeof(*e) - ENTRY_ALIGN)
+		return -EINVAL;
+	ret = shmtable_lock(hdr);
+	if (ret)
+		return ret;
+
+	link = shmtable_find(st, key, len, hash, &e);
+	if (e) {
+		shmtable_write_begin(hdr);
+		__atomic_store_n(&e->data, data, __ATOMIC_RELAXED);
+		shmtable_write_end(hdr);
+		goto out;
+	}
+	ret = -1;
+	if (only)
+		goto out;
+
+	ret = -ENOSPC;
+	need = round_up(sizeof(*e) + len + 1, ENTRY_ALIGN);
+	if (hdr->n_entries >= hdr->e_max || !(off = shmtable_alloc(st, need)))
+		goto out;
+
+	/* fill in the entry first, then publish it with one store to the bucket */
+	link = shmtable_bucket(st, hash);
+	e = shmtable_entry(st, off);
+	e->next = *link;
+	e->hash = hash;
+	e->data = data;
+	e->len = len;
+	memcpy(e->key, key, len + 1);
+	shmtable_write_begin(hdr);
+	__atomic_store_n(link, off, __ATOMIC_RELEASE);
+	hdr->n_entries++;
+	shmtable_write_end(hdr);
+	ret = 0;
+out:
+	shmtable_unlock(hdr);
+	return ret;
+}
+
+int shmtable_update(struct shmtable *st, const char *key, tdata_t data)
+{
+	return shmtable_write(st, key, data, 0);
+}
+
+int shmtable_update_only(struct shmtable *st, const char *key, tdata_t data)
+{
+	return shmtable_write(st, key, data, 1);
+}
+
+int shmtable_remove(struct shmtable *st, const char *key)
+{
+	struct shmtable_hdr *hdr = st->hdr;
+	uint64_t hash = shmtable_hashkey(st, key), *link, off;
+	struct shmtable_entry *e;
+
+	if (shmtable_lock(hdr))
+		return -1;
+
+	link = shmtable_find(st, key, strlen(key), hash, &e);
+	if (!e) {
+		shmtable_unlock(hdr);
+		return -1;
+	}
+
+	off = *link;
+	shmtable_write_begin(hdr);
+	__atomic_store_n(link, e->next, __ATOMIC_RELEASE);
+	hdr->n_entries--;
+	shmtable_free(st, off);
+	shmtable_write_end(hdr);
+	shmtable_unlock(hdr);
+	return 0;
+}
+
+int shmtable_search(struct shmtable *st, const char *key, tdata_t *data)
+{
+	struct shmtable_hdr *hdr = st->hdr;
+	uint64_t hash = shmtable_hashkey(st, key);
+	size_t len = strlen(key);
+	struct shmtable_entry *e;
+	unsigned spins = 0;
+	uint32_t seq;
+	tdata_t val = 0;
+
+	for (;;) {
+		seq = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			shmtable_reader_wait(hdr, &spins);
+			continue;
+		}
+
+		shmtable_find(st, key, len, hash, &e);
+		if (e)
+			val = __atomic_load_n(&e->data, __ATOMIC_RELAXED);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&hdr->seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+
+	if (!e)
+		return -1;
+	*data = val;
+	return 0;
+}
+
+size_t shmtable_entries(const struct shmtable *st)
+{
+	return __atomic_load_n(&st->hdr->n_entries, __ATOMIC_RELAXED);
+}
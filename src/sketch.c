@@ -0,0 +1,480 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <internal/printing.h>
+#include <internal/hash.h>
+#include <tools/sketch.h>
+#include <tools/hash.h>
+#include <tools/scoped.h>
+
+#define CMS_WIDTH_DEFAULT 2048
+#define CMS_DEPTH_DEFAULT 4
+#define CMS_DEPTH_MAX     16
+#define CMS_W_BITS_MIN    4	/* a row is at least one cache line */
+#define CMS_W_BITS_MAX    30
+#define CMS_ALIGN         64
+#define GOLDEN_RATIO_64   0x9E3779B97F4A7C15ull
+
+struct cms_params {
+	size_t width;
+	int seeded;
+};
+
+static void parse_opt(struct cms *cms, struct cms_params *p, char *option, va_list ap)
+{
+	if (strcmp(option, "width")==0) {
+		p->width = va_arg(ap, size_t);
+	} else if (strcmp(option, "depth")==0) {
+		cms->depth = va_arg(ap, unsigned);
+	} else if (strcmp(option, "seed")==0) {
+		cms->seed = va_arg(ap, uint64_t);
+		p->seeded = 1;
+	}
+}
+
+static int parse_opts(struct cms *cms, struct cms_params *p, const char *options, va_list ap)
+{
+	char *opts __scoped = scoped_strdup(options);
+	char *tmp = opts, *opt, *delim = " ";
+
+	if (!options)
+		return 0;
+	if (!opts)
+		return -ENOMEM;
+
+	for (opt = strtok_r(tmp, delim, &tmp); opt; opt = strtok_r(tmp, delim, &tmp)) {
+		parse_opt(cms, p, opt, ap);
+	}
+	return 0;
+}
+
+static size_t cms_counters(const struct cms *cms)
+{
+	return (size_t)cms->depth << cms->w_bits;
+}
+
+/* rows are cache line aligned and a multiple of it long, so that merging vectorizes */
+static int cms_alloc_rows(struct cms *cms)
+{
+	size_t bytes = cms_counters(cms)*sizeof(*cms->rows);
+
+	cms->rows = aligned_alloc(CMS_ALIGN, bytes);
+	if (!cms->rows)
+		return -ENOMEM;
+	memset(cms->rows, 0, bytes);
+	return 0;
+}
+
+int cms_init(struct cms *cms, const char *options, ...)
+{
+	struct cms_params p = { CMS_WIDTH_DEFAULT, 0 };
+	uint64_t seed[2];
+	va_list ap;
+	int ret;
+
+	memset(cms, 0, sizeof(*cms));
+	va_start(ap, options);
+	ret = parse_opts(cms, &p, options, ap);
+	va_end(ap);
+	if (ret)
+		return ret;
+
+	if (!cms->depth)
+		cms->depth = CMS_DEPTH_DEFAULT;
+	if (cms->depth > CMS_DEPTH_MAX || !p.width || p.width > (size_t)1 << CMS_W_BITS_MAX)
+		return -EINVAL;
+	for (cms->w_bits = CMS_W_BITS_MIN; ((size_t)1 << cms->w_bits) < p.width; cms->w_bits++)
+		;
+	if (!p.seeded) {
+		hash_random_seed(seed);
+		cms->seed = seed[0];
+	}
+	return cms_alloc_rows(cms);
+}
+
+int cms_init_from(struct cms *cms, const struct cms *proto)
+{
+	memset(cms, 0, sizeof(*cms));
+	cms->depth = proto->depth;
+	cms->w_bits = proto->w_bits;
+	cms->seed = proto->seed;
+	return cms_alloc_rows(cms);
+}
+
+void cms_dest(struct cms *cms)
+{
+	free(cms->rows);
+	cms->rows = NULL;
+}
+
+/*
+ * Fills idx with the counter of key in every row. The rows are indexed by
+ * h1 + i*h2 (Kirsch and Mitzenmacher), so a key is hashed only once.
+ */
+static void cms_index(const struct cms *cms, const char *key, size_t *idx)
+{
+	/* FNV-1a leaves the last bytes of the key poorly mixed */
+	uint64_t h = mix64(hash_fnv1a64(key, cms->seed)), h1, h2;
+	unsigned i;
+
+	h1 = h;
+	h2 = (h >> 32 | h << 32) | 1;
+
+	for (i = 0; i < cms->depth; i++)
+		idx[i] = ((size_t)i << cms->w_bits) +
+			(size_t)(((h1 + i*h2) * GOLDEN_RATIO_64) >> (64 - cms->w_bits));
+}
+
+uint32_t cms_add(struct cms *cms, const char *key, uint32_t n)
+{
+	size_t idx[CMS_DEPTH_MAX];
+	uint32_t est = UINT32_MAX;
+	unsigned i;
+
+	cms_index(cms, key, idx);
+	for (i = 0; i < cms->depth; i++)
+		if (cms->rows[idx[i]] < est)
+			est = cms->rows[idx[i]];
+	est = est > UINT32_MAX - n ? UINT32_MAX : est + n;
+	for (i = 0; i < cms->depth; i++)
+		if (cms->rows[idx[i]] < est)
+			cms->rows[idx[i]] = est;
+	cms->total += n;
+	return est;
+}
+
+uint32_t cms_estimate(const struct cms *cms, const char *key)
+{
+	size_t idx[CMS_DEPTH_MAX];
+	uint32_t est = UINT32_MAX;
+	unsigned i;
+
+	cms_index(cms, key, idx);
+	for (i = 0; i < cms->depth; i++)
+		if (cms->rows[idx[i]] < est)
+			est = cms->rows[idx[i]];
+	return est;
+}
+
+int cms_merge(struct cms *dst, const struct cms *src)
+{
+	uint32_t *restrict d = dst->rows;
+	const uint32_t *restrict s = src->rows;
+	size_t i, n = cms_counters(dst);
+	uint32_t sum;
+
+	if (dst->depth != src->depth || dst->w_bits != src->w_bits || dst->seed != src->seed)
+		return -EINVAL;
+
+	for (i = 0; i < n; i++) {
+		sum = d[i] + s[i];
+		d[i] = sum < d[i] ? UINT32_MAX : sum;
+	}
+	dst->total += src->total;
+	return 0;
+}
+
+void cms_clear(struct cms *cms)
+{
+	memset(cms->rows, 0, cms_counters(cms)*sizeof(*cms->rows));
+	cms->total = 0;
+}
+
+static const char *topk_key(const struct htable_node *node)
+{
+	return htable_entry(node, struct topk_counter, hnode)->key;
+}
+
+int topk_init(struct topk *tk, size_t k)
+{
+	size_t i;
+	int ret;
+
+	if (!k)
+		return -EINVAL;
+	memset(tk, 0, sizeof(*tk));
+	tk->k = k;
+	INIT_LIST_HEAD(&tk->buckets);
+	INIT_LIST_HEAD(&tk->free_buckets);
+
+	tk->counters = calloc(k, sizeof(*tk->counters));
+	tk->pool = calloc(k + 1, sizeof(*tk->pool));
+	if (!tk->counters || !tk->pool) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+	ret = htable_init(&tk->index, topk_key, "size max_size", k, k);
+	if (ret)
+		goto fail;
+
+	/* a counter moving to a new count may need a bucket before it frees its old one */
+	for (i = 0; i < k + 1; i++) {
+		INIT_LIST_HEAD(&tk->pool[i].counters);
+		list_add_tail(&tk->pool[i].entry, &tk->free_buckets);
+	}
+	return 0;
+
+fail:
+	free(tk->counters);
+	free(tk->pool);
+	return ret;
+}
+
+void topk_dest(struct topk *tk)
+{
+	size_t i;
+
+	for (i = 0; i < tk->k; i++)
+		free(tk->counters[i].key);
+	free(tk->counters);
+	free(tk->pool);
+	htable_dest(&tk->index);
+}
+
+static int topk_set_key(struct topk_counter *ctr, const char *key)
+{
+	size_t len = strlen(key) + 1;
+	char *buf;
+
+	if (len > ctr->key_cap) {
+		buf = realloc(ctr->key, len);
+		if (!buf)
+			return -ENOMEM;
+		ctr->key = buf;
+		ctr->key_cap = len;
+	}
+	memcpy(ctr->key, key, len);
+	return 0;
+}
+
+/*
+ * Moves ctr into the bucket for count, which lies after from in the list of
+ * buckets. Counts only ever grow, so the search starts at the counter's
+ * current bucket, and a stream increment by one looks at a single bucket.
+ */
+static void topk_place(struct topk *tk, struct topk_counter *ctr, uint64_t count,
+		       struct list_head *from)
+{
+	struct topk_bucket *old = ctr->bucket, *b = NULL;
+	struct list_head *pos;
+
+	for (pos = from->next; pos != &tk->buckets; pos = pos->next) {
+		b = list_entry(pos, struct topk_bucket, entry);
+		if (b->count >= count)
+			break;
+	}
+	if (pos == &tk->buckets || b->count != count) {
+		b = list_first_entry(&tk->free_buckets, struct topk_bucket, entry);
+		b->count = count;
+		/* before pos */
+		list_move_tail(&b->entry, pos);
+	}
+
+	if (old)
+		list_del(&ctr->entry);
+	list_add_tail(&ctr->entry, &b->counters);
+	ctr->bucket = b;
+	if (old && list_empty(&old->counters))
+		list_move(&old->entry, &tk->free_buckets);
+}
+
+int topk_add(struct topk *tk, const char *key, uint64_t n)
+{
+	struct topk_counter *ctr;
+	struct topk_bucket *min;
+	struct htable_node *node;
+
+	if (!n)
+		return 0;
+
+	node = htable_search(&tk->index, key);
+	if (node) {
+		ctr = htable_entry(node, struct topk_counter, hnode);
+		topk_place(tk, ctr, ctr->bucket->count + n, &ctr->bucket->entry);
+		return 0;
+	}
+
+	if (tk->n_used < tk->k) {
+		ctr = &tk->counters[tk->n_used];
+		if (topk_set_key(ctr, key))
+			return -ENOMEM;
+		tk->n_used++;
+		ctr->error = 0;
+		ctr->bucket = NULL;
+		htable_insert(&tk->index, &ctr->hnode);
+		topk_place(tk, ctr, n, &tk->buckets);
+		return 0;
+	}
+
+	/* replace the oldest of the keys with the lowest count */
+	min = list_first_entry(&tk->buckets, struct topk_bucket, entry);
+	ctr = list_first_entry(&min->counters, struct topk_counter, entry);
+	htable_remove(&tk->index, &ctr->hnode);
+	if (topk_set_key(ctr, key)) {
+		htable_insert(&tk->index, &ctr->hnode);
+		return -ENOMEM;
+	}
+	ctr->error = min->count;
+	htable_insert(&tk->index, &ctr->hnode);
+	topk_place(tk, ctr, min->count + n, &min->entry);
+	return 0;
+}
+
+int topk_search(struct topk *tk, const char *key, struct topk_item *item)
+{
+	struct htable_node *node = htable_search(&tk->index, key);
+	struct topk_counter *ctr;
+
+	if (!node)
+		return -1;
+	ctr = htable_entry(node, struct topk_counter, hnode);
+	item->key = ctr->key;
+	item->count = ctr->bucket->count;
+	item->error = ctr->error;
+	return 0;
+}
+
+size_t topk_list(struct topk *tk, struct topk_item *items, size_t n)
+{
+	struct topk_bucket *b;
+	struct topk_counter *ctr;
+	size_t i = 0;
+
+	list_for_each_entry_reverse(b, &tk->buckets, entry) {
+		list_for_each_entry(ctr, &b->counters, entry) {
+			if (i == n)
+				return i;
+			items[i].key = ctr->key;
+			items[i].count = b->count;
+			items[i].error = ctr->error;
+			i++;
+		}
+	}
+	return i;
+}
+
+/* the most an untracked key can have occurred */
+static uint64_t topk_min(struct topk *tk)
+{
+	if (tk->n_used < tk->k)
+		return 0;
+	return list_first_entry(&tk->buckets, struct topk_bucket, entry)->count;
+}
+
+static int topk_item_cmp(const void *a, const void *b)
+{
+	const struct topk_item *x = a, *y = b;
+
+	return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+/*
+ * Combines the two summaries as in Agarwal et al., "Mergeable Summaries":
+ * every key tracked by either is counted with its count in both, or the
+ * other's minimum where untracked, and the k highest are kept. dst is then
+ * rebuilt from them, lowest count first so that each lands at the tail.
+ */
+int topk_merge(struct topk *dst, struct topk *src)
+{
+	uint64_t dst_min = topk_min(dst), src_min = topk_min(src);
+	struct topk_item *cand, item;
+	struct topk_counter *ctr;
+	struct topk_bucket *b, *tmp;
+	size_t i, n = 0, keep;
+	char **keys;
+
+	if (!src->n_used)
+		return 0;
+	cand = malloc((dst->n_used + src->n_used)*sizeof(*cand));
+	if (!cand)
+		return -ENOMEM;
+	for (i = 0; i < dst->n_used; i++) {
+		ctr = &dst->counters[i];
+		cand[n].key = ctr->key;
+		cand[n].count = ctr->bucket->count;
+		cand[n].error = ctr->error;
+		if (topk_search(src, ctr->key, &item)) {
+			item.count = src_min;
+			item.error = src_min;
+		}
+		cand[n].count += item.count;
+		cand[n].error += item.error;
+		n++;
+	}
+	for (i = 0; i < src->n_used; i++) {
+		ctr = &src->counters[i];
+		if (htable_search(&dst->index, ctr->key))
+			continue;
+		cand[n].key = ctr->key;
+		cand[n].count = ctr->bucket->count + dst_min;
+		cand[n].error = ctr->error + dst_min;
+		n++;
+	}
+	qsort(cand, n, sizeof(*cand), topk_item_cmp);
+	keep = n < dst->k ? n : dst->k;
+
+	/* the keys of dst are about to be overwritten */
+	keys = calloc(keep, sizeof(*keys));
+	for (i = 0; keys && i < keep; i++) {
+		keys[i] = strdup(cand[i].key);
+		if (!keys[i])
+			break;
+	}
+	if (!keys || i < keep) {
+		while (keys && i--)
+			free(keys[i]);
+		free(keys);
+		free(cand);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < dst->n_used; i++)
+		htable_remove(&dst->index, &dst->counters[i].hnode);
+	list_for_each_entry_safe(b, tmp, &dst->buckets, entry) {
+		INIT_LIST_HEAD(&b->counters);
+		list_move(&b->entry, &dst->free_buckets);
+	}
+	dst->n_used = 0;
+
+	for (i = keep; i--; ) {
+		ctr = &dst->counters[dst->n_used++];
+		free(ctr->key);
+		ctr->key = keys[i];
+		ctr->key_cap = strlen(keys[i]) + 1;
+		ctr->error = cand[i].error;
+		ctr->bucket = NULL;
+		htable_insert(&dst->index, &ctr->hnode);
+		b = list_empty(&dst->buckets) ? NULL : list_last_entry(&dst->buckets, struct topk_bucket, entry);
+		if (!b || b->count != cand[i].count) {
+			b = list_first_entry(&dst->free_buckets, struct topk_bucket, entry);
+			b->count = cand[i].count;
+			list_move_tail(&b->entry, &dst->buckets);
+		}
+		list_add_tail(&ctr->entry, &b->counters);
+		ctr->bucket = b;
+	}
+	pr_dbg("%s: kept %zu of %zu keys\n", __func__, keep, n);
+	free(keys);
+	free(cand);
+	return 0;
+}
@@ -23,39 +23,97 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <internal/printing.h>
 #include <tools/table.h>
+#include <tools/hash.h>
+#include <tools/wal.h>
 #include <tools/zalloc.h>
 #include <tools/list.h>
-#include <tools/strdupa.h>
+#include <tools/scoped.h>
 
 struct table_entry {
 	const char *key;
 	intptr_t data;
+	uint64_t hash;
 	struct list_head bucket;
+	unsigned flags;
 };
 
-#define ABSOLUTE_MAX   (1<<30) /* no more than a billion entries */
+/* the entry and its key, stored right after it, live in table->arena[] rather than the heap */
+#define TABLE_ENTRY_F_ARENA  0x1
+/* set if that arena is table->arena[1] */
+#define TABLE_ENTRY_F_ARENA1 0x2
+
+/* no more entries than there are addressable bucket pointers */
+#define ABSOLUTE_MAX   (SIZE_MAX / (2*sizeof(struct list_head *)))
 #define E_MAX_DEFAULT  (1<<13)
 #define E_SIZE_DEFAULT (1<<10)
+#define LOAD_FACTOR_DEFAULT 0.75
+#define GROWTH_DEFAULT      2.0
+#define B_BITS_MAX     (8*sizeof(size_t) - 4)
+
+#define GOLDEN_RATIO_64 0x61c8864680b583ebull
+
+/* bucket arrays at least this large are backed by transparent huge pages */
+#define HUGEPAGE_THRESHOLD (1<<22)
 
-static int table_insert_entry(struct table *table, struct table_entry *entryp);
+/* old bucket arrays smaller than this are always rehashed on the calling thread */
+#define PARALLEL_REHASH_MIN (1<<16)
+/* rehash_threads and the threads of table_merge_parallel() are capped at this */
+#define REHASH_THREADS_MAX  256
 
-/* buckets from size */
-static size_t bfs(size_t size)
+/* compacted entries are copied into chunks this large */
+#define COMPACT_CHUNK_SIZE (1<<20)
+
+#define TABLE_F_NO_HUGEPAGES   0x1
+#define TABLE_F_BUCKETS_MAPPED 0x2
+#define TABLE_F_SIPHASH        0x4
+#define TABLE_F_SEEDED         0x8
+#define TABLE_F_MOVE_TO_FRONT  0x10
+#define TABLE_F_TRANSPOSE      0x20
+#define TABLE_F_STATS          0x40
+
+/* derives one seed from another, for the second SipHash key word and for reseeding */
+static uint64_t splitmix64(uint64_t x)
 {
-	return 2*size - 1;
+	x += 0x9e3779b97f4a7c15ull;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
 }
 
-static unsigned default_hash(const char *key)
+static size_t table_n_buckets(const struct table *table)
 {
-	unsigned h = 0x811c9dc5;
-	const unsigned char *c;
-	
-	for (c = (const unsigned char *)key; *c; c++)
-		h = (h ^ *c) *0x01000193;
-	
-	return h;
+	return (size_t)1 << table->b_bits;
+}
+
+/* Fibonacci hashing: the top bits of the product depend on every bit of the hash */
+static size_t table_bucket(const struct table *table, uint64_t hash)
+{
+	return (hash*GOLDEN_RATIO_64) >> (64 - table->b_bits);
+}
+
+/* the fewest bucket bits that hold n entries at the table's load factor */
+static unsigned table_bucket_bits(const struct table *table, size_t n)
+{
+	double want = (double)n/table->load_factor;
+	unsigned bits = 1;
+
+	while (bits < B_BITS_MAX && (double)((size_t)1 << bits) < want)
+		bits++;
+	return bits;
+}
+
+/* the number of entries 1 << bits buckets hold at the table's load factor */
+static size_t table_capacity(const struct table *table, unsigned bits)
+{
+	double cap = (double)((size_t)1 << bits)*table->load_factor;
+
+	if (cap >= (double)table->e_max)
+		return table->e_max;
+	return cap < 1 ? 1 : (size_t)cap;
 }
 
 static void parse_opt(struct table *table, char *option, va_list ap)
@@ -68,19 +126,51 @@ static void parse_opt(struct table *table, char *option, va_list ap)
 		table->e_size = va_arg(ap, size_t);
 	} else if (strcmp(option, "with_hash")==0) {
 		table->hash = va_arg(ap, table_hash_func);
+	} else if (strcmp(option, "with_hash64")==0) {
+		table->hash64 = va_arg(ap, table_hash64_func);
+	} else if (strcmp(option, "no_hugepages")==0) {
+		table->flags |= TABLE_F_NO_HUGEPAGES;
+	} else if (strcmp(option, "rehash_threads")==0) {
+		table->rehash_threads = va_arg(ap, unsigned);
+		if (table->rehash_threads > REHASH_THREADS_MAX)
+			table->rehash_threads = REHASH_THREADS_MAX;
+	} else if (strcmp(option, "seed")==0) {
+		table->seed[0] = va_arg(ap, uint64_t);
+		table->flags |= TABLE_F_SEEDED;
+	} else if (strcmp(option, "siphash")==0) {
+		table->flags |= TABLE_F_SIPHASH;
+	} else if (strcmp(option, "max_chain")==0) {
+		table->max_chain = va_arg(ap, unsigned);
+	} else if (strcmp(option, "load_factor")==0) {
+		table->load_factor = va_arg(ap, double);
+	} else if (strcmp(option, "growth")==0) {
+		table->growth = va_arg(ap, double);
+	} else if (strcmp(option, "with_wal")==0) {
+		table->wal = va_arg(ap, struct wal *);
+	} else if (strcmp(option, "move_to_front")==0) {
+		table->flags |= TABLE_F_MOVE_TO_FRONT;
+	} else if (strcmp(option, "transpose")==0) {
+		table->flags |= TABLE_F_TRANSPOSE;
+	} else if (strcmp(option, "hot_cache")==0) {
+		table->hot_mask = va_arg(ap, size_t);
+	} else if (strcmp(option, "stats")==0) {
+		table->flags |= TABLE_F_STATS;
 	}
 }
-static void parse_opts(struct table *table, const char *options, va_list ap)
+static int parse_opts(struct table *table, const char *options, va_list ap)
 {
-	char *tmp, *opt, *delim = " ";
+	char *opts __scoped = scoped_strdup(options);
+	char *tmp = opts, *opt, *delim = " ";
 
 	if (!options)
-		return;
-	
-	tmp = strdupa(options);
+		return 0;
+	if (!opts)
+		return -ENOMEM;
+
 	for (opt = strtok_r(tmp, delim, &tmp); opt; opt = strtok_r(tmp, delim, &tmp)) {
 		parse_opt(table, opt, ap);
 	}
+	return 0;
 }
 
 static int table_init_parameters(struct table *table)
@@ -105,36 +195,135 @@ static int table_init_parameters(struct table *table)
 	} else {
 		table->e_max = E_MAX_DEFAULT;
 	}
-	table->hash = default_hash;
+
+	if (!table->load_factor)
+		table->load_factor = LOAD_FACTOR_DEFAULT;
+	if (!table->growth)
+		table->growth = GROWTH_DEFAULT;
+	if (!(table->load_factor > 0) || !(table->growth > 1))
+		return -EINVAL;
+	table->b_bits = table_bucket_bits(table, table->e_size);
+	table->e_size = table_capacity(table, table->b_bits);
+
+	if (table->flags & TABLE_F_SEEDED)
+		table->seed[1] = splitmix64(table->seed[0]);
+	else
+		hash_random_seed(table->seed);
 	return 0;
 }
 
+static uint64_t table_hashkey(struct table *table, const char *key)
+{
+	if (table->hash64)
+		return table->hash64(key);
+	if (table->hash)
+		return table->hash(key);
+	if (table->flags & TABLE_F_SIPHASH)
+		return hash_siphash13(key, strlen(key), table->seed);
+	return hash_fnv1a64(key, table->seed[0]);
+}
+
+/*
+ * Allocates a zeroed array of n bucket pointers. Large arrays are mapped
+ * directly and advised into transparent huge pages so that random bucket
+ * accesses do not miss the TLB on every probe; *mapped tells the caller which
+ * of table_free_bucket_array()'s paths to take.
+ */
+static struct list_head **table_alloc_bucket_array(struct table *table, size_t n, int *mapped)
+{
+	size_t bytes = n*sizeof(struct list_head *);
+	void *p;
+
+	*mapped = 0;
+	if (bytes / sizeof(struct list_head *) != n)
+		return NULL;
+
+	if (bytes >= HUGEPAGE_THRESHOLD && !(table->flags & TABLE_F_NO_HUGEPAGES)) {
+		p = mmap(NULL, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (p != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+			if (madvise(p, bytes, MADV_HUGEPAGE)) {
+				pr_dbg("%s: MADV_HUGEPAGE: %s\n", __func__, strerror(errno));
+			}
+#endif
+			*mapped = 1;
+			return p;
+		}
+		pr_dbg("%s: mmap of %zu bytes failed, falling back to calloc\n", __func__, bytes);
+	}
+	return calloc(n, sizeof(struct list_head *));
+}
+
+static void table_free_bucket_array(struct list_head **buckets, size_t n, int mapped)
+{
+	if (mapped)
+		munmap(buckets, n*sizeof(struct list_head *));
+	else
+		free(buckets);
+}
+
 static int table_init_buckets(struct table *table)
 {
+	int mapped;
+
 	table->n_entries = 0;
-	table->buckets = calloc(bfs(table->e_size), sizeof(*(table->buckets)));
+	table->buckets = table_alloc_bucket_array(table, table_n_buckets(table), &mapped);
 	if (!table->buckets)
 		return -ENOMEM;	
+	if (mapped)
+		table->flags |= TABLE_F_BUCKETS_MAPPED;
 	return 0;	
 }
 
 static void table_dest_buckets(struct table *table)
 {
 	struct table_entry *entryp, *tmp;
-	unsigned i;
-	for (i = 0; i < bfs(table->e_size); i++) 
+	size_t i;
+	for (i = 0; i < table_n_buckets(table); i++) 
 		if (table->buckets[i]) {
 			list_for_each_entry_safe(entryp, tmp, table->buckets[i], bucket) {
 				list_del(&entryp->bucket);
+				if (entryp->flags & TABLE_ENTRY_F_ARENA)
+					continue;
 				free((void*)entryp->key);
 				free(entryp);
 			}
 			free(table->buckets[i]);
 		}
 	
-	free(table->buckets);
+	table_free_bucket_array(table->buckets, table_n_buckets(table),
+				table->flags & TABLE_F_BUCKETS_MAPPED);
+	table->flags &= ~TABLE_F_BUCKETS_MAPPED;
 	table->buckets = NULL;
 	table->n_entries = 0;
+	arena_dest(&table->arena[0]);
+	arena_dest(&table->arena[1]);
+}
+
+/* hot_mask holds the number of slots asked for until the cache is allocated */
+static int table_init_hot(struct table *table)
+{
+	size_t n = table->hot_mask;
+
+	table->hot_mask = 0;
+	if (!n)
+		return 0;
+	if (n > SIZE_MAX/2/sizeof(*table->hot))
+		return -EINVAL;
+	while (n & (n - 1))
+		n += n & -n;
+	table->hot = calloc(n, sizeof(*table->hot));
+	if (!table->hot)
+		return -ENOMEM;
+	table->hot_mask = n - 1;
+	return 0;
+}
+
+/* forgets every cached entry, for when entries may have been freed or rehashed */
+static void table_clear_hot(struct table *table)
+{
+	if (table->hot)
+		memset(table->hot, 0, (table->hot_mask + 1)*sizeof(*table->hot));
 }
 
 static int vtable_init(struct table *table, const char *options, va_list ap)
@@ -142,19 +331,30 @@ static int vtable_init(struct table *table, const char *options, va_list ap)
 	int ret;
 
 	memset(table, 0, sizeof(*table));
-	parse_opts(table, options, ap);
+	ret = parse_opts(table, options, ap);
+	if (ret)
+		return ret;
 	ret = table_init_parameters(table);
 	if (ret)
 		return ret;
-	ret = table_init_buckets(table);
+	arena_init(&table->arena[0], "chunk_size", (size_t)COMPACT_CHUNK_SIZE);
+	arena_init(&table->arena[1], "chunk_size", (size_t)COMPACT_CHUNK_SIZE);
+	ret = table_init_hot(table);
 	if (ret)
 		return ret;
+	ret = table_init_buckets(table);
+	if (ret) {
+		free(table->hot);
+		return ret;
+	}
 	return 0;
 }
 
 void table_dest(struct table *table)
 {
 	table_dest_buckets(table);
+	free(table->hot);
+	table->hot = NULL;
 	return;
 }
 
@@ -195,144 +395,563 @@ void table_free(struct table *table)
 	free(table);	
 }
 
-static struct table_entry *table_search_entry(struct table *table, const char *key)
+/* *chain is set to the number of entries walked past, the full chain length on a miss */
+static struct table_entry *table_search_entry(struct table *table, const char *key,
+					      uint64_t hash, unsigned *chain)
 {
-	unsigned h = table->hash(key)%bfs(table->e_size);
+	size_t h = table_bucket(table, hash);
 	struct list_head *bucketp = table->buckets[h];
-	struct table_entry *entryp;
+	struct table_entry *entryp, **hotp = NULL;
+	int stats = table->flags & TABLE_F_STATS;
 
-	pr_dbg("%s: hash for key '%s' is %u\n", __func__, key, h);
+	pr_dbg("%s: hash for key '%s' is %zu\n", __func__, key, h);
+	*chain = 0;
+	if (stats)
+		table->stats.searches++;
+	if (table->hot) {
+		hotp = &table->hot[hash & table->hot_mask];
+		entryp = *hotp;
+		if (entryp) {
+			if (stats)
+				table->stats.probes++;
+			if (entryp->hash == hash && strcmp(entryp->key,key)==0) {
+				if (stats)
+					table->stats.hot_hits++;
+				return entryp;
+			}
+		}
+	}
 	if (!bucketp)
 		return NULL;
 
-	list_for_each_entry(entryp, bucketp, bucket)
-		if (strcmp(entryp->key,key)==0) 
+	list_for_each_entry(entryp, bucketp, bucket) {
+		if (entryp->hash == hash && strcmp(entryp->key,key)==0) {
+			if (stats)
+				table->stats.probes += *chain + 1;
+			if (hotp)
+				*hotp = entryp;
+			if (table->flags & TABLE_F_MOVE_TO_FRONT)
+				list_move(&entryp->bucket, bucketp);
+			else if ((table->flags & TABLE_F_TRANSPOSE) && entryp->bucket.prev != bucketp)
+				list_move(&entryp->bucket, entryp->bucket.prev->prev);
 			return entryp;
-
+		}
+		(*chain)++;
+	}
+	if (stats)
+		table->stats.probes += *chain;
 	return NULL;
 }
 
-static int table_resize(struct table *table)
+/*
+ * Links entryp into its bucket without checking the load. Returns zero on
+ * success and a negative value on failure.
+ */
+static int table_link_entry(struct table *table, struct table_entry *entryp)
 {
-	size_t e_size, tmpsz;
-	struct list_head **buckets, **tmpbuck;
-	struct table_entry *entryp, *tmpe;
-	int i;
-	
-	if (table->n_entries+1 >= table->e_size) {
-		if (table->e_size >= table->e_max)
-			return -1;
-		
-		e_size = table->e_size*2;
-		if (e_size > table->e_max) 
-			e_size = table->e_max;
+	size_t h = table_bucket(table, entryp->hash);
+	struct list_head *bucketp = table->buckets[h];
 
-		pr_dbg("%s: resizing to %zu\n", __func__, e_size);
-		buckets = zalloc(bfs(e_size)*sizeof(*buckets));
-		if (!buckets)
+	pr_dbg("%s: hash for key '%s' is %zu\n", __func__, entryp->key, h);
+	if (!bucketp) {
+		bucketp = zalloc(sizeof(*bucketp));
+		if (!bucketp)
 			return -1;
 		
-		tmpbuck = table->buckets;
-		table->buckets = buckets;
-		buckets = tmpbuck;		
+		INIT_LIST_HEAD(bucketp);
+		list_add(&entryp->bucket, bucketp);
+		table->buckets[h] = bucketp;
+	} else {
+		list_add(&entryp->bucket, bucketp);
+	}
+	return 0;
+}
 
-		tmpsz = table->e_size;
-		table->e_size = e_size;
-		e_size = tmpsz;
-		
-		table->n_entries = 0;
-		
-		for (i = 0; i < bfs(e_size); i++) {
-			if (!buckets[i]) {
-				pr_dbg("%s: bucket[%d] is zero\n", __func__, i);
-				continue;
+/* moves the entries of n buckets onto list and frees the bucket heads */
+static void table_splice_buckets(struct list_head **buckets, size_t n, struct list_head *list)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (!buckets[i])
+			continue;
+		list_splice_tail(buckets[i], list);
+		free(buckets[i]);
+		buckets[i] = NULL;
+	}
+}
+
+/*
+ * Links the entries of the n old buckets into the table's new ones. Fails
+ * when a new bucket head cannot be allocated, leaving the entries not yet
+ * moved in their old buckets; the old heads are only freed on success.
+ */
+static int table_rehash_serial(struct table *table, struct list_head **buckets, size_t n)
+{
+	struct table_entry *entryp, *tmpe;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (!buckets[i]) {
+			pr_dbg("%s: bucket[%zu] is zero\n", __func__, i);
+			continue;
+		}
+		list_for_each_entry_safe(entryp, tmpe, buckets[i], bucket) {
+			list_del(&entryp->bucket);
+			pr_dbg("%s: key=%s,data=%s\n",__func__,
+			       entryp->key,
+			       (const char*)entryp->data);
+			if (table_link_entry(table, entryp) < 0) {
+				list_add(&entryp->bucket, buckets[i]);
+				return -ENOMEM;
 			}
-			list_for_each_entry_safe(entryp, tmpe, buckets[i], bucket) {
-				list_del(&entryp->bucket);
-				pr_dbg("%s: key=%s,data=%s\n",__func__,
-				       entryp->key,
-				       (const char*)entryp->data);
-				table_insert_entry(table, entryp);
+		}
+	}
+	for (i = 0; i < n; i++)
+		free(buckets[i]);
+	return 0;
+}
+
+/*
+ * Parallel rehash. Each worker owns a slice of the old bucket array and a
+ * slice (partition) of the new one. In the first phase every worker sorts the
+ * entries of its old slice onto per-destination-partition lists; in the
+ * second phase every worker drains the lists bound for its own partition into
+ * the new buckets. No two workers ever touch the same bucket, so no locking
+ * is needed. The old bucket heads are only freed in a third phase, once every
+ * entry has been linked, so that a failed rehash can put entries back.
+ */
+struct rehash_work {
+	pthread_t thread;
+	struct table *table;
+	struct list_head **old;
+	size_t n_old;
+	unsigned id;
+	unsigned n_workers;
+	struct list_head *parts;	/* n_workers x n_workers, [src*n_workers + dst] */
+	int started;			/* runs on a thread of its own */
+	size_t n_dropped;		/* entries lost to allocation failures */
+	/* for table_merge_parallel(), where table is the destination */
+	struct table **srcs;
+	unsigned n_srcs;
+	table_combine_func combine;
+	void *combine_arg;
+	size_t n_added;
+	int error;
+};
+
+static void *table_rehash_scatter(void *arg)
+{
+	struct rehash_work *w = arg;
+	size_t nb = table_n_buckets(w->table), chunk = (nb + w->n_workers - 1)/w->n_workers;
+	size_t i, lo = w->id*w->n_old/w->n_workers, hi = (w->id + 1)*w->n_old/w->n_workers;
+	struct list_head *parts = &w->parts[w->id*w->n_workers];
+	struct table_entry *entryp, *tmpe;
+
+	for (i = lo; i < hi; i++) {
+		if (!w->old[i])
+			continue;
+		list_for_each_entry_safe(entryp, tmpe, w->old[i], bucket)
+			list_move_tail(&entryp->bucket, &parts[table_bucket(w->table, entryp->hash)/chunk]);
+	}
+	return NULL;
+}
+
+/* stops at the first bucket head it cannot allocate, leaving the rest on the lists */
+static void *table_rehash_gather(void *arg)
+{
+	struct rehash_work *w = arg;
+	struct table_entry *entryp, *tmpe;
+	struct list_head *part;
+	unsigned src;
+
+	for (src = 0; src < w->n_workers; src++) {
+		part = &w->parts[src*w->n_workers + w->id];
+		list_for_each_entry_safe(entryp, tmpe, part, bucket) {
+			list_del(&entryp->bucket);
+			if (table_link_entry(w->table, entryp) < 0) {
+				list_add(&entryp->bucket, part);
+				w->error = -ENOMEM;
+				return NULL;
+			}
+		}
+	}
+	return NULL;
+}
+
+static void *table_rehash_release(void *arg)
+{
+	struct rehash_work *w = arg;
+	size_t i, lo = w->id*w->n_old/w->n_workers, hi = (w->id + 1)*w->n_old/w->n_workers;
+
+	for (i = lo; i < hi; i++)
+		free(w->old[i]);
+	return NULL;
+}
+
+/* runs fn on every worker, falling back to the calling thread if a thread cannot be started */
+static void table_rehash_phase(struct rehash_work *works, unsigned n, void *(*fn)(void *))
+{
+	unsigned i;
+
+	for (i = 1; i < n; i++)
+		works[i].started = pthread_create(&works[i].thread, NULL, fn, &works[i]) == 0;
+	fn(&works[0]);
+	for (i = 1; i < n; i++) {
+		if (works[i].started)
+			pthread_join(works[i].thread, NULL);
+		else
+			fn(&works[i]);
+	}
+}
+
+/*
+ * Moves the entries of the n old buckets into the table's new ones. On
+ * failure the old heads are kept, and entries in neither the old nor the new
+ * buckets are left on the list left.
+ */
+static int table_rehash(struct table *table, struct list_head **buckets, size_t n,
+			struct list_head *left)
+{
+	unsigned n_workers = table->rehash_threads, i;
+	struct rehash_work *works;
+	struct list_head *parts;
+	int ret = 0;
+
+	if (n_workers > 1 && n >= PARALLEL_REHASH_MIN) {
+		works = calloc(n_workers, sizeof(*works));
+		parts = calloc((size_t)n_workers*n_workers, sizeof(*parts));
+		if (works && parts) {
+			pr_dbg("%s: rehashing on %u threads\n", __func__, n_workers);
+			for (i = 0; i < n_workers*n_workers; i++)
+				INIT_LIST_HEAD(&parts[i]);
+			for (i = 0; i < n_workers; i++) {
+				works[i].table = table;
+				works[i].old = buckets;
+				works[i].n_old = n;
+				works[i].id = i;
+				works[i].n_workers = n_workers;
+				works[i].parts = parts;
+			}
+			table_rehash_phase(works, n_workers, table_rehash_scatter);
+			table_rehash_phase(works, n_workers, table_rehash_gather);
+			for (i = 0; i < n_workers; i++)
+				if (works[i].error)
+					ret = works[i].error;
+			if (ret) {
+				for (i = 0; i < n_workers*n_workers; i++)
+					list_splice_tail(&parts[i], left);
+			} else {
+				table_rehash_phase(works, n_workers, table_rehash_release);
 			}
-			free(buckets[i]);
+			free(works);
+			free(parts);
+			return ret;
 		}
+		free(works);
+		free(parts);
 	}
+	return table_rehash_serial(table, buckets, n);
+}
+
+/*
+ * Moves every entry into a new array of 1 << bits buckets. If a bucket head
+ * cannot be allocated on the way, every entry goes back to the old array,
+ * whose heads are kept until the end, and the table is left as it was.
+ */
+static int table_rehash_to(struct table *table, unsigned bits)
+{
+	struct list_head **buckets, **old = table->buckets;
+	size_t n_old = table_n_buckets(table);
+	struct table_entry *entryp, *tmpe;
+	unsigned old_bits = table->b_bits;
+	int mapped, old_mapped;
+	LIST_HEAD(left);
+
+	pr_dbg("%s: resizing to %zu buckets\n", __func__, (size_t)1 << bits);
+	buckets = table_alloc_bucket_array(table, (size_t)1 << bits, &mapped);
+	if (!buckets)
+		return -ENOMEM;
+
+	table->buckets = buckets;
+	table->b_bits = bits;
+	if (table_rehash(table, old, n_old, &left)) {
+		pr_err("%s: out of memory, keeping %zu buckets\n", __func__, n_old);
+		table_splice_buckets(buckets, (size_t)1 << bits, &left);
+		table->buckets = old;
+		table->b_bits = old_bits;
+		list_for_each_entry_safe(entryp, tmpe, &left, bucket)
+			list_move(&entryp->bucket, old[table_bucket(table, entryp->hash)]);
+		table_free_bucket_array(buckets, (size_t)1 << bits, mapped);
+		return -ENOMEM;
+	}
+
+	old_mapped = table->flags & TABLE_F_BUCKETS_MAPPED;
+	table->flags &= ~TABLE_F_BUCKETS_MAPPED;
+	if (mapped)
+		table->flags |= TABLE_F_BUCKETS_MAPPED;
+	table->e_size = table_capacity(table, bits);
+	table_free_bucket_array(old, n_old, old_mapped);
+	table_clear_hot(table);
+	table->compact_pos = 0;
 	return 0;
 }
 
+/* makes room for one more entry, growing the table by its growth factor if it is at capacity */
+static int table_resize(struct table *table)
+{
+	double target;
+	unsigned bits;
+
+	if (table->n_entries < table->e_size)
+		return 0;
+	if (table->n_entries >= table->e_max || table->b_bits >= B_BITS_MAX)
+		return -1;
+
+	target = (double)table->e_size*table->growth;
+	if (target > (double)table->e_max)
+		target = (double)table->e_max;
+	bits = table_bucket_bits(table, (size_t)target);
+	if (bits <= table->b_bits)
+		bits = table->b_bits + 1;
+	return table_rehash_to(table, bits) ? -1 : 0;
+}
+
+int table_reserve(struct table *table, size_t n)
+{
+	if (n > table->e_max)
+		return -EINVAL;
+	if (n <= table->e_size)
+		return 0;
+	return table_rehash_to(table, table_bucket_bits(table, n));
+}
+
+/*
+ * Rehashes every entry under a fresh seed with SipHash-1-3, after a chain
+ * grew past max_chain. Chains that long under a random seed point at keys
+ * chosen to collide, which a keyed hash defeats. To bound the work an
+ * attacker can cause, the table reseeds again only once it has doubled.
+ * The bucket heads are kept while entries move, so that if a new head
+ * cannot be allocated every entry can go back under the old seed.
+ */
+static void table_reseed(struct table *table)
+{
+	uint64_t seed[2] = { table->seed[0], table->seed[1] };
+	struct table_entry *entryp, *tmpe;
+	size_t i, n = table_n_buckets(table);
+	unsigned flags = table->flags;
+	LIST_HEAD(entries);
+	int ret = 0;
+
+	if (table->hash || table->hash64 || table->n_entries < table->reseed_at)
+		return;
+
+	pr_dbg("%s: reseeding at %zu entries\n", __func__, table->n_entries);
+	if (table->flags & TABLE_F_SEEDED) {
+		table->seed[0] = splitmix64(table->seed[1]);
+		table->seed[1] = splitmix64(table->seed[0]);
+	} else {
+		hash_random_seed(table->seed);
+	}
+	table->flags |= TABLE_F_SIPHASH;
+
+	for (i = 0; i < n; i++)
+		if (table->buckets[i])
+			list_splice_tail_init(table->buckets[i], &entries);
+
+	list_for_each_entry_safe(entryp, tmpe, &entries, bucket) {
+		list_del(&entryp->bucket);
+		entryp->hash = table_hashkey(table, entryp->key);
+		ret = table_link_entry(table, entryp);
+		if (ret < 0) {
+			list_add(&entryp->bucket, &entries);
+			break;
+		}
+	}
+	if (ret < 0) {
+		pr_err("%s: out of memory, keeping the seed\n", __func__);
+		table->seed[0] = seed[0];
+		table->seed[1] = seed[1];
+		table->flags = flags;
+		for (i = 0; i < n; i++)
+			if (table->buckets[i])
+				list_splice_tail_init(table->buckets[i], &entries);
+		list_for_each_entry_safe(entryp, tmpe, &entries, bucket) {
+			entryp->hash = table_hashkey(table, entryp->key);
+			list_move(&entryp->bucket, table->buckets[table_bucket(table, entryp->hash)]);
+		}
+	}
+
+	/* heads left empty, whichever seed won */
+	for (i = 0; i < n; i++) {
+		if (table->buckets[i] && list_empty(table->buckets[i])) {
+			free(table->buckets[i]);
+			table->buckets[i] = NULL;
+		}
+	}
+	table->reseed_at = 2*table->n_entries;
+	table_clear_hot(table);
+	table->compact_pos = 0;
+}
+
 static int table_insert_entry(struct table *table, struct table_entry *entryp)
 {
 	int ret;
-	unsigned h;
-	struct list_head *bucketp;
 	
 	ret = table_resize(table); 
 	if (ret)
 		return ret;
 
-	h = table->hash(entryp->key)%bfs(table->e_size);
-	pr_dbg("%s: hash for key '%s' is %u\n", __func__, entryp->key, h);
-	bucketp = table->buckets[h];
-	if (!bucketp) {
-		bucketp = zalloc(sizeof(*bucketp));
-		if (!bucketp)
-			return -1;
-		
-		INIT_LIST_HEAD(bucketp);
-		list_add(&entryp->bucket, bucketp);
-		table->buckets[h] = bucketp;
-		table->n_entries++;
-	} else {
-		list_add(&entryp->bucket, bucketp);
-	}
+	ret = table_link_entry(table, entryp);
+	if (ret < 0)
+		return ret;
+	table->n_entries++;
 	return 0;
 }
 
+/*
+ * Appends the new value of key to the table's log, if it has one. Called
+ * before the value is stored, so that the table never holds a value its log
+ * lacks.
+ */
+static int table_log_update(struct table *table, const char *key, tdata_t data)
+{
+	if (!table->wal)
+		return 0;
+	return wal_append(table->wal, WAL_OP_UPDATE, key, data, NULL) ? -1 : 0;
+}
+
+/*
+ * Checkpoints the table's log once it has grown too large. The update that
+ * got it there is logged either way, so a failure only leaves the log long.
+ */
+static void table_log_checkpoint(struct table *table)
+{
+	int ret;
+
+	if (!table->wal || !__wal_checkpoint_due(table->wal))
+		return;
+	ret = wal_checkpoint(table->wal, table);
+	if (ret)
+		pr_err("%s: checkpoint failed: %s\n", __func__, strerror(-ret));
+}
+
 int table_update_only(struct table *table, const char *key, tdata_t data)
 {
-	struct table_entry *entryp = table_search_entry(table,key);
+	unsigned chain;
+	struct table_entry *entryp = table_search_entry(table, key, table_hashkey(table, key), &chain);
 
-	if (!entryp) {
+	if (!entryp || table_log_update(table, key, data))
 		return -1;
-	} else {
-		entryp->data = data;
-		return 0;
+	entryp->data = data;
+	table_log_checkpoint(table);
+	return 0;
+}
+
+/*
+ * Returns the entry for key, inserting one with zero data if there is none.
+ * The key is hashed and its chain walked once either way.
+ */
+static struct table_entry *table_get_entry(struct table *table, const char *key, int *created)
+{
+	uint64_t hash = table_hashkey(table, key);
+	struct table_entry *entryp;
+	unsigned chain;
+	int ret;
+
+	entryp = table_search_entry(table, key, hash, &chain);
+	*created = 0;
+	if (entryp)
+		return entryp;
+
+	entryp = zalloc(sizeof(*entryp));
+	if (!entryp)
+		return NULL;
+	entryp->key = strdup(key);
+	if (!entryp->key) {
+		free(entryp);
+		return NULL;
 	}
+	entryp->hash = hash;
+	ret = table_insert_entry(table, entryp);
+	if (ret) {
+		free((void*)entryp->key);
+		free(entryp);
+		return NULL;
+	}
+	if (table->max_chain && chain >= table->max_chain)
+		table_reseed(table);
+	*created = 1;
+	return entryp;
+}
+
+/* takes back an entry table_get_entry() just inserted, when its update could not be logged */
+static void table_drop_created(struct table *table, struct table_entry *entryp)
+{
+	if (table->hot && table->hot[entryp->hash & table->hot_mask] == entryp)
+		table->hot[entryp->hash & table->hot_mask] = NULL;
+	list_del(&entryp->bucket);
+	table->n_entries--;
+	free((void *)entryp->key);
+	free(entryp);
 }
 
 int table_update(struct table *table, const char *key, tdata_t data)
 {
 	struct table_entry *entryp;
-	int ret;
+	int created;
 
 	pr_dbg("%s: key=%s,data=%s\n",__func__,key,(const char*)data);
-	entryp = table_search_entry(table, key);
-	if (!entryp) {
-		entryp = zalloc(sizeof(*entryp));
-		if (!entryp)
-			return -1;
-		entryp->key = strdup(key);
-		if (!entryp->key) {
-			free(entryp);
-			return -1;
-		}
-		entryp->data = data;
-		ret = table_insert_entry(table, entryp);
-		if (ret) {
-			free((void*)entryp->key);
-			free(entryp);
-			return -1;
-		}
-		return 0;
-	} else {
-		entryp->data = data;
-		return 0;
+	entryp = table_get_entry(table, key, &created);
+	if (!entryp)
+		return -1;
+
+	if (table_log_update(table, key, data)) {
+		if (created)
+			table_drop_created(table, entryp);
+		return -1;
+	}
+	entryp->data = data;
+	table_log_checkpoint(table);
+	return 0;
+}
+
+tdata_t *table_slot(struct table *table, const char *key, int *created)
+{
+	struct table_entry *entryp;
+	int tmp;
+
+	entryp = table_get_entry(table, key, created ? created : &tmp);
+	return entryp ? &entryp->data : NULL;
+}
+
+int table_upsert(struct table *table, const char *key, table_upsert_func fn, void *arg)
+{
+	struct table_entry *entryp;
+	int created;
+	tdata_t data;
+
+	entryp = table_get_entry(table, key, &created);
+	if (!entryp)
+		return -1;
+
+	/* fn works on a copy, which is stored once it is logged */
+	data = entryp->data;
+	fn(&data, created, arg);
+	if (table_log_update(table, key, data)) {
+		if (created)
+			table_drop_created(table, entryp);
+		return -1;
 	}
+	entryp->data = data;
+	table_log_checkpoint(table);
+	return 0;
 }
 
 int table_search(struct table *table, const char *key, tdata_t *data)
 {
-	struct table_entry *entryp = table_search_entry(table, key);	
+	unsigned chain;
+	struct table_entry *entryp = table_search_entry(table, key, table_hashkey(table, key), &chain);	
 
 	if (!entryp)
 		return -1;
@@ -340,3 +959,362 @@ int table_search(struct table *table, const char *key, tdata_t *data)
 	*data = entryp->data;
 	return 0;
 }
+
+/*
+ * Compaction copies entries into table->arena[compact_next] bucket by bucket
+ * and frees the originals. Entries from the previous pass live in the other
+ * arena, which is released in one go once a pass has moved all of them out.
+ * A rehash reorders the buckets, so it restarts the pass from bucket zero;
+ * entries already moved in this pass are recognized by their flags and left
+ * in place.
+ */
+static int table_compact_bucket(struct table *table, struct list_head *bucketp)
+{
+	struct arena *arena = &table->arena[table->compact_next];
+	unsigned flags = TABLE_ENTRY_F_ARENA | (table->compact_next ? TABLE_ENTRY_F_ARENA1 : 0);
+	struct table_entry *entryp, *tmp, *copy;
+	size_t len;
+
+	list_for_each_entry_safe(entryp, tmp, bucketp, bucket) {
+		if (entryp->flags == flags)
+			continue;
+
+		len = strlen(entryp->key) + 1;
+		copy = arena_memalign(arena, _Alignof(struct table_entry), sizeof(*copy) + len);
+		if (!copy)
+			return -ENOMEM;
+
+		memcpy(copy + 1, entryp->key, len);
+		copy->key = (const char *)(copy + 1);
+		copy->data = entryp->data;
+		copy->hash = entryp->hash;
+		copy->flags = flags;
+		list_replace(&entryp->bucket, &copy->bucket);
+		if (table->hot && table->hot[copy->hash & table->hot_mask] == entryp)
+			table->hot[copy->hash & table->hot_mask] = copy;
+
+		if (!(entryp->flags & TABLE_ENTRY_F_ARENA)) {
+			free((void *)entryp->key);
+			free(entryp);
+		}
+	}
+	return 0;
+}
+
+int table_compact_step(struct table *table, size_t n_buckets)
+{
+	size_t nb = table_n_buckets(table);
+	int ret;
+
+	for (; n_buckets && table->compact_pos < nb; n_buckets--, table->compact_pos++) {
+		if (!table->buckets[table->compact_pos])
+			continue;
+		ret = table_compact_bucket(table, table->buckets[table->compact_pos]);
+		if (ret)
+			return ret;
+	}
+	if (table->compact_pos < nb)
+		return 0;
+
+	pr_dbg("%s: pass complete\n", __func__);
+	arena_dest(&table->arena[!table->compact_next]);
+	table->compact_next = !table->compact_next;
+	table->compact_pos = 0;
+	return 1;
+}
+
+int table_compact(struct table *table)
+{
+	int ret;
+
+	/* finish a pass in progress first, entries inserted behind its cursor are still on the heap */
+	if (table->compact_pos) {
+		ret = table_compact_step(table, SIZE_MAX);
+		if (ret < 0)
+			return ret;
+	}
+	ret = table_compact_step(table, SIZE_MAX);
+	return ret < 0 ? ret : 0;
+}
+
+int table_for_each(struct table *table, table_iter_func fn, void *arg)
+{
+	struct table_entry *entryp;
+	size_t i;
+	int ret;
+
+	for (i = 0; i < table_n_buckets(table); i++) {
+		if (!table->buckets[i])
+			continue;
+		list_for_each_entry(entryp, table->buckets[i], bucket) {
+			ret = fn(entryp->key, entryp->data, arg);
+			if (ret)
+				return ret;
+		}
+	}
+	return 0;
+}
+
+uint64_t table_hash(struct table *table, const char *key)
+{
+	return table_hashkey(table, key);
+}
+
+/* whether both tables hash every key alike, so that cached hashes carry over */
+static int table_hash_compatible(struct table *a, struct table *b)
+{
+	if (a->hash64 || b->hash64)
+		return a->hash64 == b->hash64;
+	if (a->hash || b->hash)
+		return a->hash == b->hash;
+	return a->seed[0] == b->seed[0] && a->seed[1] == b->seed[1] &&
+		(a->flags & TABLE_F_SIPHASH) == (b->flags & TABLE_F_SIPHASH);
+}
+
+/* an entry leaving its table for another, copied to the heap if it lives in the old table's arena */
+static struct table_entry *table_steal_entry(struct table_entry *entryp)
+{
+	struct table_entry *copy;
+
+	if (!(entryp->flags & TABLE_ENTRY_F_ARENA))
+		return entryp;
+	copy = zalloc(sizeof(*copy));
+	if (!copy)
+		return NULL;
+	copy->key = strdup(entryp->key);
+	if (!copy->key) {
+		free(copy);
+		return NULL;
+	}
+	copy->data = entryp->data;
+	copy->hash = entryp->hash;
+	return copy;
+}
+
+static void table_free_entry(struct table_entry *entryp)
+{
+	if (entryp->flags & TABLE_ENTRY_F_ARENA)
+		return;
+	free((void *)entryp->key);
+	free(entryp);
+}
+
+static void table_combine(struct table_entry *dst, tdata_t data, table_combine_func combine, void *arg)
+{
+	if (combine)
+		combine(&dst->data, data, arg);
+	else
+		dst->data = data;
+}
+
+/* the table an emptied source is left as */
+static void table_reset_source(struct table *src)
+{
+	table_clear_hot(src);
+	if (src->n_entries)
+		return;
+	arena_dest(&src->arena[0]);
+	arena_dest(&src->arena[1]);
+	src->compact_pos = 0;
+}
+
+int table_merge(struct table *dst, struct table *src, table_combine_func combine, void *arg)
+{
+	int compatible = table_hash_compatible(dst, src), ret = 0;
+	struct table_entry *entryp, *tmpe, *found, *copy;
+	size_t i, want = dst->n_entries + src->n_entries;
+	uint64_t hash, old_hash;
+	unsigned chain;
+
+	if (dst == src || src->wal)
+		return -EINVAL;
+
+	/* grow once up front rather than step by step, a full dst is caught entry by entry */
+	table_reserve(dst, want < dst->e_max ? want : dst->e_max);
+
+	for (i = 0; i < table_n_buckets(src); i++) {
+		if (!src->buckets[i])
+			continue;
+		list_for_each_entry_safe(entryp, tmpe, src->buckets[i], bucket) {
+			hash = compatible ? entryp->hash : table_hashkey(dst, entryp->key);
+			found = table_search_entry(dst, entryp->key, hash, &chain);
+			if (found) {
+				table_combine(found, entryp->data, combine, arg);
+				list_del(&entryp->bucket);
+				src->n_entries--;
+				table_free_entry(entryp);
+				entryp = found;
+			} else {
+				copy = table_steal_entry(entryp);
+				if (!copy) {
+					ret = -ENOMEM;
+					goto out;
+				}
+				old_hash = entryp->hash;
+				list_del(&entryp->bucket);
+				src->n_entries--;
+				copy->hash = hash;
+				if (table_insert_entry(dst, copy)) {
+					/* put it back where it was */
+					if (copy != entryp)
+						table_free_entry(copy);
+					entryp->hash = old_hash;
+					list_add(&entryp->bucket, src->buckets[i]);
+					src->n_entries++;
+					ret = -1;
+					goto out;
+				}
+				entryp = copy;
+			}
+			if (dst->wal && wal_append(dst->wal, WAL_OP_UPDATE, entryp->key, entryp->data, NULL))
+				ret = -1;
+		}
+	}
+out:
+	table_reset_source(src);
+	table_log_checkpoint(dst);
+	return ret;
+}
+
+/*
+ * Parallel merge, laid out like the parallel rehash: worker i owns partition
+ * i of dst's buckets. Each worker first sorts the entries of its slice of
+ * every source onto per-destination-partition lists, then merges the lists
+ * bound for its partition into dst. Workers never share a bucket, so nothing
+ * is locked; only the shared counters are summed up afterwards.
+ */
+static void *table_merge_scatter(void *arg)
+{
+	struct rehash_work *w = arg;
+	size_t nb = table_n_buckets(w->table), chunk = (nb + w->n_workers - 1)/w->n_workers;
+	struct list_head *parts = &w->parts[w->id*w->n_workers];
+	struct table_entry *entryp, *tmpe;
+	struct table *src;
+	size_t i, lo, hi;
+	unsigned s;
+
+	for (s = 0; s < w->n_srcs; s++) {
+		src = w->srcs[s];
+		lo = w->id*table_n_buckets(src)/w->n_workers;
+		hi = (w->id + 1)*table_n_buckets(src)/w->n_workers;
+		for (i = lo; i < hi; i++) {
+			if (!src->buckets[i])
+				continue;
+			list_for_each_entry_safe(entryp, tmpe, src->buckets[i], bucket)
+				list_move_tail(&entryp->bucket, &parts[table_bucket(w->table, entryp->hash)/chunk]);
+		}
+	}
+	return NULL;
+}
+
+static void *table_merge_gather(void *arg)
+{
+	struct rehash_work *w = arg;
+	struct table *dst = w->table;
+	struct table_entry *entryp, *tmpe, *found, *copy;
+	struct list_head *bucketp;
+	unsigned src;
+
+	for (src = 0; src < w->n_workers; src++) {
+		list_for_each_entry_safe(entryp, tmpe, &w->parts[src*w->n_workers + w->id], bucket) {
+			list_del(&entryp->bucket);
+			/* a plain walk: the hot cache and the statistics of dst are shared */
+			found = NULL;
+			bucketp = dst->buckets[table_bucket(dst, entryp->hash)];
+			if (bucketp) {
+				list_for_each_entry(found, bucketp, bucket)
+					if (found->hash == entryp->hash && strcmp(found->key, entryp->key)==0)
+						break;
+				if (&found->bucket == bucketp)
+					found = NULL;
+			}
+
+			if (found) {
+				table_combine(found, entryp->data, w->combine, w->combine_arg);
+				table_free_entry(entryp);
+				entryp = found;
+			} else {
+				copy = table_steal_entry(entryp);
+				if (!copy || table_link_entry(dst, copy) < 0) {
+					pr_err("%s: out of memory, dropping '%s'\n", __func__, entryp->key);
+					if (copy && copy != entryp)
+						table_free_entry(copy);
+					table_free_entry(entryp);
+					w->n_dropped++;
+					w->error = -ENOMEM;
+					continue;
+				}
+				entryp = copy;
+				w->n_added++;
+			}
+			if (dst->wal && wal_append(dst->wal, WAL_OP_UPDATE, entryp->key, entryp->data, NULL))
+				w->error = -1;
+		}
+	}
+	return NULL;
+}
+
+int table_merge_parallel(struct table *dst, struct table **srcs, unsigned n_srcs,
+			 table_combine_func combine, void *arg, unsigned n_threads)
+{
+	struct rehash_work *works = NULL;
+	struct list_head *parts = NULL;
+	size_t want = dst->n_entries;
+	unsigned i, s;
+	int ret = 0;
+
+	for (s = 0; s < n_srcs; s++) {
+		if (srcs[s] == dst || srcs[s]->wal)
+			return -EINVAL;
+		if (!table_hash_compatible(dst, srcs[s]))
+			n_threads = 1;
+		want += srcs[s]->n_entries;
+	}
+	if (n_threads > REHASH_THREADS_MAX)
+		n_threads = REHASH_THREADS_MAX;
+	/* workers cannot grow dst, so it must hold everything beforehand */
+	if (n_threads > 1 && (want > dst->e_max || table_reserve(dst, want)))
+		n_threads = 1;
+	if (n_threads > 1) {
+		works = calloc(n_threads, sizeof(*works));
+		parts = calloc((size_t)n_threads*n_threads, sizeof(*parts));
+	}
+	if (!works || !parts) {
+		free(works);
+		free(parts);
+		for (s = 0; s < n_srcs; s++)
+			if (table_merge(dst, srcs[s], combine, arg))
+				ret = -1;
+		return ret;
+	}
+
+	pr_dbg("%s: merging %u tables on %u threads\n", __func__, n_srcs, n_threads);
+	for (i = 0; i < n_threads*n_threads; i++)
+		INIT_LIST_HEAD(&parts[i]);
+	for (i = 0; i < n_threads; i++) {
+		works[i].table = dst;
+		works[i].id = i;
+		works[i].n_workers = n_threads;
+		works[i].parts = parts;
+		works[i].srcs = srcs;
+		works[i].n_srcs = n_srcs;
+		works[i].combine = combine;
+		works[i].combine_arg = arg;
+	}
+	table_rehash_phase(works, n_threads, table_merge_scatter);
+	table_rehash_phase(works, n_threads, table_merge_gather);
+
+	for (i = 0; i < n_threads; i++) {
+		dst->n_entries += works[i].n_added;
+		if (works[i].error)
+			ret = works[i].error;
+	}
+	for (s = 0; s < n_srcs; s++) {
+		srcs[s]->n_entries = 0;
+		table_reset_source(srcs[s]);
+	}
+	free(works);
+	free(parts);
+	table_log_checkpoint(dst);
+	return ret;
+}
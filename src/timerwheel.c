@@ -0,0 +1,198 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#include <tools/timerwheel.h>
+
+#define TW_LVL_MASK (TW_LVL_SIZE - 1)
+#define TW_LVL_SHIFT(lvl) ((lvl)*TW_LVL_BITS)
+#define TW_MAX_DELTA ((UINT64_C(1) << TW_LVL_SHIFT(TW_LEVELS)) - 1)
+
+void timerwheel_init(struct timerwheel *tw, uint64_t now)
+{
+	int lvl, i;
+
+	tw->clk = now;
+	tw->n_pending = 0;
+	for (lvl = 0; lvl < TW_LEVELS; lvl++) {
+		tw->occupied[lvl] = 0;
+		for (i = 0; i < TW_LVL_SIZE; i++)
+			INIT_LIST_HEAD(&tw->slots[lvl][i]);
+	}
+}
+
+/*
+ * A timer goes in the lowest level whose span covers its distance from the
+ * clock, in the slot that level's index will have when it expires. Timers
+ * further out than the top level can reach are parked at its far end and
+ * placed again when that slot cascades.
+ */
+static void timerwheel_enqueue(struct timerwheel *tw, struct timer *timer)
+{
+	uint64_t expires = timer->expires, delta;
+	int lvl, idx;
+
+	if (expires < tw->clk)
+		expires = tw->clk;
+	delta = expires - tw->clk;
+	if (delta > TW_MAX_DELTA) {
+		delta = TW_MAX_DELTA;
+		expires = tw->clk + delta;
+	}
+
+	for (lvl = 0; lvl < TW_LEVELS - 1; lvl++)
+		if (delta < UINT64_C(1) << TW_LVL_SHIFT(lvl + 1))
+			break;
+
+	idx = (expires >> TW_LVL_SHIFT(lvl)) & TW_LVL_MASK;
+	list_add_tail(&timer->entry, &tw->slots[lvl][idx]);
+	tw->occupied[lvl] |= UINT64_C(1) << idx;
+	timer->slot = lvl*TW_LVL_SIZE + idx;
+}
+
+static void timerwheel_dequeue(struct timerwheel *tw, struct timer *timer)
+{
+	int lvl = timer->slot / TW_LVL_SIZE, idx = timer->slot % TW_LVL_SIZE;
+
+	list_del_init(&timer->entry);
+	if (list_empty(&tw->slots[lvl][idx]))
+		tw->occupied[lvl] &= ~(UINT64_C(1) << idx);
+	timer->slot = TIMER_IDLE;
+}
+
+void timerwheel_add(struct timerwheel *tw, struct timer *timer, uint64_t expires)
+{
+	if (timer_pending(timer))
+		timerwheel_dequeue(tw, timer);
+	else
+		tw->n_pending++;
+
+	timer->expires = expires;
+	timerwheel_enqueue(tw, timer);
+}
+
+int timerwheel_cancel(struct timerwheel *tw, struct timer *timer)
+{
+	if (!timer_pending(timer))
+		return -1;
+
+	timerwheel_dequeue(tw, timer);
+	tw->n_pending--;
+	return 0;
+}
+
+/*
+ * Returns the first tick at or after clk at which slot idx of level lvl is
+ * processed: the tick whose bits for lvl equal idx and whose lower bits are
+ * all zero (level 0 has no lower bits).
+ */
+static uint64_t timerwheel_slot_tick(uint64_t clk, int lvl, int idx)
+{
+	uint64_t span = UINT64_C(1) << TW_LVL_SHIFT(lvl);
+	uint64_t base = (clk + span - 1) & ~(span - 1);
+	int cur = (base >> TW_LVL_SHIFT(lvl)) & TW_LVL_MASK;
+
+	return base + ((uint64_t)((idx - cur) & TW_LVL_MASK) << TW_LVL_SHIFT(lvl));
+}
+
+/* rotates the occupancy bitmap of lvl so bit 0 is the first slot processed at or after clk */
+static uint64_t timerwheel_next_slot(const struct timerwheel *tw, uint64_t clk, int lvl)
+{
+	uint64_t span = UINT64_C(1) << TW_LVL_SHIFT(lvl);
+	uint64_t base = (clk + span - 1) & ~(span - 1);
+	int cur = (base >> TW_LVL_SHIFT(lvl)) & TW_LVL_MASK;
+	uint64_t bits = tw->occupied[lvl];
+
+	bits = cur ? (bits >> cur) | (bits << (TW_LVL_SIZE - cur)) : bits;
+	return timerwheel_slot_tick(clk, lvl, (cur + __builtin_ctzll(bits)) & TW_LVL_MASK);
+}
+
+static uint64_t timerwheel_next_tick(const struct timerwheel *tw, uint64_t clk)
+{
+	uint64_t next = UINT64_MAX, tick;
+	int lvl;
+
+	for (lvl = 0; lvl < TW_LEVELS; lvl++) {
+		if (!tw->occupied[lvl])
+			continue;
+		tick = timerwheel_next_slot(tw, clk, lvl);
+		if (tick < next)
+			next = tick;
+	}
+	return next;
+}
+
+uint64_t timerwheel_next_event(const struct timerwheel *tw)
+{
+	return timerwheel_next_tick(tw, tw->clk);
+}
+
+/* moves a whole slot to a private list first, then re-files each timer below */
+static void timerwheel_cascade(struct timerwheel *tw, int lvl, int idx)
+{
+	struct timer *timer, *tmp;
+	LIST_HEAD(batch);
+
+	if (!(tw->occupied[lvl] & (UINT64_C(1) << idx)))
+		return;
+
+	list_splice_init(&tw->slots[lvl][idx], &batch);
+	tw->occupied[lvl] &= ~(UINT64_C(1) << idx);
+	list_for_each_entry_safe(timer, tmp, &batch, entry)
+		timerwheel_enqueue(tw, timer);
+}
+
+size_t timerwheel_advance(struct timerwheel *tw, uint64_t now, struct list_head *expired)
+{
+	struct list_head *slot;
+	struct timer *timer;
+	uint64_t next;
+	size_t n = 0;
+	int lvl, idx;
+
+	while (tw->clk <= now) {
+		next = timerwheel_next_tick(tw, tw->clk);
+		if (next > now) {
+			tw->clk = now + 1;
+			break;
+		}
+		tw->clk = next;
+
+		/* at the start of each rotation of a level, pull down the next slot of the one above */
+		for (lvl = 1; lvl < TW_LEVELS; lvl++) {
+			if (tw->clk & ((UINT64_C(1) << TW_LVL_SHIFT(lvl)) - 1))
+				break;
+			timerwheel_cascade(tw, lvl, (tw->clk >> TW_LVL_SHIFT(lvl)) & TW_LVL_MASK);
+		}
+
+		idx = tw->clk & TW_LVL_MASK;
+		slot = &tw->slots[0][idx];
+		if (!list_empty(slot)) {
+			list_for_each_entry(timer, slot, entry) {
+				timer->slot = TIMER_IDLE;
+				n++;
+			}
+			list_splice_tail_init(slot, expired);
+			tw->occupied[0] &= ~(UINT64_C(1) << idx);
+		}
+		tw->clk++;
+	}
+
+	tw->n_pending -= n;
+	return n;
+}
@@ -0,0 +1,521 @@
+/* Copyright (c) 2017 Max Ruttenberg */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <internal/printing.h>
+#include <tools/wal.h>
+#include <tools/scoped.h>
+
+#define WAL_MAGIC "TWAL0001"
+#define WAL_MAGIC_LEN 8
+#define WAL_BUF_MIN 4096
+#define REPLAY_BUF_SIZE (1<<16)
+
+/* followed by key_len bytes of key, all fields little endian */
+struct wal_record {
+	uint32_t crc;		/* of everything after this field, key included */
+	uint32_t key_len;
+	uint64_t data;
+	uint8_t op;
+} __attribute__((packed));
+
+static void parse_opt(struct wal *wal, char *option, va_list ap)
+{
+	if (strcmp(option, "checkpoint_size")==0)
+		wal->checkpoint_size = va_arg(ap, size_t);
+}
+
+static int parse_opts(struct wal *wal, const char *options, va_list ap)
+{
+	char *opts __scoped = scoped_strdup(options);
+	char *tmp = opts, *opt, *delim = " ";
+
+	if (!options)
+		return 0;
+	if (!opts)
+		return -ENOMEM;
+
+	for (opt = strtok_r(tmp, delim, &tmp); opt; opt = strtok_r(tmp, delim, &tmp)) {
+		parse_opt(wal, opt, ap);
+	}
+	return 0;
+}
+
+/* CRC-32C, bytewise */
+static uint32_t crc32c(uint32_t crc, const void *data, size_t len)
+{
+	static uint32_t table[256];
+	const unsigned char *p = data;
+	uint32_t c;
+	int i, j;
+
+	if (!table[1]) {
+		for (i = 0; i < 256; i++) {
+			for (c = i, j = 0; j < 8; j++)
+				c = c & 1 ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+			table[i] = c;
+		}
+	}
+
+	crc = ~crc;
+	while (len--)
+		crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define le32(x) __builtin_bswap32(x)
+#define le64(x) __builtin_bswap64(x)
+#else
+#define le32(x) (x)
+#define le64(x) (x)
+#endif
+
+/* checksum of an encoded record, over its bytes as stored */
+static uint32_t wal_record_crc(const struct wal_record *rec, const char *key, size_t key_len)
+{
+	uint32_t crc = crc32c(0, (const char *)rec + sizeof(rec->crc), sizeof(*rec) - sizeof(rec->crc));
+
+	return crc32c(crc, key, key_len);
+}
+
+static void wal_encode(struct wal_record *rec, enum wal_op op, const char *key, size_t key_len, tdata_t data)
+{
+	rec->key_len = le32((uint32_t)key_len);
+	rec->data = le64((uint64_t)data);
+	rec->op = op;
+	rec->crc = le32(wal_record_crc(rec, key, key_len));
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ * Calls fn on every intact record of the log from the start, stopping at the
+ * first one that is torn or corrupt. Returns the offset just past the last
+ * intact record, or a negative errno value.
+ */
+static off_t wal_scan(int fd, int (*fn)(const struct wal_record *, const char *, void *), void *arg)
+{
+	char magic[WAL_MAGIC_LEN];
+	struct wal_record rec;
+	char *key = NULL, *tmp;
+	size_t key_cap = 0, key_len;
+	off_t off = WAL_MAGIC_LEN;
+	struct stat sb;
+	ssize_t n;
+	FILE *f;
+	int dfd;
+
+	if (fstat(fd, &sb))
+		return -errno;
+	dfd = dup(fd);
+	if (dfd < 0)
+		return -errno;
+	f = fdopen(dfd, "r");
+	if (!f) {
+		close(dfd);
+		return -errno;
+	}
+	setvbuf(f, NULL, _IOFBF, REPLAY_BUF_SIZE);
+	if (fseeko(f, 0, SEEK_SET)) {
+		off = -errno;
+		goto out;
+	}
+
+	n = fread(magic, 1, sizeof(magic), f);
+	if (n == 0) {
+		off = 0;
+		goto out;
+	}
+	if (n != sizeof(magic) || memcmp(magic, WAL_MAGIC, sizeof(magic))) {
+		off = -EINVAL;
+		goto out;
+	}
+
+	while (fread(&rec, sizeof(rec), 1, f) == 1) {
+		key_len = le32(rec.key_len);
+		if (key_len > sb.st_size - off - sizeof(rec))
+			break;
+		if (key_len + 1 > key_cap) {
+			tmp = realloc(key, key_len + 1);
+			if (!tmp) {
+				off = -ENOMEM;
+				goto out;
+			}
+			key = tmp;
+			key_cap = key_len + 1;
+		}
+		if (fread(key, 1, key_len, f) != key_len)
+			break;
+		key[key_len] = '\0';
+		if (wal_record_crc(&rec, key, key_len) != le32(rec.crc))
+			break;
+		rec.key_len = key_len;
+		rec.data = le64(rec.data);
+		if (fn && fn(&rec, key, arg)) {
+			off = -EIO;
+			goto out;
+		}
+		off += sizeof(rec) + key_len;
+	}
+out:
+	free(key);
+	fclose(f);
+	return off;
+}
+
+int wal_open(struct wal *wal, const char *path, const char *options, ...)
+{
+	va_list ap;
+	off_t end;
+	int ret;
+
+	memset(wal, 0, sizeof(*wal));
+	va_start(ap, options);
+	ret = parse_opts(wal, options, ap);
+	va_end(ap);
+	if (ret)
+		return ret;
+
+	wal->path = strdup(path);
+	if (!wal->path)
+		return -ENOMEM;
+	wal->fd = open(path, O_RDWR|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+	if (wal->fd < 0) {
+		ret = -errno;
+		goto fail;
+	}
+
+	end = wal_scan(wal->fd, NULL, NULL);
+	if (end < 0) {
+		ret = end;
+		goto fail_close;
+	}
+	if (end == 0) {
+		ret = write_all(wal->fd, WAL_MAGIC, WAL_MAGIC_LEN);
+		if (ret || (ret = fdatasync(wal->fd) ? -errno : 0))
+			goto fail_close;
+		end = WAL_MAGIC_LEN;
+	} else if (ftruncate(wal->fd, end)) {
+		/* cut off a torn record, or new records would be appended behind it */
+		ret = -errno;
+		goto fail_close;
+	}
+	wal->log_size = end;
+
+	pthread_mutex_init(&wal->lock, NULL);
+	pthread_cond_init(&wal->cond, NULL);
+	return 0;
+
+fail_close:
+	close(wal->fd);
+fail:
+	free(wal->path);
+	return ret;
+}
+
+void wal_close(struct wal *wal)
+{
+	if (wal_commit(wal))
+		pr_err("%s: %s: pending records lost: %s\n", __func__, wal->path, strerror(-wal->error));
+	close(wal->fd);
+	pthread_mutex_destroy(&wal->lock);
+	pthread_cond_destroy(&wal->cond);
+	free(wal->buf);
+	free(wal->flush);
+	free(wal->path);
+}
+
+int wal_append(struct wal *wal, enum wal_op op, const char *key, tdata_t data, uint64_t *lsn)
+{
+	size_t key_len = strlen(key), need = sizeof(struct wal_record) + key_len, cap;
+	struct wal_record rec;
+	char *buf;
+
+	if (key_len > UINT32_MAX)
+		return -EINVAL;
+	wal_encode(&rec, op, key, key_len, data);
+
+	pthread_mutex_lock(&wal->lock);
+	if (wal->len + need > wal->cap) {
+		cap = wal->cap ? wal->cap : WAL_BUF_MIN;
+		while (cap < wal->len + need)
+			cap *= 2;
+		buf = realloc(wal->buf, cap);
+		if (!buf) {
+			pthread_mutex_unlock(&wal->lock);
+			return -ENOMEM;
+		}
+		wal->buf = buf;
+		wal->cap = cap;
+	}
+	memcpy(wal->buf + wal->len, &rec, sizeof(rec));
+	memcpy(wal->buf + wal->len + sizeof(rec), key, key_len);
+	wal->len += need;
+	wal->appended++;
+	if (lsn)
+		*lsn = wal->appended;
+	pthread_mutex_unlock(&wal->lock);
+	return 0;
+}
+
+uint64_t wal_lsn(struct wal *wal)
+{
+	uint64_t lsn;
+
+	pthread_mutex_lock(&wal->lock);
+	lsn = wal->appended;
+	pthread_mutex_unlock(&wal->lock);
+	return lsn;
+}
+
+int __wal_checkpoint_due(struct wal *wal)
+{
+	int due;
+
+	pthread_mutex_lock(&wal->lock);
+	due = wal->checkpoint_size && wal->log_size + wal->len > wal->checkpoint_size;
+	pthread_mutex_unlock(&wal->lock);
+	return due;
+}
+
+/*
+ * Group commit. Whoever finds no batch in flight becomes the leader: it takes
+ * every record appended so far, swapping in the spare buffer so appends can
+ * continue, and writes and syncs them with the lock dropped. Everyone else
+ * waits for a batch that covers their record, and one of them leads the next
+ * batch if the current one does not.
+ */
+int wal_sync(struct wal *wal, uint64_t lsn)
+{
+	uint64_t batch;
+	size_t len, cap;
+	char *buf;
+	int ret;
+
+	pthread_mutex_lock(&wal->lock);
+	if (lsn > wal->appended)
+		lsn = wal->appended;
+	while (wal->durable < lsn && !wal->error) {
+		if (wal->syncing) {
+			pthread_cond_wait(&wal->cond, &wal->lock);
+			continue;
+		}
+
+		wal->syncing = 1;
+		batch = wal->appended;
+		buf = wal->buf;
+		len = wal->len;
+		cap = wal->cap;
+		wal->buf = wal->flush;
+		wal->cap = wal->flush_cap;
+		wal->len = 0;
+		wal->flush = buf;
+		wal->flush_cap = cap;
+		pthread_mutex_unlock(&wal->lock);
+
+		ret = write_all(wal->fd, buf, len);
+		if (!ret && fdatasync(wal->fd))
+			ret = -errno;
+
+		pthread_mutex_lock(&wal->lock);
+		if (ret) {
+			pr_err("%s: %s: %s\n", __func__, wal->path, strerror(-ret));
+			wal->error = ret;
+		} else {
+			wal->durable = batch;
+			wal->log_size += len;
+		}
+		wal->syncing = 0;
+		pthread_cond_broadcast(&wal->cond);
+	}
+	ret = wal->error;
+	pthread_mutex_unlock(&wal->lock);
+	return ret;
+}
+
+int wal_commit(struct wal *wal)
+{
+	return wal_sync(wal, wal_lsn(wal));
+}
+
+struct wal_snapshot {
+	FILE *f;
+	size_t size;
+};
+
+static int wal_snapshot_entry(const char *key, tdata_t data, void *arg)
+{
+	struct wal_snapshot *snap = arg;
+	struct wal_record rec;
+	size_t key_len = strlen(key);
+
+	wal_encode(&rec, WAL_OP_UPDATE, key, key_len, data);
+	if (fwrite(&rec, sizeof(rec), 1, snap->f) != 1 ||
+	    fwrite(key, 1, key_len, snap->f) != key_len)
+		return -1;
+	snap->size += sizeof(rec) + key_len;
+	return 0;
+}
+
+/* makes a rename in the directory of path durable */
+static int wal_sync_dir(const char *path)
+{
+	char *copy __scoped = scoped_strdup(path);
+	int fd, ret = 0;
+
+	if (!copy)
+		return -ENOMEM;
+	fd = open(dirname(copy), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	if (fsync(fd))
+		ret = -errno;
+	close(fd);
+	return ret;
+}
+
+/*
+ * The records still buffered describe updates the table already reflects, so
+ * the snapshot covers them and they are dropped rather than written out.
+ */
+int wal_checkpoint(struct wal *wal, struct table *table)
+{
+	size_t tmp_len = strlen(wal->path) + sizeof(".ckpt");
+	char *tmp __scoped = scoped_alloc(tmp_len);
+	struct wal_snapshot snap = { NULL, WAL_MAGIC_LEN };
+	uint64_t batch;
+	int fd = -1, ret;
+
+	if (!tmp)
+		return -ENOMEM;
+	snprintf(tmp, tmp_len, "%s.ckpt", wal->path);
+
+	pthread_mutex_lock(&wal->lock);
+	while (wal->syncing)
+		pthread_cond_wait(&wal->cond, &wal->lock);
+	if (wal->error) {
+		ret = wal->error;
+		pthread_mutex_unlock(&wal->lock);
+		return ret;
+	}
+	wal->syncing = 1;
+	batch = wal->appended;
+	pthread_mutex_unlock(&wal->lock);
+
+	pr_dbg("%s: %s: checkpointing %zu entries\n", __func__, wal->path, table->n_entries);
+	errno = 0;
+	fd = open(tmp, O_RDWR|O_CREAT|O_TRUNC|O_APPEND|O_CLOEXEC, 0644);
+	if (fd < 0 || !(snap.f = fdopen(dup(fd), "w")) ||
+	    fwrite(WAL_MAGIC, 1, WAL_MAGIC_LEN, snap.f) != WAL_MAGIC_LEN ||
+	    table_for_each(table, wal_snapshot_entry, &snap) || fflush(snap.f) ||
+	    fdatasync(fd) || rename(tmp, wal->path)) {
+		ret = errno ? -errno : -EIO;
+		goto fail;
+	}
+	fclose(snap.f);
+	ret = wal_sync_dir(wal->path);
+	if (ret)
+		pr_err("%s: %s: directory sync failed: %s\n", __func__, wal->path, strerror(-ret));
+
+	pthread_mutex_lock(&wal->lock);
+	close(wal->fd);
+	wal->fd = fd;
+	wal->log_size = snap.size;
+	/* records appended since the checkpoint started are kept */
+	if (wal->appended == batch)
+		wal->len = 0;
+	wal->durable = batch;
+	wal->syncing = 0;
+	pthread_cond_broadcast(&wal->cond);
+	pthread_mutex_unlock(&wal->lock);
+	return 0;
+
+fail:
+	pr_err("%s: %s: %s\n", __func__, tmp, strerror(-ret));
+	if (snap.f)
+		fclose(snap.f);
+	if (fd >= 0) {
+		close(fd);
+		unlink(tmp);
+	}
+	pthread_mutex_lock(&wal->lock);
+	wal->syncing = 0;
+	pthread_cond_broadcast(&wal->cond);
+	pthread_mutex_unlock(&wal->lock);
+	return ret;
+}
+
+struct wal_replay_state {
+	struct table *table;
+	long n;
+};
+
+static int wal_replay_record(const struct wal_record *rec, const char *key, void *arg)
+{
+	struct wal_replay_state *state = arg;
+
+	switch (rec->op) {
+	case WAL_OP_UPDATE:
+		if (table_update(state->table, key, (tdata_t)rec->data))
+			return -1;
+		break;
+	default:
+		/* struct table has no removal yet, nothing else can have been logged for it */
+		pr_err("%s: skipping record with op %u for '%s'\n", __func__, rec->op, key);
+		return 0;
+	}
+	state->n++;
+	return 0;
+}
+
+long wal_replay(struct wal *wal, struct table *table)
+{
+	struct wal_replay_state state = { table, 0 };
+	struct wal *saved = table->wal;
+	off_t end;
+
+	table->wal = NULL;
+	end = wal_scan(wal->fd, wal_replay_record, &state);
+	table->wal = saved;
+	return end < 0 ? end : state.n;
+}
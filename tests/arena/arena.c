@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <tools/arena.h>
+
+/*
+ * Allocations from small chunks, so that every case crosses chunk
+ * boundaries: alignment, rewinding to marks, reuse of released chunks and
+ * requests larger than a chunk.
+ */
+#define CHUNK_SIZE 1024
+#define N_ALLOCS   2000
+
+#define test_failure(name, fmt, ...) \
+	printf("%s %s: failure: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+#define test_success(name, fmt, ...) \
+	printf("%s %s: success: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+static uint64_t next_rand(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static size_t count_chain(const struct arena_chunk *chunk)
+{
+	size_t n = 0;
+
+	for (; chunk; chunk = chunk->next)
+		n++;
+	return n;
+}
+
+/* fails unless chunk is one of the n in chunks */
+static int known_chunk(struct arena_chunk **chunks, size_t n, const struct arena_chunk *chunk)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		if (chunks[i] == chunk)
+			return 0;
+	return 1;
+}
+
+static int run_align_tests(void)
+{
+	static char *ptrs[N_ALLOCS];
+	static size_t sizes[N_ALLOCS];
+	uint64_t state = 88172645463325252ull;
+	size_t i, j, align;
+	struct arena arena;
+	int ret = 0;
+
+	if (arena_init(&arena, "chunk_size", (size_t)CHUNK_SIZE))
+		return 1;
+	/* an empty arena has no chunk to bump through, not even for nothing */
+	if (!arena_malloc(&arena, 0) || !arena_strdup(&arena, "")) {
+		test_failure("align", "zero-sized allocation from a fresh arena failed");
+		ret = 1;
+	}
+	arena_reset(&arena);
+	if (!ret && !arena_malloc(&arena, 0)) {
+		test_failure("align", "zero-sized allocation from a reset arena failed");
+		ret = 1;
+	}
+
+	/* up to alignments above the chunk size, each allocation filled with its index */
+	for (i = 0; !ret && i < N_ALLOCS; i++) {
+		align = (size_t)1 << (next_rand(&state) % 13);
+		sizes[i] = next_rand(&state) % 200;
+		ptrs[i] = i % 3 ? arena_memalign(&arena, align, sizes[i]) : arena_malloc(&arena, sizes[i]);
+		if (!ptrs[i] || (uintptr_t)ptrs[i] % (i % 3 ? align : ARENA_ALIGN_DEFAULT)) {
+			test_failure("align", "allocation %zu of %zu aligned to %zu at %p", i, sizes[i], align,
+				     (void *)ptrs[i]);
+			ret = 1;
+			break;
+		}
+		memset(ptrs[i], (int)(i & 0xff), sizes[i]);
+	}
+	for (i = 0; !ret && i < N_ALLOCS; i++) {
+		for (j = 0; j < sizes[i]; j++) {
+			if (ptrs[i][j] != (char)(i & 0xff)) {
+				test_failure("align", "allocation %zu overwritten", i);
+				ret = 1;
+				break;
+			}
+		}
+	}
+	if (!ret)
+		test_success("align", "%d allocations in %zu chunks", N_ALLOCS, count_chain(arena.chunk));
+	arena_dest(&arena);
+	return ret;
+}
+
+static int run_mark_tests(void)
+{
+	struct arena_mark fresh, outer, inner;
+	struct arena arena;
+	char *keep, *p;
+	size_t i, n_chunks;
+	int ret = 0;
+
+	if (arena_init(&arena, "chunk_size", (size_t)CHUNK_SIZE))
+		return 1;
+
+	/* back to a mark taken before anything was allocated */
+	fresh = arena_mark(&arena);
+	for (i = 0; i < 50; i++)
+		arena_malloc(&arena, 100);
+	arena_rewind(&arena, fresh);
+	if (arena.chunk || arena.cur || count_chain(arena.spare) < 2 || !arena_malloc(&arena, 0)) {
+		test_failure("mark", "rewind to an empty arena");
+		ret = 1;
+	}
+
+	/* nested marks, each rewind crossing several chunks */
+	keep = arena_strdup(&arena, "kept across rewinds");
+	outer = arena_mark(&arena);
+	for (i = 0; i < 20; i++)
+		memset(arena_malloc(&arena, 100), 0xaa, 100);
+	inner = arena_mark(&arena);
+	n_chunks = count_chain(arena.chunk);
+	for (i = 0; i < 50; i++)
+		memset(arena_malloc(&arena, 100), 0xbb, 100);
+	arena_rewind(&arena, inner);
+	if (!ret && (arena.chunk != inner.chunk || arena.cur != inner.cur ||
+		     count_chain(arena.chunk) != n_chunks)) {
+		test_failure("mark", "inner rewind left %zu chunks, %zu expected", count_chain(arena.chunk),
+			     n_chunks);
+		ret = 1;
+	}
+	arena_rewind(&arena, outer);
+	p = arena_memalign(&arena, 1, 1);
+	if (!ret && (p != outer.cur || strcmp(keep, "kept across rewinds"))) {
+		test_failure("mark", "allocation after the outer rewind at %p, mark at %p", (void *)p,
+			     (void *)outer.cur);
+		ret = 1;
+	}
+	if (!ret)
+		test_success("mark", "rewound across chunks, %zu spare", count_chain(arena.spare));
+	arena_dest(&arena);
+	return ret;
+}
+
+static int run_reset_tests(void)
+{
+	struct arena_chunk *chunks[64];
+	size_t i, round, n = 0;
+	struct arena arena;
+	int ret = 0;
+
+	if (arena_init(&arena, "chunk_size", (size_t)CHUNK_SIZE))
+		return 1;
+	for (i = 0; i < 200; i++) {
+		arena_malloc(&arena, 100);
+		if (known_chunk(chunks, n, arena.chunk))
+			chunks[n++] = arena.chunk;
+	}
+
+	/* the same requests after every reset are served from the same chunks */
+	for (round = 0; !ret && round < 10; round++) {
+		arena_reset(&arena);
+		if (arena.chunk || count_chain(arena.spare) != n) {
+			test_failure("reset", "%zu chunks kept of %zu", count_chain(arena.spare), n);
+			ret = 1;
+		}
+		for (i = 0; !ret && i < 200; i++) {
+			if (!arena_zalloc(&arena, 100) || known_chunk(chunks, n, arena.chunk)) {
+				test_failure("reset", "new chunk in round %zu", round);
+				ret = 1;
+			}
+		}
+		if (!ret && arena.spare) {
+			test_failure("reset", "spare chunks left in round %zu", round);
+			ret = 1;
+		}
+	}
+	if (!ret)
+		test_success("reset", "%zu chunks reused over %zu resets", n, round);
+	arena_dest(&arena);
+	return ret;
+}
+
+static int run_oversized_tests(void)
+{
+	struct arena_chunk *small;
+	struct arena arena;
+	size_t size = 16 * CHUNK_SIZE;
+	char *big;
+	int ret = 0;
+
+	if (arena_init(&arena, "chunk_size", (size_t)CHUNK_SIZE))
+		return 1;
+	arena_malloc(&arena, 100);
+	small = arena.chunk;
+	arena_reset(&arena);
+
+	/* a request larger than a chunk gets one of its own and leaves the spare alone */
+	big = arena_malloc(&arena, size);
+	if (!big || arena.chunk == small || arena.spare != small) {
+		test_failure("oversized", "oversized allocation took the spare chunk");
+		ret = 1;
+	} else {
+		memset(big, 0xcc, size);
+	}
+	if (!ret && (!arena_malloc(&arena, 100) || arena.chunk != small)) {
+		test_failure("oversized", "the spare was not used after the oversized allocation");
+		ret = 1;
+	}
+
+	/* and a spare too small for the next oversized request is passed over */
+	arena_reset(&arena);
+	if (!ret && (!arena_memalign(&arena, 4 * CHUNK_SIZE, size) || count_chain(arena.spare) != 2)) {
+		test_failure("oversized", "aligned oversized allocation");
+		ret = 1;
+	}
+	if (!ret && (arena_malloc(&arena, SIZE_MAX) || arena_memalign(&arena, 64, SIZE_MAX - 32))) {
+		test_failure("oversized", "impossible size allocated");
+		ret = 1;
+	}
+	if (!ret)
+		test_success("oversized", "%zu bytes from chunks of %d", size, CHUNK_SIZE);
+	arena_dest(&arena);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	const char *test;
+	int ret = 1;
+
+	if (argc > 1) {
+		test = argv[1];
+		if (strcmp(test, "align")==0) {
+			ret = run_align_tests();
+		} else if (strcmp(test, "mark")==0) {
+			ret = run_mark_tests();
+		} else if (strcmp(test, "reset")==0) {
+			ret = run_reset_tests();
+		} else if (strcmp(test, "oversized")==0) {
+			ret = run_oversized_tests();
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <tools/art.h>
+
+/*
+ * Runs random updates and removals on a tree over a fixed set of keys, chosen
+ * to be prefixes of each other, to share prefixes longer than a node holds and
+ * to fan out to every node size, and compares lookups and ordered iteration
+ * with a sorted array of the same keys. The empty key is one of them.
+ */
+#define N_KEYS 3000
+#define N_OPS  200000
+
+static char *keys[N_KEYS];
+static size_t n_keys;
+static tdata_t model[N_KEYS];
+static char present[N_KEYS];
+
+#define test_failure(name, fmt, ...) \
+	printf("%s %s: failure: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+#define test_success(name, fmt, ...) \
+	printf("%s %s: success: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+static uint64_t next_rand(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static int cmp_keys(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static int make_keys(void)
+{
+	uint64_t state = 88172645463325252ull;
+	char buf[64];
+	size_t i, j, len;
+
+	for (i = 0; i < N_KEYS; i++) {
+		if (i < 255) {
+			/* one node with a child for every byte */
+			snprintf(buf, sizeof(buf), "wide:%c", (int)i + 1);
+		} else if (i < 255 + 40) {
+			/* each a prefix of the next */
+			memset(buf, 'p', i - 255);
+			buf[i - 255] = '\0';
+		} else if (i < 255 + 40 + 500) {
+			snprintf(buf, sizeof(buf), "a-rather-long-common-prefix/%zu", i);
+		} else {
+			len = 1 + next_rand(&state) % 12;
+			for (j = 0; j < len; j++)
+				buf[j] = "abcdxyz/"[next_rand(&state) % 8];
+			buf[len] = '\0';
+		}
+		keys[i] = strdup(buf);
+		if (!keys[i])
+			return 1;
+	}
+	/* sorting lets the checks expect iteration in array order, drop duplicates */
+	qsort(keys, N_KEYS, sizeof(*keys), cmp_keys);
+	for (i = j = 1; i < N_KEYS; i++) {
+		if (strcmp(keys[i], keys[j - 1])==0)
+			free(keys[i]);
+		else
+			keys[j++] = keys[i];
+	}
+	n_keys = j;
+	return 0;
+}
+
+static void free_keys(void)
+{
+	size_t i;
+
+	for (i = 0; i < n_keys; i++)
+		free(keys[i]);
+}
+
+/* fails unless the tree holds exactly what the model does */
+static int check_model(const char *name, struct art *art)
+{
+	size_t i, n = 0;
+	tdata_t data;
+	int ret;
+
+	for (i = 0; i < n_keys; i++) {
+		ret = art_search(art, keys[i], &data);
+		if (present[i] ? ret || data != model[i] : !ret) {
+			test_failure(name, "'%s' %s", keys[i], present[i] ? "missing or wrong" : "found after removal");
+			return 1;
+		}
+		n += present[i];
+	}
+	if (n != art->n_entries) {
+		test_failure(name, "%zu entries, expected %zu", art->n_entries, n);
+		return 1;
+	}
+	return 0;
+}
+
+static size_t run_ops(struct art *art, uint64_t *state, size_t n_ops)
+{
+	size_t i, k, n_errors = 0;
+	uint64_t r;
+	int ret;
+
+	for (i = 0; i < n_ops; i++) {
+		r = next_rand(state);
+		k = (r >> 8) % n_keys;
+		switch (r % 4) {
+		case 0:
+		case 1:
+			if (art_update(art, keys[k], r)) {
+				n_errors++;
+				break;
+			}
+			model[k] = r;
+			present[k] = 1;
+			break;
+		case 2:
+			ret = art_update_only(art, keys[k], r);
+			n_errors += (ret == 0) != present[k];
+			if (present[k])
+				model[k] = r;
+			break;
+		default:
+			ret = art_remove(art, keys[k]);
+			n_errors += (ret == 0) != present[k];
+			present[k] = 0;
+			break;
+		}
+	}
+	return n_errors;
+}
+
+static int run_model_tests(void)
+{
+	uint64_t state = 2463534242ull;
+	size_t n_errors, i;
+	struct art art;
+	int ret = 0;
+
+	art_init(&art);
+	n_errors = run_ops(&art, &state, N_OPS);
+	if (n_errors || check_model("model", &art)) {
+		test_failure("model", "%zu operations disagreed with the model", n_errors);
+		ret = 1;
+	} else {
+		test_success("model", "%d operations, %zu entries", N_OPS, art.n_entries);
+	}
+
+	/* empty the tree, shrinking every node on the way */
+	for (i = 0; i < n_keys; i++) {
+		if (present[i] && art_remove(&art, keys[i]))
+			ret = 1;
+		present[i] = 0;
+	}
+	if (ret || art.n_entries || art.root || check_model("model-empty", &art)) {
+		test_failure("model-empty", "tree not empty after removing every key");
+		ret = 1;
+	} else {
+		test_success("model-empty", "every key removed");
+	}
+	art_dest(&art);
+	return ret;
+}
+
+struct visit {
+	size_t next;		/* index in keys[] the next key should have */
+	const char *lo, *hi, *prefix;
+	size_t n, stop_after;
+	int error;
+};
+
+/* index of the first key present at or after i in range */
+static size_t next_expected(struct visit *v, size_t i)
+{
+	for (; i < n_keys; i++) {
+		if (!present[i])
+			continue;
+		if (v->prefix && strncmp(keys[i], v->prefix, strlen(v->prefix)))
+			continue;
+		if (v->lo && strcmp(keys[i], v->lo) < 0)
+			continue;
+		if (v->hi && strcmp(keys[i], v->hi) >= 0)
+			continue;
+		break;
+	}
+	return i;
+}
+
+static int visit_key(const char *key, tdata_t data, void *arg)
+{
+	struct visit *v = arg;
+
+	v->next = next_expected(v, v->next);
+	if (v->next == n_keys || strcmp(key, keys[v->next]) || data != model[v->next]) {
+		v->error = 1;
+		return -1;
+	}
+	v->next++;
+	if (++v->n == v->stop_after)
+		return 7;
+	return 0;
+}
+
+/* fails unless fn visits the expected keys in order, and stops when told to */
+static int check_visit(const char *name, struct art *art, struct visit *v)
+{
+	size_t expected = 0, i;
+	int ret;
+
+	for (i = next_expected(v, 0); i < n_keys; i = next_expected(v, i + 1))
+		expected++;
+	if (v->prefix)
+		ret = art_prefix(art, v->prefix, visit_key, v);
+	else
+		ret = art_range(art, v->lo, v->hi, visit_key, v);
+
+	if (v->stop_after && v->stop_after <= expected) {
+		if (ret != 7 || v->n != v->stop_after || v->error) {
+			test_failure(name, "did not stop after %zu keys", v->stop_after);
+			return 1;
+		}
+		return 0;
+	}
+	if (ret || v->error || v->n != expected) {
+		test_failure(name, "visited %zu keys, expected %zu", v->n, expected);
+		return 1;
+	}
+	return 0;
+}
+
+static int run_iterate_tests(void)
+{
+	static const char *bounds[][2] = {
+		{ NULL, NULL }, { "a", "b" }, { "abc", "abd" }, { "p", "pppppppppppppppppppppppq" },
+		{ "ppppp", "pppppp" }, { "wide:", "wide;" }, { "x", NULL }, { NULL, "b" },
+		{ "", "" }, { "zzz", NULL }, { "a-rather-long-common-prefix/1", "a-rather-long-common-prefix/2" },
+	};
+	static const char *prefixes[] = {
+		"", "a", "ab", "abcd", "ppppppppppp", "wide:", "a-rather-long-common-prefix/",
+		"a-rather-long-common-prefix/4", "a-rather-lung", "q", "/",
+	};
+	uint64_t state = 2463534242ull;
+	struct visit v;
+	struct art art;
+	char name[64];
+	size_t i;
+	int ret = 0;
+
+	art_init(&art);
+	run_ops(&art, &state, N_OPS);
+	for (i = 0; i < sizeof(bounds)/sizeof(bounds[0]); i++) {
+		memset(&v, 0, sizeof(v));
+		v.lo = bounds[i][0];
+		v.hi = bounds[i][1];
+		snprintf(name, sizeof(name), "range [%s, %s)", v.lo ? v.lo : "-", v.hi ? v.hi : "-");
+		ret |= check_visit(name, &art, &v);
+	}
+	for (i = 0; i < sizeof(prefixes)/sizeof(prefixes[0]); i++) {
+		memset(&v, 0, sizeof(v));
+		v.prefix = prefixes[i];
+		snprintf(name, sizeof(name), "prefix '%s'", v.prefix);
+		ret |= check_visit(name, &art, &v);
+	}
+	memset(&v, 0, sizeof(v));
+	v.stop_after = 10;
+	ret |= check_visit("range-stop", &art, &v);
+	memset(&v, 0, sizeof(v));
+	v.prefix = "a";
+	v.stop_after = 3;
+	ret |= check_visit("prefix-stop", &art, &v);
+
+	if (!ret)
+		test_success("iterate", "ranges and prefixes visited in order over %zu entries", art.n_entries);
+	art_dest(&art);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	char *test;
+	int ret = 1;
+
+	if (make_keys())
+		return 1;
+	if (argc > 1) {
+		test = argv[1];
+		if (strcmp(test, "model")==0) {
+			ret = run_model_tests();
+		} else if (strcmp(test, "iterate")==0) {
+			ret = run_iterate_tests();
+		}
+	}
+	free_keys();
+	return ret;
+}
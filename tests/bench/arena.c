@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <tools/arena.h>
+#include "bench.h"
+
+/*
+ * Serves requests that each allocate a burst of small objects of mixed
+ * sizes, a string among every few, and drop them all when the request is
+ * done: once with malloc() and free() of every object, once bumping through
+ * an arena that is reset after each request. Usage:
+ *
+ *     bench_arena [--json|--csv] [allocs per request] [requests]
+ */
+
+#define MAX_SIZE 256
+
+static uint64_t next_rand(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+/* the sizes every request asks for, the same for both allocators */
+static size_t *make_sizes(size_t n)
+{
+	uint64_t state = 88172645463325252ull;
+	size_t *sizes = malloc(n * sizeof(*sizes));
+	size_t i;
+
+	for (i = 0; sizes && i < n; i++)
+		sizes[i] = 16 + next_rand(&state) % (MAX_SIZE - 16);
+	return sizes;
+}
+
+static uint64_t run_malloc(struct bench *b, const size_t *sizes, size_t n, size_t requests)
+{
+	static const char path[] = "/var/lib/svc/objects/0123456789abcdef";
+	void **objs = malloc(n * sizeof(*objs));
+	uint64_t sum = 0;
+	size_t r, i;
+
+	if (!objs)
+		return 0;
+	bench_start(b);
+	for (r = 0; r < requests; r++) {
+		for (i = 0; i < n; i++) {
+			objs[i] = i % 8 ? malloc(sizes[i]) : strdup(path);
+			*(char *)objs[i] = (char)i;
+		}
+		for (i = 0; i < n; i++) {
+			sum += *(char *)objs[i];
+			free(objs[i]);
+		}
+	}
+	bench_stop(b);
+	bench_report(b, "malloc", n * requests, NULL);
+	free(objs);
+	return sum;
+}
+
+static uint64_t run_arena(struct bench *b, const size_t *sizes, size_t n, size_t requests,
+			  size_t chunk_size)
+{
+	static const char path[] = "/var/lib/svc/objects/0123456789abcdef";
+	void **objs = malloc(n * sizeof(*objs));
+	struct arena arena;
+	uint64_t sum = 0;
+	char label[32];
+	size_t r, i;
+
+	if (!objs || arena_init(&arena, "chunk_size", chunk_size)) {
+		free(objs);
+		return 0;
+	}
+	bench_start(b);
+	for (r = 0; r < requests; r++) {
+		for (i = 0; i < n; i++) {
+			objs[i] = i % 8 ? arena_malloc(&arena, sizes[i]) : arena_strdup(&arena, path);
+			*(char *)objs[i] = (char)i;
+		}
+		for (i = 0; i < n; i++)
+			sum += *(char *)objs[i];
+		arena_reset(&arena);
+	}
+	bench_stop(b);
+	snprintf(label, sizeof(label), "arena/%zuk", chunk_size >> 10);
+	bench_report(b, label, n * requests, NULL);
+	arena_dest(&arena);
+	free(objs);
+	return sum;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t n, requests, *sizes;
+	uint64_t sum;
+	struct bench b;
+
+	bench_init(&b, "arena", &argc, argv);
+	n = argc > 1 ? strtoull(argv[1], NULL, 0) : 1000;
+	requests = argc > 2 ? strtoull(argv[2], NULL, 0) : 10000;
+	sizes = make_sizes(n);
+	if (!n || !sizes) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	bench_params(&b, "allocs requests max_size", (double)n, (double)requests, (double)MAX_SIZE);
+	sum = 2 * run_malloc(&b, sizes, n, requests);
+	/* a chunk smaller than a request, so that it spans several, and one that holds it whole */
+	sum -= run_arena(&b, sizes, n, requests, 16 << 10);
+	sum -= run_arena(&b, sizes, n, requests, (size_t)1 << 20);
+
+	free(sizes);
+	bench_dest(&b);
+	return sum != 0;
+}
@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <tools/scoped.h>
+#include "bench.h"
+
+static const struct {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+} events[BENCH_N_EVENTS] = {
+	[BENCH_CYCLES]        = { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[BENCH_INSTRUCTIONS]  = { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	[BENCH_LLC_MISSES]    = { "llc_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	[BENCH_DTLB_MISSES]   = { "dtlb_misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+				  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+				  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	[BENCH_BRANCH_MISSES] = { "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+/* the value and how long the event was scheduled, which is less than enabled when multiplexed */
+struct bench_read {
+	uint64_t value;
+	uint64_t enabled;
+	uint64_t running;
+};
+
+double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int bench_open(enum bench_event event)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[event].type;
+	attr.config = events[event].config;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.disabled = 1;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+int bench_init(struct bench *bench, const char *name, int *argc, char *argv[])
+{
+	int i, j, err = 0;
+
+	memset(bench, 0, sizeof(*bench));
+	bench->name = name;
+	bench->out = stdout;
+	for (i = j = 1; i < *argc; i++) {
+		if (strcmp(argv[i], "--json")==0)
+			bench->format = BENCH_JSON;
+		else if (strcmp(argv[i], "--csv")==0)
+			bench->format = BENCH_CSV;
+		else
+			argv[j++] = argv[i];
+	}
+	*argc = j;
+	argv[j] = NULL;
+
+	for (i = 0; i < BENCH_N_EVENTS; i++) {
+		bench->counts[i] = -1;
+		bench->fds[i] = bench_open(i);
+		if (bench->fds[i] < 0 && !err)
+			err = errno;
+	}
+	if (err) {
+		fprintf(stderr, "%s: not counting", name);
+		for (i = 0; i < BENCH_N_EVENTS; i++)
+			if (bench->fds[i] < 0)
+				fprintf(stderr, " %s", events[i].name);
+		fprintf(stderr, " (%s)\n", strerror(err));
+	}
+
+	switch (bench->format) {
+	case BENCH_JSON:
+		fprintf(bench->out, "{\"bench\":\"%s\"", name);
+		break;
+	case BENCH_CSV:
+		fprintf(bench->out, "bench,case,metric,value\n");
+		break;
+	case BENCH_TEXT:
+		break;
+	}
+	return 0;
+}
+
+int bench_dest(struct bench *bench)
+{
+	int i;
+
+	for (i = 0; i < BENCH_N_EVENTS; i++)
+		if (bench->fds[i] >= 0)
+			close(bench->fds[i]);
+	if (bench->format == BENCH_JSON)
+		fprintf(bench->out, "%s}\n", bench->n_reports ? "\n]" : "");
+	fflush(bench->out);
+	return 0;
+}
+
+/* prints name/value pairs from a list of names and the double arguments that go with it */
+static void bench_vprint_named(struct bench *bench, const char *label, const char *names,
+			       int first, va_list ap)
+{
+	char *copy __scoped = scoped_strdup(names);
+	char *tmp = copy, *name, *delim = " ";
+	double value;
+
+	if (!names || !copy)
+		return;
+
+	for (name = strtok_r(tmp, delim, &tmp); name; name = strtok_r(tmp, delim, &tmp)) {
+		value = va_arg(ap, double);
+		switch (bench->format) {
+		case BENCH_JSON:
+			fprintf(bench->out, "%s\"%s\":%.6g", first ? "" : ",", name, value);
+			break;
+		case BENCH_CSV:
+			fprintf(bench->out, "%s,%s,%s,%.6g\n", bench->name, label, name, value);
+			break;
+		case BENCH_TEXT:
+			fprintf(bench->out, "%s%s=%.6g", first ? "" : " ", name, value);
+			break;
+		}
+		first = 0;
+	}
+}
+
+void bench_params(struct bench *bench, const char *names, ...)
+{
+	va_list ap;
+
+	va_start(ap, names);
+	switch (bench->format) {
+	case BENCH_JSON:
+		fprintf(bench->out, ",\"params\":{");
+		bench_vprint_named(bench, "", names, 1, ap);
+		fprintf(bench->out, "}");
+		break;
+	case BENCH_CSV:
+		bench_vprint_named(bench, "", names, 1, ap);
+		break;
+	case BENCH_TEXT:
+		fprintf(bench->out, "%s: ", bench->name);
+		bench_vprint_named(bench, "", names, 1, ap);
+		fprintf(bench->out, "\n");
+		break;
+	}
+	va_end(ap);
+}
+
+void bench_start(struct bench *bench)
+{
+	int i;
+
+	for (i = 0; i < BENCH_N_EVENTS; i++) {
+		if (bench->fds[i] < 0)
+			continue;
+		ioctl(bench->fds[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(bench->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+	bench->start = bench_now();
+}
+
+void bench_stop(struct bench *bench)
+{
+	struct bench_read r;
+	int i;
+
+	bench->elapsed = bench_now() - bench->start;
+	for (i = 0; i < BENCH_N_EVENTS; i++) {
+		bench->counts[i] = -1;
+		if (bench->fds[i] < 0)
+			continue;
+		ioctl(bench->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(bench->fds[i], &r, sizeof(r)) != sizeof(r) || !r.running)
+			continue;
+		/* scale up for the time the event had to share a counter */
+		bench->counts[i] = (double)r.value * r.enabled / r.running;
+	}
+}
+
+void bench_report(struct bench *bench, const char *label, size_t ops, const char *names, ...)
+{
+	double n = ops ? (double)ops : 1, ns = bench->elapsed * 1e9 / n;
+	va_list ap;
+	int i;
+
+	va_start(ap, names);
+	switch (bench->format) {
+	case BENCH_JSON:
+		fprintf(bench->out, "%s\n{\"case\":\"%s\",\"ops\":%zu,\"ns_per_op\":%.6g",
+			bench->n_reports ? "," : ",\"results\":[", label, ops, ns);
+		for (i = 0; i < BENCH_N_EVENTS; i++) {
+			if (bench->counts[i] < 0)
+				fprintf(bench->out, ",\"%s_per_op\":null", events[i].name);
+			else
+				fprintf(bench->out, ",\"%s_per_op\":%.6g", events[i].name,
+					bench->counts[i] / n);
+		}
+		bench_vprint_named(bench, label, names, 0, ap);
+		fprintf(bench->out, "}");
+		break;
+	case BENCH_CSV:
+		fprintf(bench->out, "%s,%s,ops,%zu\n", bench->name, label, ops);
+		fprintf(bench->out, "%s,%s,ns_per_op,%.6g\n", bench->name, label, ns);
+		for (i = 0; i < BENCH_N_EVENTS; i++)
+			if (bench->counts[i] >= 0)
+				fprintf(bench->out, "%s,%s,%s_per_op,%.6g\n", bench->name, label,
+					events[i].name, bench->counts[i] / n);
+		bench_vprint_named(bench, label, names, 1, ap);
+		break;
+	case BENCH_TEXT:
+		if (!bench->n_reports)
+			fprintf(bench->out, "%-24s %10s %10s %10s %10s %10s %10s\n", "case", "ns/op",
+				"cycles", "insns", "llc miss", "dtlb miss", "br miss");
+		fprintf(bench->out, "%-24s %10.2f", label, ns);
+		for (i = 0; i < BENCH_N_EVENTS; i++) {
+			if (bench->counts[i] < 0)
+				fprintf(bench->out, " %10s", "n/a");
+			else
+				fprintf(bench->out, i < BENCH_LLC_MISSES ? " %10.1f" : " %10.4f",
+					bench->counts[i] / n);
+		}
+		if (names) {
+			fprintf(bench->out, "  ");
+			bench_vprint_named(bench, label, names, 1, ap);
+		}
+		fprintf(bench->out, "\n");
+		break;
+	}
+	va_end(ap);
+	bench->n_reports++;
+}
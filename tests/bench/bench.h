@@ -0,0 +1,119 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Harness shared by the benchmarks. Around a measured region it counts the
+ * hardware events below with perf_event_open(), in user space only and in
+ * every thread the benchmark starts, and reports them per operation next to
+ * the wall-clock time. Events the machine or the kernel won't count, as is
+ * usual in VMs or with a high perf_event_paranoid, are reported as missing
+ * instead of failing the benchmark.
+ *
+ * Every benchmark accepts these flags ahead of its own arguments:
+ *
+ *     --json  one JSON document on stdout
+ *     --csv   rows of bench,case,metric,value on stdout
+ *
+ * Both are meant to be kept and diffed between versions of the library.
+ *
+ * Example:
+ *
+ *     struct bench b;
+ *
+ *     bench_init(&b, "list", &argc, argv);
+ *     bench_params(&b, "nodes", (double)n);
+ *     bench_start(&b);
+ *     ... n operations ...
+ *     bench_stop(&b);
+ *     bench_report(&b, "walk", n, "sum", (double)sum);
+ *     return bench_dest(&b);
+ */
+enum bench_event {
+	BENCH_CYCLES,
+	BENCH_INSTRUCTIONS,
+	BENCH_LLC_MISSES,
+	BENCH_DTLB_MISSES,
+	BENCH_BRANCH_MISSES,
+	BENCH_N_EVENTS,
+};
+
+enum bench_format {
+	BENCH_TEXT,
+	BENCH_JSON,
+	BENCH_CSV,
+};
+
+struct bench {
+	const char *name;
+	enum bench_format format;
+	FILE *out;
+	int fds[BENCH_N_EVENTS];		/* -1 for events that can't be counted */
+	double counts[BENCH_N_EVENTS];		/* of the last region, < 0 if not counted */
+	double start;
+	double elapsed;				/* seconds */
+	unsigned n_reports;
+};
+
+/**
+   @param bench the harness to initialize
+   @param name the name of the benchmark, reported with every result
+   @param argc points to the argument count of main()
+   @param argv the arguments of main()
+
+   Opens the counters and removes the harness flags from \p argv, leaving the
+   arguments of the benchmark itself in place and *\p argc updated.
+
+   Returns zero on success, and a negative value on failure.
+ */
+int bench_init(struct bench *bench, const char *name, int *argc, char *argv[]);
+
+/**
+   @param bench the harness to release
+
+   Closes the counters and completes the output.
+
+   Returns zero, so that main() may return it.
+ */
+int bench_dest(struct bench *bench);
+
+/**
+   @param bench the harness
+   @param names a space separated list of parameter names, expects a double argument for each
+
+   Reports the parameters the benchmark runs with, call before bench_report().
+ */
+void bench_params(struct bench *bench, const char *names, ...);
+
+/**
+   @param bench the harness
+
+   Starts counting and timing a region.
+ */
+void bench_start(struct bench *bench);
+
+/**
+   @param bench the harness
+
+   Stops counting and timing the region started by bench_start(). Threads
+   started in the region must have been joined.
+ */
+void bench_stop(struct bench *bench);
+
+/**
+   @param bench the harness
+   @param label the case the region measured
+   @param ops the number of operations in the region
+   @param names a space separated list of extra metrics, expects a double argument for each, may be NULL
+
+   Reports the time and counts of the last region per operation, followed
+   by the extra metrics as given.
+ */
+void bench_report(struct bench *bench, const char *label, size_t ops, const char *names, ...);
+
+/* seconds on the monotonic clock */
+double bench_now(void);
+
+#endif
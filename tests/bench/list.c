@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <tools/list.h>
+#include "bench.h"
+
+/*
+ * Walks a list whose nodes are linked in the order they sit in memory, and
+ * then the same nodes linked in a random order, which is what a long lived
+ * list tends to look like. The difference is all cache and TLB misses.
+ * Also moves nodes from the head to the tail, the way a LRU list does.
+ * Usage:
+ *
+ *     bench_list [--json|--csv] [nodes] [passes]
+ */
+
+struct node {
+	struct list_head list;
+	uint64_t value;
+	char pad[40];
+};
+
+static uint64_t next_rand(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static void link_nodes(struct list_head *head, struct node *nodes, size_t *order, size_t n)
+{
+	size_t i;
+
+	INIT_LIST_HEAD(head);
+	for (i = 0; i < n; i++)
+		list_add_tail(&nodes[order[i]].list, head);
+}
+
+static uint64_t walk(struct bench *b, const char *name, struct list_head *head, size_t n,
+		     size_t passes)
+{
+	struct node *node;
+	uint64_t sum = 0;
+	size_t i;
+
+	bench_start(b);
+	for (i = 0; i < passes; i++)
+		list_for_each_entry(node, head, list)
+			sum += node->value;
+	bench_stop(b);
+	bench_report(b, name, n * passes, NULL);
+	return sum;
+}
+
+static void move_tail(struct bench *b, struct list_head *head, size_t n, size_t passes)
+{
+	size_t i;
+
+	bench_start(b);
+	for (i = 0; i < n * passes; i++)
+		list_move_tail(head->next, head);
+	bench_stop(b);
+	bench_report(b, "move_tail", n * passes, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t state = 88172645463325252ull, sum;
+	size_t n, passes, i, j, tmp, *order;
+	struct list_head head;
+	struct node *nodes;
+	struct bench b;
+
+	bench_init(&b, "list", &argc, argv);
+	n = argc > 1 ? strtoull(argv[1], NULL, 0) : 1<<20;
+	passes = argc > 2 ? strtoull(argv[2], NULL, 0) : 16;
+	nodes = calloc(n, sizeof(*nodes));
+	order = calloc(n, sizeof(*order));
+	if (!n || !nodes || !order) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < n; i++) {
+		nodes[i].value = i;
+		order[i] = i;
+	}
+
+	bench_params(&b, "nodes passes node_size", (double)n, (double)passes, (double)sizeof(*nodes));
+	link_nodes(&head, nodes, order, n);
+	sum = walk(&b, "walk/sequential", &head, n, passes);
+
+	for (i = n - 1; i > 0; i--) {
+		j = next_rand(&state) % (i + 1);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+	link_nodes(&head, nodes, order, n);
+	sum -= walk(&b, "walk/shuffled", &head, n, passes);
+	move_tail(&b, &head, n, passes);
+
+	free(nodes);
+	free(order);
+	bench_dest(&b);
+	return sum != 0;
+}
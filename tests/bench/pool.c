@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <tools/pool.h>
+#include <tools/zalloc.h>
+#include "bench.h"
+
+#define OBJ_SIZE   48
+#define BATCH      256
+#define MAX_THREAD 32
+
+struct worker {
+	pthread_t thread;
+	struct pool *pool;
+	long iters;
+};
+
+static void *run_calloc(void *arg)
+{
+	struct worker *w = arg;
+	void *objs[BATCH];
+	long i;
+	int j;
+
+	for (i = 0; i < w->iters; i++) {
+		for (j = 0; j < BATCH; j++)
+			objs[j] = zalloc(OBJ_SIZE);
+		for (j = 0; j < BATCH; j++)
+			free(objs[(j * 7) % BATCH]);
+	}
+	return NULL;
+}
+
+static void *run_pool(void *arg)
+{
+	struct worker *w = arg;
+	void *objs[BATCH];
+	long i;
+	int j;
+
+	for (i = 0; i < w->iters; i++) {
+		for (j = 0; j < BATCH; j++)
+			objs[j] = pool_alloc(w->pool);
+		for (j = 0; j < BATCH; j++)
+			pool_free(w->pool, objs[(j * 7) % BATCH]);
+	}
+	return NULL;
+}
+
+/* reports alloc/free pairs, all threads, under "case/threads" */
+static void run(struct bench *b, const char *name, void *(*fn)(void *), struct pool *pool,
+		int threads, long iters)
+{
+	struct worker w[MAX_THREAD];
+	char label[32];
+	int i;
+
+	bench_start(b);
+	for (i = 0; i < threads; i++) {
+		w[i].pool = pool;
+		w[i].iters = iters;
+		pthread_create(&w[i].thread, NULL, fn, &w[i]);
+	}
+	for (i = 0; i < threads; i++)
+		pthread_join(w[i].thread, NULL);
+	bench_stop(b);
+
+	snprintf(label, sizeof(label), "%s/%d", name, threads);
+	bench_report(b, label, (size_t)threads * iters * BATCH, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	struct pool_stats stats;
+	struct pool pool;
+	struct bench b;
+	long iters;
+	int threads;
+
+	bench_init(&b, "pool", &argc, argv);
+	iters = argc > 1 ? atol(argv[1]) : 20000;
+	if (pool_init(&pool, OBJ_SIZE, "zero")) {
+		fprintf(stderr, "pool_init failed\n");
+		return 1;
+	}
+
+	bench_params(&b, "object_size batch iters", (double)OBJ_SIZE, (double)BATCH, (double)iters);
+	for (threads = 1; threads <= MAX_THREAD; threads *= 2) {
+		run(&b, "calloc", run_calloc, NULL, threads, iters);
+		run(&b, "pool", run_pool, &pool, threads, iters);
+	}
+
+	pool_stats(&pool, &stats);
+	fprintf(stderr, "outstanding=%zu cached=%zu slabs=%zu slab_bytes=%zu\n",
+		stats.outstanding, stats.cached, stats.slabs, stats.slab_bytes);
+	pool_dest(&pool);
+	bench_dest(&b);
+	return stats.outstanding != 0;
+}
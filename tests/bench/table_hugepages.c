@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <tools/table.h>
+#include "bench.h"
+
+/*
+ * Random lookups into a large table, once with the bucket array on
+ * transparent huge pages and once on regular pages. Usage:
+ *
+ *     bench_table_hugepages [--json|--csv] [entries] [lookups]
+ *
+ * The interesting sizes are those where the bucket array dwarfs the TLB
+ * reach of 4K pages, e.g. 1000000000 entries on a machine with the memory
+ * to hold them.
+ */
+
+static uint64_t next_rand(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static int run(struct bench *b, const char *name, const char *options, size_t entries, size_t lookups)
+{
+	struct table *table = table_alloc(options, entries, entries);
+	uint64_t state = 88172645463325252ull;
+	size_t i, found = 0;
+	char key[32];
+	tdata_t data;
+
+	if (!table) {
+		fprintf(stderr, "%s: table_alloc failed\n", name);
+		return 1;
+	}
+	for (i = 0; i < entries; i++) {
+		snprintf(key, sizeof(key), "k%zu", i);
+		if (table_update(table, key, i)) {
+			fprintf(stderr, "%s: table_update failed at %zu\n", name, i);
+			table_free(table);
+			return 1;
+		}
+	}
+
+	bench_start(b);
+	for (i = 0; i < lookups; i++) {
+		snprintf(key, sizeof(key), "k%zu", (size_t)(next_rand(&state) % entries));
+		found += table_search(table, key, &data) == 0;
+	}
+	bench_stop(b);
+	bench_report(b, name, lookups, NULL);
+
+	table_free(table);
+	return found != lookups;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t entries, lookups;
+	struct bench b;
+	int ret = 0;
+
+	bench_init(&b, "table_hugepages", &argc, argv);
+	entries = argc > 1 ? strtoull(argv[1], NULL, 0) : 1<<22;
+	lookups = argc > 2 ? strtoull(argv[2], NULL, 0) : 1<<22;
+
+	bench_params(&b, "entries lookups", (double)entries, (double)lookups);
+	ret |= run(&b, "hugepages", "size max_size", entries, lookups);
+	ret |= run(&b, "4k_pages", "size max_size no_hugepages", entries, lookups);
+	bench_dest(&b);
+	return ret;
+}
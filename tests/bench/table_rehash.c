@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <tools/table.h>
+#include "bench.h"
+
+/*
+ * Grows a table from a small initial size and reports the longest single
+ * table_update(), which is the last doubling of the bucket array, for an
+ * increasing number of rehash threads, along with the counters for all of
+ * the inserts. Usage:
+ *
+ *     bench_table_rehash [--json|--csv] [entries] [max threads]
+ */
+
+static int run(struct bench *b, size_t entries, unsigned threads)
+{
+	struct table *table;
+	double start, elapsed, worst = 0;
+	char key[32];
+	size_t i;
+
+	table = table_alloc("size max_size rehash_threads", (size_t)1024, entries*2, threads);
+	if (!table) {
+		fprintf(stderr, "table_alloc failed\n");
+		return 1;
+	}
+	bench_start(b);
+	for (i = 0; i < entries; i++) {
+		snprintf(key, sizeof(key), "k%zu", i);
+		start = bench_now();
+		if (table_update(table, key, i)) {
+			fprintf(stderr, "table_update failed at %zu\n", i);
+			table_free(table);
+			return 1;
+		}
+		elapsed = bench_now() - start;
+		if (elapsed > worst)
+			worst = elapsed;
+	}
+	bench_stop(b);
+
+	snprintf(key, sizeof(key), "rehash_threads/%u", threads);
+	bench_report(b, key, entries, "resize_ms", worst * 1e3);
+	table_free(table);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned max_threads, threads;
+	struct bench b;
+	size_t entries;
+	int ret = 0;
+
+	bench_init(&b, "table_rehash", &argc, argv);
+	entries = argc > 1 ? strtoull(argv[1], NULL, 0) : 1<<22;
+	max_threads = argc > 2 ? atoi(argv[2]) : 8;
+
+	bench_params(&b, "entries", (double)entries);
+	for (threads = 1; threads <= max_threads; threads *= 2)
+		ret |= run(&b, entries, threads);
+	bench_dest(&b);
+	return ret;
+}
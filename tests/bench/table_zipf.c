@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <tools/table.h>
+#include "bench.h"
+
+/*
+ * Looks up keys drawn from a Zipf distribution in a table whose chains are
+ * kept long by a high load factor, and reports the average number of entries
+ * compared per lookup for each way of organizing the buckets. The most
+ * popular keys are inserted first, which leaves them at the end of their
+ * chains in a plain table. Usage:
+ *
+ *     bench_table_zipf [--json|--csv] [keys] [lookups] [exponent]
+ */
+
+static uint64_t xorshift64(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
+}
+
+/* index of the first element of cdf[0..n) that is not below u */
+static size_t zipf_rank(const double *cdf, size_t n, double u)
+{
+	size_t lo = 0, hi = n - 1, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo)/2;
+		if (cdf[mid] < u)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int run(struct bench *b, const char *name, const char *options, size_t hot, char **keys, size_t n_keys,
+	       const size_t *ranks, size_t n_lookups)
+{
+	struct table *table;
+	tdata_t data;
+	size_t i;
+
+	table = table_alloc(options, (size_t)n_keys, 4.0, (uint64_t)1, hot);
+	if (!table) {
+		fprintf(stderr, "%s: table_alloc failed\n", name);
+		return 1;
+	}
+	for (i = 0; i < n_keys; i++) {
+		if (table_update(table, keys[i], i)) {
+			fprintf(stderr, "%s: table_update failed at %zu\n", name, i);
+			table_free(table);
+			return 1;
+		}
+	}
+	memset(&table->stats, 0, sizeof(table->stats));
+
+	bench_start(b);
+	for (i = 0; i < n_lookups; i++) {
+		if (table_search(table, keys[ranks[i]], &data) || (size_t)data != ranks[i]) {
+			fprintf(stderr, "%s: table_search failed for '%s'\n", name, keys[ranks[i]]);
+			table_free(table);
+			return 1;
+		}
+	}
+	bench_stop(b);
+
+	bench_report(b, name, n_lookups, "probes hot_hit_pct",
+		     (double)table->stats.probes / table->stats.searches,
+		     100.0 * table->stats.hot_hits / table->stats.searches);
+	table_free(table);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t state = 88172645463325252ull;
+	size_t n_keys, n_lookups, i, *ranks;
+	double s, sum = 0, *cdf;
+	struct bench b;
+	char **keys;
+	int ret = 0;
+
+	bench_init(&b, "table_zipf", &argc, argv);
+	n_keys = argc > 1 ? strtoull(argv[1], NULL, 0) : 1<<20;
+	n_lookups = argc > 2 ? strtoull(argv[2], NULL, 0) : 1<<24;
+	s = argc > 3 ? atof(argv[3]) : 0.99;
+	keys = calloc(n_keys, sizeof(*keys));
+	cdf = calloc(n_keys, sizeof(*cdf));
+	ranks = calloc(n_lookups, sizeof(*ranks));
+	if (!n_keys || !keys || !cdf || !ranks) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < n_keys; i++) {
+		keys[i] = malloc(32);
+		if (!keys[i]) {
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+		snprintf(keys[i], 32, "key:%zu", i);
+		sum += 1.0 / pow(i + 1, s);
+		cdf[i] = sum;
+	}
+	for (i = 0; i < n_keys; i++)
+		cdf[i] /= sum;
+	for (i = 0; i < n_lookups; i++)
+		ranks[i] = zipf_rank(cdf, n_keys, (xorshift64(&state) >> 11) * 0x1.0p-53);
+
+	bench_params(&b, "keys lookups exponent load_factor", (double)n_keys, (double)n_lookups, s, 4.0);
+	ret |= run(&b, "plain", "size load_factor seed stats",
+		   0, keys, n_keys, ranks, n_lookups);
+	ret |= run(&b, "transpose", "size load_factor seed stats transpose",
+		   0, keys, n_keys, ranks, n_lookups);
+	ret |= run(&b, "move_to_front", "size load_factor seed stats move_to_front",
+		   0, keys, n_keys, ranks, n_lookups);
+	ret |= run(&b, "hot_cache", "size load_factor seed hot_cache stats",
+		   n_keys/16, keys, n_keys, ranks, n_lookups);
+	ret |= run(&b, "hot_cache+move_to_front", "size load_factor seed hot_cache stats move_to_front",
+		   n_keys/16, keys, n_keys, ranks, n_lookups);
+
+	for (i = 0; i < n_keys; i++)
+		free(keys[i]);
+	free(keys);
+	free(cdf);
+	free(ranks);
+	bench_dest(&b);
+	return ret;
+}
@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <tools/btree.h>
+
+/*
+ * Runs random updates and removals on numeric and string trees, with nodes
+ * small enough for the trees to grow several levels deep, and compares
+ * lookups and ordered iteration with a sorted array of the candidate keys.
+ */
+#define N_KEYS 5000
+#define N_OPS  200000
+
+static uint64_t nums[N_KEYS];
+static char *strs[N_KEYS];
+static tdata_t model[N_KEYS];
+static char present[N_KEYS];
+
+#define test_failure(name, fmt, ...) \
+	printf("%s %s: failure: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+#define test_success(name, fmt, ...) \
+	printf("%s %s: success: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+static uint64_t next_rand(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static int cmp_strs(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static int make_keys(void)
+{
+	char buf[32];
+	size_t i;
+
+	/* the extremes and every third number in between */
+	for (i = 0; i < N_KEYS; i++)
+		nums[i] = i*3 + 1;
+	nums[0] = 0;
+	nums[N_KEYS - 1] = UINT64_MAX;
+
+	/* a few short ones, many sharing the 8 bytes kept in the nodes */
+	for (i = 0; i < N_KEYS; i++) {
+		if (i < 26)
+			snprintf(buf, sizeof(buf), "%c", (int)('a' + i));
+		else if (i == 26)
+			buf[0] = '\0';
+		else if (i % 2)
+			snprintf(buf, sizeof(buf), "samehead%zu", i);
+		else
+			snprintf(buf, sizeof(buf), "k%07zu", i);
+		strs[i] = strdup(buf);
+		if (!strs[i])
+			return 1;
+	}
+	qsort(strs, N_KEYS, sizeof(*strs), cmp_strs);
+	return 0;
+}
+
+static void free_keys(void)
+{
+	size_t i;
+
+	for (i = 0; i < N_KEYS; i++)
+		free(strs[i]);
+}
+
+static int bt_update(struct btree *bt, int str, size_t k, tdata_t data)
+{
+	return str ? btree_update_str(bt, strs[k], data) : btree_update(bt, nums[k], data);
+}
+
+static int bt_update_only(struct btree *bt, int str, size_t k, tdata_t data)
+{
+	return str ? btree_update_only_str(bt, strs[k], data) : btree_update_only(bt, nums[k], data);
+}
+
+static int bt_search(struct btree *bt, int str, size_t k, tdata_t *data)
+{
+	return str ? btree_search_str(bt, strs[k], data) : btree_search(bt, nums[k], data);
+}
+
+static int bt_remove(struct btree *bt, int str, size_t k)
+{
+	return str ? btree_remove_str(bt, strs[k]) : btree_remove(bt, nums[k]);
+}
+
+/* fails unless lookups and a full scan agree with the model */
+static int check_model(const char *name, struct btree *bt, int str)
+{
+	struct btree_iter it;
+	size_t i, n = 0;
+	const char *skey;
+	uint64_t key;
+	tdata_t data;
+	int ret;
+
+	for (i = 0; i < N_KEYS; i++) {
+		ret = bt_search(bt, str, i, &data);
+		if (present[i] ? ret || data != model[i] : !ret) {
+			test_failure(name, "key %zu %s", i, present[i] ? "missing or wrong" : "found after removal");
+			return 1;
+		}
+		n += present[i];
+	}
+	if (n != bt->n_entries) {
+		test_failure(name, "%zu entries, expected %zu", bt->n_entries, n);
+		return 1;
+	}
+
+	btree_first(bt, &it);
+	for (i = 0; i < N_KEYS; i++) {
+		if (!present[i])
+			continue;
+		ret = str ? btree_next_str(&it, &skey, &data) : btree_next(&it, &key, &data);
+		if (ret || data != model[i] || (str ? strcmp(skey, strs[i]) != 0 : key != nums[i])) {
+			test_failure(name, "scan out of order at key %zu", i);
+			return 1;
+		}
+	}
+	if ((str ? btree_next_str(&it, NULL, NULL) : btree_next(&it, NULL, NULL)) == 0) {
+		test_failure(name, "scan went past the last key");
+		return 1;
+	}
+	return 0;
+}
+
+/* seeks to every key and just above the one before, where the first key present at or after it is next */
+static int check_seek(const char *name, struct btree *bt, int str)
+{
+	struct btree_iter it;
+	size_t i, next = N_KEYS;
+	const char *skey;
+	char buf[40];
+	uint64_t key;
+	int ret;
+
+	for (i = N_KEYS; i-- > 0;) {
+		if (present[i])
+			next = i;
+		if (str) {
+			btree_seek_str(bt, &it, strs[i]);
+			ret = btree_next_str(&it, &skey, NULL);
+			if (next == N_KEYS ? !ret : ret || strcmp(skey, strs[next])) {
+				test_failure(name, "seek to '%s' landed wrong", strs[i]);
+				return 1;
+			}
+			/* just above strs[i - 1], which lands where seeking strs[i] does */
+			if (i) {
+				snprintf(buf, sizeof(buf), "%s%c", strs[i - 1], 1);
+				btree_seek_str(bt, &it, buf);
+				ret = btree_next_str(&it, &skey, NULL);
+				if (next == N_KEYS ? !ret : ret || strcmp(skey, strs[next])) {
+					test_failure(name, "seek to just after '%s' landed wrong", strs[i - 1]);
+					return 1;
+				}
+			}
+		} else {
+			btree_seek(bt, &it, nums[i]);
+			ret = btree_next(&it, &key, NULL);
+			if (next == N_KEYS ? !ret : ret || key != nums[next]) {
+				test_failure(name, "seek to %llu landed wrong", (unsigned long long)nums[i]);
+				return 1;
+			}
+			if (i) {
+				btree_seek(bt, &it, nums[i - 1] + 1);
+				ret = btree_next(&it, &key, NULL);
+				if (next == N_KEYS ? !ret : ret || key != nums[next]) {
+					test_failure(name, "seek to %llu landed wrong", (unsigned long long)nums[i - 1] + 1);
+					return 1;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+static int run_model(const char *name, const char *options, int str)
+{
+	uint64_t state = 88172645463325252ull, r;
+	size_t i, k, n_errors = 0;
+	struct btree bt;
+	tdata_t data;
+	int ret;
+
+	memset(present, 0, sizeof(present));
+	if (btree_init(&bt, options, (size_t)128))
+		return 1;
+	for (i = 0; i < N_OPS; i++) {
+		r = next_rand(&state);
+		k = (r >> 8) % N_KEYS;
+		switch (r % 5) {
+		case 0:
+		case 1:
+			if (bt_update(&bt, str, k, r)) {
+				n_errors++;
+				break;
+			}
+			model[k] = r;
+			present[k] = 1;
+			break;
+		case 2:
+			ret = bt_update_only(&bt, str, k, r);
+			n_errors += (ret == 0) != present[k];
+			if (present[k])
+				model[k] = r;
+			break;
+		case 3:
+			ret = bt_remove(&bt, str, k);
+			n_errors += (ret == 0) != present[k];
+			present[k] = 0;
+			break;
+		default:
+			ret = bt_search(&bt, str, k, &data);
+			n_errors += present[k] ? ret || data != model[k] : !ret;
+			break;
+		}
+	}
+	ret = n_errors || check_model(name, &bt, str) || check_seek(name, &bt, str);
+	if (ret)
+		test_failure(name, "%zu operations disagreed with the model", n_errors);
+	else
+		test_success(name, "%d operations, %zu entries", N_OPS, bt.n_entries);
+	btree_dest(&bt);
+	return ret;
+}
+
+static int run_model_tests(void)
+{
+	return run_model("model", "node_size", 0);
+}
+
+static int run_string_tests(void)
+{
+	return run_model("string", "node_size string_keys", 1);
+}
+
+static int run_load(const char *name, const char *options, int str)
+{
+	static tdata_t data[N_KEYS];
+	uint64_t bad[3] = { 1, 3, 3 };
+	struct btree bt;
+	size_t i;
+	int ret = 0, err;
+
+	for (i = 0; i < N_KEYS; i++) {
+		data[i] = model[i] = i;
+		present[i] = 1;
+	}
+	if (btree_init(&bt, options, (size_t)128))
+		return 1;
+	err = str ? btree_load_str(&bt, (const char *const *)strs, data, N_KEYS) :
+		btree_load(&bt, nums, data, N_KEYS);
+	if (err || check_model(name, &bt, str) || check_seek(name, &bt, str)) {
+		test_failure(name, "loaded tree disagrees with its input");
+		ret = 1;
+	}
+	/* a loaded tree is packed full, updates have to split */
+	for (i = 0; !ret && i < N_KEYS; i += 2) {
+		if (bt_remove(&bt, str, i) || bt_update(&bt, str, i, i + 1))
+			ret = 1;
+		model[i] = i + 1;
+	}
+	if (ret || check_model(name, &bt, str)) {
+		test_failure(name, "updates of a loaded tree failed");
+		ret = 1;
+	}
+	err = str ? btree_load_str(&bt, (const char *const *)strs, data, N_KEYS) :
+		btree_load(&bt, nums, data, N_KEYS);
+	if (err != -EINVAL) {
+		test_failure(name, "loading a tree that is not empty returned %d", err);
+		ret = 1;
+	}
+	btree_dest(&bt);
+
+	if (btree_init(&bt, options, (size_t)128))
+		return 1;
+	if (str)
+		err = btree_load_str(&bt, (const char *const []){ "b", "a" }, data, 2);
+	else
+		err = btree_load(&bt, bad, data, 3);
+	if (err != -EINVAL || bt.n_entries || bt.root) {
+		test_failure(name, "keys out of order were loaded");
+		ret = 1;
+	}
+	btree_dest(&bt);
+	if (!ret)
+		test_success(name, "%d keys loaded, updated and checked", N_KEYS);
+	return ret;
+}
+
+static int run_load_tests(void)
+{
+	return run_load("load", "node_size", 0) | run_load("load-string", "node_size string_keys", 1);
+}
+
+int main(int argc, char *argv[])
+{
+	char *test;
+	int ret = 1;
+
+	if (make_keys())
+		return 1;
+	if (argc > 1) {
+		test = argv[1];
+		if (strcmp(test, "model")==0) {
+			ret = run_model_tests();
+		} else if (strcmp(test, "string")==0) {
+			ret = run_string_tests();
+		} else if (strcmp(test, "load")==0) {
+			ret = run_load_tests();
+		}
+	}
+	free_keys();
+	return ret;
+}
@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <tools/cuckoo.h>
+
+/*
+ * Runs random updates, searches and removals on a cuckoo table and on a
+ * plain array of what the table should hold, and compares the two.
+ */
+#define N_KEYS 4096
+#define N_OPS  400000
+
+static tdata_t model[N_KEYS];
+static char present[N_KEYS];
+
+#define test_failure(name, fmt, ...) \
+	printf("%s %s: failure: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+#define test_success(name, fmt, ...) \
+	printf("%s %s: success: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+static uint64_t next_rand(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+/* fails unless the table holds exactly what the model does */
+static int check_model(const char *name, struct cuckoo *c, size_t n_keys)
+{
+	size_t i, n = 0;
+	char key[32];
+	tdata_t data;
+	int ret;
+
+	for (i = 0; i < n_keys; i++) {
+		snprintf(key, sizeof(key), "key:%zu", i);
+		ret = cuckoo_search(c, key, &data);
+		if (present[i] ? ret || data != model[i] : !ret) {
+			test_failure(name, "'%s' %s", key, present[i] ? "missing or wrong" : "found after removal");
+			return 1;
+		}
+		n += present[i];
+	}
+	if (n != c->n_entries) {
+		test_failure(name, "%zu entries, expected %zu", c->n_entries, n);
+		return 1;
+	}
+	return 0;
+}
+
+static int run_model_tests(void)
+{
+	uint64_t state = 88172645463325252ull, r;
+	size_t i, k, n_errors = 0;
+	struct cuckoo c;
+	char key[32];
+	tdata_t data;
+	int ret;
+
+	memset(present, 0, sizeof(present));
+	if (cuckoo_init(&c, "size max_size", (size_t)64, (size_t)N_KEYS))
+		return 1;
+	for (i = 0; i < N_OPS; i++) {
+		r = next_rand(&state);
+		k = (r >> 8) % N_KEYS;
+		snprintf(key, sizeof(key), "key:%zu", k);
+		switch (r % 5) {
+		case 0:
+		case 1:
+			if (cuckoo_update(&c, key, i)) {
+				n_errors++;
+				break;
+			}
+			model[k] = i;
+			present[k] = 1;
+			break;
+		case 2:
+			ret = cuckoo_update_only(&c, key, i);
+			n_errors += (ret == 0) != present[k];
+			if (present[k])
+				model[k] = i;
+			break;
+		case 3:
+			ret = cuckoo_remove(&c, key);
+			n_errors += (ret == 0) != present[k];
+			present[k] = 0;
+			break;
+		default:
+			ret = cuckoo_search(&c, key, &data);
+			n_errors += present[k] ? ret || data != model[k] : !ret;
+			break;
+		}
+	}
+	if (n_errors || check_model("model", &c, N_KEYS)) {
+		test_failure("model", "%zu operations disagreed with the model", n_errors);
+		cuckoo_dest(&c);
+		return 1;
+	}
+	test_success("model", "%zu operations, %zu entries in %zu buckets", (size_t)N_OPS,
+		     c.n_entries, (size_t)1 << c.b_bits);
+	cuckoo_dest(&c);
+	return 0;
+}
+
+static int run_grow_tests(void)
+{
+	size_t i, n_keys = 200000;
+	struct cuckoo *c;
+	char key[32];
+	int ret = 0;
+
+	c = cuckoo_alloc("size max_size", (size_t)8, n_keys);
+	if (!c)
+		return 1;
+	for (i = 0; i < n_keys; i++) {
+		snprintf(key, sizeof(key), "grow:%zu", i);
+		if (cuckoo_update(c, key, i)) {
+			test_failure("grow", "cuckoo_update failed at %zu of %zu", i, n_keys);
+			cuckoo_free(c);
+			return 1;
+		}
+	}
+	for (i = 0; i < n_keys; i++) {
+		tdata_t data;
+
+		snprintf(key, sizeof(key), "grow:%zu", i);
+		if (cuckoo_search(c, key, &data) || data != (tdata_t)i) {
+			test_failure("grow", "'%s' lost while growing", key);
+			ret = 1;
+			break;
+		}
+	}
+	if (!ret && cuckoo_update(c, "one too many", 0) == 0) {
+		test_failure("grow", "insert beyond max_size succeeded");
+		ret = 1;
+	}
+	if (!ret)
+		test_success("grow", "%zu entries in %zu buckets, %u stashed", c->n_entries,
+			     (size_t)1 << c->b_bits, c->n_stash);
+	cuckoo_free(c);
+
+	/* a max_size below the default size lowers the size */
+	c = cuckoo_alloc("max_size", (size_t)8);
+	if (!ret && (!c || cuckoo_update(c, "key", 0))) {
+		test_failure("grow", "max_size below the default size refused");
+		ret = 1;
+	}
+	if (c)
+		cuckoo_free(c);
+	return ret;
+}
+
+/* every key gets the same two buckets */
+static unsigned hash_const(const char *key)
+{
+	(void)key;
+	return 0x12345678;
+}
+
+static int run_collide_tests(void)
+{
+	size_t i, n;
+	struct cuckoo c;
+	char key[32];
+	tdata_t data;
+	int ret = 0;
+
+	if (cuckoo_init(&c, "size max_size with_hash", (size_t)16, (size_t)256, hash_const))
+		return 1;
+	for (n = 0; n < 256; n++) {
+		snprintf(key, sizeof(key), "c:%zu", n);
+		if (cuckoo_update(&c, key, n))
+			break;
+	}
+	/* two buckets and the stash, growing can't help */
+	if (n > 2*CUCKOO_WAYS + CUCKOO_STASH || n < CUCKOO_WAYS + CUCKOO_STASH) {
+		test_failure("collide", "%zu colliding keys fit", n);
+		ret = 1;
+	}
+	for (i = 0; i < n; i++) {
+		snprintf(key, sizeof(key), "c:%zu", i);
+		if (cuckoo_search(&c, key, &data) || data != (tdata_t)i) {
+			test_failure("collide", "'%s' lost after a failed insert", key);
+			ret = 1;
+		}
+	}
+	/* make room in a bucket and in the stash, then fill them again */
+	if (cuckoo_remove(&c, "c:0") || cuckoo_remove(&c, "c:1")) {
+		test_failure("collide", "cuckoo_remove failed");
+		ret = 1;
+	}
+	if (cuckoo_update(&c, "again:0", 0) || cuckoo_update(&c, "again:1", 1) ||
+	    cuckoo_search(&c, "c:1", &data) == 0 || c.n_entries != n) {
+		test_failure("collide", "slots freed by cuckoo_remove() not reused");
+		ret = 1;
+	}
+	if (!ret)
+		test_success("collide", "%zu colliding keys fit, %u stashed", n, c.n_stash);
+	cuckoo_dest(&c);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	char *test;
+	int ret = 1;
+
+	if (argc > 1) {
+		test = argv[1];
+		if (strcmp(test, "model")==0) {
+			ret = run_model_tests();
+		} else if (strcmp(test, "grow")==0) {
+			ret = run_grow_tests();
+		} else if (strcmp(test, "collide")==0) {
+			ret = run_collide_tests();
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <tools/dict.h>
+
+/*
+ * Random updates and removals on a dict, checked against an array that
+ * also records the order keys went in, which every walk must follow.
+ */
+#define N_KEYS 2000
+#define N_OPS  100000
+
+#define test_failure(name, fmt, ...) \
+	printf("%s %s: failure: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+#define test_success(name, fmt, ...) \
+	printf("%s %s: success: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+struct model {
+	tdata_t data[N_KEYS];
+	int present[N_KEYS];
+	uint64_t order[N_KEYS];		/* when each key went in, higher is later */
+	size_t n;
+};
+
+struct walk {
+	const struct model *m;
+	uint64_t last;
+	size_t n;
+	int error;
+};
+
+static uint64_t next_rand(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static uint64_t hash_const(const char *key)
+{
+	(void)key;
+	return 42;
+}
+
+/* every key is visited once, present, with its value, after the keys inserted before it */
+static int walk_entry(const char *key, tdata_t data, void *arg)
+{
+	struct walk *w = arg;
+	size_t k = strtoul(key + strlen("key:"), NULL, 10);
+
+	if (k >= N_KEYS || !w->m->present[k] || w->m->data[k] != data ||
+	    (w->n && w->m->order[k] <= w->last))
+		w->error = 1;
+	w->last = w->m->order[k];
+	w->n++;
+	return 0;
+}
+
+static int check(const char *name, struct dict *dict, const struct model *m)
+{
+	struct walk w = { m, 0, 0, 0 };
+	struct dict_record *rec;
+	char key[32];
+	tdata_t data;
+	size_t k;
+
+	for (k = 0; k < N_KEYS; k++) {
+		snprintf(key, sizeof(key), "key:%zu", k);
+		if (m->present[k] ? dict_search(dict, key, &data) || data != m->data[k] :
+		    dict_search(dict, key, &data) == 0) {
+			test_failure(name, "'%s' wrong", key);
+			return 1;
+		}
+	}
+	dict_for_each(dict, walk_entry, &w);
+	if (w.error || w.n != m->n || dict->n_entries != m->n) {
+		test_failure(name, "walk of %zu entries out of order, %zu expected", w.n, m->n);
+		return 1;
+	}
+	/* the macro walks the same records */
+	memset(&w, 0, sizeof(w));
+	w.m = m;
+	dict_for_each_record(rec, dict)
+		walk_entry(rec->key, rec->data, &w);
+	if (w.error || w.n != m->n) {
+		test_failure(name, "dict_for_each_record() walked %zu entries", w.n);
+		return 1;
+	}
+	return 0;
+}
+
+static int run_model(const char *name, struct dict *dict)
+{
+	static struct model m;
+	uint64_t state = 88172645463325252ull, clock = 0;
+	char key[32];
+	size_t i, k;
+	int ret;
+
+	memset(&m, 0, sizeof(m));
+	for (i = 0; i < N_OPS; i++) {
+		k = next_rand(&state) % N_KEYS;
+		snprintf(key, sizeof(key), "key:%zu", k);
+		switch (next_rand(&state) % 4) {
+		case 0:
+		case 1:
+			if (dict_update(dict, key, (tdata_t)i))
+				return 1;
+			if (!m.present[k]) {
+				m.present[k] = 1;
+				m.order[k] = ++clock;
+				m.n++;
+			}
+			m.data[k] = i;
+			break;
+		case 2:
+			ret = dict_update_only(dict, key, (tdata_t)i);
+			if ((ret == 0) != m.present[k])
+				return 1;
+			if (!ret)
+				m.data[k] = i;
+			break;
+		case 3:
+			ret = dict_remove(dict, key);
+			if ((ret == 0) != m.present[k])
+				return 1;
+			if (!ret) {
+				m.present[k] = 0;
+				m.n--;
+			}
+			break;
+		}
+		if (i % 5000 == 0 && check(name, dict, &m))
+			return 1;
+	}
+	return check(name, dict, &m);
+}
+
+static int run_model_tests(void)
+{
+	struct dict dict;
+	int ret;
+
+	/* from the smallest size, so that it grows and squeezes out holes on the way */
+	if (dict_init(&dict, "size max_size", (size_t)1, (size_t)N_KEYS))
+		return 1;
+	ret = run_model("model", &dict);
+	dict_dest(&dict);
+	if (!ret)
+		test_success("model", "%d operations in insertion order", N_OPS);
+	return ret;
+}
+
+static int run_collide_tests(void)
+{
+	struct dict *dict = dict_alloc("with_hash64 max_size", hash_const, (size_t)N_KEYS);
+	int ret;
+
+	if (!dict)
+		return 1;
+	ret = run_model("collide", dict);
+	dict_free(dict);
+	if (!ret)
+		test_success("collide", "%d operations on keys of one hash", N_OPS);
+	return ret;
+}
+
+static int run_options_tests(void)
+{
+	struct dict dict;
+	char key[32];
+	int ret = 0;
+	size_t i;
+
+	if (dict_init(&dict, "size max_size", (size_t)64, (size_t)16) != -EINVAL) {
+		test_failure("options", "size above max_size accepted");
+		return 1;
+	}
+	if (dict_init(&dict, "max_size seed", (size_t)100, (uint64_t)1))
+		return 1;
+	for (i = 0; i < 100; i++) {
+		snprintf(key, sizeof(key), "key:%zu", i);
+		ret |= dict_update(&dict, key, i);
+	}
+	/* full: new keys are refused, present ones still update, and a removal makes room */
+	if (ret || dict_update(&dict, "key:100", 100) == 0 || dict_update(&dict, "key:99", 0) ||
+	    dict_remove(&dict, "key:0") || dict_update(&dict, "key:100", 100) || dict.n_entries != 100 ||
+	    dict_remove(&dict, "key:0") == 0 || dict_update_only(&dict, "key:0", 0) == 0) {
+		test_failure("options", "wrong result at max_size");
+		ret = 1;
+	} else if (dict.records[dict.n_records - 1].key == NULL ||
+		   strcmp(dict.records[dict.n_records - 1].key, "key:100")) {
+		test_failure("options", "a key inserted after a removal is not last");
+		ret = 1;
+	} else {
+		test_success("options", "max_size of %zu held", dict.e_max);
+	}
+	dict_dest(&dict);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	const char *test;
+	int ret = 1;
+
+	if (argc > 1) {
+		test = argv[1];
+		if (strcmp(test, "model")==0) {
+			ret = run_model_tests();
+		} else if (strcmp(test, "collide")==0) {
+			ret = run_collide_tests();
+		} else if (strcmp(test, "options")==0) {
+			ret = run_options_tests();
+		}
+	}
+	return ret;
+}
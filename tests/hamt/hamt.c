@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <tools/hamt.h>
+
+/*
+ * Runs random updates and removals on a hamt and on a plain array of what it
+ * should hold, taking snapshots along the way, and checks that every snapshot
+ * still holds what the array did when it was taken.
+ */
+#define N_KEYS  2048
+#define N_OPS   100000
+#define N_SNAPS 8
+
+struct model {
+	tdata_t data[N_KEYS];
+	char present[N_KEYS];
+};
+
+#define test_failure(name, fmt, ...) \
+	printf("%s %s: failure: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+#define test_success(name, fmt, ...) \
+	printf("%s %s: success: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+static uint64_t next_rand(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+/* fails unless the hamt holds exactly what the model does */
+static int check_model(const char *name, const struct hamt *h, const struct model *m)
+{
+	size_t i, n = 0;
+	char key[32];
+	tdata_t data;
+	int ret;
+
+	for (i = 0; i < N_KEYS; i++) {
+		snprintf(key, sizeof(key), "key:%zu", i);
+		ret = hamt_search(h, key, &data);
+		if (m->present[i] ? ret || data != m->data[i] : !ret) {
+			test_failure(name, "'%s' %s", key, m->present[i] ? "missing or wrong" : "found after removal");
+			return 1;
+		}
+		n += m->present[i];
+	}
+	if (n != h->n_entries) {
+		test_failure(name, "%zu entries, expected %zu", h->n_entries, n);
+		return 1;
+	}
+	return 0;
+}
+
+/* random operations on h, mirrored in m; returns the number of disagreements */
+static size_t run_ops(struct hamt *h, struct model *m, uint64_t *state, size_t n_ops)
+{
+	size_t i, k, n_errors = 0;
+	char key[32];
+	uint64_t r;
+	int ret;
+
+	for (i = 0; i < n_ops; i++) {
+		r = next_rand(state);
+		k = (r >> 8) % N_KEYS;
+		snprintf(key, sizeof(key), "key:%zu", k);
+		switch (r % 4) {
+		case 0:
+		case 1:
+			if (hamt_update(h, key, r)) {
+				n_errors++;
+				break;
+			}
+			m->data[k] = r;
+			m->present[k] = 1;
+			break;
+		case 2:
+			ret = hamt_update_only(h, key, r);
+			n_errors += (ret == 0) != m->present[k];
+			if (m->present[k])
+				m->data[k] = r;
+			break;
+		default:
+			ret = hamt_remove(h, key);
+			n_errors += (ret == 0) != m->present[k];
+			m->present[k] = 0;
+			break;
+		}
+	}
+	return n_errors;
+}
+
+static int run_model(const char *name, const char *options, table_hash64_func hash)
+{
+	static struct model m;
+	uint64_t state = 88172645463325252ull;
+	struct hamt h;
+	size_t n_errors;
+
+	memset(&m, 0, sizeof(m));
+	if (hamt_init(&h, options, hash))
+		return 1;
+	n_errors = run_ops(&h, &m, &state, N_OPS);
+	if (n_errors || check_model(name, &h, &m)) {
+		test_failure(name, "%zu operations disagreed with the model", n_errors);
+		hamt_dest(&h);
+		return 1;
+	}
+	test_success(name, "%d operations, %zu entries", N_OPS, h.n_entries);
+	hamt_dest(&h);
+	return 0;
+}
+
+static int run_model_tests(void)
+{
+	return run_model("model", NULL, NULL);
+}
+
+/* pairs of keys share the full 64 bit hash */
+static uint64_t hash_pairs(const char *key)
+{
+	return (uint64_t)(atoi(key + strlen("key:")) / 2) * 0x9e3779b97f4a7c15ull;
+}
+
+/* every key has the same hash */
+static uint64_t hash_const(const char *key)
+{
+	(void)key;
+	return 0xdeadbeef;
+}
+
+static int run_collide_tests(void)
+{
+	int ret = 0;
+
+	ret |= run_model("collide-pairs", "with_hash64", hash_pairs);
+	ret |= run_model("collide-all", "with_hash64", hash_const);
+	return ret;
+}
+
+static int run_snapshot_tests(void)
+{
+	static struct model m, snap_model[N_SNAPS];
+	uint64_t state = 2463534242ull;
+	struct hamt h, snaps[N_SNAPS];
+	size_t n_errors = 0;
+	char name[32];
+	int i, ret = 0;
+
+	memset(&m, 0, sizeof(m));
+	if (hamt_init(&h, NULL))
+		return 1;
+	for (i = 0; i < N_SNAPS; i++) {
+		n_errors += run_ops(&h, &m, &state, N_OPS / N_SNAPS);
+		hamt_snapshot(&snaps[i], &h);
+		snap_model[i] = m;
+	}
+	/* updating a snapshot must not show through to the others */
+	n_errors += run_ops(&snaps[3], &snap_model[3], &state, N_OPS / N_SNAPS);
+	n_errors += run_ops(&h, &m, &state, N_OPS / N_SNAPS);
+
+	for (i = 0; i < N_SNAPS; i++) {
+		snprintf(name, sizeof(name), "snapshot-%d", i);
+		ret |= check_model(name, &snaps[i], &snap_model[i]);
+	}
+	ret |= check_model("snapshot-live", &h, &m);
+	if (ret || n_errors) {
+		test_failure("snapshot", "%zu operations disagreed with the model", n_errors);
+		ret = 1;
+	} else {
+		test_success("snapshot", "%d snapshots kept their contents", N_SNAPS);
+	}
+
+	/* release out of order, the nodes still shared must survive */
+	hamt_dest(&h);
+	for (i = 0; i < N_SNAPS; i += 2)
+		hamt_dest(&snaps[i]);
+	for (i = 1; i < N_SNAPS; i += 2) {
+		snprintf(name, sizeof(name), "snapshot-release-%d", i);
+		ret |= check_model(name, &snaps[i], &snap_model[i]);
+		hamt_dest(&snaps[i]);
+	}
+	if (!ret)
+		test_success("snapshot-release", "snapshots intact after releasing the others");
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	char *test;
+	int ret = 1;
+
+	if (argc > 1) {
+		test = argv[1];
+		if (strcmp(test, "model")==0) {
+			ret = run_model_tests();
+		} else if (strcmp(test, "collide")==0) {
+			ret = run_collide_tests();
+		} else if (strcmp(test, "snapshot")==0) {
+			ret = run_snapshot_tests();
+		}
+	}
+	return ret;
+}
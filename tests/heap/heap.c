@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <tools/heap.h>
+
+/*
+ * Random operations on the pairing heap and on the 4-ary heap, checked
+ * against a plain array: whatever comes out first must have the lowest key
+ * of what is in the heap.
+ */
+#define N_NODES 1000
+#define N_OPS   50000
+
+#define test_failure(name, fmt, ...) \
+	printf("%s %s: failure: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+#define test_success(name, fmt, ...) \
+	printf("%s %s: success: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+struct item {
+	uint64_t key;
+	int heap;		/* the heap it is in, -1 for none */
+	struct pheap_node hnode;
+};
+
+static struct item items[N_NODES];
+
+static uint64_t next_rand(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static int item_less(const struct pheap_node *a, const struct pheap_node *b)
+{
+	return pheap_entry(a, struct item, hnode)->key < pheap_entry(b, struct item, hnode)->key;
+}
+
+/* the lowest key in heap h, UINT64_MAX if it is empty */
+static uint64_t model_min(int h, size_t *n)
+{
+	uint64_t min = UINT64_MAX;
+	size_t i;
+
+	*n = 0;
+	for (i = 0; i < N_NODES; i++) {
+		if (items[i].heap != h)
+			continue;
+		(*n)++;
+		if (items[i].key < min)
+			min = items[i].key;
+	}
+	return min;
+}
+
+/* fails unless heap h pops out exactly its items, in order */
+static int drain(const char *name, struct pheap *heap, int h)
+{
+	struct pheap_node *node;
+	struct item *it;
+	uint64_t min;
+	size_t n;
+
+	for (;;) {
+		min = model_min(h, &n);
+		if (heap->n != n) {
+			test_failure(name, "%zu nodes in the heap, %zu expected", heap->n, n);
+			return 1;
+		}
+		node = pheap_pop(heap);
+		if (!node)
+			break;
+		it = pheap_entry(node, struct item, hnode);
+		if (it->heap != h || it->key != min) {
+			test_failure(name, "popped %llu, lowest is %llu", (unsigned long long)it->key,
+				     (unsigned long long)min);
+			return 1;
+		}
+		it->heap = -1;
+	}
+	if (n || !pheap_empty(heap)) {
+		test_failure(name, "heap empty with %zu items left", n);
+		return 1;
+	}
+	return 0;
+}
+
+static int run_pheap_tests(void)
+{
+	struct pheap heaps[2] = { PHEAP_INIT(item_less), PHEAP_INIT(item_less) };
+	uint64_t state = 88172645463325252ull, min;
+	size_t i, n, n_removed = 0;
+	struct pheap_node *node;
+	struct item *it;
+	int h;
+
+	for (i = 0; i < N_NODES; i++)
+		items[i].heap = -1;
+	for (i = 0; i < N_OPS; i++) {
+		it = &items[next_rand(&state) % N_NODES];
+		h = next_rand(&state) % 2;
+		switch (next_rand(&state) % 6) {
+		case 0:
+		case 1:
+			if (it->heap >= 0)
+				break;
+			it->key = next_rand(&state) % 100000;
+			it->heap = h;
+			pheap_insert(&heaps[h], &it->hnode);
+			break;
+		case 2:
+			min = model_min(h, &n);
+			node = pheap_pop(&heaps[h]);
+			if (!node != !n || (node && pheap_entry(node, struct item, hnode)->key != min)) {
+				test_failure("pheap", "pop of op %zu returned the wrong node", i);
+				return 1;
+			}
+			if (node)
+				pheap_entry(node, struct item, hnode)->heap = -1;
+			break;
+		case 3:
+			if (it->heap < 0 || !it->key)
+				break;
+			it->key -= next_rand(&state) % (it->key + 1);
+			pheap_decrease(&heaps[it->heap], &it->hnode);
+			break;
+		case 4:
+			/* every other removal takes the root, through pheap_remove() */
+			if (n_removed++ % 2 && heaps[h].root)
+				it = pheap_entry(heaps[h].root, struct item, hnode);
+			if (it->heap < 0)
+				break;
+			pheap_remove(&heaps[it->heap], &it->hnode);
+			it->heap = -1;
+			break;
+		case 5:
+			/* rarely, or the heaps would be merged whenever they fill */
+			if (next_rand(&state) % 16)
+				break;
+			pheap_merge(&heaps[h], &heaps[!h]);
+			for (n = 0; n < N_NODES; n++)
+				if (items[n].heap == !h)
+					items[n].heap = h;
+			if (!pheap_empty(&heaps[!h])) {
+				test_failure("pheap", "source not emptied by a merge");
+				return 1;
+			}
+			break;
+		}
+		model_min(!h, &n);
+		if (heaps[!h].n != n) {
+			test_failure("pheap", "count off after op %zu", i);
+			return 1;
+		}
+		min = model_min(h, &n);
+		if (heaps[h].n != n) {
+			test_failure("pheap", "count off after op %zu", i);
+			return 1;
+		}
+		if (n ? pheap_entry(pheap_min(&heaps[h]), struct item, hnode)->key != min : !!pheap_min(&heaps[h])) {
+			test_failure("pheap", "wrong minimum after op %zu", i);
+			return 1;
+		}
+	}
+	if (drain("pheap", &heaps[0], 0) || drain("pheap", &heaps[1], 1))
+		return 1;
+	test_success("pheap", "%d operations, %zu removals", N_OPS, n_removed);
+	return 0;
+}
+
+static int run_pheap_edge_tests(void)
+{
+	struct pheap heap = PHEAP_INIT(item_less), other;
+	size_t i;
+
+	pheap_init(&other, item_less);
+	for (i = 0; i < N_NODES; i++)
+		items[i].heap = -1;
+	if (pheap_pop(&heap) || pheap_min(&heap)) {
+		test_failure("pheap-edge", "an empty heap returned a node");
+		return 1;
+	}
+
+	/* the root removed while it has many children, and the only node removed */
+	for (i = 0; i < 100; i++) {
+		items[i].key = i;
+		items[i].heap = 0;
+		pheap_insert(&heap, &items[i].hnode);
+	}
+	pheap_remove(&heap, &items[0].hnode);
+	items[0].heap = -1;
+	pheap_remove(&heap, &items[50].hnode);
+	items[50].heap = -1;
+	if (drain("pheap-edge", &heap, 0))
+		return 1;
+	items[0].heap = 0;
+	pheap_insert(&heap, &items[0].hnode);
+	pheap_remove(&heap, &items[0].hnode);
+	items[0].heap = -1;
+	if (!pheap_empty(&heap) || heap.n) {
+		test_failure("pheap-edge", "removing the only node left it");
+		return 1;
+	}
+
+	/* decreasing the root, and a node below the root to the front */
+	for (i = 0; i < 10; i++) {
+		items[i].key = 10 + i;
+		items[i].heap = 0;
+		pheap_insert(&heap, &items[i].hnode);
+	}
+	pheap_pop(&heap);
+	items[0].heap = -1;
+	items[1].key = 1;
+	pheap_decrease(&heap, &items[1].hnode);
+	items[9].key = 0;
+	pheap_decrease(&heap, &items[9].hnode);
+	if (pheap_min(&heap) != &items[9].hnode) {
+		test_failure("pheap-edge", "decreased node not first");
+		return 1;
+	}
+
+	/* merges with an empty heap on either side */
+	pheap_merge(&heap, &other);
+	pheap_merge(&other, &heap);
+	for (i = 0; i < N_NODES; i++)
+		if (items[i].heap == 0)
+			items[i].heap = 1;
+	if (!pheap_empty(&heap) || drain("pheap-edge", &other, 1))
+		return 1;
+	test_success("pheap-edge", "root removal, decrease and empty merges");
+	return 0;
+}
+
+static int run_dheap_tests(void)
+{
+	static uint64_t model[N_OPS];
+	uint64_t state = 88172645463325252ull, key;
+	size_t i, j, n = 0, max_n = 0;
+	struct dheap heap;
+	intptr_t data;
+
+	if (dheap_init(&heap, "size", (size_t)16))
+		return 1;
+	if (dheap_min(&heap) || dheap_pop(&heap, &key, &data) == 0) {
+		test_failure("dheap", "an empty heap returned an item");
+		return 1;
+	}
+	/* pushes outnumber pops in the first half, so that the heap grows past its initial size */
+	for (i = 0; i < N_OPS; i++) {
+		if (next_rand(&state) % (i < N_OPS/2 ? 3 : 2) || !n) {
+			key = next_rand(&state) % 1000;
+			if (dheap_push(&heap, key, (intptr_t)key * 7))
+				return 1;
+			/* insertion into the sorted model */
+			for (j = n++; j && model[j - 1] > key; j--)
+				model[j] = model[j - 1];
+			model[j] = key;
+		} else {
+			if (dheap_min(&heap)->key != model[0] || dheap_pop(&heap, &key, &data) ||
+			    key != model[0] || data != (intptr_t)key * 7) {
+				test_failure("dheap", "popped %llu, lowest is %llu", (unsigned long long)key,
+					     (unsigned long long)model[0]);
+				return 1;
+			}
+			memmove(model, model + 1, --n * sizeof(*model));
+		}
+		if (heap.n != n) {
+			test_failure("dheap", "%zu items in the heap, %zu expected", heap.n, n);
+			return 1;
+		}
+		if (n > max_n)
+			max_n = n;
+	}
+	for (i = 0; i < n; i++) {
+		if (dheap_pop(&heap, i % 2 ? &key : NULL, NULL) || (i % 2 && key != model[i])) {
+			test_failure("dheap", "drained out of order");
+			return 1;
+		}
+	}
+	if (heap.n || dheap_pop(&heap, NULL, NULL) == 0) {
+		test_failure("dheap", "items left after draining");
+		return 1;
+	}
+	dheap_dest(&heap);
+	test_success("dheap", "%d operations, up to %zu items", N_OPS, max_n);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *test;
+	int ret = 1;
+
+	if (argc > 1) {
+		test = argv[1];
+		if (strcmp(test, "pheap")==0) {
+			ret = run_pheap_tests();
+		} else if (strcmp(test, "pheap-edge")==0) {
+			ret = run_pheap_edge_tests();
+		} else if (strcmp(test, "dheap")==0) {
+			ret = run_dheap_tests();
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <tools/htable.h>
+
+/*
+ * Links objects embedding a struct htable_node into a table, checking
+ * lookups, removal, iteration and growth against what was inserted.
+ */
+#define N_OBJS 20000
+
+struct obj {
+	char name[32];
+	int seen;
+	struct htable_node hnode;
+};
+
+static struct obj objs[N_OBJS];
+
+#define test_failure(name, fmt, ...) \
+	printf("%s %s: failure: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+#define test_success(name, fmt, ...) \
+	printf("%s %s: success: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+static const char *obj_key(const struct htable_node *node)
+{
+	return htable_entry(node, struct obj, hnode)->name;
+}
+
+static void make_objs(const char *fmt)
+{
+	size_t i;
+
+	memset(objs, 0, sizeof(objs));
+	for (i = 0; i < N_OBJS; i++)
+		snprintf(objs[i].name, sizeof(objs[i].name), fmt, i);
+}
+
+/* fails unless exactly the objects with present set are found */
+static int check_present(const char *name, struct htable *ht, const char *present)
+{
+	struct htable_node *node;
+	size_t i;
+
+	for (i = 0; i < N_OBJS; i++) {
+		node = htable_search(ht, objs[i].name);
+		if (present[i] ? node != &objs[i].hnode : node != NULL) {
+			test_failure(name, "'%s' %s", objs[i].name, present[i] ? "missing" : "found after removal");
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int run_basic_tests(void)
+{
+	static char present[N_OBJS];
+	struct htable ht;
+	struct obj dup;
+	size_t i;
+	int ret = 0;
+
+	make_objs("obj:%zu");
+	if (htable_init(&ht, obj_key, "size max_size", (size_t)16, (size_t)N_OBJS))
+		return 1;
+	for (i = 0; i < N_OBJS; i++) {
+		if (htable_insert(&ht, &objs[i].hnode)) {
+			test_failure("basic-insert", "htable_insert failed at %zu", i);
+			htable_dest(&ht);
+			return 1;
+		}
+		present[i] = 1;
+	}
+	ret |= check_present("basic-insert", &ht, present);
+	if (!ret)
+		test_success("basic-insert", "%zu entries in %zu buckets", ht.n_entries, htable_buckets(&ht));
+
+	strcpy(dup.name, objs[7].name);
+	if (htable_insert(&ht, &dup.hnode) != -EEXIST) {
+		test_failure("basic-duplicate", "inserting '%s' twice did not fail with -EEXIST", dup.name);
+		ret = 1;
+	} else {
+		test_success("basic-duplicate", "-EEXIST");
+	}
+
+	for (i = 0; i < N_OBJS; i += 3) {
+		htable_remove(&ht, &objs[i].hnode);
+		present[i] = 0;
+	}
+	/* removing twice is a no-op */
+	htable_remove(&ht, &objs[0].hnode);
+	if (check_present("basic-remove", &ht, present) || ht.n_entries != N_OBJS - (N_OBJS + 2)/3) {
+		test_failure("basic-remove", "%zu entries left", ht.n_entries);
+		ret = 1;
+	} else {
+		test_success("basic-remove", "%zu entries left", ht.n_entries);
+	}
+
+	for (i = 0; i < N_OBJS; i += 3) {
+		if (htable_insert(&ht, &objs[i].hnode))
+			ret = 1;
+		present[i] = 1;
+	}
+	if (ret || check_present("basic-reinsert", &ht, present)) {
+		test_failure("basic-reinsert", "removed nodes could not be linked again");
+		ret = 1;
+	} else {
+		test_success("basic-reinsert", "%zu entries", ht.n_entries);
+	}
+	htable_dest(&ht);
+	return ret;
+}
+
+static int run_iterate_tests(void)
+{
+	struct htable_node *pos;
+	struct hlist_node *tmp;
+	struct htable ht;
+	size_t i, bkt, n = 0;
+	int ret = 0;
+
+	make_objs("iter:%zu");
+	if (htable_init(&ht, obj_key, "max_size", (size_t)N_OBJS))
+		return 1;
+	for (i = 0; i < N_OBJS; i++)
+		if (htable_insert(&ht, &objs[i].hnode))
+			return 1;
+
+	htable_for_each(pos, bkt, &ht) {
+		htable_entry(pos, struct obj, hnode)->seen++;
+		n++;
+	}
+	for (i = 0; i < N_OBJS; i++) {
+		if (objs[i].seen != 1) {
+			test_failure("iterate", "'%s' visited %d times", objs[i].name, objs[i].seen);
+			ret = 1;
+			break;
+		}
+	}
+	if (!ret)
+		test_success("iterate", "visited %zu entries once each", n);
+
+	/* remove every odd one while iterating */
+	htable_for_each_safe(pos, tmp, bkt, &ht)
+		if (atoi(obj_key(pos) + strlen("iter:")) & 1)
+			htable_remove(&ht, pos);
+	n = 0;
+	htable_for_each(pos, bkt, &ht) {
+		if (atoi(obj_key(pos) + strlen("iter:")) & 1)
+			ret = 1;
+		n++;
+	}
+	if (ret || n != N_OBJS/2 || ht.n_entries != N_OBJS/2) {
+		test_failure("iterate-safe", "%zu entries left after removing the odd ones", n);
+		ret = 1;
+	} else {
+		test_success("iterate-safe", "%zu entries left after removing the odd ones", n);
+	}
+	htable_dest(&ht);
+	return ret;
+}
+
+/* a hash that puts every key in the same bucket */
+static unsigned hash_const(const char *key)
+{
+	(void)key;
+	return 42;
+}
+
+static int run_limits_tests(void)
+{
+	struct htable ht;
+	size_t i;
+	int ret = 0, err;
+
+	make_objs("Limit:%zu");
+	if (htable_init(&ht, obj_key, "size max_size", (size_t)16, (size_t)100))
+		return 1;
+	for (i = 0; i < 100; i++)
+		if (htable_insert(&ht, &objs[i].hnode))
+			ret = 1;
+	err = htable_insert(&ht, &objs[100].hnode);
+	if (ret || err != -ENOSPC) {
+		test_failure("limits-max-size", "insert beyond max_size returned %d", err);
+		ret = 1;
+	} else {
+		test_success("limits-max-size", "-ENOSPC beyond %zu entries", ht.e_max);
+	}
+	htable_dest(&ht);
+
+	err = htable_init(&ht, obj_key, "size", (size_t)1 << 31);
+	if (err != -EINVAL) {
+		test_failure("limits-size", "size above the absolute maximum returned %d", err);
+		if (!err)
+			htable_dest(&ht);
+		ret = 1;
+	} else {
+		test_success("limits-size", "size above the absolute maximum rejected");
+	}
+	if (htable_init(&ht, obj_key, "size max_size", (size_t)64, (size_t)32) != -EINVAL) {
+		test_failure("limits-size", "size above max_size accepted");
+		ret = 1;
+	}
+	/* without a size, a small max_size lowers the default one */
+	if (htable_init(&ht, obj_key, "max_size", (size_t)32)) {
+		test_failure("limits-size", "max_size below the default size rejected");
+		ret = 1;
+	} else {
+		htable_dest(&ht);
+	}
+	if (htable_init(&ht, NULL, NULL) != -EINVAL) {
+		test_failure("limits-key", "missing key function accepted");
+		ret = 1;
+	}
+
+	/* keys differing in case only are the same key, and all collide */
+	if (htable_init(&ht, obj_key, "with_hash with_cmp", hash_const, strcasecmp))
+		return 1;
+	for (i = 0; i < 50; i++)
+		if (htable_insert(&ht, &objs[i].hnode))
+			ret = 1;
+	if (ret || htable_search(&ht, "limit:7") != &objs[7].hnode ||
+	    htable_search(&ht, "LIMIT:49") != &objs[49].hnode || htable_search(&ht, "limit:50")) {
+		test_failure("limits-custom", "lookups with a custom hash and compare failed");
+		ret = 1;
+	} else {
+		test_success("limits-custom", "lookups with a custom hash and compare");
+	}
+	htable_dest(&ht);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	char *test;
+	int ret = 1;
+
+	if (argc > 1) {
+		test = argv[1];
+		if (strcmp(test, "basic")==0) {
+			ret = run_basic_tests();
+		} else if (strcmp(test, "iterate")==0) {
+			ret = run_iterate_tests();
+		} else if (strcmp(test, "limits")==0) {
+			ret = run_limits_tests();
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,373 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <tools/lftable.h>
+
+/*
+ * Several threads on one lock-free table at once, on keys of their own and
+ * on keys they all fight over, while the table grows from a few buckets.
+ * Once the threads are joined the table must hold exactly what their
+ * operations left behind.
+ */
+#define N_THREADS 4
+#define N_KEYS    20000
+#define N_SHARED  256
+#define N_OPS     50000
+
+#define test_failure(name, fmt, ...) \
+	printf("%s %s: failure: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+#define test_success(name, fmt, ...) \
+	printf("%s %s: success: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+struct worker {
+	struct lftable *table;
+	int id;
+	int error;
+	size_t n_found;
+};
+
+static uint64_t next_rand(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static int run_threads(void *(*fn)(void *), struct lftable *table, struct worker *workers)
+{
+	pthread_t threads[N_THREADS];
+	int i, ret = 0;
+
+	for (i = 0; i < N_THREADS; i++) {
+		workers[i] = (struct worker){ table, i, 0, 0 };
+		if (pthread_create(&threads[i], NULL, fn, &workers[i]))
+			return 1;
+	}
+	for (i = 0; i < N_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+		ret |= workers[i].error;
+	}
+	return ret;
+}
+
+/* each thread inserts its keys, checks and updates them, and removes the odd ones */
+static void *disjoint_thread(void *arg)
+{
+	struct worker *w = arg;
+	char key[32];
+	tdata_t data;
+	size_t i;
+
+	for (i = 0; i < N_KEYS; i++) {
+		snprintf(key, sizeof(key), "t%d:%zu", w->id, i);
+		if (lftable_update(w->table, key, i) || lftable_search(w->table, key, &data) ||
+		    data != (tdata_t)i)
+			w->error = 1;
+	}
+	for (i = 0; i < N_KEYS; i++) {
+		snprintf(key, sizeof(key), "t%d:%zu", w->id, i);
+		if (i % 2 ? lftable_remove(w->table, key) : lftable_update_only(w->table, key, i + 1))
+			w->error = 1;
+	}
+	return NULL;
+}
+
+static int run_disjoint_tests(void)
+{
+	struct worker workers[N_THREADS];
+	struct lftable table;
+	char key[32];
+	tdata_t data;
+	size_t i;
+	int t, ret;
+
+	if (lftable_init(&table, "max_size", (size_t)N_THREADS*N_KEYS))
+		return 1;
+	ret = run_threads(disjoint_thread, &table, workers);
+	for (t = 0; !ret && t < N_THREADS; t++) {
+		for (i = 0; i < N_KEYS; i++) {
+			snprintf(key, sizeof(key), "t%d:%zu", t, i);
+			if (i % 2 ? lftable_search(&table, key, &data) == 0 || lftable_update_only(&table, key, 0) == 0 :
+			    lftable_search(&table, key, &data) || data != (tdata_t)i + 1) {
+				test_failure("disjoint", "'%s' wrong after the threads are done", key);
+				ret = 1;
+				break;
+			}
+		}
+	}
+	if (ret || lftable_entries(&table) != N_THREADS*N_KEYS/2) {
+		test_failure("disjoint", "%zu entries", lftable_entries(&table));
+		ret = 1;
+	} else {
+		test_success("disjoint", "%zu entries left by %d threads", lftable_entries(&table), N_THREADS);
+	}
+	lftable_dest(&table);
+	return ret;
+}
+
+/*
+ * Every thread updates, removes and looks up the same few keys. A value
+ * carries the key it was written for, so a lookup that returns another
+ * key's value, or a value from a freed node, shows.
+ */
+static void *shared_thread(void *arg)
+{
+	struct worker *w = arg;
+	uint64_t state = 88172645463325252ull + w->id;
+	char key[32];
+	tdata_t data;
+	uint64_t r;
+	size_t i, k;
+
+	for (i = 0; i < N_OPS; i++) {
+		r = next_rand(&state);
+		k = r % N_SHARED;
+		snprintf(key, sizeof(key), "shared:%zu", k);
+		switch ((r >> 32) % 4) {
+		case 0:
+			if (lftable_update(w->table, key, (tdata_t)(i * N_SHARED + k)))
+				w->error = 1;
+			break;
+		case 1:
+			lftable_update_only(w->table, key, (tdata_t)(i * N_SHARED + k));
+			break;
+		case 2:
+			lftable_remove(w->table, key);
+			break;
+		case 3:
+			if (lftable_search(w->table, key, &data) == 0) {
+				w->n_found++;
+				if (data % N_SHARED != (tdata_t)k)
+					w->error = 1;
+			}
+			break;
+		}
+	}
+	return NULL;
+}
+
+static int run_shared_tests(void)
+{
+	struct worker workers[N_THREADS];
+	size_t k, n = 0, n_found = 0;
+	struct lftable table;
+	char key[32];
+	tdata_t data;
+	int t, ret;
+
+	if (lftable_init(&table, "size", (size_t)16))
+		return 1;
+	ret = run_threads(shared_thread, &table, workers);
+	for (t = 0; t < N_THREADS; t++)
+		n_found += workers[t].n_found;
+	for (k = 0; k < N_SHARED; k++) {
+		snprintf(key, sizeof(key), "shared:%zu", k);
+		if (lftable_search(&table, key, &data) == 0) {
+			n++;
+			if (data % N_SHARED != (tdata_t)k)
+				ret = 1;
+		}
+	}
+	/* inserts and removals raced on every key, the count must still come out exact */
+	if (ret || lftable_entries(&table) != n) {
+		test_failure("shared", "%zu entries counted, %zu found", lftable_entries(&table), n);
+		ret = 1;
+	} else {
+		test_success("shared", "%d operations, %zu lookups hit, %zu keys left", N_THREADS*N_OPS,
+			     n_found, n);
+	}
+	lftable_dest(&table);
+	return ret;
+}
+
+/* inserts keys of its own, growing the table under the others */
+static void *grow_thread(void *arg)
+{
+	struct worker *w = arg;
+	char key[32];
+	size_t i;
+
+	for (i = 0; i < N_KEYS; i++) {
+		snprintf(key, sizeof(key), "t%d:%zu", w->id, i);
+		if (lftable_update(w->table, key, i))
+			w->error = 1;
+	}
+	return NULL;
+}
+
+/* removes every key grow_thread inserted, looking each up first */
+static void *empty_thread(void *arg)
+{
+	struct worker *w = arg;
+	char key[32];
+	tdata_t data;
+	size_t i;
+
+	for (i = 0; i < N_KEYS; i++) {
+		snprintf(key, sizeof(key), "t%d:%zu", w->id, i);
+		if (lftable_search(w->table, key, &data) || data != (tdata_t)i ||
+		    lftable_remove(w->table, key) || lftable_remove(w->table, key) == 0)
+			w->error = 1;
+	}
+	return NULL;
+}
+
+static int run_grow_tests(void)
+{
+	struct worker workers[N_THREADS];
+	struct lftable table;
+	unsigned bits;
+	char key[32];
+	tdata_t data;
+	size_t i;
+	int t, ret;
+
+	if (lftable_init(&table, "size max_size", (size_t)16, (size_t)1 << 20))
+		return 1;
+	bits = table.b_bits;
+	ret = run_threads(grow_thread, &table, workers);
+	for (t = 0; !ret && t < N_THREADS; t++) {
+		for (i = 0; i < N_KEYS; i++) {
+			snprintf(key, sizeof(key), "t%d:%zu", t, i);
+			if (lftable_search(&table, key, &data) || data != (tdata_t)i) {
+				test_failure("grow", "'%s' lost while growing", key);
+				ret = 1;
+				break;
+			}
+		}
+	}
+	/* from 16 entries to 80000 at 2 per bucket is a dozen doublings */
+	if (ret || lftable_entries(&table) != N_THREADS*N_KEYS || table.b_bits < bits + 10) {
+		test_failure("grow", "%zu entries, from %u to %u bucket bits", lftable_entries(&table), bits,
+			     table.b_bits);
+		ret = 1;
+	} else {
+		test_success("grow", "%zu entries, from %u to %u bucket bits", lftable_entries(&table), bits,
+			     table.b_bits);
+	}
+
+	/* and everything removed again, by new threads with records of their own */
+	if (!ret)
+		ret = run_threads(empty_thread, &table, workers);
+	if (ret || lftable_entries(&table) != 0) {
+		test_failure("empty", "%zu entries after removing all", lftable_entries(&table));
+		ret = 1;
+	} else if (lftable_update(&table, "key", 1) || lftable_entries(&table) != 1) {
+		test_failure("empty", "emptied table not usable");
+		ret = 1;
+	} else {
+		test_success("empty", "no entries after removing all");
+	}
+	lftable_dest(&table);
+	return ret;
+}
+
+/* inserts keys of its own until the table refuses one */
+static void *fill_thread(void *arg)
+{
+	struct worker *w = arg;
+	char key[32];
+	size_t i;
+
+	for (i = 0; i < N_KEYS; i++) {
+		snprintf(key, sizeof(key), "t%d:%zu", w->id, i);
+		if (lftable_update(w->table, key, i))
+			break;
+	}
+	return NULL;
+}
+
+/* removes what fill_thread inserted, which runs from its first key up */
+static void *drain_thread(void *arg)
+{
+	struct worker *w = arg;
+	char key[32];
+	size_t i;
+
+	for (i = 0; i < N_KEYS; i++) {
+		snprintf(key, sizeof(key), "t%d:%zu", w->id, i);
+		if (lftable_remove(w->table, key))
+			break;
+	}
+	return NULL;
+}
+
+static int run_max_size_tests(void)
+{
+	struct worker workers[N_THREADS];
+	struct lftable table;
+	char key[32];
+	size_t i, n;
+	int round, ret = 0;
+
+	/* alone, a thread is held to max_size exactly, and removals make room again */
+	if (lftable_init(&table, "max_size", (size_t)10))
+		return 1;
+	for (round = 0; !ret && round < 3; round++) {
+		for (i = 0; i < 128; i++) {
+			snprintf(key, sizeof(key), "key:%zu", i);
+			if ((lftable_update(&table, key, i) == 0) != (i < 10)) {
+				test_failure("max-size", "insert %zu of round %d %s", i, round,
+					     i < 10 ? "refused" : "accepted");
+				ret = 1;
+				break;
+			}
+		}
+		for (i = 0; !ret && i < 10; i++) {
+			snprintf(key, sizeof(key), "key:%zu", i);
+			ret = lftable_remove(&table, key) != 0;
+		}
+		if (ret || lftable_entries(&table) != 0) {
+			test_failure("max-size", "%zu entries after removing all", lftable_entries(&table));
+			ret = 1;
+		}
+	}
+	lftable_dest(&table);
+	if (ret)
+		return ret;
+
+	/* several threads stop near it, each past it by less than a count interval */
+	if (lftable_init(&table, "max_size", (size_t)1000))
+		return 1;
+	for (round = 0; !ret && round < 3; round++) {
+		run_threads(fill_thread, &table, workers);
+		n = lftable_entries(&table);
+		if (n < 1000 || n > 1000 + (N_THREADS - 1)*127) {
+			test_failure("max-size", "%zu entries in round %d", n, round);
+			ret = 1;
+		}
+		run_threads(drain_thread, &table, workers);
+		if (!ret && lftable_entries(&table) != 0) {
+			test_failure("max-size", "%zu entries after removing all", lftable_entries(&table));
+			ret = 1;
+		}
+	}
+	if (!ret)
+		test_success("max-size", "refilled to max_size alone and by %d threads", N_THREADS);
+	lftable_dest(&table);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	const char *test;
+	int ret = 1;
+
+	if (argc > 1) {
+		test = argv[1];
+		if (strcmp(test, "disjoint")==0) {
+			ret = run_disjoint_tests();
+		} else if (strcmp(test, "shared")==0) {
+			ret = run_shared_tests();
+		} else if (strcmp(test, "grow")==0) {
+			ret = run_grow_tests();
+		} else if (strcmp(test, "max-size")==0) {
+			ret = run_max_size_tests();
+		}
+	}
+	return ret;
+}
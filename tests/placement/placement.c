@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <tools/arrayops.h>
+#include <tools/table.h>
+#include <tools/placement.h>
+
+/*
+ * Simulates a cluster: places N_KEYS keys hashed by a struct table on a set
+ * of nodes, changes the set, and checks how many keys moved and how evenly
+ * they are spread.
+ */
+#define N_KEYS  100000
+#define N_NODES 10
+
+static uint64_t hashes[N_KEYS];
+static uint64_t before[N_KEYS];
+
+#define test_failure(name, fmt, ...) \
+	printf("%s %s: failure: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+#define test_success(name, fmt, ...) \
+	printf("%s %s: success: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+static int hash_keys(void)
+{
+	struct table table;
+	char key[32];
+	size_t i;
+
+	if (table_init(&table, "seed", (uint64_t)42))
+		return 1;
+	for (i = 0; i < N_KEYS; i++) {
+		snprintf(key, sizeof(key), "user:%zu", i);
+		hashes[i] = table_hash(&table, key);
+	}
+	table_dest(&table);
+	return 0;
+}
+
+/* fails unless moved is within 25% of the ideal share */
+static int check_moved(const char *name, size_t moved, double ideal)
+{
+	double share = (double)moved/N_KEYS;
+
+	if (share > ideal*1.25 || share < ideal*0.75) {
+		test_failure(name, "moved %.4f of the keys, ideal %.4f", share, ideal);
+		return 1;
+	}
+	test_success(name, "moved %.4f of the keys, ideal %.4f", share, ideal);
+	return 0;
+}
+
+/* fails if any node holds more than bound times the average */
+static int check_spread(const char *name, const size_t *count, size_t n, double bound)
+{
+	size_t i, max = 0;
+
+	for (i = 0; i < n; i++)
+		if (count[i] > max)
+			max = count[i];
+	if (max > bound*N_KEYS/n) {
+		test_failure(name, "busiest node holds %.3f times the average", (double)max*n/N_KEYS);
+		return 1;
+	}
+	test_success(name, "busiest node holds %.3f times the average", (double)max*n/N_KEYS);
+	return 0;
+}
+
+static int run_jump_tests(void)
+{
+	size_t count[N_NODES + 1] = {0}, i, moved = 0, moved_wrong = 0;
+	uint32_t node;
+	int ret = 0;
+
+	for (i = 0; i < N_KEYS; i++)
+		before[i] = jump_hash(hashes[i], N_NODES);
+	for (i = 0; i < N_KEYS; i++) {
+		node = jump_hash(hashes[i], N_NODES + 1);
+		count[node]++;
+		if (node != before[i]) {
+			moved++;
+			moved_wrong += node != N_NODES;
+		}
+	}
+	ret |= check_moved("jump-grow", moved, 1.0/(N_NODES + 1));
+	if (moved_wrong) {
+		test_failure("jump-grow", "%zu keys moved between old nodes", moved_wrong);
+		ret = 1;
+	}
+	ret |= check_spread("jump-spread", count, N_NODES + 1, 1.1);
+	return ret;
+}
+
+static int run_rendezvous_tests(void)
+{
+	struct rendezvous_node nodes[N_NODES];
+	size_t count[N_NODES] = {0}, i, moved = 0, moved_wrong = 0, idx;
+	double total = 0, share;
+	int ret = 0;
+
+	for (i = 0; i < N_NODES; i++) {
+		nodes[i].id = 1000 + i;
+		nodes[i].weight = 1 + i % 3;
+		total += nodes[i].weight;
+	}
+	for (i = 0; i < N_KEYS; i++) {
+		idx = rendezvous_hash(hashes[i], nodes, N_NODES);
+		before[i] = nodes[idx].id;
+		count[idx]++;
+	}
+	for (i = 0; i < N_NODES; i++) {
+		share = (double)count[i]/N_KEYS;
+		if (share > 1.1*nodes[i].weight/total || share < 0.9*nodes[i].weight/total) {
+			test_failure("rendezvous-weights", "node %zu of weight %.0f holds %.4f of the keys",
+				     i, nodes[i].weight, share);
+			ret = 1;
+		}
+	}
+	if (!ret)
+		test_success("rendezvous-weights", "every node within 10%% of its weighted share");
+
+	/* remove node 4 by moving the last one into its place */
+	nodes[4] = nodes[N_NODES - 1];
+	for (i = 0; i < N_KEYS; i++) {
+		idx = rendezvous_hash(hashes[i], nodes, N_NODES - 1);
+		if (nodes[idx].id != before[i]) {
+			moved++;
+			moved_wrong += before[i] != 1004;
+		}
+	}
+	ret |= check_moved("rendezvous-remove", moved, (double)count[4]/N_KEYS);
+	if (moved_wrong) {
+		test_failure("rendezvous-remove", "%zu keys of remaining nodes moved", moved_wrong);
+		ret = 1;
+	}
+	return ret;
+}
+
+static int ring_assign_all(struct ring *ring, uint64_t *ids)
+{
+	size_t i;
+
+	for (i = 0; i < N_KEYS; i++)
+		if (ring_assign(ring, hashes[i], &ids[i]))
+			return 1;
+	return 0;
+}
+
+static int run_ring_tests(void)
+{
+	static uint64_t after[N_KEYS];
+	size_t count[N_NODES + 1] = {0}, i, moved = 0;
+	struct ring ring;
+	int ret = 0;
+
+	if (ring_init(&ring, "vnodes", 128u))
+		return 1;
+	for (i = 0; i < N_NODES; i++)
+		ring_add(&ring, 1000 + i);
+
+	for (i = 0; i < N_KEYS; i++)
+		ring_lookup(&ring, hashes[i], &before[i]);
+	ring_add(&ring, 1000 + N_NODES);
+	for (i = 0; i < N_KEYS; i++) {
+		ring_lookup(&ring, hashes[i], &after[i]);
+		moved += after[i] != before[i];
+		count[after[i] - 1000]++;
+	}
+	ret |= check_moved("ring-grow", moved, 1.0/(N_NODES + 1));
+	ret |= check_spread("ring-spread", count, N_NODES + 1, 1.35);
+
+	/* bounded loads, tight enough to bind: assign everything on the old ring and on the grown one */
+	ring.load_bound = 1.05;
+	ring_remove(&ring, 1000 + N_NODES);
+	if (ring_assign_all(&ring, before))
+		ret = 1;
+	for (i = 0; i < N_KEYS; i++)
+		ring_release(&ring, before[i]);
+	ring_add(&ring, 1000 + N_NODES);
+	memset(count, 0, sizeof(count));
+	if (ring_assign_all(&ring, after))
+		ret = 1;
+	for (i = 0, moved = 0; i < N_KEYS; i++) {
+		moved += after[i] != before[i];
+		count[after[i] - 1000]++;
+	}
+	ret |= check_spread("ring-bounded-spread", count, N_NODES + 1, 1.05 + 0.001);
+	/* keys displaced from full nodes cascade a little further than 1/n */
+	if ((double)moved/N_KEYS > 2.0/(N_NODES + 1)) {
+		test_failure("ring-bounded-grow", "moved %.4f of the keys", (double)moved/N_KEYS);
+		ret = 1;
+	} else {
+		test_success("ring-bounded-grow", "moved %.4f of the keys", (double)moved/N_KEYS);
+	}
+	ring_dest(&ring);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	char *test;
+	int ret = 1;
+
+	if (hash_keys())
+		return 1;
+	if (argc > 1) {
+		test = argv[1];
+		if (strcmp(test, "jump")==0) {
+			ret = run_jump_tests();
+		} else if (strcmp(test, "rendezvous")==0) {
+			ret = run_rendezvous_tests();
+		} else if (strcmp(test, "ring")==0) {
+			ret = run_ring_tests();
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <tools/pool.h>
+
+/*
+ * Objects allocated and freed on one thread and across threads, each
+ * tagged with its owner and index, so that an object handed out twice or
+ * lost in a magazine shows as a wrong tag or a wrong count.
+ */
+#define OBJ_SIZE  64
+#define N_OBJS    5000
+#define N_THREADS 4
+
+#define test_failure(name, fmt, ...) \
+	printf("%s %s: failure: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+#define test_success(name, fmt, ...) \
+	printf("%s %s: success: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+struct obj {
+	uint64_t tag;
+	char fill[OBJ_SIZE - sizeof(uint64_t)];
+};
+
+struct worker {
+	struct pool *pool;
+	pthread_barrier_t *barrier;
+	struct obj **objs;	/* N_THREADS arrays of N_OBJS */
+	int id;
+	int error;
+};
+
+static uint64_t make_tag(int id, size_t i, int round)
+{
+	return (uint64_t)round << 48 | (uint64_t)id << 32 | i;
+}
+
+/* allocates n objects into objs, each tagged and filled */
+static int alloc_tagged(struct pool *pool, struct obj **objs, size_t n, int id, int round)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		objs[i] = pool_alloc(pool);
+		if (!objs[i] || (uintptr_t)objs[i] % 16)
+			return 1;
+		objs[i]->tag = make_tag(id, i, round);
+		memset(objs[i]->fill, (int)(i & 0xff), sizeof(objs[i]->fill));
+	}
+	return 0;
+}
+
+/* fails unless all n objects still carry what alloc_tagged() wrote */
+static int check_tagged(struct obj **objs, size_t n, int id, int round)
+{
+	size_t i, j;
+
+	for (i = 0; i < n; i++) {
+		if (objs[i]->tag != make_tag(id, i, round))
+			return 1;
+		for (j = 0; j < sizeof(objs[i]->fill); j++)
+			if (objs[i]->fill[j] != (char)(i & 0xff))
+				return 1;
+	}
+	return 0;
+}
+
+static int check_stats(const char *name, struct pool *pool, size_t outstanding, size_t cached,
+		       size_t slabs)
+{
+	struct pool_stats stats;
+
+	pool_stats(pool, &stats);
+	if (stats.outstanding != outstanding || stats.cached != cached || stats.slabs != slabs ||
+	    stats.slab_bytes != slabs * pool->slab_size) {
+		test_failure(name, "%zu outstanding, %zu cached, %zu slabs, expected %zu, %zu, %zu",
+			     stats.outstanding, stats.cached, stats.slabs, outstanding, cached, slabs);
+		return 1;
+	}
+	return 0;
+}
+
+static int run_basic_tests(void)
+{
+	static struct obj *objs[N_OBJS];
+	struct pool_stats stats;
+	struct pool pool;
+	size_t i, j, slabs;
+	int ret = 0;
+
+	if (pool_init(&pool, 0, NULL) != -EINVAL ||
+	    pool_init(&pool, 4096, "slab_size", (size_t)4096) != -EINVAL) {
+		test_failure("basic", "invalid sizes accepted");
+		return 1;
+	}
+	if (pool_init(&pool, sizeof(struct obj), NULL))
+		return 1;
+
+	/* round trips, with the freed objects served again and no new slab */
+	if (alloc_tagged(&pool, objs, N_OBJS, 0, 0) || check_tagged(objs, N_OBJS, 0, 0)) {
+		test_failure("basic", "objects overlap");
+		ret = 1;
+	}
+	pool_stats(&pool, &stats);
+	slabs = stats.slabs;
+	for (i = 0; !ret && i < 10; i++) {
+		/* every other round frees in allocation order, the others in reverse */
+		for (j = 0; j < N_OBJS; j++)
+			pool_free(&pool, objs[i % 2 ? j : N_OBJS - 1 - j]);
+		if (check_stats("basic", &pool, 0, stats.outstanding + stats.cached, slabs) ||
+		    alloc_tagged(&pool, objs, N_OBJS, 0, (int)i + 1) || check_tagged(objs, N_OBJS, 0, (int)i + 1) ||
+		    check_stats("basic", &pool, N_OBJS, stats.cached, slabs)) {
+			test_failure("basic", "round trip %zu", i);
+			ret = 1;
+		}
+	}
+	for (i = 0; !ret && i < N_OBJS; i++)
+		pool_free(&pool, objs[i]);
+	if (!ret)
+		test_success("basic", "%d objects in %zu slabs, 10 round trips", N_OBJS, slabs);
+	pool_dest(&pool);
+	return ret;
+}
+
+static int run_zero_tests(void)
+{
+	struct pool pool, dirty;
+	unsigned char *p;
+	size_t i, j;
+	int ret = 0;
+
+	if (pool_init(&pool, 100, "zero") || pool_init(&dirty, 100, NULL))
+		return 1;
+	/* dirtied objects come back zeroed, without the option they come back as left */
+	for (i = 0; !ret && i < 1000; i++) {
+		p = pool_alloc(&pool);
+		for (j = 0; p && j < 100; j++) {
+			if (p[j]) {
+				test_failure("zero", "byte %zu of allocation %zu not zeroed", j, i);
+				ret = 1;
+				break;
+			}
+		}
+		if (!p)
+			ret = 1;
+		else
+			memset(p, 0xff, 100);
+		pool_free(&pool, p);
+	}
+	p = pool_alloc(&dirty);
+	memset(p, 0xff, 100);
+	pool_free(&dirty, p);
+	if (!ret && (pool_alloc(&dirty) != p || p[99] != 0xff)) {
+		test_failure("zero", "object not reused as freed without the option");
+		ret = 1;
+	}
+	if (!ret)
+		test_success("zero", "objects of %zu bytes zeroed on allocation", pool.obj_size);
+	pool_dest(&pool);
+	pool_dest(&dirty);
+	return ret;
+}
+
+/*
+ * Each thread allocates its objects, then frees those of the next thread
+ * while allocating new ones, so that most frees land in the magazines of a
+ * thread other than the allocating one.
+ */
+static void *remote_thread(void *arg)
+{
+	struct worker *w = arg;
+	int next = (w->id + 1) % N_THREADS;
+	size_t i;
+
+	if (alloc_tagged(w->pool, w->objs + w->id * N_OBJS, N_OBJS, w->id, 0))
+		w->error = 1;
+	/* only this thread touches the objects of the next from here on */
+	pthread_barrier_wait(w->barrier);
+	if (check_tagged(w->objs + next * N_OBJS, N_OBJS, next, 0))
+		w->error = 1;
+	for (i = 0; i < N_OBJS; i++)
+		pool_free(w->pool, w->objs[next * N_OBJS + i]);
+	if (alloc_tagged(w->pool, w->objs + next * N_OBJS, N_OBJS, next, 1))
+		w->error = 1;
+	return NULL;
+}
+
+static int run_threads(struct pool *pool, struct obj **objs, struct worker *workers)
+{
+	pthread_t threads[N_THREADS];
+	pthread_barrier_t barrier;
+	int i, ret = 0;
+
+	pthread_barrier_init(&barrier, NULL, N_THREADS);
+	for (i = 0; i < N_THREADS; i++) {
+		workers[i] = (struct worker){ pool, &barrier, objs, i, 0 };
+		if (pthread_create(&threads[i], NULL, remote_thread, &workers[i]))
+			return 1;
+	}
+	for (i = 0; i < N_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+		ret |= workers[i].error;
+	}
+	pthread_barrier_destroy(&barrier);
+	return ret;
+}
+
+static int run_remote_tests(void)
+{
+	static struct obj *objs[N_THREADS * N_OBJS];
+	struct worker workers[N_THREADS];
+	struct pool_stats stats;
+	struct pool pool;
+	size_t i;
+	int t, ret;
+
+	if (pool_init(&pool, sizeof(struct obj), NULL))
+		return 1;
+	ret = run_threads(&pool, objs, workers);
+	for (t = 0; !ret && t < N_THREADS; t++) {
+		if (check_tagged(objs + t * N_OBJS, N_OBJS, t, 1)) {
+			test_failure("remote", "objects of thread %d overlap", t);
+			ret = 1;
+		}
+	}
+	pool_stats(&pool, &stats);
+	if (!ret && stats.outstanding != N_THREADS * N_OBJS) {
+		test_failure("remote", "%zu outstanding after the threads exited", stats.outstanding);
+		ret = 1;
+	}
+	/* and freed once more, this time by the main thread */
+	for (i = 0; !ret && i < N_THREADS * N_OBJS; i++)
+		pool_free(&pool, objs[i]);
+	pool_stats(&pool, &stats);
+	if (!ret && stats.outstanding) {
+		test_failure("remote", "%zu outstanding after freeing all", stats.outstanding);
+		ret = 1;
+	}
+	if (!ret)
+		test_success("remote", "%d objects freed by other threads, %zu slabs", N_THREADS * N_OBJS,
+			     stats.slabs);
+	pool_dest(&pool);
+	return ret;
+}
+
+struct exit_arg {
+	struct pool *pool;
+	struct obj **objs;
+	size_t n, keep;
+	int error;
+};
+
+/* allocates n objects and frees them all but keep, then exits */
+static void *exit_thread(void *arg)
+{
+	struct exit_arg *a = arg;
+	size_t i;
+
+	if (alloc_tagged(a->pool, a->objs, a->n, 1, 0))
+		a->error = 1;
+	for (i = a->keep; i < a->n; i++)
+		pool_free(a->pool, a->objs[i]);
+	return NULL;
+}
+
+static int run_exit_tests(void)
+{
+	static struct obj *objs[N_OBJS], *mine[N_OBJS];
+	struct exit_arg a = { NULL, objs, N_OBJS, 100, 0 };
+	struct pool_stats before, after;
+	struct pool pool;
+	pthread_t thread;
+	size_t i;
+	int ret = 0;
+
+	if (pool_init(&pool, sizeof(struct obj), NULL))
+		return 1;
+	a.pool = &pool;
+	if (pthread_create(&thread, NULL, exit_thread, &a))
+		return 1;
+	pthread_join(thread, NULL);
+
+	/* the exited thread's counts and magazines went to the pool */
+	pool_stats(&pool, &before);
+	if (a.error || before.outstanding != a.keep || before.cached < a.n - a.keep) {
+		test_failure("exit", "%zu outstanding, %zu cached after the thread exited", before.outstanding,
+			     before.cached);
+		ret = 1;
+	}
+	/* every cached object can be allocated here without a new slab */
+	if (!ret && (before.cached > N_OBJS || alloc_tagged(&pool, mine, before.cached, 0, 0) ||
+		     check_tagged(objs, a.keep, 1, 0))) {
+		test_failure("exit", "objects of the exited thread lost");
+		ret = 1;
+	}
+	pool_stats(&pool, &after);
+	if (!ret && (after.slabs != before.slabs || after.cached ||
+		     after.outstanding != a.keep + before.cached)) {
+		test_failure("exit", "%zu slabs, %zu cached after taking %zu", after.slabs, after.cached,
+			     before.cached);
+		ret = 1;
+	}
+	for (i = 0; !ret && i < before.cached; i++)
+		pool_free(&pool, mine[i]);
+	for (i = 0; !ret && i < a.keep; i++)
+		pool_free(&pool, objs[i]);
+	if (!ret)
+		test_success("exit", "%zu cached objects handed on by an exited thread", before.cached);
+	pool_dest(&pool);
+	return ret;
+}
+
+static int run_stats_tests(void)
+{
+	static struct obj *objs[N_OBJS];
+	size_t per_slab, i;
+	struct pool pool;
+	int ret = 0;
+
+	if (pool_init(&pool, sizeof(struct obj), "slab_size", (size_t)65536))
+		return 1;
+	/* a slab starts with a 16 byte link to the next, and is carved a magazine at a time */
+	per_slab = (pool.slab_size - 16) / pool.obj_size;
+	if (check_stats("stats", &pool, 0, 0, 0))
+		ret = 1;
+	objs[0] = pool_alloc(&pool);
+	if (!ret && check_stats("stats", &pool, 1, POOL_MAG_ROUNDS - 1, 1))
+		ret = 1;
+	pool_free(&pool, objs[0]);
+	if (!ret && check_stats("stats", &pool, 0, POOL_MAG_ROUNDS, 1))
+		ret = 1;
+
+	/* the whole slab taken, then one more */
+	for (i = 0; !ret && i < per_slab; i++)
+		objs[i] = pool_alloc(&pool);
+	if (!ret && check_stats("stats", &pool, per_slab, 0, 1))
+		ret = 1;
+	objs[per_slab] = pool_alloc(&pool);
+	if (!ret && check_stats("stats", &pool, per_slab + 1, POOL_MAG_ROUNDS - 1, 2))
+		ret = 1;
+	for (i = 0; !ret && i <= per_slab; i++)
+		pool_free(&pool, objs[i]);
+	if (!ret && check_stats("stats", &pool, 0, per_slab + POOL_MAG_ROUNDS, 2))
+		ret = 1;
+	if (!ret)
+		test_success("stats", "%zu objects per slab counted", per_slab);
+	pool_dest(&pool);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	const char *test;
+	int ret = 1;
+
+	if (argc > 1) {
+		test = argv[1];
+		if (strcmp(test, "basic")==0) {
+			ret = run_basic_tests();
+		} else if (strcmp(test, "zero")==0) {
+			ret = run_zero_tests();
+		} else if (strcmp(test, "remote")==0) {
+			ret = run_remote_tests();
+		} else if (strcmp(test, "exit")==0) {
+			ret = run_exit_tests();
+		} else if (strcmp(test, "stats")==0) {
+			ret = run_stats_tests();
+		}
+	}
+	return ret;
+}
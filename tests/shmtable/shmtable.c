@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <tools/shmtable.h>
+
+/*
+ * A shmtable on an anonymous memfd, shared with forked writers: the parent
+ * checks what every writer left behind, and that the table survives writers
+ * killed in the middle of an update.
+ */
+#define N_WRITERS 4
+#define N_KEYS    5000
+#define N_KILLS   8
+
+#define test_failure(name, fmt, ...) \
+	printf("%s %s: failure: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+#define test_success(name, fmt, ...) \
+	printf("%s %s: success: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+static int run_basic_tests(void)
+{
+	struct shmtable st, other;
+	char key[32];
+	tdata_t data;
+	size_t i;
+	int ret = 0;
+
+	if (shmtable_create(&st, NULL, "max_size seed", (size_t)64, (uint64_t)1))
+		return 1;
+	for (i = 0; i < 64; i++) {
+		snprintf(key, sizeof(key), "key:%zu", i);
+		if (shmtable_update(&st, key, i)) {
+			test_failure("basic", "update of '%s' failed", key);
+			ret = 1;
+		}
+	}
+	if (ret || shmtable_update(&st, "key:64", 64) != -ENOSPC || shmtable_entries(&st) != 64) {
+		test_failure("basic", "%zu entries, inserted past max_size", shmtable_entries(&st));
+		ret = 1;
+	}
+	if (!ret && (shmtable_update_only(&st, "key:65", 65) == 0 || shmtable_update_only(&st, "key:7", 70) ||
+		     shmtable_remove(&st, "key:8") || shmtable_remove(&st, "key:8") == 0 ||
+		     shmtable_update(&st, "key:64", 64))) {
+		test_failure("basic", "wrong result of update_only or remove");
+		ret = 1;
+	}
+
+	/* a second mapping of the same segment sees the same entries */
+	if (!ret && shmtable_open_fd(&other, dup(st.fd)))
+		ret = 1;
+	for (i = 0; !ret && i <= 64; i++) {
+		snprintf(key, sizeof(key), "key:%zu", i);
+		if (i == 8 ? shmtable_search(&other, key, &data) == 0 :
+		    shmtable_search(&other, key, &data) || data != (tdata_t)(i == 7 ? 70 : i)) {
+			test_failure("basic", "'%s' wrong in the second mapping", key);
+			ret = 1;
+		}
+	}
+	if (!ret) {
+		shmtable_close(&other);
+		test_success("basic", "%zu entries found through a second mapping", shmtable_entries(&st));
+	}
+	shmtable_close(&st);
+	return ret;
+}
+
+/* each writer owns its keys and also bumps the shared ones, removing every other key it wrote */
+static void writer(struct shmtable *st, int w)
+{
+	char key[32];
+	size_t i;
+
+	for (i = 0; i < N_KEYS; i++) {
+		snprintf(key, sizeof(key), "w%d:%zu", w, i);
+		if (shmtable_update(st, key, i * N_WRITERS + w))
+			_exit(1);
+		snprintf(key, sizeof(key), "shared:%zu", i % 16);
+		if (shmtable_update(st, key, w))
+			_exit(1);
+		if (i % 2) {
+			snprintf(key, sizeof(key), "w%d:%zu", w, i - 1);
+			if (shmtable_remove(st, key))
+				_exit(1);
+		}
+	}
+	_exit(0);
+}
+
+static int run_fork_tests(void)
+{
+	size_t i, n_reads = 0;
+	int w, status, ret = 0;
+	pid_t pids[N_WRITERS];
+	struct shmtable st;
+	char key[32];
+	tdata_t data;
+
+	if (shmtable_create(&st, NULL, "max_size", (size_t)(N_WRITERS*N_KEYS + 64)))
+		return 1;
+	for (w = 0; w < N_WRITERS; w++) {
+		pids[w] = fork();
+		if (pids[w] < 0)
+			return 1;
+		if (pids[w] == 0)
+			writer(&st, w);
+	}
+
+	/* read while they write, a key either is missing or has a value its writer stored */
+	for (i = 0; i < N_KEYS; i++) {
+		snprintf(key, sizeof(key), "w%zu:%zu", i % N_WRITERS, i);
+		if (shmtable_search(&st, key, &data) == 0) {
+			n_reads++;
+			if (data != (tdata_t)(i * N_WRITERS + i % N_WRITERS))
+				ret = 1;
+		}
+	}
+	for (w = 0; w < N_WRITERS; w++)
+		if (waitpid(pids[w], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+			ret = 1;
+	if (ret) {
+		test_failure("fork", "a writer failed or a reader saw a torn value");
+		shmtable_close(&st);
+		return 1;
+	}
+
+	for (w = 0; w < N_WRITERS; w++) {
+		for (i = 0; i < N_KEYS; i++) {
+			snprintf(key, sizeof(key), "w%d:%zu", w, i);
+			if (i % 2 ? shmtable_search(&st, key, &data) || data != (tdata_t)(i * N_WRITERS + w) :
+			    shmtable_search(&st, key, &data) == 0) {
+				test_failure("fork", "'%s' wrong after the writers exited", key);
+				ret = 1;
+				goto out;
+			}
+		}
+	}
+	for (i = 0; i < 16; i++) {
+		snprintf(key, sizeof(key), "shared:%zu", i);
+		if (shmtable_search(&st, key, &data) || data < 0 || data >= N_WRITERS)
+			ret = 1;
+	}
+	if (ret || shmtable_entries(&st) != N_WRITERS*N_KEYS/2 + 16) {
+		test_failure("fork", "%zu entries", shmtable_entries(&st));
+		ret = 1;
+	} else {
+		test_success("fork", "%d writers, %zu entries, %zu concurrent reads hit", N_WRITERS,
+			     shmtable_entries(&st), n_reads);
+	}
+out:
+	shmtable_close(&st);
+	return ret;
+}
+
+/* updates until killed, inserting "k:<i>" = i and then recording i as the last one done */
+static void doomed_writer(struct shmtable *st, size_t from)
+{
+	char key[32];
+	size_t i;
+
+	for (i = from; ; i++) {
+		snprintf(key, sizeof(key), "k:%zu", i);
+		if (shmtable_update(st, key, i) || shmtable_update(st, "last", i))
+			_exit(1);
+	}
+}
+
+static int run_recover_tests(void)
+{
+	size_t i, n = 0, entries, n_short = 0;
+	tdata_t last, data;
+	struct shmtable st;
+	int k, status;
+	char key[32];
+	pid_t pid;
+
+	if (shmtable_create(&st, NULL, "max_size", (size_t)1 << 20))
+		return 1;
+	for (k = 0; k < N_KILLS; k++) {
+		pid = fork();
+		if (pid < 0)
+			return 1;
+		if (pid == 0)
+			doomed_writer(&st, n);
+
+		/* let it get going, then kill it wherever it is, likely holding the lock */
+		while (shmtable_search(&st, "last", &last) || last < (tdata_t)(n + 1000))
+			usleep(1000);
+		kill(pid, SIGKILL);
+		if (waitpid(pid, &status, 0) < 0 || !WIFSIGNALED(status))
+			return 1;
+
+		/* readers must get through, then writers; either finds a lock left held */
+		if (shmtable_search(&st, "last", &last))
+			return 1;
+		snprintf(key, sizeof(key), "after:%d", k);
+		if (shmtable_update(&st, key, k) || shmtable_remove(&st, key)) {
+			test_failure("recover", "the table is stuck after writer %d was killed", k);
+			return 1;
+		}
+
+		/* every key up to the last recorded is there, and at most one more */
+		for (i = 0; i <= (size_t)last; i++) {
+			snprintf(key, sizeof(key), "k:%zu", i);
+			if (shmtable_search(&st, key, &data) || data != (tdata_t)i) {
+				test_failure("recover", "'%s' lost by writer %d", key, k);
+				return 1;
+			}
+		}
+		snprintf(key, sizeof(key), "k:%zu", i + 1);
+		if (shmtable_search(&st, key, &data) == 0) {
+			test_failure("recover", "'%s' inserted ahead of its turn", key);
+			return 1;
+		}
+		snprintf(key, sizeof(key), "k:%zu", i);
+		n = shmtable_search(&st, key, &data) ? i : i + 1;
+
+		/* a writer killed between publishing an entry and counting it leaves the count one short */
+		entries = shmtable_entries(&st);
+		if (entries == n - n_short) {
+			n_short++;
+		} else if (entries != n + 1 - n_short) {
+			test_failure("recover", "%zu entries, %zu keys", entries, n + 1);
+			return 1;
+		}
+	}
+	test_success("recover", "%d writers killed, %zu keys intact, %zu entries miscounted", N_KILLS, n,
+		     n_short);
+	shmtable_close(&st);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *test;
+	int ret = 1;
+
+	if (argc > 1) {
+		test = argv[1];
+		if (strcmp(test, "basic")==0) {
+			ret = run_basic_tests();
+		} else if (strcmp(test, "fork")==0) {
+			ret = run_fork_tests();
+		} else if (strcmp(test, "recover")==0) {
+			ret = run_recover_tests();
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <tools/sketch.h>
+
+/*
+ * Count-min and Space-Saving estimates of a skewed stream, checked against
+ * the exact counts: never below them, and above by no more than the bounds
+ * the sketches promise, also after merging.
+ */
+#define N_KEYS   5000
+#define N_EVENTS 200000
+#define TOPK_K   64
+
+#define test_failure(name, fmt, ...) \
+	printf("%s %s: failure: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+#define test_success(name, fmt, ...) \
+	printf("%s %s: success: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+static uint64_t next_rand(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+/* small keys are far more frequent than large ones */
+static size_t next_key(uint64_t *state)
+{
+	uint64_t r = next_rand(state);
+
+	return (r >> 32) % (1 + (r & 0xffffffff) % N_KEYS);
+}
+
+static int run_cms_tests(void)
+{
+	static uint32_t counts[N_KEYS];
+	uint64_t state = 88172645463325252ull;
+	struct cms cms, part[2], other;
+	size_t i, k, n_over = 0, width = 1024;
+	uint32_t est, prev;
+	char key[32];
+	int ret = 0;
+
+	if (cms_init(&cms, "width depth seed", width, 4u, (uint64_t)1) ||
+	    cms_init_from(&part[0], &cms) || cms_init_from(&part[1], &cms) ||
+	    cms_init(&other, "width depth seed", width, 4u, (uint64_t)2))
+		return 1;
+	for (i = 0; i < N_EVENTS; i++) {
+		k = next_key(&state);
+		snprintf(key, sizeof(key), "key:%zu", k);
+		counts[k]++;
+		prev = cms_estimate(&cms, key);
+		est = cms_add(&cms, key, 1);
+		if (est <= prev || est != cms_estimate(&cms, key))
+			ret = 1;
+		cms_add(&part[i % 2], key, 1);
+	}
+	if (ret || cms.total != N_EVENTS) {
+		test_failure("cms", "cms_add() did not raise the estimate");
+		ret = 1;
+	}
+
+	/* e/width of the total, exceeded by few keys at depth 4 */
+	for (k = 0; !ret && k < N_KEYS; k++) {
+		snprintf(key, sizeof(key), "key:%zu", k);
+		est = cms_estimate(&cms, key);
+		if (est < counts[k]) {
+			test_failure("cms", "'%s' estimated at %u, seen %u times", key, est, counts[k]);
+			ret = 1;
+		}
+		n_over += est - counts[k] > 2.72 * N_EVENTS / width;
+	}
+	if (!ret && n_over > N_KEYS / 20) {
+		test_failure("cms", "%zu of %d keys overestimated past the bound", n_over, N_KEYS);
+		ret = 1;
+	} else if (!ret) {
+		test_success("cms", "%zu of %d keys overestimated past the bound", n_over, N_KEYS);
+	}
+
+	/* the halves merged, which never underestimates either */
+	if (!ret && (cms_merge(&other, &part[0]) != -EINVAL || cms_merge(&part[0], &part[1]) ||
+		     part[0].total != N_EVENTS)) {
+		test_failure("cms-merge", "wrong result of cms_merge()");
+		ret = 1;
+	}
+	for (k = 0; !ret && k < N_KEYS; k++) {
+		snprintf(key, sizeof(key), "key:%zu", k);
+		if (cms_estimate(&part[0], key) < counts[k]) {
+			test_failure("cms-merge", "'%s' underestimated after merging", key);
+			ret = 1;
+		}
+	}
+	if (!ret)
+		test_success("cms-merge", "halves of %d events merged", N_EVENTS);
+
+	/* counters saturate instead of wrapping, and clearing forgets everything */
+	cms_add(&other, "big", UINT32_MAX - 1);
+	if (!ret && (cms_add(&other, "big", 10) != UINT32_MAX || cms_estimate(&other, "big") != UINT32_MAX)) {
+		test_failure("cms-edge", "counter wrapped");
+		ret = 1;
+	}
+	cms_clear(&cms);
+	if (!ret && (cms.total || cms_estimate(&cms, "key:0"))) {
+		test_failure("cms-edge", "counts left after cms_clear()");
+		ret = 1;
+	} else if (!ret) {
+		test_success("cms-edge", "saturated at %u, cleared", UINT32_MAX);
+	}
+	cms_dest(&cms);
+	cms_dest(&part[0]);
+	cms_dest(&part[1]);
+	cms_dest(&other);
+	return ret;
+}
+
+/* fails unless the items are in order and each bounds the true count of its key */
+static int check_items(const char *name, struct topk *tk, const uint32_t *counts, size_t *n_items)
+{
+	struct topk_item items[TOPK_K + 1], item;
+	size_t i, n, k;
+
+	n = topk_list(tk, items, TOPK_K + 1);
+	*n_items = n;
+	if (n != tk->n_used || n > TOPK_K) {
+		test_failure(name, "%zu items listed, %zu tracked", n, tk->n_used);
+		return 1;
+	}
+	for (i = 0; i < n; i++) {
+		k = strtoul(items[i].key + strlen("key:"), NULL, 10);
+		if (i && items[i].count > items[i - 1].count) {
+			test_failure(name, "'%s' listed out of order", items[i].key);
+			return 1;
+		}
+		if (items[i].count < counts[k] || items[i].count - items[i].error > counts[k]) {
+			test_failure(name, "'%s' counted %llu with error %llu, seen %u times", items[i].key,
+				     (unsigned long long)items[i].count, (unsigned long long)items[i].error,
+				     counts[k]);
+			return 1;
+		}
+		if (topk_search(tk, items[i].key, &item) || item.count != items[i].count) {
+			test_failure(name, "'%s' listed but not found", items[i].key);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* fails unless every key seen more than total/k times is tracked */
+static int check_heavy(const char *name, struct topk *tk, const uint32_t *counts, size_t total)
+{
+	struct topk_item item;
+	char key[32];
+	size_t k;
+
+	for (k = 0; k < N_KEYS; k++) {
+		snprintf(key, sizeof(key), "key:%zu", k);
+		if (counts[k] > total / TOPK_K && topk_search(tk, key, &item)) {
+			test_failure(name, "'%s' seen %u times but not tracked", key, counts[k]);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int run_topk_tests(void)
+{
+	static uint32_t counts[N_KEYS];
+	uint64_t state = 88172645463325252ull;
+	struct topk_item item;
+	struct topk tk;
+	size_t i, k, n;
+	char key[32];
+	int ret = 0;
+
+	if (topk_init(&tk, TOPK_K))
+		return 1;
+	if (topk_search(&tk, "key:0", &item) == 0 || topk_list(&tk, &item, 1) != 0) {
+		test_failure("topk", "an empty tracker lists keys");
+		ret = 1;
+	}
+	for (i = 0; !ret && i < N_EVENTS; i++) {
+		k = next_key(&state);
+		snprintf(key, sizeof(key), "key:%zu", k);
+		counts[k]++;
+		if (topk_add(&tk, key, 1))
+			ret = 1;
+	}
+	if (ret || check_items("topk", &tk, counts, &n) || check_heavy("topk", &tk, counts, N_EVENTS)) {
+		ret = 1;
+	} else {
+		test_success("topk", "%zu keys tracked, all heavy hitters among them", n);
+	}
+	topk_dest(&tk);
+	return ret;
+}
+
+static int run_topk_merge_tests(void)
+{
+	static uint32_t counts[N_KEYS], half[N_KEYS];
+	uint64_t state = 88172645463325252ull;
+	struct topk a, b, empty;
+	size_t i, k, n, n_before;
+	char key[32];
+	int ret = 0;
+
+	if (topk_init(&a, TOPK_K) || topk_init(&b, TOPK_K) || topk_init(&empty, TOPK_K))
+		return 1;
+	/* a sees the stream shifted by half the keys, so that they disagree on the top */
+	for (i = 0; !ret && i < N_EVENTS; i++) {
+		k = next_key(&state);
+		if (i % 2)
+			k = (k + N_KEYS/2) % N_KEYS;
+		snprintf(key, sizeof(key), "key:%zu", k);
+		counts[k]++;
+		if (i % 2)
+			half[k]++;
+		ret |= topk_add(i % 2 ? &a : &b, key, 1);
+	}
+	if (ret || check_items("topk-merge", &a, half, &n_before))
+		return 1;
+
+	/* merging nothing changes nothing, merging into nothing copies */
+	if (topk_merge(&a, &empty) || a.n_used != n_before || topk_merge(&empty, &a) ||
+	    check_items("topk-merge", &empty, half, &n) || n != n_before) {
+		test_failure("topk-merge", "merge with an empty tracker changed the keys");
+		ret = 1;
+	}
+
+	/* dst is rebuilt from the candidates of both, and keeps counting afterwards */
+	if (!ret && (topk_merge(&a, &b) || check_items("topk-merge", &a, counts, &n) ||
+		     check_heavy("topk-merge", &a, counts, N_EVENTS))) {
+		ret = 1;
+	}
+	for (i = 0; !ret && i < 1000; i++) {
+		counts[0]++;
+		ret |= topk_add(&a, "key:0", 1);
+	}
+	if (!ret && (check_items("topk-merge", &a, counts, &n) || n != TOPK_K)) {
+		ret = 1;
+	} else if (!ret) {
+		test_success("topk-merge", "%zu keys kept of two trackers", n);
+	}
+	topk_dest(&a);
+	topk_dest(&b);
+	topk_dest(&empty);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	const char *test;
+	int ret = 1;
+
+	if (argc > 1) {
+		test = argv[1];
+		if (strcmp(test, "cms")==0) {
+			ret = run_cms_tests();
+		} else if (strcmp(test, "topk")==0) {
+			ret = run_topk_tests();
+		} else if (strcmp(test, "topk-merge")==0) {
+			ret = run_topk_merge_tests();
+		}
+	}
+	return ret;
+}
@@ -3,6 +3,10 @@
 #include <tools/arrayops.h>
 #include <tools/strdupa.h>
 
+/* a small threshold so that the fallback boundary is easy to cross */
+#define SCOPED_STACK_MAX 16
+#include <tools/scoped.h>
+
 struct strdupa_test {
 	const char *test_name;
 	const char *test_target;
@@ -18,6 +22,21 @@ static struct strdupa_test tests [] = {
 
 #undef DEFINE_STRDUPA_TEST
 
+struct scoped_test {
+	const char *test_name;
+	const char *test_target;
+	int test_on_heap;
+};
+
+#define DEFINE_SCOPED_TEST(t_name, t_target, t_on_heap)	\
+	{__FILE__ " " t_name, t_target, t_on_heap},
+
+static struct scoped_test scoped_tests [] = {
+#include "scoped.inc"
+};
+
+#undef DEFINE_SCOPED_TEST
+
 #define test_failure(test, result, reason)				\
 	printf("%s: input=%s, expected=%s, result=%s: failure: %s\n",	\
 	       test->test_name,						\
@@ -62,6 +81,48 @@ static int leaf_routine(struct strdupa_test *test)
 
 
 
+static int scoped_fallback(struct scoped_test *t)
+{
+	struct strdupa_test test = {t->test_name, t->test_target, t->test_target};
+	char *result __scoped = scoped_strdup(t->test_target);
+
+	if (t->test_target == NULL) {
+		if (result == NULL) {
+			test_success((&test), result);
+			return 0;
+		} else {
+			test_failure((&test), result, "null input pointer not handled");
+			return 1;
+		}
+	} else if (result == NULL) {
+		test_failure((&test), result, "result is NULL");
+		return 1;
+	} else if (result == t->test_target) {
+		test_failure((&test), result, "result points to input");
+		return 1;
+	} else if (strcmp(result, t->test_target)) {
+		test_failure((&test), result, "result does not match input");
+		return 1;
+	} else if (!scoped_on_heap(result) != !t->test_on_heap) {
+		test_failure((&test), result, t->test_on_heap ?
+			     "expected heap fallback" : "expected stack allocation");
+		return 1;
+	} else {
+		test_success((&test), result);
+		return 0;
+	}
+}
+
+static int run_scoped_fallback_tests(void)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < ARRAY_SIZE(scoped_tests); i++) {
+		ret = scoped_fallback(&scoped_tests[i]) || ret;
+	}
+	return ret;
+}
+
 static int run_leaf_routine_tests(void)
 {
 	int i, ret = 0;
@@ -84,7 +145,9 @@ int main(int argc, char *argv[])
 		test = argv[1];
 		if (strcmp(test, "leaf-routine")==0) {
 			ret = run_leaf_routine_tests();
-		} 
+		} else if (strcmp(test, "scoped-fallback")==0) {
+			ret = run_scoped_fallback_tests();
+		}
 	}
 	return ret;
 }
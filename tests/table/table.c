@@ -0,0 +1,860 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <tools/table.h>
+#include <tools/hash.h>
+
+/*
+ * Behaviour of struct table beyond plain updates and lookups: every case
+ * changes how entries are stored and checks that each key still maps to
+ * the value last written.
+ */
+#define N_KEYS 20000
+
+#define test_failure(name, fmt, ...) \
+	printf("%s %s: failure: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+#define test_success(name, fmt, ...) \
+	printf("%s %s: success: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+static int fill(struct table *table, size_t from, size_t to, tdata_t add)
+{
+	char key[32];
+	size_t i;
+
+	for (i = from; i < to; i++) {
+		snprintf(key, sizeof(key), "key:%zu", i);
+		if (table_update(table, key, i + add))
+			return 1;
+	}
+	return 0;
+}
+
+static int count_entry(const char *key, tdata_t data, void *arg)
+{
+	(void)key;
+	(void)data;
+	(*(size_t *)arg)++;
+	return 0;
+}
+
+/* fails unless keys [0, n) map to i + add, or i + add + 1 for every third */
+static int check(const char *name, struct table *table, size_t n, tdata_t add, int thirds)
+{
+	size_t i, count = 0;
+	char key[32];
+	tdata_t data;
+
+	for (i = 0; i < n; i++) {
+		snprintf(key, sizeof(key), "key:%zu", i);
+		if (table_search(table, key, &data) || data != (tdata_t)i + add + (thirds && i % 3 == 0)) {
+			test_failure(name, "'%s' missing or wrong", key);
+			return 1;
+		}
+	}
+	table_for_each(table, count_entry, &count);
+	if (count != n || table->n_entries != n) {
+		test_failure(name, "%zu entries visited, %zu counted, expected %zu", count, table->n_entries, n);
+		return 1;
+	}
+	return 0;
+}
+
+/* 32-bit FNV-1a in the upper half only, so a table looking at the low bits would put every key in one bucket */
+static uint64_t hash_high(const char *key)
+{
+	uint32_t h = 0x811c9dc5;
+
+	for (; *key; key++)
+		h = (h ^ (unsigned char)*key) * 0x01000193;
+	return (uint64_t)h << 32;
+}
+
+static int run_hash64_tests(void)
+{
+	struct table table;
+	size_t i, n = N_KEYS;
+	unsigned bits;
+	char key[32];
+	tdata_t data;
+	int ret = 0;
+
+	if (table_init(&table, "size max_size with_hash64 stats", (size_t)16, (size_t)1 << 16, hash_high))
+		return 1;
+	bits = table.b_bits;
+	if (fill(&table, 0, n, 0) || check("hash64", &table, n, 0, 0))
+		ret = 1;
+	if (!ret && (table_hash(&table, "key:1") != hash_high("key:1") || table.b_bits <= bits)) {
+		test_failure("hash64", "table_hash() is not the custom hash, or the table did not grow");
+		ret = 1;
+	}
+	/* every key hashes differently, so a lookup compares against few others */
+	table.stats.searches = table.stats.probes = 0;
+	for (i = 0; !ret && i < n; i++) {
+		snprintf(key, sizeof(key), "key:%zu", i);
+		table_search(&table, key, &data);
+	}
+	if (!ret && table.stats.probes > 2*table.stats.searches) {
+		test_failure("hash64", "%llu probes for %llu lookups", (unsigned long long)table.stats.probes,
+			     (unsigned long long)table.stats.searches);
+		ret = 1;
+	}
+	if (!ret)
+		test_success("hash64", "%zu entries, %.2f probes per lookup, %u bucket bits", n,
+			     (double)table.stats.probes / table.stats.searches, table.b_bits);
+	table_dest(&table);
+	return ret;
+}
+
+/* set in table->flags while the bucket array is mapped rather than allocated, see src/table.c */
+#define TABLE_F_BUCKETS_MAPPED 0x2
+
+/*
+ * Bucket arrays of 4MB and more are mapped and advised into huge pages
+ * unless no_hugepages is given. At a load factor of 0.25 a table crosses
+ * that size at 1 << 19 buckets, so the last doublings resize from an
+ * allocated array to a mapped one and from a mapped one to a larger one.
+ */
+static int run_buckets_tests(void)
+{
+	static const char *names[] = { "hugepages", "no_hugepages" };
+	size_t i, n = 200000, n_mapped;
+	struct table table;
+	unsigned bits, t;
+	char options[64];
+	int ret = 0;
+
+	for (t = 0; !ret && t < 2; t++) {
+		snprintf(options, sizeof(options), "size max_size load_factor %s", t ? names[t] : "");
+		if (table_init(&table, options, (size_t)16, (size_t)1 << 20, 0.25))
+			return 1;
+		bits = table.b_bits;
+		n_mapped = 0;
+		for (i = 0; !ret && i < n; i++) {
+			if (fill(&table, i, i + 1, 0)) {
+				test_failure(names[t], "update %zu failed", i);
+				ret = 1;
+			} else if (table.b_bits != bits) {
+				bits = table.b_bits;
+				n_mapped += !!(table.flags & TABLE_F_BUCKETS_MAPPED);
+				ret = check(names[t], &table, i + 1, 0, 0);
+			}
+		}
+		if (!ret && (bits < 20 || (t ? n_mapped != 0 : n_mapped != 2))) {
+			test_failure(names[t], "%zu of the arrays up to %u bits mapped", n_mapped, bits);
+			ret = 1;
+		}
+		if (!ret)
+			test_success(names[t], "%zu entries, %zu arrays mapped", n, n_mapped);
+		table_dest(&table);
+	}
+	return ret;
+}
+
+/*
+ * Grows one table past PARALLEL_REHASH_MIN buckets on 4 rehash threads, and
+ * another on more threads than are ever used, checking every key after each
+ * doubling. Past 1 << 16 old buckets every doubling is a parallel rehash.
+ */
+static int run_rehash_tests(void)
+{
+	static const unsigned threads[] = { 4, ~0u };
+	size_t n_keys[] = { 400000, 100000 };
+	size_t i, n_doublings;
+	struct table table;
+	unsigned bits, t;
+	char key[32];
+	int ret = 0;
+
+	for (t = 0; !ret && t < 2; t++) {
+		if (table_init(&table, "size max_size rehash_threads", (size_t)16, (size_t)1 << 20, threads[t]))
+			return 1;
+		if (table.rehash_threads > 256) {
+			test_failure("rehash", "%u rehash threads accepted", table.rehash_threads);
+			ret = 1;
+		}
+		bits = table.b_bits;
+		n_doublings = 0;
+		for (i = 0; !ret && i < n_keys[t]; i++) {
+			snprintf(key, sizeof(key), "key:%zu", i);
+			if (table_update(&table, key, i)) {
+				test_failure("rehash", "update of '%s' failed", key);
+				ret = 1;
+			} else if (table.b_bits != bits) {
+				bits = table.b_bits;
+				n_doublings++;
+				ret = check("rehash", &table, i + 1, 0, 0);
+			}
+		}
+		if (!ret && (bits <= 17 || check("rehash", &table, n_keys[t], 0, 0))) {
+			test_failure("rehash", "%u bucket bits", bits);
+			ret = 1;
+		}
+		if (!ret)
+			test_success("rehash", "%zu entries, %zu doublings on %u threads", n_keys[t], n_doublings,
+				     table.rehash_threads);
+		table_dest(&table);
+	}
+	return ret;
+}
+
+/* SipHash-1-3 of the bytes 0, 1, ... n - 1 under the key 00 01 ... 0f, for n up to 16 */
+static const uint64_t siphash13_vectors[] = {
+	0xabac0158050fc4dcull, 0xc9f49bf37d57ca93ull, 0x82cb9b024dc7d44dull, 0x8bf80ab8e7ddf7fbull,
+	0xcf75576088d38328ull, 0xdef9d52f49533b67ull, 0xc50d2b50c59f22a7ull, 0xd3927d989bb11140ull,
+	0x369095118d299a8eull, 0x25a48eb36c063de4ull, 0x79de85ee92ff097full, 0x70c118c1f94dc352ull,
+	0x78a384b157b4d9a2ull, 0x306f760c1229ffa7ull, 0x605aa111c0f95d34ull, 0xd320d86d2a519956ull,
+	0xcc4fdd1a7d908b66ull,
+};
+
+static int run_siphash_tests(void)
+{
+	const uint64_t key[2] = { 0x0706050403020100ull, 0x0f0e0d0c0b0a0908ull };
+	struct table a, b, fnv;
+	unsigned char data[16];
+	size_t i, n_same = 0;
+	char str[32];
+	int ret = 0;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = (unsigned char)i;
+	for (i = 0; i <= sizeof(data); i++) {
+		if (hash_siphash13(data, i, key) != siphash13_vectors[i]) {
+			test_failure("siphash", "SipHash-1-3 of %zu bytes is %016llx", i,
+				     (unsigned long long)hash_siphash13(data, i, key));
+			return 1;
+		}
+	}
+
+	/* the table hashes with it, keyed by its seed */
+	if (table_init(&a, "seed siphash", (uint64_t)7) || table_init(&b, "seed siphash", (uint64_t)7) ||
+	    table_init(&fnv, "seed", (uint64_t)7))
+		return 1;
+	for (i = 0; i < N_KEYS; i++) {
+		snprintf(str, sizeof(str), "key:%zu", i);
+		if (table_hash(&a, str) != table_hash(&b, str))
+			ret = 1;
+		n_same += table_hash(&a, str) == table_hash(&fnv, str);
+	}
+	if (ret || n_same) {
+		test_failure("siphash", "tables of one seed disagree, or %zu hashes equal to FNV-1a", n_same);
+		ret = 1;
+	} else {
+		test_success("siphash", "%zu vectors, tables of one seed agree", sizeof(siphash13_vectors) / 8);
+	}
+	table_dest(&a);
+	table_dest(&b);
+	table_dest(&fnv);
+	return ret;
+}
+
+struct walk {
+	char keys[N_KEYS][16];
+	size_t n;
+};
+
+static int walk_entry(const char *key, tdata_t data, void *arg)
+{
+	struct walk *w = arg;
+
+	(void)data;
+	if (w->n < N_KEYS)
+		snprintf(w->keys[w->n], sizeof(w->keys[0]), "%s", key);
+	w->n++;
+	return 0;
+}
+
+/* tables of one seed place every key alike, so they walk in the same order; another seed does not */
+static int run_seed_tests(void)
+{
+	static struct walk walks[3];
+	static const uint64_t seeds[3] = { 7, 7, 8 };
+	struct table tables[3];
+	size_t i, n_moved = 0;
+	char key[32];
+	int t, ret = 0;
+
+	for (t = 0; t < 3; t++) {
+		if (table_init(&tables[t], "max_size seed", (size_t)N_KEYS, seeds[t]) ||
+		    fill(&tables[t], 0, N_KEYS, 0))
+			return 1;
+		walks[t].n = 0;
+		table_for_each(&tables[t], walk_entry, &walks[t]);
+	}
+	for (i = 0; i < N_KEYS; i++) {
+		snprintf(key, sizeof(key), "key:%zu", i);
+		if (table_hash(&tables[0], key) != table_hash(&tables[1], key) ||
+		    strcmp(walks[0].keys[i], walks[1].keys[i])) {
+			test_failure("seed", "tables seeded alike differ at '%s'", key);
+			ret = 1;
+			break;
+		}
+		n_moved += strcmp(walks[0].keys[i], walks[2].keys[i]) != 0;
+	}
+	if (!ret && n_moved < N_KEYS / 2) {
+		test_failure("seed", "another seed moved only %zu of %d keys", n_moved, N_KEYS);
+		ret = 1;
+	} else if (!ret) {
+		test_success("seed", "placement reproduced, %zu of %d keys moved by another seed", n_moved, N_KEYS);
+	}
+	for (t = 0; t < 3; t++)
+		table_dest(&tables[t]);
+	return ret;
+}
+
+static unsigned hash_const(const char *key)
+{
+	(void)key;
+	return 42;
+}
+
+/* the bucket of hash in a table of 1 << bits buckets, as table_bucket() in src/table.c computes it */
+static size_t bucket_of(uint64_t hash, unsigned bits)
+{
+	return (hash*0x61c8864680b583ebull) >> (64 - bits);
+}
+
+/*
+ * Keys brute-forced to share a bucket under a known seed, as an attacker who
+ * learned the seed would send them. Past max_chain the table must switch to
+ * SipHash-1-3 under a new seed, after which the keys spread out again.
+ */
+static int run_reseed_tests(void)
+{
+	static char flood[64][32];
+	size_t i, n = 0, target = 0;
+	struct table table, custom;
+	uint64_t before;
+	char key[32];
+	tdata_t data;
+	int ret = 0;
+
+	if (table_init(&table, "size max_size seed max_chain stats", (size_t)4096, (size_t)4096,
+		       (uint64_t)42, 8u))
+		return 1;
+	for (i = 0; n < 64; i++) {
+		snprintf(key, sizeof(key), "flood:%zu", i);
+		if (!n)
+			target = bucket_of(table_hash(&table, key), table.b_bits);
+		if (bucket_of(table_hash(&table, key), table.b_bits) == target)
+			snprintf(flood[n++], sizeof(flood[0]), "%s", key);
+	}
+	before = table_hash(&table, flood[0]);
+	for (i = 0; i < 64; i++)
+		ret |= table_update(&table, flood[i], (tdata_t)i);
+	if (ret || table_hash(&table, flood[0]) == before) {
+		test_failure("reseed", "%d colliding keys did not reseed the table", 64);
+		ret = 1;
+	}
+
+	/* every key still there, and found after few comparisons */
+	table.stats.searches = table.stats.probes = 0;
+	for (i = 0; !ret && i < 64; i++) {
+		if (table_search(&table, flood[i], &data) || data != (tdata_t)i) {
+			test_failure("reseed", "'%s' lost in the reseed", flood[i]);
+			ret = 1;
+		}
+	}
+	if (!ret && (table.n_entries != 64 || table.stats.probes > 2*table.stats.searches)) {
+		test_failure("reseed", "%zu entries, %llu probes for 64 lookups", table.n_entries,
+			     (unsigned long long)table.stats.probes);
+		ret = 1;
+	}
+	/* and keys inserted after it land under the new seed */
+	if (!ret && fill(&table, 0, 1000, 0))
+		ret = 1;
+	for (i = 0; !ret && i < 1000; i++) {
+		snprintf(key, sizeof(key), "key:%zu", i);
+		if (table_search(&table, key, &data) || data != (tdata_t)i) {
+			test_failure("reseed", "'%s' missing after the reseed", key);
+			ret = 1;
+		}
+	}
+	table_dest(&table);
+	if (ret)
+		return ret;
+
+	/* max_chain leaves a custom hash alone, however much it collides */
+	if (table_init(&custom, "max_size with_hash max_chain", (size_t)200, hash_const, 8u))
+		return 1;
+	if (fill(&custom, 0, 200, 0) || check("reseed", &custom, 200, 0, 0) || table_hash(&custom, "key:0") != 42) {
+		test_failure("reseed", "a colliding with_hash was reseeded");
+		ret = 1;
+	} else {
+		test_success("reseed", "64 keys in one bucket reseeded, custom hash left alone");
+	}
+	table_dest(&custom);
+	return ret;
+}
+
+static int run_compact_tests(void)
+{
+	size_t i, n = N_KEYS, steps = 0;
+	struct table table;
+	char key[32];
+	int ret = 0, done = 0;
+
+	if (table_init(&table, "size max_size seed", (size_t)16, (size_t)1 << 16, (uint64_t)1))
+		return 1;
+	if (fill(&table, 0, n, 0))
+		return 1;
+	for (i = 0; i < n; i += 3) {
+		snprintf(key, sizeof(key), "key:%zu", i);
+		table_update(&table, key, i + 1);
+	}
+
+	/* twice, the second pass moves entries out of the arena the first filled */
+	if (table_compact(&table) || check("compact", &table, n, 0, 1) ||
+	    table_compact(&table) || check("compact", &table, n, 0, 1)) {
+		test_failure("compact", "entries lost or changed by table_compact()");
+		ret = 1;
+	} else {
+		test_success("compact", "%zu entries found after two passes", n);
+	}
+
+	/* a pass spread over many calls, with updates and growth in between */
+	while (!ret && !done) {
+		done = table_compact_step(&table, 64);
+		if (done < 0) {
+			test_failure("compact-step", "table_compact_step() failed");
+			ret = 1;
+			break;
+		}
+		if (++steps % 16 == 0 && n < 3*N_KEYS) {
+			if (fill(&table, n, n + 1000, 0))
+				ret = 1;
+			n += 1000;
+			/* keep updating values the pass has already moved */
+			for (i = 0; i < n; i += 3) {
+				snprintf(key, sizeof(key), "key:%zu", i);
+				table_update(&table, key, i + 1);
+			}
+			ret |= check("compact-step", &table, n, 0, 1);
+		}
+	}
+	if (ret || check("compact-step", &table, n, 0, 1)) {
+		test_failure("compact-step", "entries lost or changed by table_compact_step()");
+		ret = 1;
+	} else {
+		test_success("compact-step", "%zu entries found after %zu steps in %zu buckets", n, steps,
+			     (size_t)1 << table.b_bits);
+	}
+	table_dest(&table);
+	return ret;
+}
+
+struct upsert_arg {
+	size_t calls;
+	size_t created;
+};
+
+static void upsert_add(tdata_t *data, int created, void *arg)
+{
+	struct upsert_arg *a = arg;
+
+	a->calls++;
+	a->created += created;
+	if (created && *data) {
+		/* a new entry starts at zero, counted twice so that the test fails */
+		a->created++;
+	}
+	*data += 1;
+}
+
+static int run_upsert_tests(void)
+{
+	struct upsert_arg a = { 0, 0 };
+	size_t i, n_created = 0;
+	struct table table;
+	int created, ret = 0;
+	tdata_t *slot;
+	char key[32];
+
+	if (table_init(&table, "size max_size", (size_t)16, (size_t)N_KEYS))
+		return 1;
+	/* every key three times, the first inserts it at i and the others increment it */
+	for (i = 0; i < 3*N_KEYS; i++) {
+		snprintf(key, sizeof(key), "key:%zu", i % N_KEYS);
+		slot = table_slot(&table, key, &created);
+		if (!slot || created != (i < N_KEYS) ||
+		    *slot != (created ? 0 : (tdata_t)(i % N_KEYS + i / N_KEYS - 1))) {
+			test_failure("slot", "wrong slot for '%s' on pass %zu", key, i / N_KEYS);
+			ret = 1;
+			break;
+		}
+		n_created += created;
+		if (created)
+			*slot = i;
+		else
+			(*slot)++;
+	}
+	if (ret || check("slot", &table, N_KEYS, 2, 0) || n_created != N_KEYS) {
+		ret = 1;
+	} else {
+		test_success("slot", "%zu keys created, then found twice each", n_created);
+	}
+
+	for (i = 0; !ret && i < 2*N_KEYS; i++) {
+		snprintf(key, sizeof(key), "key:%zu", i);
+		if (table_upsert(&table, key, upsert_add, &a))
+			break;
+	}
+	/* the present keys are incremented, the first new one hits max_size */
+	if (ret || i != N_KEYS || a.calls != N_KEYS || a.created != 0) {
+		test_failure("upsert", "%zu upserts, %zu calls, %zu created", i, a.calls, a.created);
+		ret = 1;
+	} else if (check("upsert", &table, N_KEYS, 3, 0)) {
+		ret = 1;
+	} else {
+		test_success("upsert", "%zu values updated in place", a.calls);
+	}
+	table_dest(&table);
+
+	/* a full table still hands out slots of keys it has, and only those */
+	memset(&a, 0, sizeof(a));
+	if (table_init(&table, "size max_size", (size_t)16, (size_t)16) || fill(&table, 0, 16, 0))
+		return 1;
+	if (table_slot(&table, "key:16", &created) || table_upsert(&table, "key:16", upsert_add, &a) == 0 ||
+	    a.calls || !table_slot(&table, "key:15", &created) || created ||
+	    table_upsert(&table, "key:15", upsert_add, &a) || a.calls != 1 || a.created) {
+		test_failure("upsert-full", "wrong result at max_size");
+		ret = 1;
+	} else {
+		test_success("upsert-full", "new keys refused at max_size, present ones updated");
+	}
+	table_dest(&table);
+	return ret;
+}
+
+static int run_reserve_tests(void)
+{
+	unsigned bits, last_bits, min_step = ~0u;
+	size_t i, e_size;
+	struct table table;
+	char key[32];
+	int ret = 0;
+
+	if (table_init(&table, "size max_size", (size_t)16, (size_t)N_KEYS))
+		return 1;
+	if (table_reserve(&table, N_KEYS + 1) != -EINVAL || table.e_size >= N_KEYS) {
+		test_failure("reserve", "reserved past max_size");
+		ret = 1;
+	} else if (table_reserve(&table, N_KEYS) || table.e_size < N_KEYS) {
+		test_failure("reserve", "room for %zu of %d entries", table.e_size, N_KEYS);
+		ret = 1;
+	}
+	bits = table.b_bits;
+	e_size = table.e_size;
+	/* neither the keys reserved for, nor a smaller reservation, change the buckets */
+	if (!ret && (fill(&table, 0, N_KEYS, 0) || table_reserve(&table, 16) ||
+		     table.b_bits != bits || table.e_size != e_size || check("reserve", &table, N_KEYS, 0, 0))) {
+		test_failure("reserve", "rehashed from %u to %u bucket bits", bits, table.b_bits);
+		ret = 1;
+	} else if (!ret) {
+		test_success("reserve", "%d entries in %zu buckets without rehashing", N_KEYS, (size_t)1 << bits);
+	}
+	table_dest(&table);
+
+	/* 4 entries per bucket, and at least 4 times the capacity on every growth */
+	if (table_init(&table, "size max_size load_factor growth", (size_t)16, (size_t)1 << 20, 4.0, 4.0))
+		return 1;
+	last_bits = table.b_bits;
+	for (i = 0; !ret && i < N_KEYS; i++) {
+		snprintf(key, sizeof(key), "key:%zu", i);
+		if (table_update(&table, key, i))
+			ret = 1;
+		if (table.b_bits != last_bits) {
+			if (table.b_bits - last_bits < min_step)
+				min_step = table.b_bits - last_bits;
+			last_bits = table.b_bits;
+		}
+		if (table.n_entries > table.e_size ||
+		    table.e_size != (size_t)((double)((size_t)1 << table.b_bits) * 4.0))
+			ret = 1;
+	}
+	if (ret || min_step < 2 || check("load_factor", &table, N_KEYS, 0, 0)) {
+		test_failure("load_factor", "%zu entries, %zu capacity in %zu buckets, step of %u bits",
+			     table.n_entries, table.e_size, (size_t)1 << table.b_bits, min_step);
+		ret = 1;
+	} else {
+		test_success("load_factor", "%d entries in %zu buckets", N_KEYS, (size_t)1 << table.b_bits);
+	}
+	table_dest(&table);
+
+	if (table_init(&table, "load_factor", -1.0) != -EINVAL || table_init(&table, "load_factor", -0.5) != -EINVAL ||
+	    table_init(&table, "growth", 1.0) != -EINVAL || table_init(&table, "growth", 0.5) != -EINVAL) {
+		test_failure("load_factor", "invalid load_factor or growth accepted");
+		return 1;
+	}
+	/* zero, like an omitted option, selects the defaults */
+	if (table_init(&table, "load_factor growth", 0.0, 0.0))
+		return 1;
+	if (!(table.load_factor > 0) || !(table.growth > 1)) {
+		test_failure("load_factor", "load_factor %g and growth %g by default", table.load_factor, table.growth);
+		ret = 1;
+	} else {
+		test_success("load_factor", "invalid load_factor and growth rejected");
+	}
+	table_dest(&table);
+	return ret;
+}
+
+static uint64_t next_rand(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+/* skewed lookups: seven in eight go to 64 hot keys, returns the average probes per lookup */
+static double lookup_skewed(const char *name, struct table *table, size_t n, int *ret)
+{
+	uint64_t state = 88172645463325252ull, searches = table->stats.searches;
+	uint64_t probes = table->stats.probes;
+	size_t i, k;
+	char key[32];
+	tdata_t data;
+
+	for (i = 0; i < 64*500; i++) {
+		k = next_rand(&state);
+		k = k % 8 ? k % 64 * 97 % n : k % n;
+		snprintf(key, sizeof(key), "key:%zu", k);
+		if (table_search(table, key, &data) || data != (tdata_t)k) {
+			test_failure(name, "'%s' missing or wrong", key);
+			*ret = 1;
+			break;
+		}
+	}
+	if (table->stats.searches - searches != i) {
+		test_failure(name, "%llu searches counted for %zu",
+			     (unsigned long long)(table->stats.searches - searches), i);
+		*ret = 1;
+	}
+	return (double)(table->stats.probes - probes) / i;
+}
+
+static int run_organize_tests(void)
+{
+	static const char *names[] = { "none", "move_to_front", "transpose", "hot_cache" };
+	char options[96];
+	double probes[4];
+	struct table table;
+	int i, ret = 0;
+
+	/* long chains, so that reordering them shows */
+	for (i = 0; i < 4; i++) {
+		snprintf(options, sizeof(options), "max_size load_factor seed stats %s", i ? names[i] : "");
+		if (table_init(&table, options, (size_t)1 << 16, 8.0, (uint64_t)1, (size_t)256))
+			return 1;
+		if (fill(&table, 0, N_KEYS, 0))
+			return 1;
+		probes[i] = lookup_skewed(names[i], &table, N_KEYS, &ret);
+		/* most of the lookups, seven in eight of which are for a key that fits the cache */
+		if (i == 3 && !ret && table.stats.hot_hits < 64*500/2) {
+			test_failure(names[i], "%llu hot hits in %d lookups", (unsigned long long)table.stats.hot_hits,
+				     64*500);
+			ret = 1;
+		}
+
+		/* reordered chains and cached entries survive compaction and growth */
+		if (!ret && table_compact(&table))
+			ret = 1;
+		if (!ret)
+			lookup_skewed(names[i], &table, N_KEYS, &ret);
+		if (!ret && (fill(&table, N_KEYS, 2*N_KEYS, 0) || check(names[i], &table, 2*N_KEYS, 0, 0)))
+			ret = 1;
+		if (!ret)
+			lookup_skewed(names[i], &table, 2*N_KEYS, &ret);
+		table_dest(&table);
+		if (ret)
+			return ret;
+		if (i && probes[i] >= probes[0]) {
+			test_failure(names[i], "%.2f probes per lookup, %.2f without", probes[i], probes[0]);
+			return 1;
+		}
+		test_success(names[i], "%.2f probes per lookup", probes[i]);
+	}
+	return ret;
+}
+
+static void combine_add(tdata_t *data, tdata_t other, void *arg)
+{
+	*data += other;
+	__atomic_add_fetch((size_t *)arg, 1, __ATOMIC_RELAXED);
+}
+
+/* fails unless src is empty but still usable */
+static int check_emptied(const char *name, struct table *src)
+{
+	size_t count = 0;
+	tdata_t data;
+
+	table_for_each(src, count_entry, &count);
+	if (src->n_entries || count || table_search(src, "key:0", &data) == 0 ||
+	    table_update(src, "key:0", 1) || table_search(src, "key:0", &data) || data != 1) {
+		test_failure(name, "source not left empty");
+		return 1;
+	}
+	return 0;
+}
+
+static int run_merge_tests(void)
+{
+	size_t i, n_combined, n = N_KEYS, found;
+	struct table dst, src;
+	char key[32];
+	tdata_t data;
+	int seeded, ret = 0;
+
+	/* dst has [0, n) at i and src [n/2, 3n/2) at 1: the overlap is combined */
+	for (seeded = 0; seeded < 2; seeded++) {
+		n_combined = 0;
+		if (table_init(&dst, "max_size seed", (size_t)1 << 16, (uint64_t)1) ||
+		    table_init(&src, "max_size seed", (size_t)1 << 16, (uint64_t)(seeded ? 1 : 2)))
+			return 1;
+		if (fill(&dst, 0, n, 0))
+			return 1;
+		for (i = n/2; i < 3*n/2; i++) {
+			snprintf(key, sizeof(key), "key:%zu", i);
+			ret |= table_update(&src, key, 1);
+		}
+		if (ret || table_merge(&dst, &src, combine_add, &n_combined) || n_combined != n/2) {
+			test_failure("merge", "%zu of %zu duplicates combined", n_combined, n/2);
+			ret = 1;
+		}
+		for (i = 0; !ret && i < 3*n/2; i++) {
+			snprintf(key, sizeof(key), "key:%zu", i);
+			if (table_search(&dst, key, &data) || data != (i < n/2 ? (tdata_t)i : i < n ? (tdata_t)i + 1 : 1)) {
+				test_failure("merge", "'%s' wrong after merging", key);
+				ret = 1;
+			}
+		}
+		if (!ret && (dst.n_entries != 3*n/2 || check_emptied("merge", &src)))
+			ret = 1;
+
+		/* without combine the value of src wins */
+		if (!ret && (table_merge(&dst, &src, NULL, NULL) || table_search(&dst, "key:0", &data) || data != 1)) {
+			test_failure("merge", "value of dst kept without combine");
+			ret = 1;
+		}
+		table_dest(&dst);
+		table_dest(&src);
+		if (ret)
+			return ret;
+		test_success("merge", "%zu entries, %zu combined, %s hashes", 3*n/2, n_combined,
+			     seeded ? "cached" : "recomputed");
+	}
+
+	/* dst fills up partway: what did not fit stays in src, nothing is lost or doubled */
+	if (table_init(&dst, "max_size seed", n + 100, (uint64_t)1) ||
+	    table_init(&src, "max_size seed", (size_t)1 << 16, (uint64_t)1))
+		return 1;
+	if (fill(&dst, 0, n, 0) || fill(&src, n, 2*n, 0) || table_compact(&src))
+		return 1;
+	if (table_merge(&dst, &src, NULL, NULL) == 0 || dst.n_entries != n + 100 || src.n_entries != n - 100) {
+		test_failure("merge-full", "%zu entries in dst, %zu in src", dst.n_entries, src.n_entries);
+		ret = 1;
+	}
+	for (i = n; !ret && i < 2*n; i++) {
+		snprintf(key, sizeof(key), "key:%zu", i);
+		found = !table_search(&dst, key, &data) + !table_search(&src, key, &data);
+		if (found != 1 || data != (tdata_t)i) {
+			test_failure("merge-full", "'%s' in %zu tables", key, found);
+			ret = 1;
+		}
+	}
+	if (!ret)
+		test_success("merge-full", "%zu entries moved before max_size, %zu left", dst.n_entries - n,
+			     src.n_entries);
+	table_dest(&dst);
+	table_dest(&src);
+	return ret;
+}
+
+static int run_merge_parallel_tests(void)
+{
+	struct table dst, srcs[4], *ptrs[4];
+	size_t i, s, n = N_KEYS, n_combined;
+	char key[32];
+	tdata_t data;
+	int seeded, ret = 0;
+
+	/* src s holds [s*n/2, s*n/2 + n) at 1, so a key ends up counting the sources it was in */
+	for (seeded = 0; seeded < 2; seeded++) {
+		n_combined = 0;
+		if (table_init(&dst, "max_size seed", (size_t)1 << 16, (uint64_t)1))
+			return 1;
+		for (s = 0; s < 4; s++) {
+			ptrs[s] = &srcs[s];
+			if (table_init(&srcs[s], "max_size seed", (size_t)1 << 16, (uint64_t)(seeded || s ? 1 : 2)))
+				return 1;
+			for (i = s*n/2; i < s*n/2 + n; i++) {
+				snprintf(key, sizeof(key), "key:%zu", i);
+				if (table_update(&srcs[s], key, 1))
+					return 1;
+			}
+		}
+		if (table_merge_parallel(&dst, ptrs, 4, combine_add, &n_combined, 4) || dst.n_entries != 5*n/2 ||
+		    n_combined != 3*n/2) {
+			test_failure("merge-parallel", "%zu entries, %zu combined", dst.n_entries, n_combined);
+			ret = 1;
+		}
+		for (i = 0; !ret && i < 5*n/2; i++) {
+			snprintf(key, sizeof(key), "key:%zu", i);
+			if (table_search(&dst, key, &data) || data != (i < n/2 || i >= 2*n ? 1 : 2)) {
+				test_failure("merge-parallel", "'%s' counted %ld times", key, (long)data);
+				ret = 1;
+			}
+		}
+		for (s = 0; !ret && s < 4; s++)
+			ret = check_emptied("merge-parallel", &srcs[s]);
+		table_dest(&dst);
+		for (s = 0; s < 4; s++)
+			table_dest(&srcs[s]);
+		if (ret)
+			return ret;
+		/* a source hashing differently sends everything down the serial path */
+		test_success("merge-parallel", "%zu entries from 4 tables, %s", 5*n/2,
+			     seeded ? "in parallel" : "one after the other");
+	}
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	char *test;
+	int ret = 1;
+
+	if (argc > 1) {
+		test = argv[1];
+		if (strcmp(test, "hash64")==0) {
+			ret = run_hash64_tests();
+		} else if (strcmp(test, "buckets")==0) {
+			ret = run_buckets_tests();
+		} else if (strcmp(test, "rehash")==0) {
+			ret = run_rehash_tests();
+		} else if (strcmp(test, "siphash")==0) {
+			ret = run_siphash_tests();
+		} else if (strcmp(test, "seed")==0) {
+			ret = run_seed_tests();
+		} else if (strcmp(test, "reseed")==0) {
+			ret = run_reseed_tests();
+		} else if (strcmp(test, "compact")==0) {
+			ret = run_compact_tests();
+		} else if (strcmp(test, "upsert")==0) {
+			ret = run_upsert_tests();
+		} else if (strcmp(test, "reserve")==0) {
+			ret = run_reserve_tests();
+		} else if (strcmp(test, "organize")==0) {
+			ret = run_organize_tests();
+		} else if (strcmp(test, "merge")==0) {
+			ret = run_merge_tests();
+		} else if (strcmp(test, "merge-parallel")==0) {
+			ret = run_merge_parallel_tests();
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <tools/timerwheel.h>
+
+/*
+ * Arms, re-arms and cancels timers at random, near and far, and advances the
+ * wheel in steps of random length, checking that every timer expires in the
+ * advance that covers its expiry tick, in expiry order, and no other.
+ */
+#define N_TIMERS 2000
+#define N_ROUNDS 20000
+
+struct model_timer {
+	struct timer timer;
+	int pending;
+	uint64_t due;		/* expiry, or the clock when armed if that was later */
+};
+
+static struct model_timer timers[N_TIMERS];
+
+#define test_failure(name, fmt, ...) \
+	printf("%s %s: failure: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+#define test_success(name, fmt, ...) \
+	printf("%s %s: success: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+static uint64_t next_rand(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static uint64_t random_expiry(uint64_t *state, uint64_t now)
+{
+	uint64_t r = next_rand(state);
+
+	switch (r % 8) {
+	case 0:
+		/* in the past */
+		return now - (r >> 8) % 100;
+	case 1:
+		return now + (r >> 8) % (UINT64_C(1) << 20);
+	case 2:
+		/* beyond what the top level reaches */
+		return now + (UINT64_C(1) << 48) + (r >> 8) % (UINT64_C(1) << 50);
+	case 3:
+		return now + (r >> 8) % 5000;
+	default:
+		return now + (r >> 8) % 100;
+	}
+}
+
+/* advances to now and checks what expired against the model */
+static int check_advance(const char *name, struct timerwheel *tw, uint64_t now)
+{
+	struct model_timer *mt;
+	struct timer *t, *tmp;
+	uint64_t last = 0, min_due = UINT64_MAX;
+	size_t n, n_due = 0, n_pending = 0, i;
+	LIST_HEAD(expired);
+
+	for (i = 0; i < N_TIMERS; i++)
+		n_due += timers[i].pending && timers[i].due <= now;
+	n = timerwheel_advance(tw, now, &expired);
+	if (n != n_due) {
+		test_failure(name, "%zu timers expired at %llu, expected %zu", n, (unsigned long long)now, n_due);
+		return 1;
+	}
+	list_for_each_entry_safe(t, tmp, &expired, entry) {
+		mt = container_of(t, struct model_timer, timer);
+		if (!mt->pending || mt->due > now || mt->due < last || timer_pending(t)) {
+			test_failure(name, "timer due at %llu expired at %llu, after one due at %llu",
+				     (unsigned long long)mt->due, (unsigned long long)now,
+				     (unsigned long long)last);
+			return 1;
+		}
+		last = mt->due;
+		mt->pending = 0;
+		list_del_init(&t->entry);
+	}
+	for (i = 0; i < N_TIMERS; i++) {
+		if (!timers[i].pending)
+			continue;
+		n_pending++;
+		if (timers[i].due < min_due)
+			min_due = timers[i].due;
+	}
+	if (n_pending != tw->n_pending || timerwheel_next_event(tw) > min_due) {
+		test_failure(name, "%zu pending, expected %zu, next event %llu after %llu", tw->n_pending,
+			     n_pending, (unsigned long long)timerwheel_next_event(tw),
+			     (unsigned long long)min_due);
+		return 1;
+	}
+	return 0;
+}
+
+static int run_model_tests(void)
+{
+	uint64_t state = 88172645463325252ull, now = 1000000, r, expires;
+	struct timerwheel tw;
+	size_t round, i, k, n_cancels = 0;
+	int ret;
+
+	timerwheel_init(&tw, now);
+	for (i = 0; i < N_TIMERS; i++) {
+		timer_init(&timers[i].timer);
+		timers[i].pending = 0;
+	}
+	for (round = 0; round < N_ROUNDS; round++) {
+		for (i = 0; i < 8; i++) {
+			r = next_rand(&state);
+			k = (r >> 8) % N_TIMERS;
+			if (r % 5 == 0) {
+				ret = timerwheel_cancel(&tw, &timers[k].timer);
+				if ((ret == 0) != timers[k].pending) {
+					test_failure("model", "cancel returned %d", ret);
+					return 1;
+				}
+				timers[k].pending = 0;
+				n_cancels++;
+				continue;
+			}
+			/* the wheel's clock is now + 1 once now has been advanced to */
+			expires = random_expiry(&state, now);
+			timerwheel_add(&tw, &timers[k].timer, expires);
+			timers[k].pending = 1;
+			timers[k].due = expires < tw.clk ? tw.clk : expires;
+		}
+		r = next_rand(&state);
+		if (r % 100 == 0)
+			now += (r >> 8) % (UINT64_C(1) << 22);
+		else
+			now += (r >> 8) % 50;
+		if (check_advance("model", &tw, now))
+			return 1;
+	}
+	/* everything left, including the far ones */
+	if (check_advance("model-drain", &tw, now + (UINT64_C(1) << 51)) || tw.n_pending) {
+		test_failure("model-drain", "%zu timers left", tw.n_pending);
+		return 1;
+	}
+	if (timerwheel_next_event(&tw) != UINT64_MAX) {
+		test_failure("model-drain", "next event with nothing pending");
+		return 1;
+	}
+	test_success("model", "%d rounds, %zu cancels", N_ROUNDS, n_cancels);
+	return 0;
+}
+
+static int run_edge_tests(void)
+{
+	struct timerwheel tw;
+	struct timer a, b;
+	LIST_HEAD(expired);
+	int ret = 0;
+
+	timerwheel_init(&tw, 1000);
+	timer_init(&a);
+	timer_init(&b);
+	if (timerwheel_cancel(&tw, &a) == 0 || timerwheel_next_event(&tw) != UINT64_MAX) {
+		test_failure("edge-idle", "an idle timer could be cancelled");
+		ret = 1;
+	}
+
+	/* an expiry in the past is clamped to the clock */
+	timerwheel_add(&tw, &a, 10);
+	if (timerwheel_advance(&tw, 999, &expired) || !timer_pending(&a) ||
+	    timerwheel_advance(&tw, 1000, &expired) != 1 || timer_pending(&a)) {
+		test_failure("edge-past", "timer in the past did not expire at the clock");
+		ret = 1;
+	}
+	list_del_init(&a.entry);
+	/* the clock is now 1001, advancing to 1000 again doesn't move it */
+	timerwheel_add(&tw, &a, 500);
+	if (timerwheel_advance(&tw, 1000, &expired) || timerwheel_advance(&tw, 1001, &expired) != 1) {
+		test_failure("edge-past", "timer in the past did not expire once the clock moved");
+		ret = 1;
+	}
+	list_del_init(&a.entry);
+	if (!ret)
+		test_success("edge-past", "expiries in the past are clamped to the clock");
+
+	/* re-arming moves the timer, and the order of expiry follows the ticks */
+	timerwheel_add(&tw, &a, 5000);
+	timerwheel_add(&tw, &b, 3000);
+	timerwheel_add(&tw, &a, 2000);
+	if (tw.n_pending != 2 || timerwheel_next_event(&tw) > 2000 ||
+	    timerwheel_advance(&tw, 2999, &expired) != 1 || expired.next != &a.entry) {
+		test_failure("edge-rearm", "re-armed timer did not expire at its new tick");
+		ret = 1;
+	}
+	list_del_init(&a.entry);
+	if (timerwheel_advance(&tw, 1000000, &expired) != 1 || expired.next != &b.entry || tw.n_pending) {
+		test_failure("edge-rearm", "second timer did not expire");
+		ret = 1;
+	} else {
+		test_success("edge-rearm", "re-armed timer expired at its new tick");
+	}
+	list_del_init(&b.entry);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	char *test;
+	int ret = 1;
+
+	if (argc > 1) {
+		test = argv[1];
+		if (strcmp(test, "model")==0) {
+			ret = run_model_tests();
+		} else if (strcmp(test, "edge")==0) {
+			ret = run_edge_tests();
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <tools/table.h>
+#include <tools/wal.h>
+
+/*
+ * A table logging to a wal in a temporary directory; every case closes the
+ * log and replays it into a fresh table, which must come out the same.
+ */
+#define N_THREADS 4
+#define N_KEYS    2000
+
+#define test_failure(name, fmt, ...) \
+	printf("%s %s: failure: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+#define test_success(name, fmt, ...) \
+	printf("%s %s: success: " fmt "\n", __FILE__, name, ##__VA_ARGS__)
+
+static char dir[64];
+static char path[96];
+
+static int make_dir(void)
+{
+	snprintf(dir, sizeof(dir), "/tmp/wal-test-XXXXXX");
+	if (!mkdtemp(dir))
+		return 1;
+	snprintf(path, sizeof(path), "%s/table.wal", dir);
+	return 0;
+}
+
+static void remove_dir(void)
+{
+	char tmp[128];
+
+	unlink(path);
+	snprintf(tmp, sizeof(tmp), "%s.ckpt", path);
+	unlink(tmp);
+	rmdir(dir);
+}
+
+/* replays the log into a new table, which must map keys [0, n) to i + add, or i + even for even i */
+static long replay_check(const char *name, size_t n, tdata_t add, tdata_t even)
+{
+	struct table table;
+	struct wal wal;
+	char key[32];
+	tdata_t data;
+	long ret;
+	size_t i;
+
+	if (wal_open(&wal, path, NULL))
+		return -1;
+	if (table_init(&table, "max_size", (size_t)1 << 20)) {
+		wal_close(&wal);
+		return -1;
+	}
+	ret = wal_replay(&wal, &table);
+	for (i = 0; ret >= 0 && i < n; i++) {
+		snprintf(key, sizeof(key), "key:%zu", i);
+		if (table_search(&table, key, &data) || data != (tdata_t)i + (i % 2 ? add : even)) {
+			test_failure(name, "'%s' missing or wrong after replay", key);
+			ret = -1;
+		}
+	}
+	if (ret >= 0 && table.n_entries != n) {
+		test_failure(name, "%zu entries after replay, expected %zu", table.n_entries, n);
+		ret = -1;
+	}
+	table_dest(&table);
+	wal_close(&wal);
+	return ret;
+}
+
+struct writer {
+	pthread_mutex_t *lock;
+	struct table *table;
+	struct wal *wal;
+	int id;
+	int error;
+};
+
+/* updates under the table lock, then syncs outside it, joining whatever batch is going */
+static void *writer_thread(void *arg)
+{
+	struct writer *w = arg;
+	char key[32];
+	uint64_t lsn;
+	size_t i;
+
+	for (i = w->id; i < N_KEYS; i += N_THREADS) {
+		snprintf(key, sizeof(key), "key:%zu", i);
+		pthread_mutex_lock(w->lock);
+		if (table_update(w->table, key, i))
+			w->error = 1;
+		lsn = wal_lsn(w->wal);
+		pthread_mutex_unlock(w->lock);
+		if (wal_sync(w->wal, lsn))
+			w->error = 1;
+	}
+	return NULL;
+}
+
+static int run_group_tests(void)
+{
+	pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	struct writer writers[N_THREADS];
+	pthread_t threads[N_THREADS];
+	struct table table;
+	struct wal wal;
+	int i, ret = 0;
+	long n;
+
+	if (make_dir() || wal_open(&wal, path, NULL))
+		return 1;
+	if (table_init(&table, "max_size with_wal", (size_t)N_KEYS, &wal))
+		return 1;
+	for (i = 0; i < N_THREADS; i++) {
+		writers[i] = (struct writer){ &lock, &table, &wal, i, 0 };
+		if (pthread_create(&threads[i], NULL, writer_thread, &writers[i]))
+			return 1;
+	}
+	for (i = 0; i < N_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+		ret |= writers[i].error;
+	}
+	/* all durable already, nothing left for close to write */
+	if (ret || wal.durable != N_KEYS || wal.len) {
+		test_failure("group", "%llu of %d records durable", (unsigned long long)wal.durable, N_KEYS);
+		ret = 1;
+	}
+	table_dest(&table);
+	wal_close(&wal);
+
+	n = replay_check("group", N_KEYS, 0, 0);
+	if (ret || n != N_KEYS) {
+		ret = 1;
+	} else {
+		test_success("group", "%ld records from %d threads replayed", n, N_THREADS);
+	}
+	remove_dir();
+	return ret;
+}
+
+static int run_torn_tests(void)
+{
+	struct table table;
+	struct stat sb;
+	struct wal wal;
+	char key[32];
+	int ret = 0;
+	size_t i;
+
+	if (make_dir() || wal_open(&wal, path, NULL) ||
+	    table_init(&table, "max_size with_wal", (size_t)N_KEYS, &wal))
+		return 1;
+	for (i = 0; i < N_KEYS; i++) {
+		snprintf(key, sizeof(key), "key:%zu", i);
+		ret |= table_update(&table, key, i);
+	}
+	ret |= wal_commit(&wal);
+	table_dest(&table);
+	wal_close(&wal);
+
+	/* a crash in the middle of writing the last record */
+	if (ret || stat(path, &sb) || truncate(path, sb.st_size - 3)) {
+		test_failure("torn", "could not write the log");
+		ret = 1;
+	} else if (replay_check("torn", N_KEYS - 1, 0, 0) != N_KEYS - 1) {
+		ret = 1;
+	}
+
+	/* the torn record is cut off on open, so records appended next are replayed too */
+	if (!ret && (wal_open(&wal, path, NULL) || table_init(&table, "max_size with_wal", (size_t)N_KEYS, &wal))) {
+		ret = 1;
+	} else if (!ret) {
+		snprintf(key, sizeof(key), "key:%d", N_KEYS - 1);
+		ret |= table_update(&table, key, N_KEYS - 1);
+		ret |= wal_commit(&wal);
+		table_dest(&table);
+		wal_close(&wal);
+		if (ret || replay_check("torn", N_KEYS, 0, 0) != N_KEYS)
+			ret = 1;
+	}
+	if (!ret)
+		test_success("torn", "torn record dropped, %d records replayed after appending", N_KEYS);
+	remove_dir();
+	return ret;
+}
+
+static int run_checkpoint_tests(void)
+{
+	size_t i, checkpoint_size = 16 << 10;
+	struct table table;
+	struct stat sb;
+	struct wal wal;
+	char key[32];
+	int ret = 0;
+	long n;
+
+	/* 10 passes over the keys, checkpointed automatically as the log grows */
+	if (make_dir() || wal_open(&wal, path, "checkpoint_size", checkpoint_size) ||
+	    table_init(&table, "max_size with_wal", (size_t)N_KEYS, &wal))
+		return 1;
+	for (i = 0; i < 10*N_KEYS; i++) {
+		snprintf(key, sizeof(key), "key:%zu", i % N_KEYS);
+		ret |= table_update(&table, key, i);
+		if (i % 100 == 0)
+			ret |= wal_commit(&wal);
+	}
+	ret |= wal_commit(&wal);
+	if (ret || stat(path, &sb) || (size_t)sb.st_size > 2*checkpoint_size + N_KEYS*32) {
+		test_failure("checkpoint", "log of %lld bytes", (long long)sb.st_size);
+		ret = 1;
+	}
+	table_dest(&table);
+	wal_close(&wal);
+	n = replay_check("checkpoint", N_KEYS, 9*N_KEYS, 9*N_KEYS);
+	if (ret || n < N_KEYS || n >= 10*N_KEYS) {
+		ret = 1;
+	} else {
+		test_success("checkpoint", "%ld records replayed for %d updates", n, 10*N_KEYS);
+	}
+	if (ret) {
+		remove_dir();
+		return ret;
+	}
+
+	/* an explicit checkpoint, then updates past it */
+	if (wal_open(&wal, path, NULL) || table_init(&table, "max_size with_wal", (size_t)N_KEYS, &wal))
+		return 1;
+	if (wal_replay(&wal, &table) < 0 || wal_checkpoint(&wal, &table))
+		ret = 1;
+	for (i = 0; i < N_KEYS; i += 2) {
+		snprintf(key, sizeof(key), "key:%zu", i);
+		ret |= table_update_only(&table, key, i + 10*N_KEYS);
+	}
+	table_dest(&table);
+	wal_close(&wal);
+	n = replay_check("checkpoint", N_KEYS, 9*N_KEYS, 10*N_KEYS);
+	if (ret || n != N_KEYS + N_KEYS/2) {
+		test_failure("checkpoint", "%ld records after an explicit checkpoint", n);
+		ret = 1;
+	} else {
+		test_success("checkpoint", "%ld records after an explicit checkpoint", n);
+	}
+	remove_dir();
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	const char *test;
+	int ret = 1;
+
+	if (argc > 1) {
+		test = argv[1];
+		if (strcmp(test, "group")==0) {
+			ret = run_group_tests();
+		} else if (strcmp(test, "torn")==0) {
+			ret = run_torn_tests();
+		} else if (strcmp(test, "checkpoint")==0) {
+			ret = run_checkpoint_tests();
+		}
+	}
+	return ret;
+}